@@ -0,0 +1,311 @@
+/*
+ This file is part of micronau.
+ Copyright (c) 2013 - David Smitley
+
+ Permission is granted to use this software under the terms of the GPL v2 (or any later version)
+
+ Details can be found at: www.gnu.org/licenses
+*/
+
+#include "AutomationThinner.h"
+
+AutomationThinner::AutomationThinner(SendFunction f, int tick_ms) :
+    send(f),
+    num_active(0),
+    tolerance(1.0),
+    window_ms(30.0)
+{
+    tracks.calloc(MAX_NRPN);
+    active.calloc(MAX_NRPN);
+    if (tick_ms > 0) {
+        startTimer(tick_ms);
+    }
+}
+
+AutomationThinner::~AutomationThinner()
+{
+    stopTimer();
+}
+
+void AutomationThinner::start_line(track &t, double now, int value)
+{
+    double dt = jmax(now - t.anchor_t, 0.001);
+    t.has_cand = true;
+    t.cand_t = now;
+    t.cand_v = value;
+    t.lo = (value - tolerance - t.anchor_v) / dt;
+    t.hi = (value + tolerance - t.anchor_v) / dt;
+}
+
+void AutomationThinner::emit(int nrpn, track &t, double now, int value, out_value *out, int &n)
+{
+    t.has_anchor = true;
+    t.anchor_t = now;
+    t.anchor_v = value;
+    t.has_cand = false;
+    out[n].nrpn = nrpn;
+    out[n].value = value;
+    n++;
+}
+
+void AutomationThinner::add(int nrpn, int value, double now)
+{
+    if ((nrpn < 0) || (nrpn >= MAX_NRPN)) {
+        return;
+    }
+    out_value out[2];
+    int n = 0;
+    {
+        ScopedLock l(lock);
+        received += 1;
+        track &t = tracks[nrpn];
+
+        if (t.has_cand) {
+            double dt = jmax(now - t.anchor_t, 0.001);
+            double slope = (value - t.anchor_v) / dt;
+            if ((now - t.anchor_t < window_ms) && (slope >= t.lo) && (slope <= t.hi)) {
+                // still on the line, narrow the fan to this point's tolerance too
+                t.lo = jmax(t.lo, (value - tolerance - t.anchor_v) / dt);
+                t.hi = jmin(t.hi, (value + tolerance - t.anchor_v) / dt);
+                t.cand_t = now;
+                t.cand_v = value;
+                return;
+            }
+            // the line ends at the held point
+            emit(nrpn, t, t.cand_t, t.cand_v, out, n);
+        }
+
+        if (t.has_anchor && (value == t.anchor_v)) {
+            duplicates += 1;
+        } else if (!t.has_anchor || (now - t.anchor_t >= window_ms)) {
+            emit(nrpn, t, now, value, out, n);
+        } else {
+            start_line(t, now, value);
+            if (!t.is_active) {
+                t.is_active = true;
+                active[num_active++] = nrpn;
+            }
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        sent += 1;
+        send(out[i].nrpn, out[i].value);
+    }
+}
+
+void AutomationThinner::flush(double now)
+{
+    // a chunk at a time, sent with the lock released. Removing swaps the last
+    // entry in, and anything added in between lands past i for the next flush.
+    int i = MAX_NRPN;
+    for (;;) {
+        out_value out[FLUSH_CHUNK];
+        int n = 0;
+        {
+            ScopedLock l(lock);
+            i = jmin(i, num_active);
+            while ((n < FLUSH_CHUNK) && (i > 0)) {
+                int nrpn = active[--i];
+                track &t = tracks[nrpn];
+                if (t.has_cand && (now - t.anchor_t < window_ms)) {
+                    continue;
+                }
+                if (t.has_cand) {
+                    emit(nrpn, t, t.cand_t, t.cand_v, out, n);
+                }
+                t.is_active = false;
+                active[i] = active[--num_active];
+            }
+        }
+        for (int j = 0; j < n; j++) {
+            sent += 1;
+            send(out[j].nrpn, out[j].value);
+        }
+        if (i == 0) {
+            return;
+        }
+    }
+}
+
+void AutomationThinner::flush_all()
+{
+    flush(std::numeric_limits<double>::max());
+}
+
+void AutomationThinner::reset()
+{
+    ScopedLock l(lock);
+    for (int i = 0; i < MAX_NRPN; i++) {
+        tracks[i].is_active = false;
+        tracks[i].has_anchor = false;
+        tracks[i].has_cand = false;
+    }
+    num_active = 0;
+}
+
+void AutomationThinner::hiResTimerCallback()
+{
+    flush(Time::getMillisecondCounterHiRes());
+}
+
+double AutomationThinner::get_ratio() const
+{
+    int r = received.get();
+    return (r > 0) ? (double) sent.get() / r : 1.0;
+}
+
+void AutomationThinner::clear_stats()
+{
+    received = 0;
+    sent = 0;
+    duplicates = 0;
+}
+
+String AutomationThinner::get_summary() const
+{
+    return String(received.get()) + " in, " + String(sent.get()) + " out (" +
+           String(get_ratio() * 100.0, 1) + "%), " + String(duplicates.get()) + " duplicates, tolerance " +
+           String(tolerance, 1) + " window " + String(window_ms, 0) + "ms";
+}
+
+//==============================================================================
+namespace {
+    // a line between each pair of (time, value) points
+    double line_at(const Array<double> &t, const Array<int> &v, double when)
+    {
+        if (when <= t[0]) {
+            return v[0];
+        }
+        for (int i = 1; i < t.size(); i++) {
+            if (when <= t[i]) {
+                return v[i - 1] + (v[i] - v[i - 1]) * (when - t[i - 1]) / (t[i] - t[i - 1]);
+            }
+        }
+        return v.getLast();
+    }
+}
+
+bool AutomationThinnerTests()
+{
+    // sent values, and the index of the input value each one is
+    Array<int> sent_values;
+    Array<int> sent_index;
+    Array<int> values;
+    Array<double> times;
+    int call_first = 0;
+    AutomationThinner thin([&] (int, int value) {
+        // a held value goes out ahead of the one that ended its line
+        int idx = values.size() - 1;
+        if ((sent_values.size() == call_first) && (value != values[idx])) {
+            idx--;
+        }
+        sent_values.add(value);
+        sent_index.add(idx);
+    }, 0);
+    thin.set_tolerance(1.0);
+    thin.set_window_ms(30.0);
+
+    // one second of a slow sine on a 0-127 parameter, one value per 5.3ms block
+    for (double now = 0; now < 1000; now += 256 * 1000.0 / 48000.0) {
+        int v = roundToInt(64 + 60 * std::sin(now * 2 * double_Pi / 1000.0));
+        values.add(v);
+        times.add(now);
+        call_first = sent_values.size();
+        thin.add(42, v, now);
+        call_first = sent_values.size();
+        thin.flush(now);
+    }
+    call_first = sent_values.size();
+    thin.flush(times.getLast() + 100);
+    Logger::writeToLog("AutomationThinner: " + thin.get_summary());
+
+    if ((sent_values.size() == 0) || (sent_values.getLast() != values.getLast())) {
+        Logger::writeToLog("AutomationThinner: final value lost");
+        return false;
+    }
+    if (thin.get_ratio() > 0.5) {
+        Logger::writeToLog("AutomationThinner: sweep not thinned");
+        return false;
+    }
+    // every input value is within the tolerance of the lines between the sent ones
+    Array<double> sent_times;
+    for (int i = 0; i < sent_index.size(); i++) {
+        sent_times.add(times[sent_index[i]]);
+    }
+    for (int i = 0; i < times.size(); i++) {
+        double err = line_at(sent_times, sent_values, times[i]) - values[i];
+        if (std::abs(err) > thin.get_tolerance() + 0.5) {
+            Logger::writeToLog("AutomationThinner: sent curve off by " + String(err, 2) + " at " + String(times[i], 1) + "ms");
+            return false;
+        }
+    }
+
+    // the same value over and over is sent once
+    double now = 5000;
+    values.add(99);
+    thin.clear_stats();
+    for (int i = 0; i < 100; i++) {
+        thin.add(7, 99, now += 1);
+    }
+    thin.flush_all();
+    if ((thin.get_sent() != 1) || (thin.get_duplicates() != 99)) {
+        Logger::writeToLog("AutomationThinner: repeated values not dropped");
+        return false;
+    }
+
+    // a single change after a quiet spell goes straight out
+    now += 1000;
+    values.add(10);
+    int before = sent_values.size();
+    thin.add(42, 10, now);
+    if ((sent_values.size() != before + 1) || (sent_values.getLast() != 10)) {
+        Logger::writeToLog("AutomationThinner: single edit delayed");
+        return false;
+    }
+    // a quick second edit is held, then flushed at the end of the window
+    values.add(20);
+    thin.add(42, 20, now + 5);
+    thin.flush(now + 10);
+    if (sent_values.size() != before + 1) {
+        Logger::writeToLog("AutomationThinner: held value sent early");
+        return false;
+    }
+    thin.flush(now + 31);
+    if ((sent_values.size() != before + 2) || (sent_values.getLast() != 20)) {
+        Logger::writeToLog("AutomationThinner: held value not flushed");
+        return false;
+    }
+
+    // tolerance 0 never sends more than there were changes
+    int exact_sent = 0;
+    AutomationThinner exact([&] (int, int) { exact_sent++; }, 0);
+    exact.set_tolerance(0);
+    int changes = 0;
+    for (int i = 0; i < times.size(); i++) {
+        exact.add(42, values[i], times[i]);
+        changes += ((i == 0) || (values[i] != values[i - 1])) ? 1 : 0;
+    }
+    exact.flush_all();
+    if ((exact_sent > changes) || (exact_sent != exact.get_sent())) {
+        Logger::writeToLog("AutomationThinner: more sent than there were changes");
+        return false;
+    }
+
+    // more held values than fit in one chunk all get flushed, once each
+    int wide_sent[300] = {};
+    AutomationThinner wide([&] (int nrpn, int) { wide_sent[nrpn]++; }, 0);
+    for (int nrpn = 0; nrpn < 300; nrpn++) {
+        wide.add(nrpn, 1, 0);
+        wide.add(nrpn, 2, 1);
+    }
+    wide.flush_all();
+    wide.flush_all();
+    for (int nrpn = 0; nrpn < 300; nrpn++) {
+        // the first value goes straight out, the second is held
+        if (wide_sent[nrpn] != 2) {
+            Logger::writeToLog("AutomationThinner: held value of nrpn " + String(nrpn) + " not flushed once");
+            return false;
+        }
+    }
+    return true;
+}
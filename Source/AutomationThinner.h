@@ -0,0 +1,119 @@
+/*
+ This file is part of micronau.
+ Copyright (c) 2013 - David Smitley
+
+ Permission is granted to use this software under the terms of the GPL v2 (or any later version)
+
+ Details can be found at: www.gnu.org/licenses
+*/
+
+#ifndef __AUTOMATIONTHINNER_H__
+#define __AUTOMATIONTHINNER_H__
+
+#include "MicronauCore.h"
+#include <functional>
+
+//==============================================================================
+/*
+    AutomationThinner:
+        Sits between host automation and the nrpn output. Hosts call setParameter
+        once a block or more, and a smooth sweep would otherwise put thousands of
+        4 message nrpns on a 3125 byte/s cable.
+
+        Per nrpn:
+          - a value equal to the one last sent is dropped
+          - while values keep to a straight line (within +-tolerance) from the
+            last sent point they are held back, and only the last point of the
+            line is sent once the curve bends. This is the usual "sloping fan"
+            simplification, done as the values arrive.
+          - nothing is held longer than the window after the last sent point,
+            and whatever is still held when the curve goes quiet is flushed by
+            the timer. The final value always goes out.
+
+        Nothing allocates after construction: add() is called on the audio thread
+        and shares the lock with the timer's flush.
+
+        A change after a quiet spell goes out at once, so single edits from the
+        gui or a control surface are not delayed.
+
+        The synth steps to each value it gets, so a larger tolerance or window
+        means fewer, bigger steps; the counters give the reduction to weigh
+        against audible zipper noise.
+*/
+class AutomationThinner : private HighResolutionTimer
+{
+public:
+    typedef std::function<void (int nrpn, int value)> SendFunction;
+
+    enum {
+        MAX_NRPN = 2048,
+        TICK_MS = 5,
+        FLUSH_CHUNK = 64        // values sent per hold of the lock when flushing
+    };
+
+    // tick_ms 0 leaves flushing to the caller
+    AutomationThinner(SendFunction f, int tick_ms = TICK_MS);
+    ~AutomationThinner();
+
+    // in parameter steps, 0 sends every change of value
+    void set_tolerance(double steps) {tolerance = steps;}
+    double get_tolerance() const {return tolerance;}
+    void set_window_ms(double ms) {window_ms = ms;}
+    double get_window_ms() const {return window_ms;}
+
+    // a new value for nrpn, any thread
+    void add(int nrpn, int value) {add(nrpn, value, Time::getMillisecondCounterHiRes());}
+    void add(int nrpn, int value, double now);
+    // send anything held for longer than the window
+    void flush(double now);
+    // send everything held, now
+    void flush_all();
+    // forget held values and what was last sent (after a full sync)
+    void reset();
+
+    int get_received() const {return received.get();}
+    int get_sent() const {return sent.get();}
+    int get_duplicates() const {return duplicates.get();}
+    // sent / received, 1 when nothing was thinned
+    double get_ratio() const;
+    void clear_stats();
+    String get_summary() const;
+
+private:
+    struct track {
+        bool is_active;         // listed in active
+        bool has_anchor;        // last value sent
+        double anchor_t;
+        int anchor_v;
+        bool has_cand;          // newest value held back
+        double cand_t;
+        int cand_v;
+        double lo, hi;          // slopes from the anchor that pass every held point
+    };
+    struct out_value {
+        int nrpn;
+        int value;
+    };
+
+    void hiResTimerCallback();
+    void start_line(track &t, double now, int value);
+    void emit(int nrpn, track &t, double now, int value, out_value *out, int &n);
+
+    SendFunction send;
+    CriticalSection lock;
+    HeapBlock<track> tracks;
+    HeapBlock<int> active;      // nrpns that may hold a value, unordered
+    int num_active;
+    double tolerance;
+    double window_ms;
+
+    Atomic<int> received;
+    Atomic<int> sent;
+    Atomic<int> duplicates;
+
+    JUCE_DECLARE_NON_COPYABLE (AutomationThinner)
+};
+
+bool AutomationThinnerTests();
+
+#endif  // __AUTOMATIONTHINNER_H__
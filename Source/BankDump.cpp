@@ -0,0 +1,211 @@
+/*
+ This file is part of micronau.
+ Copyright (c) 2013 - David Smitley
+
+ Permission is granted to use this software under the terms of the GPL v2 (or any later version)
+
+ Details can be found at: www.gnu.org/licenses
+*/
+
+#include "BankDump.h"
+
+BankDump::BankDump(ProgramBank &s, SendFunction f, FinishedFunction fin) :
+    Thread("micronau bank dump"),
+    store(s),
+    send(f),
+    finished(fin),
+    drain_until(0),
+    draining(false),
+    window(4),
+    timeout_ms(1000),
+    max_retries(3),
+    running(false),
+    total(0),
+    start_time(0),
+    last_reply(0)
+{
+}
+
+BankDump::~BankDump()
+{
+    stop();
+}
+
+MidiMessage BankDump::make_request(int bank, int prog)
+{
+    unsigned char req[]= {0x00, 0x00, 0x0e, 0x26, 0x41, 0x0, 0x0, 0x0};
+    req[5] = bank;
+    req[6] = (prog >> 7) & 1;
+    req[7] = prog & 0x7f;
+    return MidiMessage::createSysExMessage(req, sizeof(req));
+}
+
+bool BankDump::start(int first_slot, int count, const File &save_to)
+{
+    if (running) {
+        return false;
+    }
+    stopThread(1000);
+
+    ScopedLock l(lock);
+    todo.clear();
+    in_flight.clear();
+    attempts.clear();
+    for (int i = first_slot; (i < first_slot + count) && (i < ProgramBank::NUM_SLOTS); i++) {
+        if (i >= 0) {
+            todo.push_back(i);
+        }
+    }
+    if (todo.empty()) {
+        return false;
+    }
+
+    save_file = save_to;
+    total = (int) todo.size();
+    done = 0;
+    failed = 0;
+    retries = 0;
+    bytes_in = 0;
+    draining = false;
+    start_time = last_reply = Time::getMillisecondCounter();
+    end_time = 0;
+    running = true;
+    startThread();
+    return true;
+}
+
+void BankDump::stop()
+{
+    signalThreadShouldExit();
+    notify();
+    stopThread(2000);
+    running = false;
+}
+
+void BankDump::send_next()
+{
+    request r;
+    r.slot = todo.front();
+    todo.pop_front();
+    r.sent = Time::getMillisecondCounter();
+    in_flight.push_back(r);
+    send(make_request(ProgramBank::bank_of(r.slot), ProgramBank::prog_of(r.slot)));
+}
+
+void BankDump::run()
+{
+    while (!threadShouldExit()) {
+        {
+            ScopedLock l(lock);
+            uint32 now = Time::getMillisecondCounter();
+
+            if (draining) {
+                if (now >= drain_until) {
+                    draining = false;
+                    last_reply = now;
+                }
+            } else {
+                if (!in_flight.empty()) {
+                    // the oldest request is answered next, so it is only late if nothing
+                    // has arrived for a while - not because replies are queued ahead of it.
+                    uint32 since = jmax(in_flight.front().sent, last_reply);
+                    if (now - since > (uint32) timeout_ms) {
+                        // go back and re-request everything that is in flight, oldest first
+                        int slot = in_flight.front().slot;
+                        if (++attempts[slot] > max_retries) {
+                            failed += 1;
+                            in_flight.pop_front();
+                        }
+                        while (!in_flight.empty()) {
+                            todo.push_front(in_flight.back().slot);
+                            in_flight.pop_back();
+                            retries += 1;
+                        }
+                        draining = true;
+                        drain_until = now + timeout_ms / 2;
+                        continue;
+                    }
+                }
+
+                while (((int) in_flight.size() < window) && !todo.empty()) {
+                    send_next();
+                }
+
+                if (in_flight.empty() && todo.empty()) {
+                    break;
+                }
+            }
+        }
+        wait(5);
+    }
+
+    end_time = Time::getMillisecondCounter();
+    if (!threadShouldExit() && (save_file != File())) {
+        store.save(save_file);
+    }
+    running = false;
+    if (finished) {
+        finished();
+    }
+}
+
+bool BankDump::handle_sysex(const uint8 *data, int size)
+{
+    if (!running) {
+        return false;
+    }
+    if ((size != ProgramBank::PROGRAM_LEN) ||
+        (data[0] != 0x00) || (data[1] != 0x00) || (data[2] != 0x0e) || (data[3] != 0x22)) {
+        return false;
+    }
+
+    ScopedLock l(lock);
+    uint32 now = Time::getMillisecondCounter();
+    if (draining) {
+        // reply to a request we already gave up on, keep draining until the line is quiet
+        drain_until = now + timeout_ms / 2;
+        return true;
+    }
+    if (in_flight.empty()) {
+        // not ours
+        return false;
+    }
+
+    request r = in_flight.front();
+    in_flight.pop_front();
+    if (validateProgramSysex(data, size) != SYSEX_OK) {
+        // corrupted on the way in, ask again unless it keeps happening
+        if (++attempts[r.slot] > max_retries) {
+            failed += 1;
+        } else {
+            todo.push_front(r.slot);
+            retries += 1;
+        }
+    } else if (store.set_program(r.slot, data, size)) {
+        done += 1;
+    } else {
+        failed += 1;
+    }
+    bytes_in += size + 2;
+    last_reply = now;
+    notify();
+    return true;
+}
+
+double BankDump::get_programs_per_sec() const
+{
+    uint32 end = end_time.get() ? end_time.get() : Time::getMillisecondCounter();
+    if (end <= start_time) {
+        return 0.0;
+    }
+    return done.get() * 1000.0 / (end - start_time);
+}
+
+double BankDump::get_bytes_per_sec() const
+{
+    uint32 end = end_time.get() ? end_time.get() : Time::getMillisecondCounter();
+    if (end <= start_time) {
+        return 0.0;
+    }
+    return bytes_in.get() * 1000.0 / (end - start_time);
+}
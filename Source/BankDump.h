@@ -0,0 +1,108 @@
+/*
+ This file is part of micronau.
+ Copyright (c) 2013 - David Smitley
+
+ Permission is granted to use this software under the terms of the GPL v2 (or any later version)
+
+ Details can be found at: www.gnu.org/licenses
+*/
+
+#ifndef __BANKDUMP_H__
+#define __BANKDUMP_H__
+
+#include "MicronauCore.h"
+#include <juce_audio_basics/juce_audio_basics.h>
+#include "ProgramBank.h"
+#include <deque>
+#include <map>
+#include <functional>
+
+//==============================================================================
+/*
+    BankDump:
+        Fetches a range of programs from the Micron into a ProgramBank.
+
+        Up to 'window' program requests are kept outstanding at once. The synth
+        answers requests in the order it receives them, so each incoming dump
+        belongs to the oldest outstanding request. If that request times out,
+        everything in flight is thrown away and re-requested (after letting any
+        stragglers drain) so a late reply can never land in the wrong slot.
+
+        Requests go out through the send function given to the constructor, so
+        the engine can be pointed at the real midi port or a software stand-in.
+        The optional finished function is called on the dump thread once the
+        dump has ended, completed or stopped, and the bank has been saved.
+*/
+class BankDump : private Thread
+{
+public:
+    typedef std::function<void (const MidiMessage &)> SendFunction;
+    typedef std::function<void ()> FinishedFunction;
+
+    BankDump(ProgramBank &store, SendFunction send, FinishedFunction finished = nullptr);
+    ~BankDump();
+
+    // fetch count programs starting at first_slot; if save_to is not File() the
+    // bank is written there once the dump is complete.
+    bool start(int first_slot, int count, const File &save_to = File());
+    void stop();
+    bool is_running() const {return running;}
+
+    // call with every incoming sysex (data without f0/f7); returns true if the
+    // message was a reply to one of our requests and has been consumed.
+    bool handle_sysex(const uint8 *data, int size);
+
+    void set_window(int n) {window = jlimit(1, 32, n);}
+    void set_timeout_ms(int ms) {timeout_ms = ms;}
+    void set_max_retries(int n) {max_retries = n;}
+
+    // progress, safe to poll from any thread
+    int get_total() const {return total;}
+    int get_done() const {return done.get();}
+    int get_failed() const {return failed.get();}
+    int get_retries() const {return retries.get();}
+    double get_programs_per_sec() const;
+    double get_bytes_per_sec() const;
+
+    static MidiMessage make_request(int bank, int prog);
+
+private:
+    void run();
+    void send_next();
+
+    struct request {
+        int slot;
+        uint32 sent;
+        int attempts;
+    };
+
+    ProgramBank &store;
+    SendFunction send;
+    FinishedFunction finished;
+    File save_file;
+
+    CriticalSection lock;
+    std::deque<int> todo;
+    std::deque<request> in_flight;
+    std::map<int, int> attempts;
+    uint32 drain_until;
+    bool draining;
+
+    int window;
+    int timeout_ms;
+    int max_retries;
+
+    volatile bool running;
+    int total;
+    Atomic<int> done;
+    Atomic<int> failed;
+    Atomic<int> retries;
+    Atomic<int> bytes_in;
+    uint32 start_time;
+    uint32 last_reply;
+    Atomic<uint32> end_time;
+
+    JUCE_DECLARE_NON_COPYABLE (BankDump)
+};
+
+#endif  // __BANKDUMP_H__
@@ -0,0 +1,526 @@
+/*
+ This file is part of micronau.
+ Copyright (c) 2013 - David Smitley
+
+ Permission is granted to use this software under the terms of the GPL v2 (or any later version)
+
+ Details can be found at: www.gnu.org/licenses
+*/
+
+#include "HardwareReturn.h"
+
+// quiet enough to start a ping, and the lowest onset threshold
+static const float MAX_NOISE = 0.02f;
+static const float MIN_THRESHOLD = 0.004f;
+// onset threshold over the noise floor
+static const float NOISE_MARGIN = 4.0f;
+
+static float chunk_peak(const float *src, int n)
+{
+    Range<float> r = FloatVectorOperations::findMinAndMax(src, n);
+    return jmax(-r.getStart(), r.getEnd());
+}
+
+int OnsetDetector::find(const float *const *channels, int num_channels, int num_samples, float threshold)
+{
+    for (int pos = 0; pos < num_samples; pos += CHUNK) {
+        int len = jmin((int) CHUNK, num_samples - pos);
+        bool crossed = false;
+        for (int c = 0; c < num_channels && !crossed; c++) {
+            crossed = chunk_peak(channels[c] + pos, len) >= threshold;
+        }
+        if (!crossed) {
+            continue;
+        }
+        // the earliest crossing in the chunk, over all channels
+        int first = len;
+        for (int c = 0; c < num_channels; c++) {
+            const float *src = channels[c] + pos;
+            for (int i = 0; i < first; i++) {
+                if (std::abs(src[i]) >= threshold) {
+                    first = i;
+                    break;
+                }
+            }
+        }
+        return pos + first;
+    }
+    return -1;
+}
+
+float OnsetDetector::peak(const float *const *channels, int num_channels, int num_samples)
+{
+    float p = 0;
+    for (int c = 0; c < num_channels; c++) {
+        p = jmax(p, chunk_peak(channels[c], num_samples));
+    }
+    return p;
+}
+
+//==============================================================================
+HardwareReturn::HardwareReturn(NoteFunction f) :
+    send_note(f),
+    sample_rate(44100),
+    insert(0),
+    channel(1),
+    requested(0),
+    cancel_requested(0),
+    state(IDLE),
+    pings_done(0),
+    runs(0),
+    latency_us(-1),
+    latency_changed(0),
+    phase(QUIET),
+    clock(0),
+    phase_start(0),
+    ping_at(0),
+    noise(0),
+    threshold(MIN_THRESHOLD),
+    note_channel(1),
+    note_on(false),
+    num_pings(0),
+    lost(0),
+    capturing(false),
+    capture_len(0),
+    capture_pos(0),
+    onset_at(0)
+{
+    zeromem(pings, sizeof(pings));
+}
+
+void HardwareReturn::prepare(double sr)
+{
+    sample_rate = sr;
+    capture_len = (int) (CAPTURE_MS * sr / 1000.0);
+    capture_data.allocate((size_t) capture_len, true);
+    capture_pos = 0;
+    clock = 0;
+    phase_start = 0;
+    ping_at = 0;
+    latency_changed = 1;
+}
+
+int HardwareReturn::get_latency_samples() const
+{
+    int us = latency_us.get();
+    return (us < 0) ? 0 : roundToInt(us * sample_rate / 1.0e6);
+}
+
+void HardwareReturn::set_latency_ms(double ms)
+{
+    latency_us = (ms < 0) ? -1 : roundToInt(ms * 1000.0);
+    latency_changed = 1;
+}
+
+bool HardwareReturn::get_capture(Array<float> &dest) const
+{
+    if (get_state() != CAPTURED) {
+        return false;
+    }
+    dest.clearQuick();
+    dest.addArray(capture_data.getData(), capture_len);
+    return true;
+}
+
+void HardwareReturn::start(bool capture)
+{
+    capturing = capture;
+    state = capture ? CAPTURING : MEASURING;
+    runs += 1;
+    capture_pos = 0;
+    pings_done = 0;
+    num_pings = 0;
+    lost = 0;
+    phase = QUIET;
+    phase_start = clock;
+    ping_at = clock;
+    noise = 0;
+    note_channel = channel.get();
+}
+
+void HardwareReturn::note_off()
+{
+    if (note_on) {
+        send_note(MidiMessage::noteOff(note_channel, NOTE));
+        note_on = false;
+    }
+}
+
+void HardwareReturn::ping_done(int latency)
+{
+    note_off();
+    if (latency >= 0) {
+        pings[num_pings++] = latency;
+    } else {
+        lost++;
+    }
+    pings_done += 1;
+    if (num_pings + lost >= NUM_PINGS) {
+        finish();
+        return;
+    }
+    phase = QUIET;
+    phase_start = clock;
+    ping_at = clock;
+    noise = 0;
+}
+
+void HardwareReturn::finish()
+{
+    if (num_pings < MIN_PINGS) {
+        // keep whatever was measured before
+        state = FAILED;
+        return;
+    }
+    std::sort(pings, pings + num_pings);
+    latency_us = roundToInt(pings[num_pings / 2] * 1.0e6 / sample_rate);
+    latency_changed = 1;
+    state = MEASURED;
+}
+
+// mono mix of in[from, from + n) onto the end of the capture
+void HardwareReturn::record(const float *const *in, int num_channels, int from, int n)
+{
+    n = jmin(n, capture_len - capture_pos);
+    float *dest = capture_data + capture_pos;
+    const float gain = 1.0f / (float) num_channels;
+    FloatVectorOperations::copyWithMultiply(dest, in[0] + from, gain, n);
+    for (int c = 1; c < num_channels; c++) {
+        FloatVectorOperations::addWithMultiply(dest, in[c] + from, gain, n);
+    }
+    capture_pos += n;
+}
+
+void HardwareReturn::process(AudioSampleBuffer &buffer)
+{
+    const int n = buffer.getNumSamples();
+    const int num_channels = buffer.getNumChannels();
+    const float *const *in = buffer.getArrayOfReadPointers();
+
+    if (cancel_requested.compareAndSetBool(0, 1)) {
+        requested = 0;
+        if ((get_state() == MEASURING) || (get_state() == CAPTURING)) {
+            note_off();
+            state = IDLE;
+        }
+    }
+    int request = requested.exchange(0);
+    if (request != 0) {
+        note_off();
+        start(request == CAPTURE_REQUEST);
+    }
+
+    const bool measuring = (get_state() == MEASURING) || (get_state() == CAPTURING);
+    if (measuring && (num_channels > 0)) {
+        const int64 block_end = clock + n;
+        if (phase == QUIET) {
+            float p = OnsetDetector::peak(in, num_channels, n);
+            if (p > MAX_NOISE) {
+                // something still sounds, the quiet starts over after it
+                phase_start = block_end;
+                noise = 0;
+            } else {
+                noise = jmax(noise, p);
+            }
+            if (block_end - phase_start >= (int64) (QUIET_MS * sample_rate / 1000.0)) {
+                // the note goes out with the next block
+                threshold = jmax(noise * NOISE_MARGIN, MIN_THRESHOLD);
+                send_note(MidiMessage::noteOn(note_channel, NOTE, (uint8) VELOCITY));
+                note_on = true;
+                ping_at = block_end;
+                phase = LISTEN;
+            } else if (block_end - ping_at > (int64) (MAX_WAIT_MS * sample_rate / 1000.0)) {
+                // never quiet enough to hear a ping
+                num_pings = 0;
+                state = FAILED;
+            }
+        } else if (phase == LISTEN) {
+            int onset = OnsetDetector::find(in, num_channels, n, threshold);
+            if (onset < 0) {
+                if (block_end - ping_at > (int64) (MAX_LATENCY_MS * sample_rate / 1000.0)) {
+                    if (capturing) {
+                        note_off();
+                        state = FAILED;
+                    } else {
+                        ping_done(-1);
+                    }
+                }
+            } else if (capturing) {
+                onset_at = clock + onset;
+                phase = RECORD;
+                record(in, num_channels, onset, n - onset);
+            } else {
+                ping_done((int) (clock + onset - ping_at));
+            }
+        } else {
+            record(in, num_channels, 0, n);
+        }
+        if (phase == RECORD) {
+            if (block_end - onset_at >= (int64) (HOLD_MS * sample_rate / 1000.0)) {
+                note_off();
+            }
+            if (capture_pos == capture_len) {
+                note_off();
+                state = CAPTURED;
+            }
+        }
+    }
+    clock += n;
+
+    // the test notes are not for the mix
+    if (!get_insert() || measuring) {
+        buffer.clear();
+    }
+}
+
+String HardwareReturn::get_status() const
+{
+    switch (get_state()) {
+        case MEASURING:
+            return "measuring, ping " + String(jmin(get_pings_done() + 1, (int) NUM_PINGS)) + "/" + String((int) NUM_PINGS);
+        case CAPTURING:
+            return "capturing";
+        case FAILED:
+            return "no return heard";
+        default:
+            break;
+    }
+    if (latency_us.get() < 0) {
+        return "not measured";
+    }
+    return String(get_latency_ms(), 1) + "ms (" + String(get_latency_samples()) + " samples)";
+}
+
+//==============================================================================
+namespace {
+
+// Stands in for the synth and the audio interface: a note on turns into a
+// tone on the input delay samples after the start of the next block, with a
+// noise floor underneath. stray_ping gets its tone early, as if something
+// else had sounded.
+struct Loopback
+{
+    Loopback(int d, float noise_level) : delay(d), noise(noise_level), clock(0), block_end(0),
+        sounding_from(-1), sounding_to(-1), notes(0), stray_ping(-1), stray_delay(0), silent(false), rnd(7) {}
+
+    void midi(const MidiMessage &m)
+    {
+        if (m.isNoteOn()) {
+            if (!silent) {
+                sounding_from = block_end + ((notes == stray_ping) ? stray_delay : delay);
+                sounding_to = -1;
+            }
+            notes++;
+        } else if (m.isNoteOff() && (sounding_from >= 0)) {
+            // a short release
+            sounding_to = jmax(block_end, sounding_from) + 200;
+        }
+    }
+
+    void render(AudioSampleBuffer &buffer)
+    {
+        block_end = clock + buffer.getNumSamples();
+        for (int i = 0; i < buffer.getNumSamples(); i++) {
+            int64 t = clock + i;
+            float v = noise * (rnd.nextFloat() * 2.0f - 1.0f);
+            if ((sounding_from >= 0) && (t >= sounding_from) && ((sounding_to < 0) || (t < sounding_to))) {
+                v += 0.5f * std::cos((float) (t - sounding_from) * 0.06f);
+            }
+            for (int c = 0; c < buffer.getNumChannels(); c++) {
+                buffer.setSample(c, i, (c == 0) ? v : 0.5f * v);
+            }
+        }
+        clock = block_end;
+    }
+
+    int delay;
+    float noise;
+    int64 clock;
+    int64 block_end;
+    int64 sounding_from;
+    int64 sounding_to;
+    int notes;
+    int stray_ping;
+    int stray_delay;
+    bool silent;
+    Random rnd;
+};
+
+// runs blocks of varying size until the measurement ends, false on a timeout
+bool run_measurement(HardwareReturn &hw, Loopback &loop, int max_block, bool capture = false)
+{
+    Random sizes(3);
+    AudioSampleBuffer buffer(2, max_block);
+    if (capture) {
+        hw.capture();
+    } else {
+        hw.measure();
+    }
+    for (int blocks = 0; blocks < 100000; blocks++) {
+        int n = 1 + sizes.nextInt(max_block);
+        buffer.setSize(2, n, false, false, true);
+        loop.render(buffer);
+        hw.process(buffer);
+        HardwareReturn::State state = hw.get_state();
+        if ((blocks > 0) && (state != HardwareReturn::MEASURING) && (state != HardwareReturn::CAPTURING)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+}
+
+bool HardwareReturnTests()
+{
+    // onsets in every position of a chunk and on either channel
+    {
+        HeapBlock<float> a(300, true), b(300, true);
+        const float *ch[] = {a, b};
+        if ((OnsetDetector::find(ch, 2, 300, 0.1f) != -1) || (OnsetDetector::peak(ch, 2, 300) != 0)) {
+            Logger::writeToLog("HardwareReturn: onset in silence");
+            return false;
+        }
+        for (int at = 0; at < 300; at++) {
+            zeromem(a, 300 * sizeof(float));
+            zeromem(b, 300 * sizeof(float));
+            (at & 1 ? a : b)[at] = -0.2f;
+            if (at + 5 < 300) {
+                (at & 1 ? b : a)[at + 5] = 0.9f;
+            }
+            if (OnsetDetector::find(ch, 2, 300, 0.1f) != at) {
+                Logger::writeToLog("HardwareReturn: onset at " + String(at) + " missed");
+                return false;
+            }
+        }
+    }
+
+    Loopback *current = nullptr;
+    HardwareReturn hw([&] (const MidiMessage &m) { current->midi(m); });
+    hw.prepare(48000);
+    hw.set_channel(3);
+
+    // a clean return
+    {
+        Loopback loop(1234, 0.001f);
+        current = &loop;
+        hw.take_latency_changed();
+        if (!run_measurement(hw, loop, 512) || (hw.get_state() != HardwareReturn::MEASURED) ||
+            (std::abs(hw.get_latency_samples() - 1234) > 1) || (loop.notes != HardwareReturn::NUM_PINGS)) {
+            Logger::writeToLog("HardwareReturn: latency not measured, got " + hw.get_status());
+            return false;
+        }
+        if (!hw.take_latency_changed() || hw.take_latency_changed() || (hw.get_reported_latency() != 0)) {
+            Logger::writeToLog("HardwareReturn: latency change not reported once");
+            return false;
+        }
+        hw.set_insert(true);
+        if (hw.get_reported_latency() != hw.get_latency_samples()) {
+            Logger::writeToLog("HardwareReturn: inserted latency not reported");
+            return false;
+        }
+        hw.set_insert(false);
+    }
+
+    // one ping hears something early, the median is not moved
+    {
+        Loopback loop(700, 0.001f);
+        loop.stray_ping = 2;
+        loop.stray_delay = 90;
+        current = &loop;
+        if (!run_measurement(hw, loop, 64) || (std::abs(hw.get_latency_samples() - 700) > 1)) {
+            Logger::writeToLog("HardwareReturn: stray onset taken, got " + hw.get_status());
+            return false;
+        }
+    }
+
+    // nothing comes back, or the input never goes quiet: failed, the old value stays
+    {
+        Loopback loop(500, 0.001f);
+        loop.silent = true;
+        current = &loop;
+        if (!run_measurement(hw, loop, 256) || (hw.get_state() != HardwareReturn::FAILED) ||
+            (std::abs(hw.get_latency_samples() - 700) > 1)) {
+            Logger::writeToLog("HardwareReturn: missing return not failed");
+            return false;
+        }
+        Loopback noisy(500, 0.3f);
+        current = &noisy;
+        if (!run_measurement(hw, noisy, 256) || (hw.get_state() != HardwareReturn::FAILED) || (noisy.notes != 0)) {
+            Logger::writeToLog("HardwareReturn: noisy input not failed");
+            return false;
+        }
+    }
+
+    // a capture starts at the onset and holds the note for HOLD_MS
+    {
+        Loopback loop(500, 0.001f);
+        current = &loop;
+        Array<float> cap;
+        if (hw.get_capture(cap) || !run_measurement(hw, loop, 100, true) || (hw.get_state() != HardwareReturn::CAPTURED) ||
+            !hw.get_capture(cap) || (cap.size() != HardwareReturn::CAPTURE_MS * 48) || (loop.notes != 1)) {
+            Logger::writeToLog("HardwareReturn: nothing captured, " + hw.get_status());
+            return false;
+        }
+        float held = 0, released = 0;
+        for (int i = 0; i < cap.size(); i++) {
+            float v = std::abs(cap[i]);
+            if (i < HardwareReturn::HOLD_MS * 48) {
+                held = jmax(held, v);
+            } else if (i > (HardwareReturn::HOLD_MS + 20) * 48) {
+                released = jmax(released, v);
+            }
+        }
+        if ((cap[0] < 0.3f) || (held < 0.35f) || (released > 0.01f)) {
+            Logger::writeToLog("HardwareReturn: capture not onset aligned or note not released");
+            return false;
+        }
+        if (std::abs(hw.get_latency_samples() - 700) > 1) {
+            Logger::writeToLog("HardwareReturn: capture changed the latency");
+            return false;
+        }
+    }
+
+    // the input reaches the output only when inserted, and never while measuring
+    {
+        Loopback loop(100, 0.1f);
+        current = &loop;
+        AudioSampleBuffer buffer(2, 128), copy(2, 128);
+        loop.render(buffer);
+        copy.makeCopyOf(buffer);
+        hw.process(buffer);
+        if (buffer.getMagnitude(0, 128) != 0) {
+            Logger::writeToLog("HardwareReturn: output not silent");
+            return false;
+        }
+        hw.set_insert(true);
+        buffer.makeCopyOf(copy);
+        hw.process(buffer);
+        if ((buffer.getSample(0, 17) != copy.getSample(0, 17)) || (buffer.getSample(1, 99) != copy.getSample(1, 99))) {
+            Logger::writeToLog("HardwareReturn: input not passed through");
+            return false;
+        }
+        hw.measure();
+        buffer.makeCopyOf(copy);
+        hw.process(buffer);
+        if ((hw.get_state() != HardwareReturn::MEASURING) || (buffer.getMagnitude(0, 128) != 0)) {
+            Logger::writeToLog("HardwareReturn: output not muted while measuring");
+            return false;
+        }
+        hw.cancel();
+        hw.process(buffer);
+        if (hw.get_state() != HardwareReturn::IDLE) {
+            Logger::writeToLog("HardwareReturn: measurement not cancelled");
+            return false;
+        }
+    }
+
+    // a restored value follows the sample rate
+    hw.set_latency_ms(10.0);
+    hw.prepare(96000);
+    if ((hw.get_latency_samples() != 960) || !hw.take_latency_changed()) {
+        Logger::writeToLog("HardwareReturn: restored latency wrong");
+        return false;
+    }
+    return true;
+}
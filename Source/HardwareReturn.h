@@ -0,0 +1,186 @@
+/*
+ This file is part of micronau.
+ Copyright (c) 2013 - David Smitley
+
+ Permission is granted to use this software under the terms of the GPL v2 (or any later version)
+
+ Details can be found at: www.gnu.org/licenses
+*/
+
+#ifndef __HARDWARERETURN_H__
+#define __HARDWARERETURN_H__
+
+#include "MicronauCore.h"
+#include <juce_audio_basics/juce_audio_basics.h>
+#include <functional>
+
+//==============================================================================
+/*
+    OnsetDetector:
+        Finds the first sample of a block whose magnitude reaches a threshold.
+        Each channel is checked a chunk at a time with FloatVectorOperations
+        (SSE/NEON where JUCE has them), and only the chunk that crosses is
+        scanned sample by sample, so a silent block costs one vector pass.
+        Nothing here allocates.
+*/
+class OnsetDetector
+{
+public:
+    enum {
+        CHUNK = 32
+    };
+
+    // index of the first sample at or above threshold on any channel, -1 if none
+    static int find(const float *const *channels, int num_channels, int num_samples, float threshold);
+    // largest magnitude in the block
+    static float peak(const float *const *channels, int num_channels, int num_samples);
+};
+
+//==============================================================================
+/*
+    HardwareReturn:
+        "Hardware insert": the Micron's audio comes back on the plugin's input
+        and is passed to its output, so it plays and bounces like any other
+        instrument. For the host to line it up with the rest of the mix it has
+        to know how late the audio arrives after the midi that caused it.
+
+        measure() sends test notes through the NoteFunction and times each one
+        from the start of the block after it was sent (where the output queues
+        place it) until its onset shows up on the input:
+          - wait for the input to go quiet, and take its noise floor
+          - send the note, look for the first sample above the threshold
+          - send the note off, and go again until NUM_PINGS notes were timed
+        The latency is the median of the pings, so one that caught a stray
+        sound does not count. The output is muted while measuring.
+
+        capture() records the response to one test note instead: the same wait
+        for quiet and note on, then CAPTURE_MS of the input (mixed to mono) from
+        its onset, with the note released after HOLD_MS. The recording goes into
+        a buffer sized in prepare(), and can be copied out once the state is
+        CAPTURED. This is what the sound matching fingerprints, see SoundMatch.
+
+        process() runs on the audio thread and never allocates or blocks. It
+        calls the NoteFunction there too, so that has to hand the note to a
+        preallocated queue rather than a midi port. The settings and results
+        are atomics any thread can read. A new latency is reported once through
+        take_latency_changed(), for the processor to hand to setLatencySamples
+        on the message thread.
+*/
+class HardwareReturn
+{
+public:
+    typedef std::function<void (const MidiMessage &msg)> NoteFunction;
+
+    enum State {
+        IDLE = 0,
+        MEASURING,
+        MEASURED,
+        FAILED,
+        CAPTURING,
+        CAPTURED
+    };
+
+    enum {
+        NUM_PINGS = 5,
+        MIN_PINGS = 3,          // timed pings needed for a result
+        QUIET_MS = 100,         // input has to stay quiet this long before a ping
+        MAX_WAIT_MS = 3000,     // for the quiet, before giving up
+        MAX_LATENCY_MS = 1000,  // for an onset, before the ping counts as lost
+        CAPTURE_MS = 1500,
+        HOLD_MS = 500,
+        NOTE = 60,
+        VELOCITY = 127
+    };
+
+    explicit HardwareReturn(NoteFunction f);
+
+    void prepare(double sample_rate);
+
+    // pass the input to the output, otherwise the output is silent as before
+    void set_insert(bool on) {insert = on;}
+    bool get_insert() const {return insert.get();}
+    // midi channel 1-16 of the test notes
+    void set_channel(int c) {channel = jlimit(1, 16, c);}
+
+    // start (or restart) a measurement or a capture, any thread
+    void measure() {requested = MEASURE_REQUEST;}
+    void capture() {requested = CAPTURE_REQUEST;}
+    void cancel() {cancel_requested = 1;}
+
+    // audio thread: buffer holds the input on entry and the output on return
+    void process(AudioSampleBuffer &buffer);
+
+    State get_state() const {return (State) state.get();}
+    int get_pings_done() const {return pings_done.get();}
+    // counts measurements and captures as the audio thread starts them
+    int get_runs() const {return runs.get();}
+    double get_sample_rate() const {return sample_rate;}
+    // the last capture, false unless the state is CAPTURED
+    bool get_capture(Array<float> &dest) const;
+    // in samples at the current rate, 0 before anything was measured
+    int get_latency_samples() const;
+    double get_latency_ms() const {return latency_us.get() / 1000.0;}
+    // a measured or restored value; ms < 0 forgets it
+    void set_latency_ms(double ms);
+    // what the host should be told: the latency while inserted, else 0
+    int get_reported_latency() const {return get_insert() ? get_latency_samples() : 0;}
+    // true once after the reported latency may have changed
+    bool take_latency_changed() {return latency_changed.compareAndSetBool(0, 1);}
+
+    String get_status() const;
+
+private:
+    enum Phase {
+        QUIET,
+        LISTEN,
+        RECORD
+    };
+
+    enum {
+        MEASURE_REQUEST = 1,
+        CAPTURE_REQUEST
+    };
+
+    void start(bool capture);
+    void record(const float *const *in, int num_channels, int from, int n);
+    void finish();
+    void ping_done(int latency);
+    void note_off();
+
+    NoteFunction send_note;
+    double sample_rate;
+
+    Atomic<int> insert;
+    Atomic<int> channel;
+    Atomic<int> requested;
+    Atomic<int> cancel_requested;
+    Atomic<int> state;
+    Atomic<int> pings_done;
+    Atomic<int> runs;
+    Atomic<int> latency_us;     // -1 when unknown
+    Atomic<int> latency_changed;
+
+    // audio thread only
+    Phase phase;
+    int64 clock;                // samples processed since prepare
+    int64 phase_start;
+    int64 ping_at;
+    float noise;
+    float threshold;
+    int note_channel;
+    bool note_on;
+    int pings[NUM_PINGS];
+    int num_pings;
+    int lost;
+    bool capturing;
+    HeapBlock<float> capture_data;
+    int capture_len;
+    int capture_pos;
+    int64 onset_at;
+
+    JUCE_DECLARE_NON_COPYABLE (HardwareReturn)
+};
+
+bool HardwareReturnTests();
+
+#endif  // __HARDWARERETURN_H__
@@ -0,0 +1,256 @@
+/*
+ This file is part of micronau.
+ Copyright (c) 2013 - David Smitley
+
+ Permission is granted to use this software under the terms of the GPL v2 (or any later version)
+
+ Details can be found at: www.gnu.org/licenses
+*/
+
+#include "HostMidiOut.h"
+
+const char *HostMidiOut::port_name = "Host (plugin midi out)";
+
+HostMidiOut::HostMidiOut() :
+    fifo(QUEUE_BYTES),
+    audio_thread(nullptr),
+    have_held(false),
+    wire_free(0),
+    last_render(0),
+    bandwidth(DIN_BYTES_PER_SEC)
+{
+    ring.calloc(QUEUE_BYTES);
+    held_data.calloc(MAX_MESSAGE);
+}
+
+void HostMidiOut::reset()
+{
+    SpinLock::ScopedLockType l(write_lock);
+    fifo.reset();
+    have_held = false;
+    wire_free = 0;
+    last_render = 0;
+}
+
+void HostMidiOut::write(const void *src, int n)
+{
+    int start1, size1, start2, size2;
+    fifo.prepareToWrite(n, start1, size1, start2, size2);
+    memcpy(ring + start1, src, size1);
+    if (size2 > 0) {
+        memcpy(ring + start2, (const uint8 *) src + size1, size2);
+    }
+    fifo.finishedWrite(size1 + size2);
+}
+
+void HostMidiOut::read(void *dst, int n)
+{
+    int start1, size1, start2, size2;
+    fifo.prepareToRead(n, start1, size1, start2, size2);
+    memcpy(dst, ring + start1, size1);
+    if (size2 > 0) {
+        memcpy((uint8 *) dst + size1, ring + start2, size2);
+    }
+    fifo.finishedRead(size1 + size2);
+}
+
+bool HostMidiOut::push(const MidiMessage &msg)
+{
+    header h;
+    h.size = msg.getRawDataSize();
+    // host automation reaches us on the audio thread between blocks
+    h.time = (Thread::getCurrentThreadId() == audio_thread.get()) ? -1.0 : Time::getMillisecondCounterHiRes();
+
+    if (h.size > MAX_MESSAGE) {
+        dropped += 1;
+        return false;
+    }
+    // header and data become visible to the reader together
+    uint8 buf[sizeof(header) + MAX_MESSAGE];
+    memcpy(buf, &h, sizeof(h));
+    memcpy(buf + sizeof(h), msg.getRawData(), h.size);
+
+    SpinLock::ScopedLockType l(write_lock);
+    if (fifo.getFreeSpace() < (int) sizeof(h) + h.size) {
+        dropped += 1;
+        return false;
+    }
+    write(buf, sizeof(h) + h.size);
+    return true;
+}
+
+bool HostMidiOut::fetch()
+{
+    if (fifo.getNumReady() < (int) sizeof(header)) {
+        return false;
+    }
+    read(&held, sizeof(held));
+    read(held_data, held.size);
+    have_held = true;
+    return true;
+}
+
+void HostMidiOut::render(MidiBuffer &out, int num_samples, double sample_rate)
+{
+    audio_thread = Thread::getCurrentThreadId();
+    double now = Time::getMillisecondCounterHiRes();
+    double samples_per_byte = (bandwidth > 0) ? sample_rate / bandwidth : 0.0;
+
+    while (have_held || fetch()) {
+        double want = 0;
+        if ((held.time >= 0) && (last_render > 0)) {
+            // keep the spacing it was sent with, one block later
+            want = jlimit(0.0, (double) (num_samples - 1), (held.time - last_render) * sample_rate / 1000.0);
+        }
+        double pos = jmax(want, wire_free);
+        if (pos >= num_samples) {
+            // wire is busy until a later block
+            break;
+        }
+        out.addEvent(held_data, held.size, (int) pos);
+        if ((int) (pos - want) > max_delay.get()) {
+            max_delay = (int) (pos - want);
+        }
+        wire_free = pos + held.size * samples_per_byte;
+        have_held = false;
+    }
+    wire_free = jmax(0.0, wire_free - num_samples);
+    last_render = now;
+}
+
+static Array<int> event_positions(const MidiBuffer &b, int *bytes = nullptr)
+{
+    Array<int> positions;
+    MidiBuffer::Iterator i(b);
+    const uint8 *data;
+    int size, pos;
+    while (i.getNextEvent(data, size, pos)) {
+        positions.add(pos);
+        if (bytes != nullptr) {
+            *bytes += size;
+        }
+    }
+    return positions;
+}
+
+bool HostMidiOutTests()
+{
+    const double sr = 44100;
+    const int block = 512;
+    const double samples_per_byte = sr / HostMidiOut::DIN_BYTES_PER_SEC;
+    HostMidiOut out;
+    MidiBuffer b;
+
+    // automation from the audio thread: 10 nrpns, more than a block can carry
+    out.render(b, block, sr);
+    for (int n = 0; n < 10; n++) {
+        out.push(MidiMessage::controllerEvent(1, 0x63, 0));
+        out.push(MidiMessage::controllerEvent(1, 0x62, n));
+        out.push(MidiMessage::controllerEvent(1, 0x06, 0));
+        out.push(MidiMessage::controllerEvent(1, 0x26, n));
+    }
+    Array<int> all;
+    int bytes = 0;
+    for (int blk = 0; blk < 8; blk++) {
+        b.clear();
+        out.render(b, block, sr);
+        Array<int> p = event_positions(b, &bytes);
+        for (int i = 0; i < p.size(); i++) {
+            all.add(blk * block + p[i]);
+        }
+    }
+    if ((all.size() != 40) || (bytes != 120) || (all[0] != 0)) {
+        Logger::writeToLog("HostMidiOut: automation not delivered");
+        return false;
+    }
+    for (int i = 1; i < all.size(); i++) {
+        if (all[i] - all[i - 1] < (int) (3 * samples_per_byte) - 1) {
+            Logger::writeToLog("HostMidiOut: events closer than the wire allows");
+            return false;
+        }
+    }
+    if (all.getLast() > (int) (40 * 3 * samples_per_byte) + 1) {
+        Logger::writeToLog("HostMidiOut: events spread further than needed");
+        return false;
+    }
+
+    // same input, same output
+    {
+        HostMidiOut again;
+        MidiBuffer c;
+        again.render(c, block, sr);
+        for (int n = 0; n < 10; n++) {
+            again.push(MidiMessage::controllerEvent(1, 0x63, 0));
+            again.push(MidiMessage::controllerEvent(1, 0x62, n));
+            again.push(MidiMessage::controllerEvent(1, 0x06, 0));
+            again.push(MidiMessage::controllerEvent(1, 0x26, n));
+        }
+        Array<int> second;
+        for (int blk = 0; blk < 8; blk++) {
+            c.clear();
+            again.render(c, block, sr);
+            Array<int> p = event_positions(c);
+            for (int i = 0; i < p.size(); i++) {
+                second.add(blk * block + p[i]);
+            }
+        }
+        if (second != all) {
+            Logger::writeToLog("HostMidiOut: not deterministic");
+            return false;
+        }
+    }
+
+    // from another thread: spacing in time is kept
+    {
+        HostMidiOut gui;
+        MidiBuffer c;
+        gui.render(c, block, sr);
+        struct Sender : public Thread {
+            Sender(HostMidiOut &o) : Thread("gui"), out(o) {}
+            void run() {
+                out.push(MidiMessage::controllerEvent(1, 7, 1));
+                Thread::sleep(20);
+                out.push(MidiMessage::controllerEvent(1, 7, 2));
+            }
+            HostMidiOut &out;
+        } sender(gui);
+        sender.startThread();
+        sender.waitForThreadToExit(1000);
+        c.clear();
+        gui.render(c, 8192, sr);
+        Array<int> p = event_positions(c);
+        int gap = (p.size() == 2) ? p[1] - p[0] : 0;
+        if ((gap < 15 * sr / 1000) || (gap > 60 * sr / 1000)) {
+            Logger::writeToLog("HostMidiOut: timing of gui events lost, gap " + String(gap));
+            return false;
+        }
+    }
+
+    // a program dump fills the wire for many blocks, and the queue never blocks
+    {
+        HostMidiOut dump;
+        MidiBuffer c;
+        dump.render(c, block, sr);
+        uint8 sysex[434];
+        memset(sysex, 0, sizeof(sysex));
+        sysex[0] = 0xf0;
+        sysex[433] = 0xf7;
+        int pushed = 0;
+        while (dump.push(MidiMessage(sysex, sizeof(sysex)))) {
+            pushed++;
+        }
+        if ((dump.get_dropped() != 1) || (pushed < 100)) {
+            Logger::writeToLog("HostMidiOut: queue overflow not handled");
+            return false;
+        }
+        c.clear();
+        dump.render(c, block, sr);
+        c.clear();
+        dump.render(c, block, sr);
+        if (!c.isEmpty()) {
+            Logger::writeToLog("HostMidiOut: second dump sent while the first is on the wire");
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,92 @@
+/*
+ This file is part of micronau.
+ Copyright (c) 2013 - David Smitley
+
+ Permission is granted to use this software under the terms of the GPL v2 (or any later version)
+
+ Details can be found at: www.gnu.org/licenses
+*/
+
+#ifndef __HOSTMIDIOUT_H__
+#define __HOSTMIDIOUT_H__
+
+#include "MicronauCore.h"
+#include <juce_audio_basics/juce_audio_basics.h>
+
+//==============================================================================
+/*
+    HostMidiOut:
+        Output mode where everything we would send to the Micron is written into
+        the host's midi buffer in processBlock instead of a private midi port, so
+        the host can record it, bounce it and route it like any other track.
+
+        Messages can be pushed from any thread. Those pushed from the audio
+        thread (host automation arrives there, between blocks) are placed at the
+        start of the next block, so an offline bounce always gives the same
+        result. Messages from other threads (gui, midi input) keep their spacing
+        in time and come out one block later.
+
+        The wire to the synth only carries so many bytes per second, so events
+        are spread: each one starts after the previous has finished on the wire,
+        and whatever does not fit in a block moves on to the next one.
+*/
+class HostMidiOut
+{
+public:
+    static const char *port_name;
+    enum {
+        DIN_BYTES_PER_SEC = 3125,
+        QUEUE_BYTES = 64 * 1024,
+        MAX_MESSAGE = 1024
+    };
+
+    HostMidiOut();
+
+    // 0 for no limit
+    void set_bandwidth(int bytes_per_sec) {bandwidth = bytes_per_sec;}
+    // forget queued messages and wire state
+    void reset();
+
+    // any thread, returns false if the queue is full
+    bool push(const MidiMessage &msg);
+
+    // audio thread: add queued messages to the block
+    void render(MidiBuffer &out, int num_samples, double sample_rate);
+
+    int get_dropped() const {return dropped.get();}
+    int get_queued_bytes() const {return fifo.getNumReady();}
+    // how far the spreader has had to push events back, in samples
+    int get_max_delay() const {return max_delay.get();}
+
+private:
+    struct header {
+        double time;        // ms, or -1 for "start of next block"
+        int size;
+    };
+
+    void write(const void *src, int n);
+    void read(void *dst, int n);
+    bool fetch();
+
+    SpinLock write_lock;
+    AbstractFifo fifo;
+    HeapBlock<uint8> ring;
+    Atomic<Thread::ThreadID> audio_thread;
+
+    // audio thread only
+    header held;
+    HeapBlock<uint8> held_data;
+    bool have_held;
+    double wire_free;       // in samples from the start of the current block
+    double last_render;
+    int bandwidth;
+
+    Atomic<int> dropped;
+    Atomic<int> max_delay;
+
+    JUCE_DECLARE_NON_COPYABLE (HostMidiOut)
+};
+
+bool HostMidiOutTests();
+
+#endif  // __HOSTMIDIOUT_H__
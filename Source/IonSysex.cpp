@@ -20,9 +20,8 @@
 */
 
 #include "IonSysex.h"
-#include <CoreFoundation/CoreFoundation.h>
 #include <math.h>
-#include "../JuceLibraryCode/JuceHeader.h"
+#include "BinaryData.h"
 #include "tinyxml.h"
 
 
@@ -33,8 +32,6 @@
 #include <map>
 #include "mapping.h"
 
-#define SYSEX_PROGRAM_SIZE 434
-
 static UInt32 checksum(unsigned char *buff, UInt32 len);
 
 void logDebug(const char *s)
@@ -42,7 +39,7 @@ void logDebug(const char *s)
 //	fprintf(stdout, "%s\n", s);
 }
 
-static bool encodeToMidi(vector<unsigned char> &raw, vector <unsigned char> &encoded)
+bool encodeToMidi(vector<unsigned char> &raw, vector <unsigned char> &encoded)
 {
     unsigned char *rawBuf = new unsigned char[raw.size()];
     int encodedBufSize = raw.size() + (raw.size() / 7);
@@ -74,14 +71,14 @@ static bool encodeToMidi(vector<unsigned char> &raw, vector <unsigned char> &enc
         encoded.push_back(encodedBuf[i]);
     }
 
-    delete encodedBuf;
-    delete rawBuf;
+    delete[] encodedBuf;
+    delete[] rawBuf;
     return true;
 }
 
 // gets rid of the byte with the set of most significant bits for the next 7 bytes.
 // SHRINK
-static bool decodeFromMidi(vector<unsigned char> &encoded, vector<unsigned char> &raw)
+bool decodeFromMidi(vector<unsigned char> &encoded, vector<unsigned char> &raw)
 {
     if (encoded.size() % 8) {
         return false;
@@ -109,8 +106,8 @@ static bool decodeFromMidi(vector<unsigned char> &encoded, vector<unsigned char>
     raw.clear();
     for(int i = 0; i < rawBufSize; i++) raw.push_back(rawBuf[i]);
 
-    delete encodedBuf;
-    delete rawBuf;
+    delete[] encodedBuf;
+    delete[] rawBuf;
     return true;
 }
 
@@ -142,7 +139,7 @@ static vector<string> init_string_vector(const char *strorig)
       // and reallocate buffer if necessary
       if((ptr3 - ptr1) > curBufLen){
          curBufLen = (ptr3 - ptr1) + 1;
-         if(buf != NULL) delete buf;
+         if(buf != NULL) delete[] buf;
          buf = new char[curBufLen];
       }
       *ptr3 = '\0';
@@ -151,7 +148,7 @@ static vector<string> init_string_vector(const char *strorig)
       if(!done)
          ptr2++;
    }
-   if(buf != NULL) delete buf;
+   if(buf != NULL) delete[] buf;
    free(str);
    return ret;
 }
@@ -236,19 +233,34 @@ int ListItemParameter::getNrpnValue()
 
 IonSysexParam::IonSysexParam(const char *name)
 {
-   m_name = name;
+   m_name = strdup(name);
    m_conv = NONE;
    m_nrpn = -1;
    m_offset = -1;
-   m_valueSet = false;
+   m_min = 0;
+   m_max = 0;
+   m_store = NULL;
+   m_storeIdx = 0;
    m_cntrlOffset = 0;
    m_paramName = NULL;
    m_defaultValue = 0;
    m_textValue = String("");
 
-   init_mapping();   
+   // the tables are shared, fill them once even if params are made on several threads
+   static bool mapped = (init_mapping(), true);
+   (void) mapped;
  }
 
+IonSysexParam::~IonSysexParam()
+{
+   // the names are copies made while the xml was loaded
+   free((void *) m_name);
+   free((void *) m_paramName);
+   for (unsigned int i = 0; i < m_list.size(); i++) {
+      free((void *) m_list[i].getName());
+   }
+}
+
 String IonSysexParam::getTextValue()
 {
     return m_textValue;
@@ -270,14 +282,103 @@ String IonSysexParam::getParamName()
 
 void IonSysexParam::setParamName(const char *str)
 {
-    m_paramName = str;
+    // str belongs to the xml document, which goes away after loading
+    free((void *) m_paramName);
+    m_paramName = strdup(str);
+}
+
+// Display strings depend only on the conversion and the value, so every parameter
+// with the same conversion and range (or the same list) shares one table. Tables
+// are built on first use and live until the plugin is unloaded.
+struct ConversionTable {
+    SInt32 first;
+    StringArray text;
+};
+
+static CriticalSection conversionTableLock;
+static OwnedArray<ConversionTable> conversionTables;
+static std::map<String, ConversionTable*> conversionTableIndex;
+// remembered by parameters that have no table
+static ConversionTable noConversionTable;
+
+// domains larger than this (raw 14 bit values) are formatted on demand
+#define MAX_CONVERSION_TABLE 2048
+
+const ConversionTable *IonSysexParam::getConversionTable()
+{
+    ConversionTable *table = m_conversionTable.get();
+    if (table != NULL) {
+        return (table == &noConversionTable) ? NULL : table;
+    }
+
+    SInt32 first = m_min;
+    SInt32 last = m_max;
+    if (getList().size() != 0) {
+        first = jmax(0, m_min);
+        last = jmin(m_max, (int) getList().size() - 1);
+    }
+    if ((last < first) || (last - first >= MAX_CONVERSION_TABLE)) {
+        m_conversionTable = &noConversionTable;
+        return NULL;
+    }
+
+    String key;
+    if (getList().size() != 0) {
+        key = "list";
+        for (unsigned int i = 0; i < getList().size(); i++) {
+            key << "|" << getList()[i].getName();
+        }
+    } else {
+        key << (int) m_conv << ":";
+    }
+    key << ":" << (int) first << ":" << (int) last;
+
+    ScopedLock l(conversionTableLock);
+    std::map<String, ConversionTable*>::iterator it = conversionTableIndex.find(key);
+    if (it != conversionTableIndex.end()) {
+        table = it->second;
+    } else {
+        table = new ConversionTable;
+        table->first = first;
+        table->text.ensureStorageAllocated(last - first + 1);
+        for (SInt32 v = first; v <= last; v++) {
+            table->text.add(formatValue(v));
+        }
+        conversionTables.add(table);
+        conversionTableIndex[key] = table;
+    }
+    m_conversionTable = table;
+    return table;
 }
 
 String IonSysexParam::getConvertedValue(SInt32 val)
+{
+	return getTextForValue(getValue());
+}
+
+String IonSysexParam::getTextForValue(SInt32 val)
+{
+	val += m_cntrlOffset;
+    const ConversionTable *table = getConversionTable();
+    if (table != NULL) {
+        SInt32 idx = val - table->first;
+        if ((idx >= 0) && (idx < table->text.size())) {
+            // shares the table's string, no formatting or allocation
+            return table->text[idx];
+        }
+    }
+    return formatValue(val);
+}
+
+String IonSysexParam::formatValue(SInt32 val)
 {
     char buf[128];
-	val = getValue() + m_cntrlOffset;
 	if (getList().size() != 0) {
+		// values come from program dumps and saved states, some lists are
+		// shorter than the parameter's range
+		if ((val < 0) || (val >= (SInt32) getList().size())) {
+			return String(val);
+		}
 		return String(getList()[val].getName());
 	}
 	else {
@@ -406,12 +507,7 @@ String IonSysexParam::getConvertedValue(SInt32 val)
 
 int IonSysexParam::getValue()
 {
-    if(m_valueSet)  {
-		return m_value;
-	}
-    m_value = m_min;
-    m_valueSet = true;
-    return m_value;
+    return m_store->get(m_storeIdx);
 }
 
 int IonSysexParam::getBitWidth()
@@ -459,15 +555,12 @@ bool IonSysexParam::setNameFromContent(unsigned char *content)
    memcpy(name,&content[m_offset/8],15);
    name[14] = 0;
    m_textValue = String(name);
-   m_valueSet = true;
    return true;
 }
 
 void IonSysexParam::setValue(int value)
 {
-    m_value = value;
-    m_valueSet = true;
-    return;
+    m_store->set(m_storeIdx, value);
 }
 
 void IonSysexParam::setNrpn(int nrpn)
@@ -478,12 +571,12 @@ void IonSysexParam::setNrpn(int nrpn)
 bool IonSysexParam::writeNameToBuffer(unsigned char *buffer)
 {
 	char str[16];
-	bzero(str, sizeof(str));
+	memset(str, 0, sizeof(str));
 	m_textValue.copyToUTF8(str, sizeof(str));
 //	const char *str = CFStringGetCStringPtr(m_textValue, 0);
-	bzero(&buffer[m_offset/8], 15);
+	memset(&buffer[m_offset/8], 0, 15);
 	memcpy((char *) &buffer[m_offset/8], str, 14);
-	bzero(&buffer[296], 15);
+	memset(&buffer[296], 0, 15);
 	memcpy(&buffer[296], str, 14);
 	return true;
 }
@@ -500,6 +593,8 @@ static void setBit(unsigned char *buffer, int offset, short val)
 	buffer[offset/8] = b;
 }
 
+// Per parameter packing. Whole programs go through IonSysexParams::packContent,
+// this is kept as the reference it is tested against (ProgramLayoutTests).
 bool IonSysexParam::writeValueToBuffer(unsigned char *buffer)
 {
 	int i;
@@ -522,7 +617,7 @@ bool IonSysexParam::writeValueToBuffer(unsigned char *buffer)
     unsigned char tmp;
 //    printf("writing %s. Bits: %d, Byte Offset: %d value %d\n", m_name, bits, byte_offset, m_value);
 
-    short s_value = (short) m_value;
+    short s_value = (short) getValue();
 	s_value += getCntrlOffset();
     if(s_value < m_min)
         s_value = m_min;
@@ -575,9 +670,10 @@ bool IonSysexParam::writeValueToBuffer(unsigned char *buffer)
 		}
     }
 
-    // fx2, sync param
+    // fx2, sync param: one byte, the one before it is the fx2 sync flag
    if (m_offset == 1112) {
 	  s_value += 12;
+	  bits = 8;
    }
 	// fx wet/dry mix
    if (m_offset == 2240) {
@@ -589,26 +685,26 @@ bool IonSysexParam::writeValueToBuffer(unsigned char *buffer)
   // mod src 1336, 1344, 1352, ....
   for (i = 0; i < 12; i++) {
 	  if (m_offset == (1336+(i*8))) {
-		s_value = mod_src_n_to_s[s_value];
+		s_value = remap(mod_src_n_to_s, s_value);
 	  }
 	  // remap mod destinations 1432, 1440, ....
 	  if (m_offset == (1432+(i*8))) {
-		s_value = mod_dst_n_to_s[s_value];
+		s_value = remap(mod_dst_n_to_s, s_value);
 	  }
   }
   // filter offset 608, 616
   for (i = 0; i < 2; i++) {
 	  if (m_offset == (608+(i*8))) {
-		s_value = filter_n_to_s[s_value];
+		s_value = remap(filter_n_to_s, s_value);
 	  }
   }
   // s&h source 1168
   if (m_offset == 1168) {
-	s_value = sh_n_to_s[s_value];
+	s_value = remap(sh_n_to_s, s_value);
   }
   // tracking source 1912
   if (m_offset == 1912) {
-	s_value = tracking_n_to_s[s_value];
+	s_value = remap(tracking_n_to_s, s_value);
   }
   if (m_offset == 122) {
 		if (s_value > 0) {
@@ -642,6 +738,7 @@ bool IonSysexParam::writeValueToBuffer(unsigned char *buffer)
    return true;
 }
 
+// Per parameter unpacking, reference for IonSysexParams::unpackContent.
 bool IonSysexParam::setValueFromContent(unsigned char *content)
 {
    int i;
@@ -665,6 +762,9 @@ bool IonSysexParam::setValueFromContent(unsigned char *content)
 	  l_max = 100;
 	  bits = 8;
    }
+   if (m_offset == 1112) {
+	  bits = 8;
+   }
   int byte_offset = m_offset / 8;
    int result;
    // Read low byte
@@ -749,28 +849,25 @@ bool IonSysexParam::setValueFromContent(unsigned char *content)
   // remap mod destinations
   for (i = 0; i < 12; i++) {
 	  if (m_offset == (1432+(i*8))) {
-		result = mod_dst_s_to_n[result];
+		result = remap(mod_dst_s_to_n, result);
 	  }
 	  if (m_offset == (1336+(i*8))) {
-		result = mod_src_s_to_n[result];
+		result = remap(mod_src_s_to_n, result);
 	  }
   }
   for (i = 0; i < 2; i++) {
 	  if (m_offset == (608+(i*8))) {
-		result = filter_s_to_n[result];
+		result = remap(filter_s_to_n, result);
 	  }
   }
   if (m_offset == 1168) {
-	result = sh_s_to_n[result];
+	result = remap(sh_s_to_n, result);
   }
   // tracking source 1912
   if (m_offset == 1912) {
-	result = tracking_s_to_n[result];
+	result = remap(tracking_s_to_n, result);
   }
-   m_value = result - m_cntrlOffset;
-   //cout << "m_value was " << result << endl;
-   //
-   m_valueSet = true;
+   setValue(result - m_cntrlOffset);
    return true;
 }
 
@@ -841,12 +938,12 @@ int IonSysexParam::getNrpn() const
 int IonSysexParam::getNrpnValue()
 {
     int v = getValue();
-    if(m_conv == LIST){
+    if((m_conv == LIST) && (v >= 0) && (v < (int) m_list.size())){
         if(m_list[v].hasSpecialNrpnValue()){
             return m_list[v].getNrpnValue();
         }
     }
-    return m_value;
+    return v;
 }
 
 bool IonSysexParam::hasNrpn() 
@@ -925,14 +1022,14 @@ void IonSysexParam::printDebug()
    }else if(m_conv == NAME){
       cout << "value: " << String(m_textValue)  << endl;
    }else{
-      cout << "value:" << m_value << endl;
+      cout << "value:" << getValue() << endl;
    }
    cout << "--------------------------------" << endl;
 }
 
 ////// IonSysexParams
 
-IonSysexParams::IonSysexParams()
+IonSysexParams::IonSysexParams(SchemaLoader loader)
 {
 	fx1Param = 0;
 	fx2Param = 0;
@@ -949,14 +1046,433 @@ IonSysexParams::IonSysexParams()
 
 #include "params.def"
 */
-    initFromXml();
+    if (loader == DOM_SCHEMA) {
+        initFromDom();
+    } else {
+        initFromXml();
+    }
+    values.allocate(params.size());
+    for (unsigned int i = 0; i < params.size(); i++) {
+        params[i]->setStore(&values, i);
+        values.set(i, params[i]->m_min);
+    }
+    buildLayout();
+}
+// Attribute and conversion names of the schema, found through a hash of their
+// second and last character and their length. The multipliers are picked so
+// that the names below don't collide (checked when the table is built); a hit
+// is confirmed with one compare, so anything else is simply not found.
+class SchemaNames
+{
+public:
+    SchemaNames(const char *const *list, int n, int bits, int a, int b, int c) :
+        names(list), count(n), mask((1 << bits) - 1), mulA(a), mulB(b), mulLen(c)
+    {
+        slots.resize(mask + 1, -1);
+        for (int i = 0; i < count; i++) {
+            int h = hash(names[i], (int) strlen(names[i]));
+            jassert(slots[h] < 0);
+            slots[h] = i;
+        }
+    }
+
+    // index of the name, -1 if it is not one of them
+    int find(const char *s, int len) const
+    {
+        if (len == 0) {
+            return -1;
+        }
+        int i = slots[hash(s, len)];
+        return ((i >= 0) && (strncmp(names[i], s, len) == 0) && (names[i][len] == 0)) ? i : -1;
+    }
+
+private:
+    int hash(const char *s, int len) const
+    {
+        return ((unsigned char) s[len > 1 ? 1 : 0] * mulA + (unsigned char) s[len - 1] * mulB + len * mulLen) & mask;
+    }
+
+    const char *const *names;
+    int count, mask, mulA, mulB, mulLen;
+    vector<int> slots;
+};
+
+enum SchemaAttribute {
+    ATTR_NAME, ATTR_CONVERSION, ATTR_MIN, ATTR_MAX, ATTR_SYSEXOFFSET, ATTR_DEFAULTVAL,
+    ATTR_NRPN, ATTR_CNTRLOFFSET, ATTR_PARAMNAME, ATTR_NRPNVALUE, ATTR_DISABLE
+};
+
+static const char *const attributeNames[] = {
+    "name", "conversion", "min", "max", "sysexoffset", "defaultval",
+    "nrpn", "cntrloffset", "paramname", "nrpnvalue", "disable"
+};
+
+// in the order of IonSysexParam::Conversion
+static const char *const conversionNames[] = {
+    "NONE", "LIST", "PERCENT", "TENTHS_OF_PERCENT", "INT32", "INT16", "INT8",
+    "ENV_TIME", "FX1_FX2_BALANCE", "FILTER_FREQ", "PITCH_FINE", "PORTA_TIME",
+    "LFO_FREQ", "RELEASE_TIME", "FILTER_OFFSET_FREQ", "FILTER_OFFSET_OCT",
+    "BALANCE", "TENTHS", "NAME", "TEXT_LABEL", "WET_DRY", "PRE_BAL", "POST_BAL",
+    "EXT_IN", "FX_LFO_FREQ", "MS", "OCTAVE", "SEMITONE", "BANK"
+};
+
+static const SchemaNames &schemaAttributes()
+{
+    static const SchemaNames names(attributeNames, numElementsInArray(attributeNames), 4, 1, 1, 14);
+    return names;
+}
+
+static const SchemaNames &schemaConversions()
+{
+    static const SchemaNames names(conversionNames, numElementsInArray(conversionNames), 6, 7, 3, 4);
+    return names;
+}
+
+// Pulls tags out of parameters.xml one at a time, without building anything.
+// Understands what the schema uses: the declaration, comments, elements and
+// attributes, the predefined entities and character references. Like TinyXML,
+// it takes unquoted attribute values and drops a '&' that starts no entity
+// (so "s&h" loads as "sh", which is what the editor has always shown).
+class SchemaReader
+{
+public:
+    SchemaReader(const char *xml, int size) : closing(false), selfClosing(false), error(false), p(xml), end(xml + size) {}
+
+    // the next start or end tag, false at the end or on an error
+    bool nextTag()
+    {
+        while (p < end) {
+            const char *lt = (const char *) memchr(p, '<', end - p);
+            if (lt == NULL) {
+                p = end;
+                return false;
+            }
+            p = lt + 1;
+            if (startsWith("?")) {
+                skipPast("?>");
+            } else if (startsWith("!--")) {
+                skipPast("-->");
+            } else if (startsWith("!")) {
+                skipPast(">");
+            } else {
+                closing = (p < end) && (*p == '/');
+                if (closing) {
+                    p++;
+                }
+                readName();
+                selfClosing = false;
+                if (closing) {
+                    skipPast(">");
+                }
+                return !error && (nameLen > 0);
+            }
+        }
+        return false;
+    }
+
+    // the next attribute of the start tag just read, false after the last one
+    bool nextAttribute()
+    {
+        skipSpace();
+        if (p >= end) {
+            error = true;
+            return false;
+        }
+        if (*p == '>') {
+            p++;
+            return false;
+        }
+        if (*p == '/') {
+            selfClosing = true;
+            skipPast(">");
+            return false;
+        }
+        readName();
+        skipSpace();
+        if ((nameLen == 0) || (p >= end) || (*p != '=')) {
+            error = true;
+            return false;
+        }
+        p++;
+        skipSpace();
+        value.clear();
+        if (p >= end) {
+            error = true;
+            return false;
+        }
+        if ((*p != '"') && (*p != '\'')) {
+            // unquoted (defaultval=-50), taken up to a space or the end of the tag as TinyXML does
+            while ((p < end) && (*p != ' ') && (*p != '\t') && (*p != '\n') && (*p != '\r') &&
+                   (*p != '/') && (*p != '>')) {
+                value += *p++;
+            }
+            return true;
+        }
+        char quote = *p++;
+        while ((p < end) && (*p != quote)) {
+            if (*p == '&') {
+                readEntity();
+            } else {
+                value += *p++;
+            }
+        }
+        if (p >= end) {
+            error = true;
+            return false;
+        }
+        p++;
+        return true;
+    }
+
+    // the rest of the start tag, if its attributes are not wanted
+    void skipAttributes()
+    {
+        while (nextAttribute()) {
+        }
+    }
+
+    bool nameIs(const char *s) const
+    {
+        return (strncmp(name, s, nameLen) == 0) && (s[nameLen] == 0);
+    }
+
+    const char *name;
+    int nameLen;
+    string value;
+    bool closing, selfClosing, error;
+
+private:
+    bool startsWith(const char *s) const
+    {
+        size_t n = strlen(s);
+        return ((size_t) (end - p) >= n) && (memcmp(p, s, n) == 0);
+    }
+
+    void skipPast(const char *s)
+    {
+        size_t n = strlen(s);
+        while ((p < end) && !startsWith(s)) {
+            p++;
+        }
+        if (p >= end) {
+            error = true;
+        }
+        p = jmin(p + n, end);
+    }
+
+    void skipSpace()
+    {
+        while ((p < end) && ((*p == ' ') || (*p == '\t') || (*p == '\n') || (*p == '\r'))) {
+            p++;
+        }
+    }
+
+    void readName()
+    {
+        name = p;
+        while ((p < end) && (*p != ' ') && (*p != '\t') && (*p != '\n') && (*p != '\r') &&
+               (*p != '=') && (*p != '/') && (*p != '>')) {
+            p++;
+        }
+        nameLen = (int) (p - name);
+    }
+
+    void readEntity()
+    {
+        static const struct { const char *text; char c; } entities[] = {
+            {"&amp;", '&'}, {"&lt;", '<'}, {"&gt;", '>'}, {"&quot;", '"'}, {"&apos;", '\''}
+        };
+        for (int i = 0; i < numElementsInArray(entities); i++) {
+            if (startsWith(entities[i].text)) {
+                value += entities[i].c;
+                p += strlen(entities[i].text);
+                return;
+            }
+        }
+        if (startsWith("&#")) {
+            const char *semi = (const char *) memchr(p, ';', jmin((int) (end - p), 12));
+            if (semi != NULL) {
+                bool hex = (p[2] == 'x');
+                juce_wchar c = (juce_wchar) strtol(p + (hex ? 3 : 2), NULL, hex ? 16 : 10);
+                value += String::charToString(c).toRawUTF8();
+                p = semi + 1;
+                return;
+            }
+        }
+        p++;
+    }
+
+    const char *p;
+    const char *end;
+};
 
+// what sscanf("%d") accepts, which is what TinyXML's QueryIntValue used
+static bool schemaInt(const string &s, int &v)
+{
+    char *e;
+    long l = strtol(s.c_str(), &e, 10);
+    if (e == s.c_str()) {
+        return false;
+    }
+    v = (int) l;
+    return true;
 }
+
+// One pass over the schema, making each parameter and list item as its tag is read.
 void IonSysexParams::initFromXml()
+{
+    int sz;
+    const char *text = BinaryData::getNamedResource("parameters_xml", sz);
+    const SchemaNames &attributes = schemaAttributes();
+    const SchemaNames &conversions = schemaConversions();
+    SchemaReader xml(text, sz);
+
+    // 0 outside the root, 1 in it, 2 in a parameter, more inside anything else
+    int depth = 0;
+    IonSysexParam *param = NULL;
+    while (xml.nextTag()) {
+        if (xml.closing) {
+            depth--;
+            continue;
+        }
+        if (depth == 1) {
+            if (!xml.nameIs("parameter")) {
+                logDebug("One of the root children was not a parameter node. Aborting");
+                return;
+            }
+            if (!xml.nextAttribute() || (attributes.find(xml.name, xml.nameLen) != ATTR_NAME)) {
+                logDebug("First attribute of parameter element not name. Aborting");
+                return;
+            }
+            param = new IonSysexParam(xml.value.c_str());
+            params.push_back(param);
+            while (xml.nextAttribute()) {
+                int v;
+                switch (attributes.find(xml.name, xml.nameLen)) {
+                    case ATTR_CONVERSION: {
+                        int c = conversions.find(xml.value.c_str(), (int) xml.value.size());
+                        if (c >= 0) {
+                            param->setConversion((IonSysexParam::Conversion) c);
+                        }
+                        break;
+                    }
+                    case ATTR_MIN:
+                        if (schemaInt(xml.value, v)) {
+                            param->setMin(v);
+                        } else {
+                            logDebug("Error parsing min attribute");
+                        }
+                        break;
+                    case ATTR_MAX:
+                        if (schemaInt(xml.value, v)) {
+                            param->setMax(v);
+                        } else {
+                            logDebug("Error parsing max attribute");
+                        }
+                        break;
+                    case ATTR_SYSEXOFFSET:
+                        if (schemaInt(xml.value, v)) {
+                            param->setOffset(v);
+                        } else {
+                            logDebug("Error parsing sysexoffset attribute");
+                        }
+                        break;
+                    case ATTR_DEFAULTVAL:
+                        if (schemaInt(xml.value, v)) {
+                            param->setDefaultValue(v);
+                        } else {
+                            logDebug("Error parsing defaultval attribute");
+                        }
+                        break;
+                    case ATTR_NRPN:
+                        if (schemaInt(xml.value, v)) {
+                            if (v == FX1_SELECTOR) {
+                                fx1Param = param;
+                            }
+                            if (v == FX2_SELECTOR) {
+                                fx2Param = param;
+                            }
+                            param->setNrpn(v);
+                        } else {
+                            logDebug("Error parsing nrpn attribute");
+                        }
+                        break;
+                    case ATTR_CNTRLOFFSET:
+                        // added to the value sent to a controller, for ones
+                        // (bcr2000) that don't handle negative values well
+                        if (schemaInt(xml.value, v)) {
+                            param->setCntrlOffset(v);
+                        } else {
+                            logDebug("Error parsing cntrloffset attribute");
+                        }
+                        break;
+                    case ATTR_PARAMNAME:
+                        param->setParamName(xml.value.c_str());
+                        break;
+                    default:
+                        break;
+                }
+            }
+        } else if ((depth == 2) && (param->getConversionType() == IonSysexParam::LIST)) {
+            if (!xml.nameIs("listitem")) {
+                logDebug("One of the root children was not a parameter node. Aborting");
+                return;
+            }
+            string itemName;
+            bool any = false, disabled = false, special = false;
+            int nrpnValue = 0;
+            while (xml.nextAttribute()) {
+                any = true;
+                switch (attributes.find(xml.name, xml.nameLen)) {
+                    case ATTR_NAME:
+                        itemName = xml.value;
+                        break;
+                    case ATTR_DISABLE:
+                        disabled = (xml.value == "true");
+                        break;
+                    case ATTR_NRPNVALUE:
+                        special = schemaInt(xml.value, nrpnValue);
+                        if (!special) {
+                            logDebug("nrpn attribute ok, but couldn't parse value");
+                        }
+                        break;
+                    default:
+                        break;
+                }
+            }
+            if (!any) {
+                logDebug("listitem element with no attributes");
+            } else {
+                ListItemParameter item(strdup(itemName.c_str()));
+                if (disabled) {
+                    item.setEnabled(false);
+                }
+                if (special) {
+                    item.setSpecialNrpnValue(nrpnValue);
+                }
+                param->appendToList(item);
+            }
+        } else {
+            xml.skipAttributes();
+        }
+        if (!xml.selfClosing) {
+            depth++;
+        }
+    }
+    if (xml.error) {
+        logDebug("Unable to parse parameters.xml");
+    }
+}
+
+// The schema through a TinyXML document, kept as the reference for initFromXml
+// (ParamSchemaTests).
+void IonSysexParams::initFromDom()
 {
     int sz;
     const char *xml = BinaryData::getNamedResource("parameters_xml", sz);
+    // read once and thrown away, everything kept from it is copied
     TiXmlDocument doc;
+    doc.UseArena(true);
     if(!doc.Parse(xml)){
         logDebug("Unable to parse parameters.xml");
         return;
@@ -978,7 +1494,7 @@ void IonSysexParams::initFromXml()
 		}else{
 			paramName = pParamAttrib->Value();
 		}
-		params.push_back(new IonSysexParam(strdup(paramName)));
+		params.push_back(new IonSysexParam(paramName));
 		param = params[params.size() - 1];
 		pParamAttrib = pParamAttrib->Next();
 		while(pParamAttrib != 0){
@@ -1115,7 +1631,7 @@ void IonSysexParams::initFromXml()
 
 					while(pListItemAttrib != NULL){
 						if(string(pListItemAttrib->Name()) == "name"){
-							listItemName = strdup(pListItemAttrib->Value());
+							listItemName = pListItemAttrib->Value();
 						}else if(string(pListItemAttrib->Name()) == "disable"){
 							if(string(pListItemAttrib->Value()) == "true")
 								disableListItem = true;
@@ -1129,7 +1645,7 @@ void IonSysexParams::initFromXml()
 						}
 						pListItemAttrib = pListItemAttrib->Next();
 					}
-					ListItemParameter listItemParam(listItemName);
+					ListItemParameter listItemParam(strdup(listItemName));
 					if(disableListItem)
 						listItemParam.setEnabled(false);
 					if(hasSpecialNrpn)
@@ -1145,6 +1661,11 @@ void IonSysexParams::initFromXml()
 
 bool IonSysexParams::parseParamsFromContent(unsigned char *ptr, int contentSize)
 {
+   // header, opcode, program header and the encoded content
+   if (contentSize < 8 + (int) sizeof(ProgramHeader) + 360) {
+      logDebug("Sysex too short");
+      return false;
+   }
    char buf[4];
    // header
    memcpy(buf, ptr, sizeof(buf));
@@ -1178,15 +1699,11 @@ bool IonSysexParams::parseParamsFromContent(unsigned char *ptr, int contentSize)
 	 decodedContent[i] = decoded[i];
    }
 
-    for(unsigned int i = 0; i < params.size(); i++){
-      params[i]->setValueFromContent(decodedContent);
-	  if (params[i]->getNrpn() == FX1_SELECTOR) {
-		 fx1Param = params[i];
-	   }
-	  if (params[i]->getNrpn() == FX2_SELECTOR) {
-		 fx2Param = params[i];
-	   }
-//     params[i].printDebug();
+   // per call: programs are decoded on several threads at once
+   HeapBlock<int> unpacked(params.size(), true);
+   unpackContent(decodedContent, unpacked);
+   for (unsigned int i = 0; i < layout.size(); i++) {
+      values.set(layout[i].param, unpacked[layout[i].param]);
    }
     
    {
@@ -1197,7 +1714,7 @@ bool IonSysexParams::parseParamsFromContent(unsigned char *ptr, int contentSize)
         m_prog_name = String(name);
    }
 
-   delete decodedContent;
+   delete[] decodedContent;
    return true;
 }
 
@@ -1231,10 +1748,10 @@ SInt32 IonSysexParams::fx1fx2NrpnNum(IonSysexParam *p)
 SInt32 IonSysexParam::fxMin()
 {
 	if (m_nrpn == FX1_SELECTOR) {
-		return m_value*10+FX1_FIRST_NRPN;
+		return getValue()*10+FX1_FIRST_NRPN;
 	}
 	if (m_nrpn == FX2_SELECTOR) {
-		return m_value*5+FX2_FIRST_NRPN;
+		return getValue()*5+FX2_FIRST_NRPN;
 	}
 	return -1;
 }
@@ -1279,6 +1796,280 @@ bool IonSysexParams::shouldSkipFx2(IonSysexParam *p) {
 	return false;
 }
 
+// Fields that do not follow the plain offset/min/max rules of the XML descriptions.
+// Everything offset specific lives here, so the pack/unpack loops don't test offsets.
+static const struct {
+    int offset;
+    ProgramField::Coupling coupling;
+    int flagBits[3];
+    int bias;
+    int scale;
+    int width;              // 0 keeps the width worked out from min/max
+    int readMin, readMax;   // used when they differ
+} fieldExceptions[] = {
+    {  282, ProgramField::FM_EXP,   { 295,  -1,  -1 },  0, 1, 0,    0,   0 },  // fm algorithm, lin/exp flag
+    {  278, ProgramField::SYNC,     { 278, 279, 280 },  0, 1, 0,    0,   0 },  // osc sync on/off, route, type
+    {  152, ProgramField::SWITCHED, { 135,  -1,  -1 },  0, 1, 0,    0,   0 },  // portamento
+    {  122, ProgramField::SWITCHED, { 121,  -1,  -1 },  0, 1, 0,    0,   0 },  // unison
+    { 1112, ProgramField::PLAIN,    {  -1,  -1,  -1 }, 12, 1, 8,    0,   0 },  // fx2 sync rate, byte after the sync flag
+    { 2240, ProgramField::PLAIN,    {  -1,  -1,  -1 },  0, 2, 8, -100, 100 },  // fx wet/dry
+};
+
+// list parameters whose order in the synth differs from ours, see mapping.h
+static const struct {
+    int firstOffset;
+    int count;              // consecutive byte fields
+    const int *toSynth;
+    const int *toValue;
+    int toSynthSize;        // entries in each table, values are clamped to them
+    int toValueSize;
+} fieldRemaps[] = {
+    { 1336, 12, mod_src_n_to_s, mod_src_s_to_n, numElementsInArray(mod_src_n_to_s), numElementsInArray(mod_src_s_to_n) },
+    { 1432, 12, mod_dst_n_to_s, mod_dst_s_to_n, numElementsInArray(mod_dst_n_to_s), numElementsInArray(mod_dst_s_to_n) },
+    {  608,  2, filter_n_to_s, filter_s_to_n, numElementsInArray(filter_n_to_s), numElementsInArray(filter_s_to_n) },
+    { 1168,  1, sh_n_to_s, sh_s_to_n, numElementsInArray(sh_n_to_s), numElementsInArray(sh_s_to_n) },
+    { 1912,  1, tracking_n_to_s, tracking_s_to_n, numElementsInArray(tracking_n_to_s), numElementsInArray(tracking_s_to_n) },
+};
+
+void IonSysexParams::buildLayout()
+{
+    layout.clear();
+    fx1Index = -1;
+    fx2Index = -1;
+    for (unsigned int i = 0; i < params.size(); i++) {
+        IonSysexParam *p = params[i];
+        if (p->getNrpn() == FX1_SELECTOR) {
+            fx1Index = i;
+            fx1Param = p;
+        }
+        if (p->getNrpn() == FX2_SELECTOR) {
+            fx2Index = i;
+            fx2Param = p;
+        }
+        if ((p->m_offset < 0) || (p->m_conv == IonSysexParam::NAME) || (p->m_conv == IonSysexParam::TEXT_LABEL)) {
+            continue;
+        }
+
+        ProgramField f;
+        f.param = i;
+        f.nrpn = p->getNrpn();
+        f.byteOffset = p->m_offset / 8;
+        f.shift = p->m_offset % 8;
+        f.readMin = f.writeMin = p->m_min;
+        f.readMax = f.writeMax = p->m_max;
+        f.bias = 0;
+        f.scale = 1;
+        f.cntrlOffset = p->getCntrlOffset();
+        f.coupling = ProgramField::PLAIN;
+        f.flagBits[0] = f.flagBits[1] = f.flagBits[2] = -1;
+        f.toSynth = NULL;
+        f.toValue = NULL;
+
+        int bits = p->getBitWidth();
+        for (unsigned int e = 0; e < sizeof(fieldExceptions) / sizeof(fieldExceptions[0]); e++) {
+            if (fieldExceptions[e].offset != p->m_offset) {
+                continue;
+            }
+            f.coupling = fieldExceptions[e].coupling;
+            memcpy(f.flagBits, fieldExceptions[e].flagBits, sizeof(f.flagBits));
+            f.bias = fieldExceptions[e].bias;
+            f.scale = fieldExceptions[e].scale;
+            if (fieldExceptions[e].width) {
+                bits = fieldExceptions[e].width;
+            }
+            if (fieldExceptions[e].readMin != fieldExceptions[e].readMax) {
+                f.readMin = fieldExceptions[e].readMin;
+                f.readMax = fieldExceptions[e].readMax;
+            }
+        }
+        for (unsigned int r = 0; r < sizeof(fieldRemaps) / sizeof(fieldRemaps[0]); r++) {
+            int delta = p->m_offset - fieldRemaps[r].firstOffset;
+            if ((delta >= 0) && (delta % 8 == 0) && (delta / 8 < fieldRemaps[r].count)) {
+                f.toSynth = fieldRemaps[r].toSynth;
+                f.toValue = fieldRemaps[r].toValue;
+                f.readMax = jmin(f.readMax, fieldRemaps[r].toValueSize - 1);
+                f.writeMax = jmin(f.writeMax, fieldRemaps[r].toSynthSize - 1);
+            }
+        }
+
+        // signed fields always take the whole byte
+        if (bits > 8) {
+            f.width = 16;
+        } else if ((bits < 8) && (f.readMin >= 0)) {
+            f.width = bits;
+        } else {
+            f.width = 8;
+        }
+        f.isSigned = (f.readMin < 0);
+        layout.push_back(f);
+    }
+}
+
+void IonSysexParams::unpackContent(const unsigned char *content, int *values)
+{
+    for (unsigned int i = 0; i < layout.size(); i++) {
+        const ProgramField &f = layout[i];
+        int r;
+        if (f.width == 16) {
+            r = content[f.byteOffset] + 256 * content[f.byteOffset - 1];
+        } else if (f.width == 8) {
+            r = content[f.byteOffset];
+        } else {
+            r = (content[f.byteOffset] >> f.shift) & ((1 << f.width) - 1);
+        }
+        if (f.isSigned && (r & (1 << (f.width - 1)))) {
+            r -= (1 << f.width);
+        }
+        r -= f.bias;
+        if (r < f.readMin) {
+            r = f.readMin;
+        }
+        if (r > f.readMax) {
+            r = f.readMax;
+        }
+
+        switch (f.coupling) {
+        case ProgramField::FM_EXP:
+            r = (r & 0x3) + getBit(f.flagBits[0]) * 3;
+            break;
+        case ProgramField::SYNC:
+            // 0: off, 1: hard 2->1, 2: hard 2+3->1, 3: soft 2->1, 4: soft 2+3->1
+            if (getBit(f.flagBits[0])) {
+                r = 0;
+            } else {
+                r = (getBit(f.flagBits[2]) ? 0 : 2) + getBit(f.flagBits[1]) + 1;
+            }
+            break;
+        case ProgramField::SWITCHED:
+            r = getBit(f.flagBits[0]) ? 0 : r + 1;
+            break;
+        default:
+            break;
+        }
+
+        r /= f.scale;
+        if (f.toValue) {
+            r = f.toValue[r];
+        }
+        values[f.param] = r - f.cntrlOffset;
+    }
+}
+
+void IonSysexParams::packContent(const int *values, unsigned char *content)
+{
+    // fx parameters share their bytes, only the selected effect writes them
+    SInt32 fx1First = (fx1Index >= 0) ? values[fx1Index] * 10 + FX1_FIRST_NRPN : -1;
+    SInt32 fx2First = ((fx2Index >= 0) && values[fx2Index]) ? (values[fx2Index] - 1) * 5 + FX2_FIRST_NRPN : -1;
+
+    for (unsigned int i = 0; i < layout.size(); i++) {
+        const ProgramField &f = layout[i];
+        if ((fx1First >= 0) && (f.nrpn >= FX1_FIRST_NRPN) && (f.nrpn <= FX1_LAST_NRPN) &&
+            ((f.nrpn < fx1First) || (f.nrpn >= fx1First + 10))) {
+            continue;
+        }
+        if ((fx2First >= 0) && (f.nrpn >= FX2_FIRST_NRPN) && (f.nrpn <= FX2_LAST_NRPN) &&
+            ((f.nrpn < fx2First) || (f.nrpn >= fx2First + 5))) {
+            continue;
+        }
+
+        short s = (short) values[f.param];
+        s += f.cntrlOffset;
+        if (s < f.writeMin) {
+            s = f.writeMin;
+        }
+        if (s > f.writeMax) {
+            s = f.writeMax;
+        }
+
+        switch (f.coupling) {
+        case ProgramField::FM_EXP:
+            setBit(content, f.flagBits[0], (s >= 3) ? 1 : 0);
+            if (s >= 3) {
+                s -= 3;
+            }
+            break;
+        case ProgramField::SYNC:
+            if (s > 0) {
+                s--;
+                setBit(content, f.flagBits[2], ((s >> 1) & 1) ? 0 : 1);
+                setBit(content, f.flagBits[1], s & 1);
+                s = 0;
+            } else {
+                s = 1;
+            }
+            break;
+        case ProgramField::SWITCHED:
+            if (s > 0) {
+                setBit(content, f.flagBits[0], 0);
+                s--;
+            } else {
+                setBit(content, f.flagBits[0], 1);
+            }
+            break;
+        default:
+            break;
+        }
+
+        s += f.bias;
+        s *= f.scale;
+        if (f.toSynth) {
+            s = f.toSynth[s];
+        }
+
+        if (f.width == 16) {
+            content[f.byteOffset] = (unsigned char) (s & 0xff);
+            content[f.byteOffset - 1] = (unsigned char) ((s >> 8) & 0xff);
+        } else if (f.width == 8) {
+            content[f.byteOffset] = (unsigned char) (s & 0xff);
+        } else {
+            unsigned char mask = ((1 << f.width) - 1) << f.shift;
+            content[f.byteOffset] = (content[f.byteOffset] & (~mask & 0xff)) | (s << f.shift);
+        }
+    }
+}
+
+void ParamValueStore::allocate(int n)
+{
+    // whole cache lines, starting on a line boundary
+    const int line = 64;
+    int bytes = ((n * (int) sizeof(int16) + line - 1) / line) * line;
+    block.calloc(bytes + line);
+    values = (std::atomic<int16> *) (((pointer_sized_int) block.getData() + line - 1) & ~(pointer_sized_int) (line - 1));
+    for (int i = 0; i < n; i++) {
+        new (values + i) std::atomic<int16>(0);
+    }
+    count = n;
+}
+
+void ParamValueStore::snapshot(int16 *dst) const
+{
+    // relaxed loads of adjacent int16s, the compiler turns this into a plain copy
+    for (int i = 0; i < count; i++) {
+        dst[i] = values[i].load(std::memory_order_relaxed);
+    }
+}
+
+void ParamValueStore::restore(const int16 *src)
+{
+    for (int i = 0; i < count; i++) {
+        values[i].store(src[i], std::memory_order_relaxed);
+    }
+}
+
+bool IonSysexParams::restoreValues(const int16 *src, int n)
+{
+    if (n != values.size()) {
+        return false;
+    }
+    // saved states come from the host, clamp before anyone can read them
+    HeapBlock<int16> clamped(n);
+    for (int i = 0; i < n; i++) {
+        clamped[i] = (int16) jlimit(params[i]->getMin(), params[i]->getMax(), (int) src[i]);
+    }
+    values.restore(clamped);
+    return true;
+}
+
 IonSysexParams::~IonSysexParams()
 {
         for(unsigned int i = 0; i < params.size(); i++) delete params[i];
@@ -1296,28 +2087,24 @@ bool IonSysexParams::getAsSysexMessage(unsigned char* sysexBuf)
 	UInt32 cs;
     // Buffer is 315 chars, which is encoded
     // The raw buffer is 315 + (315 / 7) bytes long
-    unsigned char *rawContent = new unsigned char[350];
-    for(int i = 0; i < 350; i++) rawContent[i] = 0;
+    unsigned char rawContent[350];
+    memset(rawContent, 0, sizeof(rawContent));
     // first write to a buffer (of 315) then expand
+    HeapBlock<int> packed(params.size());
     for(unsigned int i = 0; i < params.size(); i++){
-		if (shouldSkipFx1(params[i])) {
-			continue;
-		}
-		if (shouldSkipFx2(params[i])) {
-			continue;
-		}
-        params[i]->writeValueToBuffer(rawContent);
+        packed[i] = values.get(i);
     }
+    packContent(packed, rawContent);
 	// if not 1, then we add a new program
 	rawContent[293] = 1;
      {
         char str[16];
-        bzero(str, sizeof(str));
+        memset(str, 0, sizeof(str));
         m_prog_name.copyToUTF8(str, sizeof(str));
         //	const char *str = CFStringGetCStringPtr(m_textValue, 0);
-        bzero(&rawContent[0], 15);
+        memset(&rawContent[0], 0, 15);
         memcpy((char *) &rawContent[0], str, 14);
-        bzero(&rawContent[296], 15);
+        memset(&rawContent[296], 0, 15);
         memcpy(&rawContent[296], str, 14);
     }
 	cs = checksum(rawContent, 315);
@@ -1338,12 +2125,12 @@ bool IonSysexParams::getAsSysexMessage(unsigned char* sysexBuf)
     
     ProgramHeader programHeader;
     /* TODO: fill program header */
-	bzero(&programHeader, sizeof(programHeader));
+	memset(&programHeader, 0, sizeof(programHeader));
 	memcpy(programHeader.tag, "Q01SYNTH", 8);
-	programHeader.n_checksum = htonl(cs);
+	programHeader.n_checksum = ByteOrder::swapIfLittleEndian((uint32) cs);
 	memcpy(programHeader.version, "\x76\x31\x2e\x30\xff\xff\xff\xff", 8);
-	bzero(programHeader.date, 12);
-	bzero(programHeader.time, 12);
+	memset(programHeader.date, 0, 12);
+	memset(programHeader.time, 0, 12);
 	memcpy(&programHeader.n_length, "\x00\x00\x01\x3b", 4);
 	programHeader.matchId = 0xff;
 	programHeader.dirty = 0;
@@ -1521,7 +2308,7 @@ bool IonSysex::parse(FILE *fp)
    }
    logDebug("Sending to parse from content");
    params.parseParamsFromContent(buffer, restOfFile - 1);
-   delete buffer;
+   delete[] buffer;
    logDebug("Done Parsing");
    return true;
 }
@@ -1531,6 +2318,30 @@ bool IonSysex::HasErrors()
     return hasErrors;
 }
 
+namespace {
+
+// encodes the same program over and over, as the message, preloader and
+// host state threads do
+struct EncodeThread : public Thread
+{
+    EncodeThread(IonSysexParams &p, const unsigned char *e) : Thread("encode"), params(p), expected(e), ok(true) {}
+
+    void run()
+    {
+        unsigned char msg[SYSEX_PROGRAM_SIZE];
+        for (int i = 0; i < 2000 && ok; i++) {
+            params.getAsSysexMessage(msg);
+            ok = (memcmp(msg, expected, sizeof(msg)) == 0);
+        }
+    }
+
+    IonSysexParams &params;
+    const unsigned char *expected;
+    bool ok;
+};
+
+}
+
 bool IonSysexTests()
 {
     //IonSysex test;
@@ -1548,10 +2359,497 @@ bool IonSysexTests()
 		logDebug("Mismatching element");
         return false;
     }
-    // test headers
-    // test contents
-    // test name
-    IonSysex is("test.syx");
+
+    // the default program must survive parse -> message -> parse
+    int sz;
+    const char *x = BinaryData::getNamedResource("default_syx", sz);
+    IonSysexParams first, second;
+    unsigned char msg[SYSEX_PROGRAM_SIZE];
+    if (!first.parseParamsFromContent((unsigned char *) &x[1], sz - 2)) {
+        logDebug("default program does not parse");
+        return false;
+    }
+    first.set_prog_name("Round Trip");
+    first.getAsSysexMessage(msg);
+    if (validateProgramSysex(&msg[1], SYSEX_PROGRAM_SIZE - 2) != SYSEX_OK ||
+        !second.parseParamsFromContent(&msg[1], SYSEX_PROGRAM_SIZE - 2))
+    {
+        logDebug("generated program dump is not valid");
+        return false;
+    }
+    if (second.get_prog_name() != "Round Trip") {
+        logDebug("program name lost");
+        return false;
+    }
+    for (UInt32 i = 0; i < first.numParams(); i++) {
+        if (first.getParam(i)->getValue() != second.getParam(i)->getValue()) {
+            logDebug("parameter value lost");
+            return false;
+        }
+    }
+
+    // a genuine snapshot restores unchanged, a damaged one is clamped
+    vector<int16> snap(first.numParams());
+    first.getValueStore().snapshot(&snap[0]);
+    if (second.restoreValues(&snap[0], (int) snap.size() - 1)) {
+        logDebug("restoreValues accepted the wrong size");
+        return false;
+    }
+    second.restoreValues(&snap[0], (int) snap.size());
+    for (UInt32 i = 0; i < first.numParams(); i++) {
+        if (second.getParam(i)->getValue() != snap[i]) {
+            logDebug("restoreValues changed a value in range");
+            return false;
+        }
+        snap[i] = 32000;
+    }
+    second.restoreValues(&snap[0], (int) snap.size());
+    for (UInt32 i = 0; i < first.numParams(); i++) {
+        if (second.getParam(i)->getValue() != second.getParam(i)->getMax()) {
+            logDebug("restoreValues did not clamp");
+            return false;
+        }
+    }
+
+    // one program encoded on several threads at once
+    {
+        std::unique_ptr<EncodeThread> threads[4];
+        for (auto &t : threads) {
+            t.reset(new EncodeThread(first, msg));
+            t->startThread();
+        }
+        bool same = true;
+        for (auto &t : threads) {
+            t->waitForThreadToExit(-1);
+            same = same && t->ok;
+        }
+        if (!same) {
+            logDebug("concurrent encodes differ");
+            return false;
+        }
+    }
+
+    unsigned char nrpn[12];
+    const unsigned char expected[12] = {0xb2, 0x63, 0x04, 0xb2, 0x62, 0x40, 0xb2, 0x06, 0x01, 0xb2, 0x26, 0x05};
+    if (encodeNrpn(2, 576, 133, nrpn) != 12 || memcmp(nrpn, expected, 12) != 0) {
+        logDebug("nrpn encoding");
+        return false;
+    }
+    return true;
+}
+
+// the layout table must give exactly what the per parameter code gives
+bool ProgramLayoutTests()
+{
+    IonSysexParams ref;
+    IonSysexParams table;
+    Random rnd(315);
+    vector<int> values(ref.numParams());
+    unsigned char init[320], a[320], b[320];
+
+    for (int n = 0; n < 2000; n++) {
+        for (int i = 0; i < 315; i++) {
+            init[i] = (unsigned char) rnd.nextInt(256);
+        }
+        memset(&init[315], 0, 5);
+
+        // unpack random content
+        table.unpackContent(init, &values[0]);
+        for (UInt32 i = 0; i < ref.numParams(); i++) {
+            IonSysexParam *p = ref.getParam(i);
+            if ((p->getOffset() < 0) || (p->getConversionType() == IonSysexParam::NAME)) {
+                continue;
+            }
+            p->setValueFromContent(init);
+            if (p->getValue() != values[i]) {
+                logDebug("unpackContent differs from setValueFromContent");
+                return false;
+            }
+        }
+
+        // pack random values over random content
+        for (UInt32 i = 0; i < ref.numParams(); i++) {
+            IonSysexParam *p = ref.getParam(i);
+            values[i] = p->getMin() + rnd.nextInt(p->getMax() - p->getMin() + 1);
+            p->setValue(values[i]);
+        }
+        memcpy(a, init, sizeof(a));
+        memcpy(b, init, sizeof(b));
+        for (UInt32 i = 0; i < ref.numParams(); i++) {
+            IonSysexParam *p = ref.getParam(i);
+            if (ref.shouldSkipFx1(p) || ref.shouldSkipFx2(p)) {
+                continue;
+            }
+            p->writeValueToBuffer(a);
+        }
+        table.packContent(&values[0], b);
+        if (memcmp(a, b, 315) != 0) {
+            logDebug("packContent differs from writeValueToBuffer");
+            return false;
+        }
+
+        // reading a program and writing it back normalises it (clamping, lossy mapping
+        // tables, unselected fx fields); doing it a second time must change nothing
+        table.unpackContent(init, &values[0]);
+        memcpy(a, init, sizeof(a));
+        table.packContent(&values[0], a);
+        table.unpackContent(a, &values[0]);
+        memcpy(b, a, sizeof(b));
+        table.packContent(&values[0], b);
+        if (memcmp(a, b, 315) != 0) {
+            logDebug("unpack/pack round trip not stable");
+            return false;
+        }
+    }
+    return true;
+}
+
+// cached display strings match the formatted ones, and what a host scanning every
+// parameter text costs with and without the tables
+bool ConversionTableTests()
+{
+    IonSysexParams params;
+    int texts = 0;
+    for (UInt32 i = 0; i < params.numParams(); i++) {
+        IonSysexParam *p = params.getParam(i);
+        if ((p->getConversionType() == IonSysexParam::NAME) || (p->getConversionType() == IonSysexParam::TEXT_LABEL)) {
+            continue;
+        }
+        for (int v = p->getMin(); v <= p->getMax(); v++) {
+            if ((p->getList().size() != 0) && (v + p->getCntrlOffset() >= (int) p->getList().size())) {
+                continue;
+            }
+            p->setValue(v);
+            if (p->getConvertedValue(v) != p->formatValue(v + p->getCntrlOffset())) {
+                logDebug("cached text differs");
+                return false;
+            }
+            texts++;
+        }
+    }
+
+    // host refreshing every parameter's text, values changing in between
+    const int passes = 200;
+    Random rnd(1);
+    for (UInt32 i = 0; i < params.numParams(); i++) {
+        IonSysexParam *p = params.getParam(i);
+        p->setValue(p->getMin() + rnd.nextInt(p->getMax() - p->getMin() + 1));
+    }
+    double cached = 0, formatted = 0;
+    int len = 0;
+    for (int pass = 0; pass < passes; pass++) {
+        double t = Time::getMillisecondCounterHiRes();
+        for (UInt32 i = 0; i < params.numParams(); i++) {
+            IonSysexParam *p = params.getParam(i);
+            if (p->getConversionType() == IonSysexParam::NAME) {
+                continue;
+            }
+            len += p->getConvertedValue(p->getValue()).length();
+        }
+        cached += Time::getMillisecondCounterHiRes() - t;
+
+        t = Time::getMillisecondCounterHiRes();
+        for (UInt32 i = 0; i < params.numParams(); i++) {
+            IonSysexParam *p = params.getParam(i);
+            if ((p->getConversionType() == IonSysexParam::NAME) ||
+                ((p->getList().size() != 0) && (p->getValue() + p->getCntrlOffset() >= (int) p->getList().size()))) {
+                continue;
+            }
+            len -= p->formatValue(p->getValue() + p->getCntrlOffset()).length();
+        }
+        formatted += Time::getMillisecondCounterHiRes() - t;
+    }
+    Logger::writeToLog("ConversionTable: " + String(texts) + " texts checked, full parameter scan " +
+                       String(cached * 1000 / passes, 1) + "us cached, " +
+                       String(formatted * 1000 / passes, 1) + "us formatted");
+    return true;
+}
+
+// values written from several threads at once stay whole and land where they were written
+bool ParamValueStoreTests()
+{
+    IonSysexParams params;
+    ParamValueStore &store = params.getValueStore();
+    if (store.size() != (int) params.numParams()) {
+        return false;
+    }
+    for (UInt32 i = 0; i < params.numParams(); i++) {
+        IonSysexParam *p = params.getParam(i);
+        if (p->getValue() != p->getMin() + p->getCntrlOffset()) {
+            logDebug("store not initialised to min");
+            return false;
+        }
+    }
+
+    // each thread owns every 4th parameter and writes values only it uses
+    class Writer : public Thread {
+    public:
+        Writer(IonSysexParams &p, int t) : Thread("store writer"), params(p), id(t) {}
+        void run() {
+            for (int n = 0; n < 20000; n++) {
+                for (UInt32 i = id; i < params.numParams(); i += 4) {
+                    params.getParam(i)->setValue(id * 1000 + (n & 0xff));
+                }
+            }
+        }
+        IonSysexParams &params;
+        int id;
+    };
+    OwnedArray<Writer> writers;
+    for (int t = 0; t < 4; t++) {
+        writers.add(new Writer(params, t));
+        writers.getLast()->startThread();
+    }
+    HeapBlock<int16> snap(store.size());
+    bool ok = true;
+    bool running = true;
+    while (ok && running) {
+        running = false;
+        for (int t = 0; t < 4; t++) {
+            running = running || writers[t]->isThreadRunning();
+        }
+        store.snapshot(snap);
+        for (int i = 0; i < store.size(); i++) {
+            IonSysexParam *p = params.getParam(i);
+            int v = snap[i];
+            if ((v != p->getMin() + p->getCntrlOffset()) && ((v / 1000 != i % 4) || (v % 1000 > 0xff))) {
+                ok = false;
+            }
+        }
+    }
+    for (int t = 0; t < 4; t++) {
+        writers[t]->stopThread(5000);
+    }
+    if (!ok) {
+        logDebug("torn or misplaced value");
+        return false;
+    }
+
+    store.snapshot(snap);
+    for (int i = 0; i < store.size(); i++) {
+        if (snap[i] != (i % 4) * 1000 + (19999 & 0xff)) {
+            logDebug("last write lost");
+            return false;
+        }
+        snap[i] = -i;
+    }
+    store.restore(snap);
+    for (UInt32 i = 0; i < params.numParams(); i++) {
+        if (params.getParam(i)->getValue() != -(int) i) {
+            logDebug("restore failed");
+            return false;
+        }
+    }
+    return true;
+}
+
+// Every value of every parameter, one at a time on top of the default program, through
+// each way a value leaves and comes back:
+//   - per parameter: writeValueToBuffer, 7/8 bit encode and decode, setValueFromContent
+//   - whole program: getAsSysexMessage, validate, parseParamsFromContent
+//   - nrpn: the value the synth is sent (list items may have their own), back to the item
+// Parameters are shared out over one thread per cpu, each with its own IonSysexParams.
+// asymmetries that are how the program format works, not bugs
+static const struct {
+    int offset;
+    const char *path;
+    const char *why;
+} sweepExceptions[] = {
+    { 121, "program", "unison on/off is the flag Unison voices sets whenever a program is packed" },
+};
+
+static int sweepExpected(IonSysexParam *p, int v)
+{
+    int off = p->getCntrlOffset();
+    return jlimit(p->getMin(), p->getMax(), v + off) - off;
+}
+
+static int nrpnToValue(IonSysexParam *p, const unsigned char *msg)
+{
+    // 14 bits, two's complement for signed parameters and negative list values
+    int value = (msg[8] << 7) | msg[11];
+    int signedValue = (value & 0x2000) ? value - 0x4000 : value;
+    vector<ListItemParameter> &list = p->getList();
+    for (unsigned int i = 0; i < list.size(); i++) {
+        if (list[i].hasSpecialNrpnValue() && (list[i].getNrpnValue() == signedValue)) {
+            return i;
+        }
+    }
+    return (p->getMin() < 0) ? signedValue : value;
+}
+
+class ParamSweeper : public Thread
+{
+public:
+    ParamSweeper(const unsigned char *program, int programSize, int first, int step) :
+        Thread("param sweep"), content(program), contentSize(programSize), start(first), stride(step), values(0) {}
+
+    void run()
+    {
+        IonSysexParams params, reread;
+        params.parseParamsFromContent((unsigned char *) content, contentSize);
+        vector<unsigned char> raw(&content[8], &content[contentSize]), plain, encoded, decoded;
+        decodeFromMidi(raw, plain);
+        unsigned char msg[SYSEX_PROGRAM_SIZE];
+        unsigned char nrpn[12];
+
+        for (UInt32 i = start; i < params.numParams(); i += stride) {
+            IonSysexParam *p = params.getParam(i);
+            if ((p->getOffset() < 0) || (p->getConversionType() == IonSysexParam::NAME) ||
+                (p->getConversionType() == IonSysexParam::TEXT_LABEL)) {
+                continue;
+            }
+            selectFx(params, p);
+            int initial = p->getValue();
+            for (int v = p->getMin(); v <= p->getMax(); v++) {
+                if ((p->getList().size() != 0) && (v + p->getCntrlOffset() >= (int) p->getList().size())) {
+                    continue;
+                }
+                values++;
+                int expected = sweepExpected(p, v);
+
+                p->setValue(v);
+                encoded.clear();
+                decoded.clear();
+                vector<unsigned char> buffer(plain);
+                p->writeValueToBuffer(&buffer[0]);
+                encodeToMidi(buffer, encoded);
+                decodeFromMidi(encoded, decoded);
+                p->setValueFromContent(&decoded[0]);
+                check(p, "per parameter", v, expected, p->getValue());
+
+                p->setValue(v);
+                params.getAsSysexMessage(msg);
+                if ((validateProgramSysex(&msg[1], SYSEX_PROGRAM_SIZE - 2) != SYSEX_OK) ||
+                    !reread.parseParamsFromContent(&msg[1], SYSEX_PROGRAM_SIZE - 2)) {
+                    check(p, "program dump invalid", v, 0, 1);
+                } else {
+                    check(p, "program", v, expected, reread.getParam(i)->getValue());
+                }
+
+                if (p->hasNrpn() && !p->isFxSelector()) {
+                    encodeNrpn(0, params.fx1fx2NrpnNum(p) & 0x3fff, p->getNrpnValue(), nrpn);
+                    check(p, "nrpn", v, v, nrpnToValue(p, nrpn));
+                }
+            }
+            p->setValue(initial);
+        }
+    }
+
+    const unsigned char *content;
+    int contentSize;
+    UInt32 start, stride;
+    int values;
+    StringArray mismatches;
+
+private:
+    // fx parameters are only written while their effect is the selected one
+    static void selectFx(IonSysexParams &params, IonSysexParam *p)
+    {
+        int n = p->getNrpn();
+        for (UInt32 i = 0; i < params.numParams(); i++) {
+            IonSysexParam *s = params.getParam(i);
+            if ((s->getNrpn() == FX1_SELECTOR) && (n >= FX1_FIRST_NRPN) && (n < FX1_LAST_NRPN)) {
+                s->setValue((n - FX1_FIRST_NRPN) / 10);
+            }
+            if ((s->getNrpn() == FX2_SELECTOR) && (n >= FX2_FIRST_NRPN) && (n < FX2_LAST_NRPN)) {
+                s->setValue((n - FX2_FIRST_NRPN) / 5 + 1);
+            }
+        }
+    }
+
+    void check(IonSysexParam *p, const char *path, int v, int expected, int got)
+    {
+        for (unsigned int e = 0; e < sizeof(sweepExceptions) / sizeof(sweepExceptions[0]); e++) {
+            if ((sweepExceptions[e].offset == p->getOffset()) && (strcmp(sweepExceptions[e].path, path) == 0)) {
+                return;
+            }
+        }
+        if (expected != got) {
+            mismatches.add(String(path) + ": " + p->getName() + " (offset " + String(p->getOffset()) +
+                           ") " + String(v) + " came back as " + String(got) + ", expected " + String(expected));
+        }
+    }
+};
+
+bool ParamSweepTests()
+{
+    int sz;
+    const char *x = BinaryData::getNamedResource("default_syx", sz);
+    double t = Time::getMillisecondCounterHiRes();
+
+    int threads = jmax(1, SystemStats::getNumCpus());
+    OwnedArray<ParamSweeper> sweepers;
+    for (int n = 0; n < threads; n++) {
+        sweepers.add(new ParamSweeper((const unsigned char *) &x[1], sz - 2, n, threads));
+        sweepers.getLast()->startThread();
+    }
+    int values = 0;
+    StringArray mismatches;
+    for (ParamSweeper *s : sweepers) {
+        s->waitForThreadToExit(-1);
+        values += s->values;
+        mismatches.addArray(s->mismatches);
+    }
+    for (int i = 0; i < mismatches.size(); i++) {
+        Logger::writeToLog("ParamSweep: " + mismatches[i]);
+    }
+    Logger::writeToLog("ParamSweep: " + String(values) + " values on " + String(threads) + " threads in " +
+                       String(Time::getMillisecondCounterHiRes() - t, 0) + "ms, " +
+                       String(mismatches.size()) + " mismatches");
+    return mismatches.isEmpty();
+}
+
+// the streamed schema is the one TinyXML gives, and what it costs each way
+bool ParamSchemaTests()
+{
+    IonSysexParams stream;
+    IonSysexParams dom(IonSysexParams::DOM_SCHEMA);
+    if ((stream.numParams() != dom.numParams()) || (stream.numParams() < 300)) {
+        logDebug("schema: parameter count differs");
+        return false;
+    }
+    for (UInt32 i = 0; i < stream.numParams(); i++) {
+        IonSysexParam *a = stream.getParam(i);
+        IonSysexParam *b = dom.getParam(i);
+        if ((strcmp(a->getName(), b->getName()) != 0) || (a->getConversionType() != b->getConversionType()) ||
+            (a->getMin() != b->getMin()) || (a->getMax() != b->getMax()) || (a->getOffset() != b->getOffset()) ||
+            (a->getNrpn() != b->getNrpn()) || (a->getCntrlOffset() != b->getCntrlOffset()) ||
+            (a->getDefaultValue() != b->getDefaultValue()) || (a->getParamName() != b->getParamName()) ||
+            (a->getList().size() != b->getList().size())) {
+            Logger::writeToLog(String("schema: ") + a->getName() + " differs");
+            return false;
+        }
+        for (unsigned int n = 0; n < a->getList().size(); n++) {
+            ListItemParameter &x = a->getList()[n];
+            ListItemParameter &y = b->getList()[n];
+            if ((strcmp(x.getName(), y.getName()) != 0) || (x.isDisabled() != y.isDisabled()) ||
+                (x.hasSpecialNrpnValue() != y.hasSpecialNrpnValue()) || (x.getNrpnValue() != y.getNrpnValue())) {
+                Logger::writeToLog(String("schema: list item ") + String(n) + " of " + a->getName() + " differs");
+                return false;
+            }
+        }
+    }
+    if ((stream.fx1fx2NrpnNum(stream.getParam(0)) != dom.fx1fx2NrpnNum(dom.getParam(0)))) {
+        return false;
+    }
+
+    const int loads = 20;
+    double streamed = 0, parsed = 0;
+    for (int n = 0; n < loads; n++) {
+        double t = Time::getMillisecondCounterHiRes();
+        {
+            IonSysexParams p;
+        }
+        streamed += Time::getMillisecondCounterHiRes() - t;
+        t = Time::getMillisecondCounterHiRes();
+        {
+            IonSysexParams p(IonSysexParams::DOM_SCHEMA);
+        }
+        parsed += Time::getMillisecondCounterHiRes() - t;
+    }
+    Logger::writeToLog("ParamSchema: " + String(stream.numParams()) + " parameters, load " +
+                       String(streamed / loads, 2) + "ms streamed, " + String(parsed / loads, 2) + "ms through TinyXML");
     return true;
 }
 
@@ -1687,3 +2985,81 @@ static UInt32 checksum(unsigned char *buff, UInt32 len)
 	}
 	return cs * -1;
 }
+
+// decode 8 -> 7 in place of decodeFromMidi, for callers that must not allocate
+static void decodeBlock(const unsigned char *encoded, int encodedSize, unsigned char *raw)
+{
+    for (int i = 0; i * 8 < encodedSize; i++) {
+        unsigned char highbits = encoded[i * 8];
+        for (int j = 0; j < 7; j++) {
+            raw[i * 7 + j] = encoded[i * 8 + j + 1] | ((highbits << (j + 1)) & 0x80);
+        }
+    }
+}
+
+int encodeNrpn(int channel, int nrpn, int value, unsigned char *out)
+{
+    unsigned char status = 0xb0 | (channel & 0x0f);
+    unsigned char data[4] = {
+        (unsigned char) ((nrpn >> 7) & 0x7f),
+        (unsigned char) (nrpn & 0x7f),
+        (unsigned char) ((value >> 7) & 0x7f),
+        (unsigned char) (value & 0x7f)
+    };
+    const unsigned char cc[4] = {0x63, 0x62, 0x06, 0x26};
+    for (int i = 0; i < 4; i++) {
+        out[i * 3] = status;
+        out[i * 3 + 1] = cc[i];
+        out[i * 3 + 2] = data[i];
+    }
+    return 12;
+}
+
+String programNameFromSysex(const unsigned char *content, int contentSize)
+{
+    if (contentSize < 8 + 64 + 16) {
+        return String();
+    }
+    // the name is the first 14 bytes of the content, i.e. the first two 8 byte groups
+    unsigned char raw[14];
+    decodeBlock(&content[8 + 64], 16, raw);
+    char name[15];
+    memcpy(name, raw, 14);
+    name[14] = 0;
+    return String(name);
+}
+
+int validateProgramSysex(const unsigned char *content, int contentSize)
+{
+    // header + opcode + encoded program header + encoded content
+    if (contentSize != SYSEX_PROGRAM_SIZE - 2) {
+        return SYSEX_BAD_LENGTH;
+    }
+    if (content[0] != 0x00 ||
+        content[1] != 0x00 ||
+        content[2] != 0x0e ||
+        content[3] != 0x22)
+    {
+        return SYSEX_BAD_HEADER;
+    }
+    for (int i = 4; i < contentSize; i++) {
+        if (content[i] & 0x80) {
+            return SYSEX_BAD_HEADER;
+        }
+    }
+
+    unsigned char header[56];
+    decodeBlock(&content[8], 64, header);
+    if (memcmp(header, "Q01SYNTH", 8) != 0) {
+        return SYSEX_BAD_HEADER;
+    }
+
+    // checksum() reads whole words, so leave a zeroed tail after the 315 bytes
+    unsigned char raw[316];
+    raw[315] = 0;
+    decodeBlock(&content[8 + 64], 360, raw);
+    if (checksum(raw, 315) != toBigEndian(&header[8])) {
+        return SYSEX_BAD_CHECKSUM;
+    }
+    return SYSEX_OK;
+}
@@ -27,8 +27,8 @@
 #include <vector>
 #include <map>
 #include <iostream>
-#include <MacTypes.h>
-#include "../JuceLibraryCode/JuceHeader.h"
+#include <atomic>
+#include "MicronauCore.h"
 
 #define FX1_SELECTOR 800
 #define FX2_SELECTOR 801
@@ -37,8 +37,15 @@
 #define FX2_FIRST_NRPN 920
 #define FX2_LAST_NRPN FX2_FIRST_NRPN+5*6
 #define NO_NRPN 4096
-//typedef unsigned int UInt32;
-//typedef int SInt32;
+#define SYSEX_PROGRAM_SIZE 434
+
+// result of checking a program dump before it is parsed
+#define SYSEX_OK 0
+#define SYSEX_BAD_LENGTH 1
+#define SYSEX_BAD_HEADER 2
+#define SYSEX_BAD_CHECKSUM 3
+typedef unsigned int UInt32;
+typedef int SInt32;
 
 // TODO: remove this "using namespace" from here
 using namespace std;
@@ -68,6 +75,26 @@ typedef struct _ProgramHeader ProgramHeader;
 
 class IonSysex;
 class IonSysexParams;
+struct ConversionTable;
+
+// Current values of all parameters of one IonSysexParams, kept apart from the
+// descriptions: one atomic int16 per parameter index in a single cache line
+// aligned block. Any thread may read or write without locking.
+class ParamValueStore {
+   public:
+      ParamValueStore() : values(NULL), count(0) {}
+      void allocate(int n);
+      int size() const { return count; }
+      int get(int idx) const { return values[idx].load(std::memory_order_relaxed); }
+      void set(int idx, int v) { values[idx].store((int16) v, std::memory_order_relaxed); }
+      // copy of every value at once, dst/src hold size() values
+      void snapshot(int16 *dst) const;
+      void restore(const int16 *src);
+   private:
+      HeapBlock<char> block;
+      std::atomic<int16> *values;
+      int count;
+};
 
 class ListItemParameter{
     public:
@@ -88,6 +115,7 @@ class ListItemParameter{
 class IonSysexParam {
    public:
       IonSysexParam(const char *name);
+      ~IonSysexParam();
 
       enum Conversion{
          NONE = 0,
@@ -130,7 +158,12 @@ class IonSysexParam {
       int getNrpnValue();
 	  int getDefaultValue() { return m_defaultValue;}
  	  void setDefaultValue(int v) { m_defaultValue = v;}
+      // display text of the current value, from a shared table (val is not used)
       String getConvertedValue(SInt32 val);
+      // display text of any value in getMin()..getMax(), from the shared table
+      String getTextForValue(SInt32 val);
+      // display text of a raw value, formatted every time
+      String formatValue(SInt32 val);
       String getTextValue();
 	  bool setTextValue(const char *);
       void setParamName(const char *);
@@ -143,6 +176,7 @@ class IonSysexParam {
       int getMin() { return m_min - m_cntrlOffset; };
       int getMax() { return m_max - m_cntrlOffset; };
       int getNrpn() const;
+      int getOffset() const { return m_offset; }
 	  int getCntrlOffset();
 	  bool hasNrpn();
       bool isFxSelector() const;
@@ -161,10 +195,13 @@ class IonSysexParam {
 
    private:
       bool setNameFromContent(unsigned char *content);
+      const ConversionTable *getConversionTable();
+      Atomic<ConversionTable*> m_conversionTable;
 	  unsigned char progName[16];
      // bool setList(string list);
       void appendToList(ListItemParameter value);
       void setNrpn(int nrpn);
+      void setStore(ParamValueStore *store, int idx) { m_store = store; m_storeIdx = idx; }
       bool setConversion(Conversion conv);
       bool setMin(int min);
       bool setMax(int max);
@@ -174,8 +211,8 @@ class IonSysexParam {
       vector<ListItemParameter> m_list;
       bool m_hasMin;
       bool m_hasMax;
-      bool m_valueSet;
-      int m_value;
+      ParamValueStore *m_store;
+      int m_storeIdx;
       const char *m_name;
       String m_textValue;
 	  const char *m_paramName;
@@ -193,16 +230,54 @@ class IonSysexParam {
        0x1b1  (434)      -> F7 (sysex footer)
        */
 
+// how one parameter sits in the 315 byte program content.
+// Built once from the XML descriptions plus the exceptions table in IonSysex.cpp.
+struct ProgramField {
+   enum Coupling {
+      PLAIN = 0,
+      FM_EXP,     // values 3..5 set flag 0 and store value - 3
+      SYNC,       // 0 sets flag 0 (own bit), else type/route in flags 2/1
+      SWITCHED    // 0 sets flag 0, otherwise value - 1 is stored
+   };
+   SInt32 param;           // index into IonSysexParams::params
+   SInt32 nrpn;
+   SInt32 byteOffset;      // byte holding the value, or its low byte
+   SInt32 shift;           // bit position of fields narrower than a byte
+   SInt32 width;           // 16, 8 or the width of a packed field
+   bool isSigned;
+   SInt32 readMin, readMax;
+   SInt32 writeMin, writeMax;
+   SInt32 bias;            // stored = value + bias
+   SInt32 scale;           // stored = value * scale
+   SInt32 cntrlOffset;
+   Coupling coupling;
+   SInt32 flagBits[3];
+   const int *toSynth;     // remap tables, NULL if none
+   const int *toValue;
+};
+
 // parameter descriptions loaded from XML
 class IonSysexParams{
    public:
-      IonSysexParams();
+      // how parameters.xml is read: streamed straight into the parameters, or
+      // through a TinyXML document (the reference the stream is tested against)
+      enum SchemaLoader { STREAM_SCHEMA, DOM_SCHEMA };
+      explicit IonSysexParams(SchemaLoader loader = STREAM_SCHEMA);
       bool parseParamsFromContent(unsigned char *content, int contentSize);
       void fillBuffer(unsigned char *buffer);
 	  IonSysexParam *getParam(UInt32 idx);
+      ParamValueStore &getValueStore() { return values; }
+      // restore a snapshot of the value store, clamping each value to its
+      // parameter's range; false if n is not the number of values
+      bool restoreValues(const int16 *src, int n);
 	  UInt32 numParams() {return params.size();}
       ~IonSysexParams();
       bool getAsSysexMessage(unsigned char *sysBuf);
+
+      // whole-program conversion through the layout table, values are indexed like params.
+      // Parameters without a field (name, labels, no offset) are left alone.
+      void unpackContent(const unsigned char *content, int *values);
+      void packContent(const int *values, unsigned char *content);
     
       String get_prog_name() {return m_prog_name;}
       void set_prog_name(String s) {m_prog_name = s;}
@@ -216,7 +291,13 @@ class IonSysexParams{
       SysexHeader sysexHeader;
       ProgramHeader programHeader;
       void initFromXml();
+      void initFromDom();
+      void buildLayout();
       vector<IonSysexParam*> params;
+      ParamValueStore values;
+      vector<ProgramField> layout;
+      SInt32 fx1Index;
+      SInt32 fx2Index;
 	  IonSysexParam *fx1Param;
 	  IonSysexParam *fx2Param;
       String m_prog_name;
@@ -249,6 +330,26 @@ class IonSysex{
       int fileSize;
 };
 
+// 7 <-> 8 bit packing of sysex data: each group of 7 bytes is sent as a byte
+// holding their high bits followed by the 7 low parts
+bool encodeToMidi(vector<unsigned char> &raw, vector<unsigned char> &encoded);
+bool decodeFromMidi(vector<unsigned char> &encoded, vector<unsigned char> &raw);
+
+// the 4 controller messages (cc 99, 98, 6, 38; 12 bytes) that set an nrpn on
+// a channel (0-15), returns the number of bytes written to out
+int encodeNrpn(int channel, int nrpn, int value, unsigned char *out);
+
+// checks length, header and checksum of a program dump, content is the
+// message without f0/f7. Does not allocate, so it is safe on the midi thread.
+int validateProgramSysex(const unsigned char *content, int contentSize);
+// program name from a program dump (data without f0/f7), without decoding the rest
+String programNameFromSysex(const unsigned char *content, int contentSize);
+
 bool IonSysexTests();
+bool ProgramLayoutTests();
+bool ConversionTableTests();
+bool ParamValueStoreTests();
+bool ParamSweepTests();
+bool ParamSchemaTests();
 
 #endif
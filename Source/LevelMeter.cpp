@@ -0,0 +1,263 @@
+/*
+ This file is part of micronau.
+ Copyright (c) 2013 - David Smitley
+
+ Permission is granted to use this software under the terms of the GPL v2 (or any later version)
+
+ Details can be found at: www.gnu.org/licenses
+*/
+
+#include "LevelMeter.h"
+
+static const double LOWEST_HZ = 60.0;
+static const double HIGHEST_HZ = 16000.0;
+static const float FLOOR_DB = -100.0f;
+
+// four running sums so the adds do not wait on each other
+static float sum(const float *x, int n)
+{
+    float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        s0 += x[i];
+        s1 += x[i + 1];
+        s2 += x[i + 2];
+        s3 += x[i + 3];
+    }
+    for (; i < n; i++) {
+        s0 += x[i];
+    }
+    return (s0 + s1) + (s2 + s3);
+}
+
+LevelMeter::LevelMeter() :
+    sample_rate(0),
+    filled(0),
+    peak(0),
+    sum_squares(0),
+    counted(0),
+    fifo(QUEUE_FRAMES),
+    dropped(0)
+{
+    window.calloc(SpectrumAnalyser::SIZE);
+    spectrum.calloc(SpectrumAnalyser::BINS);
+    squares.calloc(CHUNK);
+    frames.calloc(QUEUE_FRAMES);
+    zeromem(band_bin, sizeof(band_bin));
+}
+
+void LevelMeter::prepare(double sr)
+{
+    sample_rate = sr;
+    const double bin_hz = sr / SpectrumAnalyser::SIZE;
+    const double hi_hz = jmin(HIGHEST_HZ, sr * 0.45);
+    band_bin[0] = jmax(1, (int) (LOWEST_HZ / bin_hz));
+    for (int b = 1; b <= NUM_BANDS; b++) {
+        double f = LOWEST_HZ * std::pow(hi_hz / LOWEST_HZ, (double) b / NUM_BANDS);
+        band_bin[b] = jlimit(band_bin[b - 1] + 1, (int) SpectrumAnalyser::BINS, (int) (f / bin_hz));
+    }
+    FloatVectorOperations::clear(window, SpectrumAnalyser::SIZE);
+    filled = 0;
+    peak = 0;
+    sum_squares = 0;
+    counted = 0;
+}
+
+double LevelMeter::band_hz(int band) const
+{
+    return band_bin[jlimit(0, (int) NUM_BANDS, band)] * sample_rate / SpectrumAnalyser::SIZE;
+}
+
+void LevelMeter::process(const AudioSampleBuffer &buffer, int num_channels)
+{
+    const int n = buffer.getNumSamples();
+    num_channels = jmin(num_channels, buffer.getNumChannels());
+    if ((sample_rate <= 0) || (num_channels <= 0)) {
+        return;
+    }
+    const float gain = 1.0f / num_channels;
+
+    // in pieces that end where the window fills up
+    for (int pos = 0; pos < n; ) {
+        const int len = jmin(n - pos, SpectrumAnalyser::SIZE - filled, (int) CHUNK);
+        float *w = window + filled;
+        for (int c = 0; c < num_channels; c++) {
+            const float *x = buffer.getReadPointer(c, pos);
+            Range<float> r = FloatVectorOperations::findMinAndMax(x, len);
+            peak = jmax(peak, -r.getStart(), r.getEnd());
+            FloatVectorOperations::multiply(squares, x, x, len);
+            sum_squares += sum(squares, len);
+            if (c == 0) {
+                FloatVectorOperations::copyWithMultiply(w, x, gain, len);
+            } else {
+                FloatVectorOperations::addWithMultiply(w, x, gain, len);
+            }
+        }
+        counted += len * num_channels;
+        filled += len;
+        pos += len;
+        if (filled == SpectrumAnalyser::SIZE) {
+            analyse();
+        }
+    }
+}
+
+void LevelMeter::analyse()
+{
+    fft.power(window, spectrum);
+
+    Frame f;
+    f.peak = peak;
+    f.rms = (counted > 0) ? (float) std::sqrt(sum_squares / counted) : 0.0f;
+    // a full scale sine in the middle of a bin, through the Hann window
+    const float full_scale = (SpectrumAnalyser::SIZE / 4.0f) * (SpectrumAnalyser::SIZE / 4.0f);
+    for (int b = 0; b < NUM_BANDS; b++) {
+        float p = FloatVectorOperations::findMaximum(spectrum + band_bin[b], band_bin[b + 1] - band_bin[b]);
+        f.bands[b] = jmax(FLOOR_DB, 10.0f * std::log10(p / full_scale + 1.0e-12f));
+    }
+
+    int start1, size1, start2, size2;
+    fifo.prepareToWrite(1, start1, size1, start2, size2);
+    if (size1 + size2 == 0) {
+        dropped += 1;
+    } else {
+        frames[(size1 > 0) ? start1 : start2] = f;
+        fifo.finishedWrite(1);
+    }
+
+    // the second half is the first half of the next window
+    FloatVectorOperations::copy(window, window + HOP, SpectrumAnalyser::SIZE - HOP);
+    filled = SpectrumAnalyser::SIZE - HOP;
+    peak = 0;
+    sum_squares = 0;
+    counted = 0;
+}
+
+bool LevelMeter::read(Frame &frame)
+{
+    const int ready = fifo.getNumReady();
+    if (ready == 0) {
+        return false;
+    }
+    int start1, size1, start2, size2;
+    fifo.prepareToRead(ready, start1, size1, start2, size2);
+    float top = 0;
+    double power = 0;
+    for (int i = 0; i < size1 + size2; i++) {
+        const Frame &f = frames[(i < size1) ? start1 + i : start2 + i - size1];
+        top = jmax(top, f.peak);
+        power += f.rms * f.rms;
+    }
+    frame = frames[(size2 > 0) ? start2 + size2 - 1 : start1 + size1 - 1];
+    frame.peak = top;
+    frame.rms = (float) std::sqrt(power / (size1 + size2));
+    fifo.finishedRead(size1 + size2);
+    return true;
+}
+
+//==============================================================================
+namespace {
+
+void feed(LevelMeter &meter, int num_channels, int total, int block, float amplitude, double hz, double sr)
+{
+    AudioSampleBuffer buffer(num_channels, block);
+    for (int pos = 0; pos < total; pos += block) {
+        for (int i = 0; i < block; i++) {
+            float v = amplitude * (float) std::sin(2.0 * MathConstants<double>::pi * hz * (pos + i) / sr);
+            for (int c = 0; c < num_channels; c++) {
+                buffer.setSample(c, i, v);
+            }
+        }
+        meter.process(buffer, num_channels);
+    }
+}
+
+// the audio thread: blocks that get louder all the time
+struct RisingWriter : public Thread
+{
+    RisingWriter(LevelMeter &m) : Thread("audio"), meter(m) {}
+
+    void run()
+    {
+        AudioSampleBuffer buffer(1, 64);
+        for (int block = 0; block < 4000 && !threadShouldExit(); block++) {
+            buffer.clear();
+            buffer.setSample(0, 10, (block + 1) / 4000.0f);
+            meter.process(buffer, 1);
+            if ((block & 31) == 0) {
+                Thread::yield();
+            }
+        }
+    }
+
+    LevelMeter &meter;
+};
+
+}
+
+bool LevelMeterTests()
+{
+    const double sr = 44100;
+    LevelMeter meter;
+    LevelMeter::Frame f;
+
+    // a -6dB sine, in blocks that do and do not divide the window
+    const int blocks[] = {64, 37};
+    for (int block : blocks) {
+        meter.prepare(sr);
+        feed(meter, 2, 4 * SpectrumAnalyser::SIZE, block, 0.5f, 1000.0, sr);
+        if (!meter.read(f) || (std::abs(f.peak - 0.5f) > 0.01f) || (std::abs(f.rms - 0.3536f) > 0.01f)) {
+            Logger::writeToLog("LevelMeter: sine measured as peak " + String(f.peak) + " rms " + String(f.rms));
+            return false;
+        }
+        int loudest = 0;
+        for (int b = 1; b < LevelMeter::NUM_BANDS; b++) {
+            loudest = (f.bands[b] > f.bands[loudest]) ? b : loudest;
+        }
+        bool apart = true;
+        for (int b = 0; b < LevelMeter::NUM_BANDS; b++) {
+            apart = apart && ((b == loudest) || (f.bands[b] < f.bands[loudest] - 20.0f));
+        }
+        if ((meter.band_hz(loudest) > 1000.0) || (meter.band_hz(loudest + 1) <= 1000.0) ||
+            (std::abs(f.bands[loudest] + 6.0f) > 1.5f) || !apart) {
+            Logger::writeToLog("LevelMeter: sine in band " + String(loudest) + " at " + String(f.bands[loudest], 1) + "dB");
+            return false;
+        }
+        // nothing new, nothing to draw
+        if (meter.read(f)) {
+            Logger::writeToLog("LevelMeter: frame read twice");
+            return false;
+        }
+    }
+
+    // silence, with nobody reading for a while
+    meter.prepare(sr);
+    feed(meter, 1, 2 * LevelMeter::QUEUE_FRAMES * LevelMeter::HOP, 64, 0.0f, 0.0, sr);
+    if ((meter.get_dropped() == 0) || !meter.read(f) || (f.peak != 0) || (f.rms != 0) ||
+        (f.bands[0] != -100.0f) || (f.bands[LevelMeter::NUM_BANDS - 1] != -100.0f) || meter.read(f)) {
+        Logger::writeToLog("LevelMeter: silence not metered, " + String(meter.get_dropped()) + " dropped");
+        return false;
+    }
+
+    // read while it is written: frames come out whole and in order
+    meter.prepare(sr);
+    RisingWriter writer(meter);
+    writer.startThread();
+    float last = 0;
+    int reads = 0;
+    bool ok = true;
+    while (writer.isThreadRunning() || (reads == 0)) {
+        if (meter.read(f)) {
+            ok = ok && (f.peak >= last) && (f.peak <= 1.0f) && (f.rms <= f.peak);
+            last = f.peak;
+            reads++;
+        }
+        Thread::yield();
+    }
+    writer.stopThread(1000);
+    if (!ok || (reads == 0)) {
+        Logger::writeToLog("LevelMeter: frames out of order across threads");
+        return false;
+    }
+    return true;
+}
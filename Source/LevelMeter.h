@@ -0,0 +1,87 @@
+/*
+ This file is part of micronau.
+ Copyright (c) 2013 - David Smitley
+
+ Permission is granted to use this software under the terms of the GPL v2 (or any later version)
+
+ Details can be found at: www.gnu.org/licenses
+*/
+
+#ifndef __LEVELMETER_H__
+#define __LEVELMETER_H__
+
+#include "SoundMatch.h"
+
+//==============================================================================
+/*
+    LevelMeter:
+        Peak, rms and a coarse spectrum of the synth's audio return, measured on
+        the audio thread and read by the editor.
+
+        The input channels are mixed down into a window of SpectrumAnalyser::SIZE
+        samples; every HOP samples the window is analysed and a Frame with the
+        peak and rms since the last one and the level of NUM_BANDS log spaced
+        bands goes into a single reader, single writer fifo. Everything is
+        allocated by the constructor and prepare(), the audio thread never waits
+        on the reader, and a frame the reader has no room for is dropped.
+
+        The level work is FloatVectorOperations over the whole block, so the
+        cost per block is small next to one transform every HOP samples.
+*/
+class LevelMeter
+{
+public:
+    enum {
+        NUM_BANDS = 12,
+        HOP = SpectrumAnalyser::SIZE / 2,
+        QUEUE_FRAMES = 32,
+        CHUNK = 256                 // samples squared at a time for the rms
+    };
+
+    struct Frame {
+        float peak;                 // linear, over every input channel
+        float rms;                  // linear, all channels together
+        float bands[NUM_BANDS];     // dB relative to a full scale sine, -100 at most
+    };
+
+    LevelMeter();
+
+    // before the audio thread runs, like prepareToPlay
+    void prepare(double sample_rate);
+    // audio thread: the first num_channels channels of the block
+    void process(const AudioSampleBuffer &buffer, int num_channels);
+
+    // reader: true if frames came in since the last call. frame holds the
+    // newest one, with the highest peak and the mean rms of all of them
+    bool read(Frame &frame);
+    int get_dropped() const {return dropped.get();}
+
+    // lower edge of a band in Hz at the prepared sample rate
+    double band_hz(int band) const;
+
+private:
+    void analyse();
+
+    SpectrumAnalyser fft;
+    double sample_rate;
+    int band_bin[NUM_BANDS + 1];
+
+    // audio thread only
+    HeapBlock<float> window;
+    HeapBlock<float> spectrum;
+    HeapBlock<float> squares;
+    int filled;
+    float peak;
+    double sum_squares;
+    int counted;
+
+    AbstractFifo fifo;
+    HeapBlock<Frame> frames;
+    Atomic<int> dropped;
+
+    JUCE_DECLARE_NON_COPYABLE (LevelMeter)
+};
+
+bool LevelMeterTests();
+
+#endif  // __LEVELMETER_H__
@@ -0,0 +1,239 @@
+/*
+ This file is part of micronau.
+ Copyright (c) 2013 - David Smitley
+
+ Permission is granted to use this software under the terms of the GPL v2 (or any later version)
+
+ Details can be found at: www.gnu.org/licenses
+*/
+
+#include "LibraryCapture.h"
+
+LibraryCapture::LibraryCapture(HardwareReturn &h, FingerprintIndex &i, LoadFunction f, FinishedFunction fin) :
+    Thread("micronau library capture"),
+    hw(h),
+    index(i),
+    load(f),
+    finished(fin),
+    resume(false),
+    total(0),
+    settle_ms(SETTLE_MS),
+    done(0),
+    failed(0),
+    fingerprinting(0),
+    fingerprinted(-1)
+{
+}
+
+LibraryCapture::~LibraryCapture()
+{
+    stop();
+}
+
+bool LibraryCapture::start(int count, const File &d, const File &f, bool r)
+{
+    if (is_running() || (count <= 0) || !d.createDirectory()) {
+        return false;
+    }
+    total = count;
+    dir = d;
+    fingerprints = f;
+    resume = r;
+    done = 0;
+    failed = 0;
+    fingerprinting = 0;
+    fingerprinted = -1;
+    startThread();
+    return true;
+}
+
+void LibraryCapture::stop()
+{
+    signalThreadShouldExit();
+    stopThread(CAPTURE_TIMEOUT_MS);
+}
+
+String LibraryCapture::get_status() const
+{
+    if (fingerprinting.get()) {
+        return "fingerprinting " + String(total) + " captures";
+    }
+    String s = "captured " + String(get_done() - get_failed()) + "/" + String(total);
+    if (get_failed() > 0) {
+        s << ", " << get_failed() << " silent";
+    }
+    if (fingerprinted.get() >= 0) {
+        s << ", " << fingerprinted.get() << " fingerprints";
+    }
+    return s;
+}
+
+bool LibraryCapture::capture_one(int i)
+{
+    File f = FingerprintIndex::capture_file(dir, i);
+    if (resume && f.existsAsFile()) {
+        return true;
+    }
+    if (!load(i)) {
+        return false;
+    }
+    wait(settle_ms);
+    if (threadShouldExit()) {
+        return false;
+    }
+
+    // the state only counts once the audio thread has started this capture
+    int runs = hw.get_runs();
+    hw.capture();
+    uint32 start = Time::getMillisecondCounter();
+    while ((hw.get_runs() == runs) || (hw.get_state() == HardwareReturn::CAPTURING)) {
+        if (threadShouldExit() || (Time::getMillisecondCounter() - start > (uint32) CAPTURE_TIMEOUT_MS)) {
+            hw.cancel();
+            return false;
+        }
+        wait(5);
+    }
+    Array<float> samples;
+    return hw.get_capture(samples) && save_capture(f, samples.getRawDataPointer(), samples.size(), hw.get_sample_rate());
+}
+
+bool LibraryCapture::capture_all()
+{
+    for (int i = 0; i < total; i++) {
+        if (threadShouldExit()) {
+            return false;
+        }
+        if (!capture_one(i)) {
+            if (threadShouldExit()) {
+                return false;
+            }
+            failed += 1;
+        }
+        done = i + 1;
+    }
+    return true;
+}
+
+void LibraryCapture::run()
+{
+    bool complete = capture_all();
+    if (finished) {
+        finished();
+    }
+    if (!complete) {
+        return;
+    }
+
+    fingerprinting = 1;
+    int n = index.build(dir, total, SystemStats::getNumCpus());
+    index.save(fingerprints);
+    fingerprinted = n;
+    fingerprinting = 0;
+}
+
+//==============================================================================
+namespace {
+
+// the synth, its audio interface and a host calling processBlock: the loaded
+// program sets how bright the test note sounds, and it is heard latency
+// samples after the block it was sent in
+struct SynthStandIn : public Thread
+{
+    SynthStandIn(HardwareReturn &h) : Thread("audio"), hw(h), program(-1), clock(0), block_end(0), from(-1), to(-1), brightness(0) {}
+
+    bool load(int p)
+    {
+        if (p == 2) {
+            return false;   // an empty slot
+        }
+        program = p;
+        return true;
+    }
+
+    void midi(const MidiMessage &m)
+    {
+        if (m.isNoteOn()) {
+            from = block_end + 300;
+            to = -1;
+            brightness = 0.2f + 0.25f * program.get();
+        } else if (m.isNoteOff()) {
+            to = jmax(from, block_end) + 100;
+        }
+    }
+
+    void run()
+    {
+        const double sr = 44100;
+        AudioSampleBuffer buffer(2, 256);
+        hw.prepare(sr);
+        int blocks = 0;
+        while (!threadShouldExit()) {
+            block_end = clock + 256;
+            for (int i = 0; i < 256; i++) {
+                int64 t = clock + i;
+                float v = 0;
+                if ((from >= 0) && (t >= from) && ((to < 0) || (t < to))) {
+                    for (int h = 1; h <= 6; h++) {
+                        v += std::pow(brightness, (float) h - 1) * std::sin((float) (2.0 * MathConstants<double>::pi * 261.63 * h * t / sr));
+                    }
+                    v *= 0.3f;
+                }
+                buffer.setSample(0, i, v);
+                buffer.setSample(1, i, v);
+            }
+            clock = block_end;
+            hw.process(buffer);
+            // faster than real time, but leave the capture thread some room
+            if ((++blocks & 15) == 0) {
+                Thread::sleep(1);
+            }
+        }
+    }
+
+    HardwareReturn &hw;
+    Atomic<int> program;
+    int64 clock, block_end, from, to;
+    float brightness;
+};
+
+}
+
+bool LibraryCaptureTests()
+{
+    SynthStandIn *synth = nullptr;
+    HardwareReturn hw([&] (const MidiMessage &m) { synth->midi(m); });
+    SynthStandIn s(hw);
+    synth = &s;
+    FingerprintIndex index;
+    int finished = 0;
+    LibraryCapture capture(hw, index, [&] (int p) { return s.load(p); }, [&] { finished++; });
+    capture.set_settle_ms(5);
+
+    File bank = File::createTempFile(".syx");
+    File dir = FingerprintIndex::captures_dir(bank);
+    File fp = FingerprintIndex::fingerprints_file(bank);
+    s.startThread();
+
+    bool ok = capture.start(4, dir, fp);
+    for (int n = 0; ok && capture.is_running() && n < 20000; n++) {
+        Thread::sleep(1);
+    }
+    FingerprintIndex loaded;
+    SoundFingerprint target;
+    Array<FingerprintIndex::Match> m;
+    ok = ok && !capture.is_running() && (finished == 1) && (capture.get_done() == 4) && (capture.get_failed() == 1) &&
+         FingerprintIndex::capture_file(dir, 3).existsAsFile() && !FingerprintIndex::capture_file(dir, 2).existsAsFile() &&
+         loaded.load(fp) && (loaded.num_fingerprints() == 3) && index.get(1, target);
+    if (ok) {
+        m = loaded.match(target, 3);
+    }
+    s.stopThread(1000);
+    dir.deleteRecursively();
+    fp.deleteFile();
+    bank.deleteFile();
+    if (!ok || (m.size() != 3) || (m[0].index != 1) || (m[0].distance != 0)) {
+        Logger::writeToLog("LibraryCapture: library not captured, " + capture.get_status());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,92 @@
+/*
+ This file is part of micronau.
+ Copyright (c) 2013 - David Smitley
+
+ Permission is granted to use this software under the terms of the GPL v2 (or any later version)
+
+ Details can be found at: www.gnu.org/licenses
+*/
+
+#ifndef __LIBRARYCAPTURE_H__
+#define __LIBRARYCAPTURE_H__
+
+#include "HardwareReturn.h"
+#include "SoundMatch.h"
+#include <functional>
+
+//==============================================================================
+/*
+    LibraryCapture:
+        Records how every program of a library sounds, for the sound matching.
+
+        For each program in turn the LoadFunction sends it to the synth, and
+        after SETTLE_MS the HardwareReturn captures its response to the test
+        note; the capture is saved in the captures folder. The audio thread has
+        to keep running for this (hosts call processBlock while stopped too).
+        Once every program has had its turn the captures are fingerprinted into
+        the FingerprintIndex on all cores and the index is saved, see
+        FingerprintIndex::build.
+
+        A program whose capture fails (a silent patch, say) is counted and
+        skipped. Captures already in the folder are kept, so a run that was
+        stopped can be finished with start(..., resume = true).
+
+        The synth is left holding whatever program was loaded last, so once
+        the captures are over (or stopped) the FinishedFunction is called on
+        the capture thread to put the edit buffer back.
+*/
+class LibraryCapture : private Thread
+{
+public:
+    // sends program index to the synth, false if there is no program there
+    typedef std::function<bool (int index)> LoadFunction;
+    typedef std::function<void ()> FinishedFunction;
+
+    enum {
+        SETTLE_MS = 300,
+        CAPTURE_TIMEOUT_MS = 10000
+    };
+
+    LibraryCapture(HardwareReturn &hw, FingerprintIndex &index, LoadFunction load, FinishedFunction finished = nullptr);
+    ~LibraryCapture();
+
+    // captures programs 0..count-1 into dir, then fingerprints them and saves
+    // the index to fingerprints
+    bool start(int count, const File &dir, const File &fingerprints, bool resume = false);
+    void stop();
+    bool is_running() const {return isThreadRunning();}
+
+    void set_settle_ms(int ms) {settle_ms = ms;}
+
+    // progress, safe to poll from any thread
+    int get_total() const {return total;}
+    int get_done() const {return done.get();}
+    int get_failed() const {return failed.get();}
+    String get_status() const;
+
+private:
+    void run();
+    // false if stopped
+    bool capture_all();
+    bool capture_one(int index);
+
+    HardwareReturn &hw;
+    FingerprintIndex &index;
+    LoadFunction load;
+    FinishedFunction finished;
+    File dir;
+    File fingerprints;
+    bool resume;
+    int total;
+    int settle_ms;
+    Atomic<int> done;
+    Atomic<int> failed;
+    Atomic<int> fingerprinting;
+    Atomic<int> fingerprinted;
+
+    JUCE_DECLARE_NON_COPYABLE (LibraryCapture)
+};
+
+bool LibraryCaptureTests();
+
+#endif  // __LIBRARYCAPTURE_H__
@@ -0,0 +1,26 @@
+/*
+ This file is part of micronau.
+ Copyright (c) 2013 - David Smitley
+
+ Permission is granted to use this software under the terms of the GPL v2 (or any later version)
+
+ Details can be found at: www.gnu.org/licenses
+*/
+
+#ifndef __MICRONAUCORE_H__
+#define __MICRONAUCORE_H__
+
+/*
+    What the core (sysex codec, parameter schema, tinyxml) needs from JUCE:
+    juce_core and nothing else, so that it builds on its own without the
+    audio and gui modules, see CMakeLists.txt. Plugin code includes
+    JuceHeader.h as before.
+*/
+#include "../JuceLibraryCode/AppConfig.h"
+#include <juce_core/juce_core.h>
+
+#if ! DONT_SET_USING_JUCE_NAMESPACE
+ using namespace juce;
+#endif
+
+#endif  // __MICRONAUCORE_H__
@@ -0,0 +1,138 @@
+/*
+ This file is part of micronau.
+ Copyright (c) 2013 - David Smitley
+
+ Permission is granted to use this software under the terms of the GPL v2 (or any later version)
+
+ Details can be found at: www.gnu.org/licenses
+*/
+
+#include "MicronauParameter.h"
+
+MicronauParameter::MicronauParameter(IonSysexParam *p, bool m, ApplyFunction f) :
+    param(p),
+    apply(f),
+    meta(m)
+{
+    is_text = (p->getConversionType() == IonSysexParam::NAME) || (p->getConversionType() == IonSysexParam::TEXT_LABEL);
+    min = p->getMin();
+    max = p->getMax();
+    range = (float) jmax(1, max - min);
+    inv_range = 1.0f / range;
+    num_steps = max - min + 1;
+    default_value = to_normalised(jlimit(min, max, p->getDefaultValue()));
+    name = StringPool::getGlobalPool().getPooledString(p->getName());
+}
+
+float MicronauParameter::getValue() const
+{
+    return to_normalised(param->getValue());
+}
+
+void MicronauParameter::setValue(float newValue)
+{
+    apply(to_raw(newValue));
+}
+
+String MicronauParameter::getName(int maximumStringLength) const
+{
+    // shares the pooled string unless the host wants it shorter
+    if (name.length() <= maximumStringLength) {
+        return name;
+    }
+    return name.substring(0, maximumStringLength);
+}
+
+String MicronauParameter::getText(float value, int maximumStringLength) const
+{
+    String text = is_text ? param->getTextValue() : param->getTextForValue(to_raw(value));
+    if (text.length() <= maximumStringLength) {
+        return text;
+    }
+    return text.substring(0, maximumStringLength);
+}
+
+float MicronauParameter::getValueForText(const String &text) const
+{
+    String t = text.trim();
+    // rarely called, a search through the display texts is fine
+    if (!is_text && (max - min < 4096)) {
+        for (int v = min; v <= max; v++) {
+            if (param->getTextForValue(v).trim() == t) {
+                return to_normalised(v);
+            }
+        }
+    }
+    return to_normalised(jlimit(min, max, t.getIntValue()));
+}
+
+//==============================================================================
+bool MicronauParameterTests()
+{
+    IonSysexParams params;
+    OwnedArray<MicronauParameter> host;
+    int last_applied = -1;
+    for (int i = 0; i < (int) params.numParams(); i++) {
+        IonSysexParam *p = params.getParam(i);
+        if (p->hasNrpn()) {
+            host.add(new MicronauParameter(p, false, [p, &last_applied] (int v) { p->setValue(v); last_applied = v; }));
+        }
+    }
+
+    for (int i = 0; i < host.size(); i++) {
+        MicronauParameter *mp = host[i];
+        IonSysexParam *p = mp->get_param();
+        if ((mp->get_min() != p->getMin()) || (mp->get_max() != p->getMax()) ||
+            (mp->getNumSteps() != p->getMax() - p->getMin() + 1)) {
+            Logger::writeToLog("MicronauParameter: cached range of " + String(p->getName()) + " is wrong");
+            return false;
+        }
+        if (mp->getName(100) != String(p->getName()) || (mp->getName(3) != String(p->getName()).substring(0, 3))) {
+            Logger::writeToLog("MicronauParameter: name of " + String(p->getName()) + " is wrong");
+            return false;
+        }
+        // every raw value survives normalising, and the host's value reads back
+        for (int v = mp->get_min(); v <= mp->get_max(); v++) {
+            float n = mp->to_normalised(v);
+            if ((n < 0.0f) || (n > 1.0f) || (mp->to_raw(n) != v)) {
+                Logger::writeToLog("MicronauParameter: " + String(p->getName()) + " " + String(v) + " does not round trip");
+                return false;
+            }
+        }
+        int mid = (mp->get_min() + mp->get_max()) / 2;
+        mp->setValue(mp->to_normalised(mid));
+        if ((last_applied != mid) || (p->getValue() != mid) || (mp->to_raw(mp->getValue()) != mid)) {
+            Logger::writeToLog("MicronauParameter: " + String(p->getName()) + " set to " + String(mid) + " reads " + String(p->getValue()));
+            return false;
+        }
+        // the host's text is the editor's text, and parses back
+        if ((p->getConversionType() != IonSysexParam::NAME) && (p->getConversionType() != IonSysexParam::TEXT_LABEL)) {
+            String s = mp->getText(mp->getValue(), 100);
+            if (s != p->getConvertedValue(mid)) {
+                Logger::writeToLog("MicronauParameter: text of " + String(p->getName()) + " differs from the editor's");
+                return false;
+            }
+            int parsed = mp->to_raw(mp->getValueForText(s));
+            if (p->getTextForValue(parsed) != s) {
+                Logger::writeToLog("MicronauParameter: " + String(p->getName()) + " text '" + s + "' does not parse back");
+                return false;
+            }
+        }
+    }
+
+    // what a host does when it builds its lanes: name, steps and a text per value
+    double t0 = Time::getMillisecondCounterHiRes();
+    int chars = 0;
+    for (int pass = 0; pass < 10; pass++) {
+        for (int i = 0; i < host.size(); i++) {
+            MicronauParameter *mp = host[i];
+            chars += mp->getName(32).length() + mp->getNumSteps();
+            for (int k = 0; k <= 16; k++) {
+                chars += mp->getText(k / 16.0f, 32).length();
+            }
+        }
+    }
+    double t1 = Time::getMillisecondCounterHiRes();
+    Logger::writeToLog("MicronauParameter: " + String(host.size()) + " parameters scanned 10 times in " + String(t1 - t0, 2) + "ms (" + String(chars) + ")");
+    return true;
+}
@@ -0,0 +1,80 @@
+/*
+ This file is part of micronau.
+ Copyright (c) 2013 - David Smitley
+
+ Permission is granted to use this software under the terms of the GPL v2 (or any later version)
+
+ Details can be found at: www.gnu.org/licenses
+*/
+
+#ifndef __MICRONAUPARAMETER_H__
+#define __MICRONAUPARAMETER_H__
+
+#include "MicronauCore.h"
+#include <juce_audio_processors/juce_audio_processors.h>
+#include "IonSysex.h"
+#include <functional>
+
+//==============================================================================
+/*
+    MicronauParameter:
+        What the host sees of one nrpn parameter.
+
+        Hosts get the usual 0..1 value and walk names, step counts and display
+        text in tight loops while they build automation lanes, so everything
+        that does not change is worked out once here: range and its inverse,
+        step count, normalised default and the (pooled) name. Display text
+        comes from the parameter's shared conversion table.
+
+        These are plain AudioProcessorParameters, added in nrpn order, so the
+        wrappers keep identifying them by index as they did before and saved
+        automation stays attached to the same parameters.
+
+        The value itself stays in the IonSysexParam; setting it goes through
+        the ApplyFunction, which sends the nrpn and handles the special cases.
+*/
+class MicronauParameter : public AudioProcessorParameter
+{
+public:
+    // raw value between getMin() and getMax()
+    typedef std::function<void (int value)> ApplyFunction;
+
+    MicronauParameter(IonSysexParam *p, bool meta, ApplyFunction f);
+
+    IonSysexParam *get_param() const {return param;}
+    int get_min() const {return min;}
+    int get_max() const {return max;}
+
+    float to_normalised(int value) const {return (value - min) * inv_range;}
+    int to_raw(float normalised) const {return min + roundToInt(jlimit(0.0f, 1.0f, normalised) * range);}
+
+    float getValue() const override;
+    void setValue(float newValue) override;
+    float getDefaultValue() const override {return default_value;}
+    String getName(int maximumStringLength) const override;
+    String getLabel() const override {return String();}
+    String getText(float value, int maximumStringLength) const override;
+    float getValueForText(const String &text) const override;
+    int getNumSteps() const override {return num_steps;}
+    bool isDiscrete() const override {return true;}
+    bool isMetaParameter() const override {return meta;}
+
+private:
+    IonSysexParam *param;
+    ApplyFunction apply;
+    bool meta;
+    bool is_text;           // NAME/TEXT_LABEL show the parameter's text, not a value
+    int min;
+    int max;
+    float range;
+    float inv_range;
+    int num_steps;
+    float default_value;
+    String name;
+
+    JUCE_DECLARE_NON_COPYABLE (MicronauParameter)
+};
+
+bool MicronauParameterTests();
+
+#endif  // __MICRONAUPARAMETER_H__
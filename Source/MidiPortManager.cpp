@@ -0,0 +1,551 @@
+/*
+ This file is part of micronau.
+ Copyright (c) 2013 - David Smitley
+
+ Permission is granted to use this software under the terms of the GPL v2 (or any later version)
+
+ Details can be found at: www.gnu.org/licenses
+*/
+
+#include "MidiPortManager.h"
+#include <deque>
+
+//==============================================================================
+class MidiPortManager::Port : private Thread
+{
+public:
+    Port(const String &n, MidiOutput *d, OutputFunction f, int rate) :
+        Thread("MidiPort " + n),
+        name(n),
+        device(d),
+        output(f),
+        bytes_per_sec(rate),
+        current(0),
+        wire_free(0)
+    {
+        startThread(8);
+    }
+
+    ~Port()
+    {
+        stopThread(1000);
+    }
+
+    const String &get_name() const {return name;}
+
+    void add_client(SharedMidiOut *client)
+    {
+        ScopedLock l(lock);
+        queues.add(new Queue(client));
+    }
+
+    // true if that was the last one
+    bool remove_client(SharedMidiOut *client)
+    {
+        // not while one of its frames is going out, it may still be timed
+        ScopedLock s(frame_lock);
+        ScopedLock l(lock);
+        int i = index_of(client);
+        if (i >= 0) {
+            queues.remove(i);
+            if (current > i) {
+                current--;
+            }
+            if (current >= queues.size()) {
+                current = 0;
+            }
+        }
+        return queues.isEmpty();
+    }
+
+    void push(SharedMidiOut *client, const Array<MidiMessage> &msgs)
+    {
+        double now = Time::getMillisecondCounterHiRes();
+        {
+            ScopedLock l(lock);
+            Queue *q = queues[index_of(client)];
+            for (int i = 0; i < msgs.size(); ) {
+                int n = frame_length(msgs, i);
+                Frame f;
+                f.bytes = 0;
+                f.queued_at = now;
+                for (int k = 0; k < n; k++) {
+                    f.msgs.add(msgs.getReference(i + k));
+                    f.bytes += msgs.getReference(i + k).getRawDataSize();
+                }
+                q->queued_bytes += f.bytes;
+                q->frames.push_back(f);
+                i += n;
+            }
+        }
+        notify();
+    }
+
+    // never waits for the device: the port's thread sends it before the next frame
+    void send_now(SharedMidiOut *client, const MidiMessage &m)
+    {
+        {
+            ScopedLock l(lock);
+            account(queues[index_of(client)], m.getRawDataSize());
+            thru.push_back(m);
+        }
+        notify();
+    }
+
+    void set_wire_histogram(SharedMidiOut *client, LatencyHistogram *h)
+    {
+        ScopedLock l(lock);
+        queues[index_of(client)]->wire = h;
+    }
+
+    SharedMidiOut::Stats get_stats(const SharedMidiOut *client)
+    {
+        ScopedLock l(lock);
+        Queue *q = queues[index_of(client)];
+        roll_window(q, Time::getMillisecondCounter());
+        SharedMidiOut::Stats s;
+        s.bytes_sent = q->bytes_sent;
+        s.frames_sent = q->frames_sent;
+        s.bytes_per_sec = q->last_window_bytes;
+        s.queued_bytes = q->queued_bytes;
+        return s;
+    }
+
+private:
+    struct Frame {
+        Array<MidiMessage> msgs;
+        int bytes;
+        double queued_at;
+    };
+
+    struct Queue {
+        Queue(SharedMidiOut *c) :
+            client(c), wire(nullptr), queued_bytes(0), deficit(0), topped_up(false),
+            bytes_sent(0), frames_sent(0), window_start(Time::getMillisecondCounter()),
+            window_bytes(0), last_window_bytes(0)
+        {
+        }
+        SharedMidiOut *client;
+        LatencyHistogram *wire;
+        std::deque<Frame> frames;
+        int queued_bytes;
+        int deficit;
+        bool topped_up;         // got its quantum this round
+        int64 bytes_sent;
+        int frames_sent;
+        uint32 window_start;
+        int window_bytes;
+        int last_window_bytes;
+    };
+
+    int index_of(const SharedMidiOut *client) const
+    {
+        for (int i = 0; i < queues.size(); i++) {
+            if (queues.getUnchecked(i)->client == client) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    void roll_window(Queue *q, uint32 now)
+    {
+        if (now - q->window_start >= 1000) {
+            q->last_window_bytes = (now - q->window_start < 2000) ? q->window_bytes : 0;
+            q->window_bytes = 0;
+            q->window_start = now;
+        }
+    }
+
+    // call with the lock held
+    void account(Queue *q, int bytes)
+    {
+        double now = Time::getMillisecondCounterHiRes();
+        wire_free = jmax(wire_free, now) + bytes * 1000.0 / bytes_per_sec;
+        roll_window(q, (uint32) now);
+        q->window_bytes += bytes;
+        q->bytes_sent += bytes;
+    }
+
+    bool any_queued() const
+    {
+        for (int i = 0; i < queues.size(); i++) {
+            if (!queues.getUnchecked(i)->frames.empty()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // deficit round robin, one frame per call; call with the lock held and something queued
+    Queue *next_frame(Frame &out)
+    {
+        for (;;) {
+            Queue *q = queues.getUnchecked(current);
+            if (q->frames.empty()) {
+                q->deficit = 0;
+            } else {
+                if (!q->topped_up) {
+                    q->deficit += QUANTUM;
+                    q->topped_up = true;
+                }
+                Frame &f = q->frames.front();
+                if (f.bytes <= q->deficit) {
+                    q->deficit -= f.bytes;
+                    q->queued_bytes -= f.bytes;
+                    q->frames_sent += 1;
+                    account(q, f.bytes);
+                    out.msgs.swapWith(f.msgs);
+                    out.bytes = f.bytes;
+                    out.queued_at = f.queued_at;
+                    q->frames.pop_front();
+                    return q;
+                }
+            }
+            q->topped_up = false;
+            current = (current + 1) % queues.size();
+        }
+    }
+
+    void send_thru()
+    {
+        for (;;) {
+            MidiMessage m;
+            {
+                ScopedLock l(lock);
+                if (thru.empty()) {
+                    return;
+                }
+                m = thru.front();
+                thru.pop_front();
+            }
+            output(m);
+        }
+    }
+
+    void run()
+    {
+        while (!threadShouldExit()) {
+            send_thru();
+            Frame f;
+            int wait_ms = -1;
+            {
+                // taken before the frame is picked, so its client (and the
+                // histogram the frame is timed in) stays until it has gone out
+                ScopedLock s(frame_lock);
+                LatencyHistogram *wire = nullptr;
+                {
+                    ScopedLock l(lock);
+                    if (any_queued()) {
+                        double ahead = wire_free - Time::getMillisecondCounterHiRes();
+                        if (ahead > AHEAD_MS) {
+                            wait_ms = jmax(1, (int) (ahead - AHEAD_MS));
+                        } else {
+                            wire = next_frame(f)->wire;
+                        }
+                    }
+                }
+                if (f.msgs.size() > 0) {
+                    for (int i = 0; i < f.msgs.size(); i++) {
+                        output(f.msgs.getReference(i));
+                    }
+                    if (wire != nullptr) {
+                        wire->add(Time::getMillisecondCounterHiRes() - f.queued_at);
+                    }
+                    continue;
+                }
+            }
+            wait(wait_ms);
+        }
+    }
+
+    String name;
+    std::unique_ptr<MidiOutput> device;
+    OutputFunction output;
+    int bytes_per_sec;
+
+    CriticalSection lock;       // queues, thru and accounting
+    CriticalSection frame_lock; // held by the port's thread for a whole frame
+    OwnedArray<Queue> queues;
+    std::deque<MidiMessage> thru;
+    int current;
+    double wire_free;           // when the cable will have sent everything so far
+
+    JUCE_DECLARE_NON_COPYABLE (Port)
+};
+
+//==============================================================================
+MidiPortManager::MidiPortManager()
+{
+}
+
+MidiPortManager::~MidiPortManager()
+{
+    // every SharedMidiOut should be gone by now
+    jassert(ports.isEmpty());
+}
+
+SharedMidiOut *MidiPortManager::open(const String &name)
+{
+    ScopedLock l(lock);
+    for (int i = 0; i < ports.size(); i++) {
+        if (ports[i]->get_name() == name) {
+            return new SharedMidiOut(*this, ports[i], name);
+        }
+    }
+    int idx = MidiOutput::getDevices().indexOf(name);
+    if (idx < 0) {
+        return nullptr;
+    }
+    MidiOutput *device = MidiOutput::openDevice(idx).release();
+    if (device == nullptr) {
+        return nullptr;
+    }
+    Port *p = new Port(name, device, [device] (const MidiMessage &m) { device->sendMessageNow(m); }, WIRE_BYTES_PER_SEC);
+    ports.add(p);
+    return new SharedMidiOut(*this, p, name);
+}
+
+SharedMidiOut *MidiPortManager::open(const String &name, OutputFunction output, int bytes_per_sec)
+{
+    ScopedLock l(lock);
+    for (int i = 0; i < ports.size(); i++) {
+        if (ports[i]->get_name() == name) {
+            return new SharedMidiOut(*this, ports[i], name);
+        }
+    }
+    Port *p = new Port(name, nullptr, output, bytes_per_sec);
+    ports.add(p);
+    return new SharedMidiOut(*this, p, name);
+}
+
+int MidiPortManager::get_num_ports() const
+{
+    ScopedLock l(lock);
+    return ports.size();
+}
+
+void MidiPortManager::release(SharedMidiOut *client)
+{
+    ScopedLock l(lock);
+    if (client->port->remove_client(client)) {
+        // last one out closes the device
+        ports.removeObject(client->port);
+    }
+}
+
+int MidiPortManager::frame_length(const Array<MidiMessage> &msgs, int start)
+{
+    const MidiMessage &first = msgs.getReference(start);
+    if (!first.isController()) {
+        return 1;
+    }
+    int cc = first.getControllerNumber();
+    bool nrpn = (cc == 0x63) || (cc == 0x62);
+    bool bank = (cc == 0x00) || (cc == 0x20);
+    if (!nrpn && !bank) {
+        return 1;
+    }
+
+    // nrpn number, then data entry msb/lsb; or bank msb/lsb, then the program change
+    int n = 1;
+    while (start + n < msgs.size()) {
+        const MidiMessage &m = msgs.getReference(start + n);
+        if (m.getChannel() != first.getChannel()) {
+            break;
+        }
+        if (m.isProgramChange()) {
+            n += bank ? 1 : 0;
+            break;
+        }
+        if (!m.isController()) {
+            break;
+        }
+        int c = m.getControllerNumber();
+        if (nrpn && ((c == 0x62) || (c == 0x06))) {
+            n++;
+        } else if (nrpn && (c == 0x26)) {
+            n++;
+            break;
+        } else if (bank && (c == 0x20)) {
+            n++;
+        } else {
+            break;
+        }
+    }
+    return n;
+}
+
+//==============================================================================
+SharedMidiOut::SharedMidiOut(MidiPortManager &m, MidiPortManager::Port *p, const String &name) :
+    manager(m),
+    port(p),
+    port_name(name)
+{
+    port->add_client(this);
+}
+
+SharedMidiOut::~SharedMidiOut()
+{
+    manager.release(this);
+}
+
+void SharedMidiOut::send(const MidiMessage &m)
+{
+    Array<MidiMessage> msgs;
+    msgs.add(m);
+    port->push(this, msgs);
+}
+
+void SharedMidiOut::send(const Array<MidiMessage> &msgs)
+{
+    port->push(this, msgs);
+}
+
+void SharedMidiOut::send_now(const MidiMessage &m)
+{
+    port->send_now(this, m);
+}
+
+SharedMidiOut::Stats SharedMidiOut::get_stats() const
+{
+    return port->get_stats(this);
+}
+
+void SharedMidiOut::set_wire_histogram(LatencyHistogram *h)
+{
+    port->set_wire_histogram(this, h);
+}
+
+//==============================================================================
+bool MidiPortManagerTests()
+{
+    MidiPortManager manager;
+    CriticalSection lock;
+    Array<MidiMessage> wire;
+    MidiPortManager::OutputFunction out = [&] (const MidiMessage &m) {
+        ScopedLock l(lock);
+        wire.add(m);
+    };
+
+    // two instances syncing nrpns at once, a third only playing notes through
+    std::unique_ptr<SharedMidiOut> a(manager.open("Test", out, 20000));
+    std::unique_ptr<SharedMidiOut> b(manager.open("Test", out));
+    std::unique_ptr<SharedMidiOut> c(manager.open("Test", out));
+    if ((manager.get_num_ports() != 1) || (a->get_port_name() != "Test")) {
+        Logger::writeToLog("MidiPortManager: instances do not share the port");
+        return false;
+    }
+    LatencyHistogram a_wire;
+    a->set_wire_histogram(&a_wire);
+    const int num = 200;
+    Array<MidiMessage> ma, mb;
+    for (int i = 0; i < num; i++) {
+        int v = i & 0x7f;
+        ma.add(MidiMessage::controllerEvent(1, 0x63, 1));
+        ma.add(MidiMessage::controllerEvent(1, 0x62, v));
+        ma.add(MidiMessage::controllerEvent(1, 0x06, 0));
+        ma.add(MidiMessage::controllerEvent(1, 0x26, v));
+        mb.add(MidiMessage::controllerEvent(2, 0x63, 2));
+        mb.add(MidiMessage::controllerEvent(2, 0x62, v));
+        mb.add(MidiMessage::controllerEvent(2, 0x06, 0));
+        mb.add(MidiMessage::controllerEvent(2, 0x26, v));
+    }
+    a->send(ma);
+    b->send(mb);
+    for (int i = 0; i < 20; i++) {
+        c->send_now(MidiMessage::noteOn(3, 60, (uint8) 100));
+        Thread::sleep(3);
+    }
+
+    uint32 give_up = Time::getMillisecondCounter() + 5000;
+    while ((a->get_stats().queued_bytes + b->get_stats().queued_bytes > 0) && (Time::getMillisecondCounter() < give_up)) {
+        Thread::sleep(5);
+    }
+    Thread::sleep(20);
+
+    Array<MidiMessage> got;
+    {
+        ScopedLock l(lock);
+        got = wire;
+    }
+    if (got.size() != 2 * ma.size() + 20) {
+        Logger::writeToLog("MidiPortManager: " + String(got.size()) + " messages on the wire");
+        return false;
+    }
+    // no nrpn is broken up, and while both are queued they take turns
+    int frames = 0;
+    int a_in_first_half = 0;
+    for (int i = 0; i < got.size(); i++) {
+        const MidiMessage &m = got.getReference(i);
+        if (!m.isController() || (m.getControllerNumber() != 0x63)) {
+            continue;
+        }
+        if ((i + 3 >= got.size()) || (got[i + 1].getControllerNumber() != 0x62) ||
+            (got[i + 2].getControllerNumber() != 0x06) || (got[i + 3].getControllerNumber() != 0x26) ||
+            (got[i + 3].getChannel() != m.getChannel())) {
+            Logger::writeToLog("MidiPortManager: nrpn interleaved at " + String(i));
+            return false;
+        }
+        if ((frames < num) && (m.getChannel() == 1)) {
+            a_in_first_half++;
+        }
+        frames++;
+    }
+    if (abs(a_in_first_half - num / 2) > num / 10) {
+        Logger::writeToLog("MidiPortManager: " + String(a_in_first_half) + " of the first " + String(num) + " nrpns from one instance");
+        return false;
+    }
+
+    SharedMidiOut::Stats sa = a->get_stats(), sc = c->get_stats();
+    if ((sa.bytes_sent != ma.size() * 3) || (sa.frames_sent != num) || (sc.bytes_sent != 20 * 3) || (a_wire.get_count() != num)) {
+        Logger::writeToLog("MidiPortManager: bytes sent not accounted");
+        return false;
+    }
+
+    // last one out closes the port
+    a = nullptr;
+    b = nullptr;
+    if (manager.get_num_ports() != 1) {
+        return false;
+    }
+    c = nullptr;
+    if (manager.get_num_ports() != 0) {
+        Logger::writeToLog("MidiPortManager: port left open");
+        return false;
+    }
+
+    // a device that takes its time over a dump does not hold up thru
+    {
+        WaitableEvent written;
+        std::unique_ptr<SharedMidiOut> slow(manager.open("Slow", [&] (const MidiMessage &m) {
+            if (m.isSysEx()) {
+                Thread::sleep(200);
+                written.signal();
+            }
+        }, 0x7fffffff));
+        const uint8 dump[430] = {0};
+        slow->send(MidiMessage::createSysExMessage(dump, sizeof(dump)));
+        Thread::sleep(20);
+        double t0 = Time::getMillisecondCounterHiRes();
+        slow->send_now(MidiMessage::noteOn(1, 60, (uint8) 100));
+        double waited = Time::getMillisecondCounterHiRes() - t0;
+        written.wait(2000);
+        slow = nullptr;
+        if (waited > 100) {
+            Logger::writeToLog("MidiPortManager: thru waited " + String(waited, 1) + "ms behind a dump");
+            return false;
+        }
+    }
+
+    Array<MidiMessage> bank;
+    bank.add(MidiMessage::controllerEvent(1, 0x00, 0));
+    bank.add(MidiMessage::controllerEvent(1, 0x20, 1));
+    bank.add(MidiMessage::programChange(1, 5));
+    bank.add(MidiMessage::noteOn(1, 60, (uint8) 1));
+    if ((MidiPortManager::frame_length(bank, 0) != 3) || (MidiPortManager::frame_length(bank, 3) != 1)) {
+        Logger::writeToLog("MidiPortManager: bank select not framed");
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,122 @@
+/*
+ This file is part of micronau.
+ Copyright (c) 2013 - David Smitley
+
+ Permission is granted to use this software under the terms of the GPL v2 (or any later version)
+
+ Details can be found at: www.gnu.org/licenses
+*/
+
+#ifndef __MIDIPORTMANAGER_H__
+#define __MIDIPORTMANAGER_H__
+
+#include "MicronauCore.h"
+#include <juce_audio_devices/juce_audio_devices.h>
+#include "MidiStats.h"
+#include <functional>
+
+class SharedMidiOut;
+
+//==============================================================================
+/*
+    MidiPortManager:
+        One per process (see SharedResourcePointer), shares midi output devices
+        between plugin instances.
+
+        Every instance that picks a port gets its own SharedMidiOut; the device
+        is opened by the first one and closed when the last one lets go. What
+        the instances send is queued per instance and merged on the port's
+        thread:
+          - messages that only mean something together (an nrpn's 4 controllers,
+            bank select + program change, see frame_length) are a frame and go
+            out back to back, so another instance cannot land in the middle.
+          - frames are taken from the instances' queues by deficit round robin,
+            QUANTUM bytes per instance per round, so a sysex dump or an nrpn
+            sync on one instance does not hold up the others.
+          - the port runs at most AHEAD_MS ahead of the cable's byte rate;
+            anything queued beyond that waits here, where it can still be
+            scheduled fairly, instead of in the driver.
+
+        send_now() is for thru: it skips the queues and the byte rate, and the
+        port's thread sends it before the next frame. Nothing a caller does
+        waits for the device.
+*/
+class MidiPortManager
+{
+public:
+    typedef std::function<void (const MidiMessage &)> OutputFunction;
+
+    enum {
+        WIRE_BYTES_PER_SEC = 3125,  // 31250 baud, 10 bits a byte
+        AHEAD_MS = 10,
+        QUANTUM = 64
+    };
+
+    MidiPortManager();
+    ~MidiPortManager();
+
+    // nullptr if there is no output device with that name
+    SharedMidiOut *open(const String &name);
+    // a port that is not a device; the first open of a name decides its output
+    SharedMidiOut *open(const String &name, OutputFunction output, int bytes_per_sec = WIRE_BYTES_PER_SEC);
+
+    int get_num_ports() const;
+
+    // number of messages from start on that have to go out together
+    static int frame_length(const Array<MidiMessage> &msgs, int start);
+
+private:
+    friend class SharedMidiOut;
+    class Port;
+
+    void release(SharedMidiOut *client);
+
+    CriticalSection lock;
+    OwnedArray<Port> ports;
+
+    JUCE_DECLARE_NON_COPYABLE (MidiPortManager)
+};
+
+//==============================================================================
+/*
+    SharedMidiOut:
+        An instance's handle on a shared port, from MidiPortManager::open.
+        Deleting it releases the port.
+*/
+class SharedMidiOut
+{
+public:
+    struct Stats {
+        int64 bytes_sent;
+        int frames_sent;
+        int bytes_per_sec;      // over the last full second
+        int queued_bytes;
+    };
+
+    ~SharedMidiOut();
+
+    // queued, fair shared with the other instances on the port
+    void send(const MidiMessage &m);
+    void send(const Array<MidiMessage> &msgs);
+    // right away, between two frames
+    void send_now(const MidiMessage &m);
+
+    const String &get_port_name() const {return port_name;}
+    Stats get_stats() const;
+    // time from send() until the frame is handed to the device goes here
+    void set_wire_histogram(LatencyHistogram *h);
+
+private:
+    friend class MidiPortManager;
+    SharedMidiOut(MidiPortManager &m, MidiPortManager::Port *p, const String &name);
+
+    MidiPortManager &manager;
+    MidiPortManager::Port *port;
+    String port_name;
+
+    JUCE_DECLARE_NON_COPYABLE (SharedMidiOut)
+};
+
+bool MidiPortManagerTests();
+
+#endif  // __MIDIPORTMANAGER_H__
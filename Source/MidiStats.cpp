@@ -0,0 +1,245 @@
+/*
+ This file is part of micronau.
+ Copyright (c) 2013 - David Smitley
+
+ Permission is granted to use this software under the terms of the GPL v2 (or any later version)
+
+ Details can be found at: www.gnu.org/licenses
+*/
+
+#include "MidiStats.h"
+
+static const double first_bin_ms = 0.05;
+
+LatencyHistogram::LatencyHistogram()
+{
+}
+
+double LatencyHistogram::bin_upper_ms(int bin)
+{
+    return first_bin_ms * std::pow(2.0, bin / 4.0);
+}
+
+void LatencyHistogram::add(double ms)
+{
+    int bin = 0;
+    if (ms > first_bin_ms) {
+        bin = jmin((int) NUM_BINS - 1, (int) std::ceil(4.0 * std::log2(ms / first_bin_ms)));
+    }
+    bins[bin] += 1;
+    count += 1;
+
+    int64 us = (int64) (jmax(0.0, ms) * 1000.0);
+    sum_us += us;
+    int64 m = max_us.get();
+    while ((us > m) && !max_us.compareAndSetBool(us, m)) {
+        m = max_us.get();
+    }
+}
+
+void LatencyHistogram::clear()
+{
+    for (int i = 0; i < NUM_BINS; i++) {
+        bins[i] = 0;
+    }
+    count = 0;
+    sum_us = 0;
+    max_us = 0;
+}
+
+double LatencyHistogram::get_mean_ms() const
+{
+    int n = count.get();
+    return (n > 0) ? sum_us.get() / 1000.0 / n : 0.0;
+}
+
+double LatencyHistogram::get_percentile(double pct) const
+{
+    Array<int> b = get_bins();
+    int total = 0;
+    for (int i = 0; i < NUM_BINS; i++) {
+        total += b[i];
+    }
+    if (total == 0) {
+        return 0.0;
+    }
+    int want = jmax(1, (int) std::ceil(total * pct / 100.0));
+    int seen = 0;
+    for (int i = 0; i < NUM_BINS; i++) {
+        seen += b[i];
+        if (seen >= want) {
+            return bin_upper_ms(i);
+        }
+    }
+    return bin_upper_ms(NUM_BINS - 1);
+}
+
+Array<int> LatencyHistogram::get_bins() const
+{
+    Array<int> b;
+    for (int i = 0; i < NUM_BINS; i++) {
+        b.add(bins[i].get());
+    }
+    return b;
+}
+
+//==============================================================================
+MidiStats::MidiStats() :
+    rate_time(0),
+    rate_out(0),
+    rate_in(0)
+{
+}
+
+static int64 now_us()
+{
+    // never 0, that means no request
+    return (int64) (Time::getMillisecondCounterHiRes() * 1000.0) + 1;
+}
+
+void MidiStats::request_sent()
+{
+    request_us = now_us();
+}
+
+void MidiStats::reply_received()
+{
+    int64 sent_at = request_us.exchange(0);
+    if (sent_at != 0) {
+        request_to_reply.add((now_us() - sent_at) / 1000.0);
+    }
+}
+
+void MidiStats::get_rates(double &out_per_sec, double &in_per_sec, double now)
+{
+    int64 out = bytes_out.get();
+    int64 in = bytes_in.get();
+    double secs = (now - rate_time) / 1000.0;
+    if ((rate_time == 0) || (secs <= 0)) {
+        out_per_sec = 0;
+        in_per_sec = 0;
+    } else {
+        out_per_sec = (out - rate_out) / secs;
+        in_per_sec = (in - rate_in) / secs;
+    }
+    rate_time = now;
+    rate_out = out;
+    rate_in = in;
+}
+
+void MidiStats::clear()
+{
+    enqueue_to_wire.clear();
+    request_to_reply.clear();
+    bytes_out = 0;
+    bytes_in = 0;
+    request_us = 0;
+    rate_time = 0;
+}
+
+static void add_histogram_summary(String &s, const String &name, const LatencyHistogram &h)
+{
+    s << name << " count," << h.get_count() << "\n";
+    s << name << " mean ms," << String(h.get_mean_ms(), 3) << "\n";
+    s << name << " p50 ms," << String(h.get_percentile(50), 3) << "\n";
+    s << name << " p99 ms," << String(h.get_percentile(99), 3) << "\n";
+    s << name << " max ms," << String(h.get_max_ms(), 3) << "\n";
+}
+
+String MidiStats::to_csv(const StringPairArray &extra) const
+{
+    String s;
+    s << "name,value\n";
+    s << "bytes out," << get_bytes_out() << "\n";
+    s << "bytes in," << get_bytes_in() << "\n";
+    add_histogram_summary(s, "enqueue to wire", enqueue_to_wire);
+    add_histogram_summary(s, "request to reply", request_to_reply);
+    for (int i = 0; i < extra.size(); i++) {
+        s << extra.getAllKeys()[i] << "," << extra.getAllValues()[i] << "\n";
+    }
+
+    s << "\nbin upper ms,enqueue to wire,request to reply\n";
+    Array<int> w = enqueue_to_wire.get_bins();
+    Array<int> r = request_to_reply.get_bins();
+    for (int i = 0; i < LatencyHistogram::NUM_BINS; i++) {
+        s << String(LatencyHistogram::bin_upper_ms(i), 3) << "," << w[i] << "," << r[i] << "\n";
+    }
+    return s;
+}
+
+//==============================================================================
+namespace {
+    class AddingThread : public Thread {
+    public:
+        AddingThread(LatencyHistogram &h) : Thread("add"), hist(h) {}
+        void run() {
+            for (int i = 0; i < 100000; i++) {
+                hist.add((i % 100) * 0.1);
+            }
+        }
+        LatencyHistogram &hist;
+    };
+}
+
+bool MidiStatsTests()
+{
+    LatencyHistogram h;
+    h.add(0.01);
+    h.add(1.0);
+    h.add(1.0);
+    h.add(100.0);
+    if ((h.get_count() != 4) || (h.get_max_ms() != 100.0) || (h.get_percentile(50) < 1.0) || (h.get_percentile(50) > 1.19) ||
+        (h.get_percentile(100) < 100.0) || (h.get_percentile(100) > 100.0 * 1.19) ||
+        (std::abs(h.get_mean_ms() - 102.01 / 4) > 0.001)) {
+        Logger::writeToLog("MidiStats: histogram of 4 values is wrong, p50 " + String(h.get_percentile(50)) +
+                           " p100 " + String(h.get_percentile(100)) + " mean " + String(h.get_mean_ms()));
+        return false;
+    }
+
+    // concurrent writers lose nothing
+    h.clear();
+    AddingThread a(h), b(h), c(h);
+    a.startThread();
+    b.startThread();
+    c.startThread();
+    a.waitForThreadToExit(5000);
+    b.waitForThreadToExit(5000);
+    c.waitForThreadToExit(5000);
+    Array<int> bins = h.get_bins();
+    int total = 0;
+    for (int i = 0; i < bins.size(); i++) {
+        total += bins[i];
+    }
+    if ((h.get_count() != 300000) || (total != 300000) || (std::abs(h.get_max_ms() - 9.9) > 0.001)) {
+        Logger::writeToLog("MidiStats: concurrent adds lost, " + String(total));
+        return false;
+    }
+
+    MidiStats s;
+    s.reply_received();
+    s.request_sent();
+    Thread::sleep(20);
+    s.reply_received();
+    s.reply_received();
+    if ((s.request_to_reply.get_count() != 1) || (s.request_to_reply.get_max_ms() < 19.0)) {
+        Logger::writeToLog("MidiStats: request to reply not timed");
+        return false;
+    }
+    double out_rate, in_rate;
+    s.get_rates(out_rate, in_rate, 5000);
+    s.sent(1000);
+    s.get_rates(out_rate, in_rate, 5100);
+    if ((out_rate != 10000) || (in_rate != 0)) {
+        Logger::writeToLog("MidiStats: rate " + String(out_rate));
+        return false;
+    }
+    StringPairArray extra;
+    extra.set("queued bytes", "12");
+    String csv = s.to_csv(extra);
+    if (!csv.contains("request to reply count,1\n") || !csv.contains("queued bytes,12\n") ||
+        (StringArray::fromLines(csv).size() < LatencyHistogram::NUM_BINS + 10)) {
+        Logger::writeToLog("MidiStats: csv incomplete");
+        return false;
+    }
+    return true;
+}
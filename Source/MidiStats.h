@@ -0,0 +1,103 @@
+/*
+ This file is part of micronau.
+ Copyright (c) 2013 - David Smitley
+
+ Permission is granted to use this software under the terms of the GPL v2 (or any later version)
+
+ Details can be found at: www.gnu.org/licenses
+*/
+
+#ifndef __MIDISTATS_H__
+#define __MIDISTATS_H__
+
+#include "MicronauCore.h"
+
+//==============================================================================
+/*
+    LatencyHistogram:
+        Counts of times in ms, in bins a quarter octave wide from 0.05ms up to
+        a few seconds. add() is a couple of atomic operations and can be called
+        from any thread, the audio thread included; readers see a snapshot
+        that may be a count or two behind.
+*/
+class LatencyHistogram
+{
+public:
+    enum {
+        NUM_BINS = 64
+    };
+
+    LatencyHistogram();
+
+    void add(double ms);
+    void clear();
+
+    int get_count() const {return count.get();}
+    double get_mean_ms() const;
+    double get_max_ms() const {return max_us.get() / 1000.0;}
+    // upper edge of the bin the percentile (0-100) falls into
+    double get_percentile(double pct) const;
+    Array<int> get_bins() const;
+
+    static double bin_upper_ms(int bin);
+
+private:
+    Atomic<int> bins[NUM_BINS];
+    Atomic<int> count;
+    Atomic<int64> sum_us;
+    Atomic<int64> max_us;
+
+    JUCE_DECLARE_NON_COPYABLE (LatencyHistogram)
+};
+
+//==============================================================================
+/*
+    MidiStats:
+        What the send and receive paths of an instance have been doing:
+          - enqueue to wire: how long messages sat in a shared port's queue
+          - request to reply: send_request until the program dump arrives
+          - bytes sent and received
+        Only atomics are touched on those paths; get_rates() and to_csv() are
+        for a single reader such as the editor.
+*/
+class MidiStats
+{
+public:
+    MidiStats();
+
+    LatencyHistogram enqueue_to_wire;
+    LatencyHistogram request_to_reply;
+
+    void sent(int bytes) {bytes_out += bytes;}
+    void received(int bytes) {bytes_in += bytes;}
+    void request_sent();
+    // a program dump arrived; counts only if a request was waiting for it
+    void reply_received();
+
+    int64 get_bytes_out() const {return bytes_out.get();}
+    int64 get_bytes_in() const {return bytes_in.get();}
+    // bytes per second since the previous call
+    void get_rates(double &out_per_sec, double &in_per_sec) {get_rates(out_per_sec, in_per_sec, Time::getMillisecondCounterHiRes());}
+    void get_rates(double &out_per_sec, double &in_per_sec, double now);
+
+    void clear();
+
+    // name,value lines for everything here plus extra, then one line per histogram bin
+    String to_csv(const StringPairArray &extra) const;
+
+private:
+    Atomic<int64> bytes_out;
+    Atomic<int64> bytes_in;
+    Atomic<int64> request_us;   // 0 when nothing is outstanding
+
+    // reader side
+    double rate_time;
+    int64 rate_out;
+    int64 rate_in;
+
+    JUCE_DECLARE_NON_COPYABLE (MidiStats)
+};
+
+bool MidiStatsTests();
+
+#endif  // __MIDISTATS_H__
@@ -0,0 +1,317 @@
+/*
+ This file is part of micronau.
+ Copyright (c) 2013 - David Smitley
+
+ Permission is granted to use this software under the terms of the GPL v2 (or any later version)
+
+ Details can be found at: www.gnu.org/licenses
+*/
+
+#include "MidiThruScheduler.h"
+
+MidiThruScheduler::MidiThruScheduler(OutputFunction f) :
+    Thread("micronau midi thru"),
+    output(f),
+    fifo(QUEUE_BYTES),
+    latency_ms(10.0),
+    anchored(false),
+    blocks_seen(0),
+    block_start(0),
+    expected_start(0),
+    have_next(false)
+{
+    ring.calloc(QUEUE_BYTES);
+    next_data.calloc(MAX_MESSAGE);
+    startThread(9);
+}
+
+MidiThruScheduler::~MidiThruScheduler()
+{
+    signalThreadShouldExit();
+    notify();
+    stopThread(1000);
+}
+
+void MidiThruScheduler::schedule_block(const MidiBuffer &midi, int num_samples, double sample_rate, double now)
+{
+    if (sample_rate <= 0) {
+        return;
+    }
+    double block_ms = num_samples * 1000.0 / sample_rate;
+
+    // predict where this block starts, and move that prediction towards the
+    // measured callback time by a running average. Big jumps (stalls, first
+    // block) take the measured time directly.
+    double err = now - expected_start;
+    if (!anchored || (std::abs(err) > jmax(50.0, 4 * block_ms))) {
+        block_start = now;
+        blocks_seen = 1;
+        anchored = true;
+    } else {
+        blocks_seen = jmin(blocks_seen + 1, 64);
+        block_start = expected_start + err / blocks_seen;
+    }
+    expected_start = block_start + block_ms;
+
+    MidiBuffer::Iterator i(midi);
+    const uint8 *data;
+    int size, pos;
+    while (i.getNextEvent(data, size, pos)) {
+        header h;
+        h.due = block_start + pos * 1000.0 / sample_rate + latency_ms;
+        h.size = size;
+        write(h, data);
+    }
+}
+
+void MidiThruScheduler::schedule_next(const MidiMessage &msg)
+{
+    header h;
+    h.due = (anchored ? expected_start : Time::getMillisecondCounterHiRes()) + latency_ms;
+    h.size = msg.getRawDataSize();
+    write(h, msg.getRawData());
+}
+
+void MidiThruScheduler::write(const header &h, const uint8 *data)
+{
+    int total = (int) sizeof(h) + h.size;
+    if ((h.size > MAX_MESSAGE) || (fifo.getFreeSpace() < total)) {
+        dropped += 1;
+        return;
+    }
+    int start1, size1, start2, size2;
+    fifo.prepareToWrite(total, start1, size1, start2, size2);
+    uint8 buf[sizeof(header) + MAX_MESSAGE];
+    memcpy(buf, &h, sizeof(h));
+    memcpy(buf + sizeof(h), data, h.size);
+    memcpy(ring + start1, buf, size1);
+    if (size2 > 0) {
+        memcpy(ring + start2, buf + size1, size2);
+    }
+    fifo.finishedWrite(size1 + size2);
+    notify();
+}
+
+bool MidiThruScheduler::fetch()
+{
+    if (fifo.getNumReady() < (int) sizeof(header)) {
+        return false;
+    }
+    int start1, size1, start2, size2;
+    fifo.prepareToRead(sizeof(header), start1, size1, start2, size2);
+    memcpy(&next, ring + start1, size1);
+    if (size2 > 0) {
+        memcpy((uint8 *) &next + size1, ring + start2, size2);
+    }
+    fifo.finishedRead(size1 + size2);
+
+    fifo.prepareToRead(next.size, start1, size1, start2, size2);
+    memcpy(next_data, ring + start1, size1);
+    if (size2 > 0) {
+        memcpy(next_data + size1, ring + start2, size2);
+    }
+    fifo.finishedRead(size1 + size2);
+    have_next = true;
+    return true;
+}
+
+void MidiThruScheduler::run()
+{
+    while (!threadShouldExit()) {
+        if (!have_next && !fetch()) {
+            // until write() has something
+            wait(-1);
+            continue;
+        }
+        double wait_ms = next.due - Time::getMillisecondCounterHiRes();
+        int ms = (int) (wait_ms - SPIN_USEC / 1000.0);
+        if (ms > 0) {
+            // a write meanwhile only wakes it early, the next event is still the one due first
+            wait(ms);
+            continue;
+        }
+        if (wait_ms > 0) {
+            Thread::yield();
+            continue;
+        }
+
+        if (output) {
+            output(MidiMessage(next_data, next.size, next.due / 1000.0));
+        }
+        double late = Time::getMillisecondCounterHiRes() - next.due;
+        int bin = jlimit(0, NUM_BINS - 1, (int) (late * 1000.0 / BIN_USEC));
+        histogram[bin] += 1;
+        have_next = false;
+    }
+}
+
+Array<int> MidiThruScheduler::get_histogram() const
+{
+    Array<int> h;
+    for (int i = 0; i < NUM_BINS; i++) {
+        h.add(histogram[i].get());
+    }
+    return h;
+}
+
+void MidiThruScheduler::clear_histogram()
+{
+    for (int i = 0; i < NUM_BINS; i++) {
+        histogram[i] = 0;
+    }
+}
+
+double MidiThruScheduler::get_percentile(double pct) const
+{
+    Array<int> h = get_histogram();
+    int total = 0;
+    for (int i = 0; i < h.size(); i++) {
+        total += h[i];
+    }
+    if (total == 0) {
+        return 0.0;
+    }
+    int target = jmax(1, (int) std::ceil(total * pct / 100.0));
+    int seen = 0;
+    for (int i = 0; i < h.size(); i++) {
+        seen += h[i];
+        if (seen >= target) {
+            // upper edge of the bin
+            return (i + 1) * BIN_USEC / 1000.0;
+        }
+    }
+    return NUM_BINS * BIN_USEC / 1000.0;
+}
+
+String MidiThruScheduler::get_jitter_summary() const
+{
+    Array<int> h = get_histogram();
+    int total = 0;
+    for (int i = 0; i < h.size(); i++) {
+        total += h[i];
+    }
+    return String(total) + " events, late by p50 " + String(get_percentile(50), 1) +
+           "ms p99 " + String(get_percentile(99), 1) + "ms max " + String(get_percentile(100), 1) + "ms";
+}
+
+//==============================================================================
+namespace {
+
+// spread of the middle 96% of a set of offsets
+double peak_to_peak(Array<double> v)
+{
+    v.sort();
+    const int outliers = v.size() / 50;
+    return v[v.size() - 1 - outliers] - v[outliers];
+}
+
+}
+
+// A fake audio driver calls schedule_block at the right average rate but with
+// random callback delays. The clock model is checked on given callback times,
+// against the due times the scheduler stamps on what it sends: the spread of
+// (due - ideal) against what stamping each block with the callback time would
+// have given. Then the same runs on the wall clock, where how late the events
+// really come out depends on the machine and is only reported.
+bool MidiThruSchedulerTests()
+{
+    const double sr = 48000;
+    const int block = 256;
+    const int num_blocks = 300;
+    const double block_ms = block * 1000.0 / sr;
+    const double latency = block_ms + 5.0;
+
+    CriticalSection lock;
+    Array<double> stamped, arrived;
+    MidiThruScheduler thru([&] (const MidiMessage &m) {
+        double t = Time::getMillisecondCounterHiRes();
+        ScopedLock l(lock);
+        stamped.add(m.getTimeStamp() * 1000.0);
+        arrived.add(t);
+    });
+    thru.set_latency_ms(latency);
+
+    // given times, in the past so that everything is due at once
+    Array<double> ideal, legacy;
+    Random rnd(33);
+    double t0 = Time::getMillisecondCounterHiRes() - num_blocks * block_ms - 1000;
+    for (int k = 0; k < num_blocks; k++) {
+        double callback = t0 + k * block_ms + rnd.nextDouble() * 3.0;
+        int pos = (k * 37) % block;
+        MidiBuffer b;
+        b.addEvent(MidiMessage::noteOn(1, 60, (uint8) 100), pos);
+        thru.schedule_block(b, block, sr, callback);
+        ideal.add(t0 + (k * block + pos) * 1000.0 / sr);
+        legacy.add(callback + pos * 1000.0 / sr);
+    }
+    // one of our own, due where the next block would start
+    thru.schedule_next(MidiMessage::noteOff(1, 60));
+    for (int n = 0; n < 1000; n++) {
+        {
+            ScopedLock l(lock);
+            if (stamped.size() == num_blocks + 1) {
+                break;
+            }
+        }
+        Thread::sleep(1);
+    }
+    {
+        ScopedLock l(lock);
+        if (stamped.size() != num_blocks + 1) {
+            Logger::writeToLog("MidiThruScheduler: " + String(stamped.size()) + " of " + String(num_blocks + 1) + " events sent");
+            return false;
+        }
+        // ignore the first blocks while the clock model settles
+        Array<double> late, legacy_late;
+        for (int k = 50; k < num_blocks; k++) {
+            late.add(stamped[k] - ideal[k]);
+            legacy_late.add(legacy[k] - ideal[k]);
+        }
+        double jitter = peak_to_peak(late), legacy_jitter = peak_to_peak(legacy_late);
+        Logger::writeToLog("MidiThruScheduler: clock model jitter " + String(jitter, 2) + "ms peak to peak, callback stamped " +
+                           String(legacy_jitter, 2) + "ms");
+        if (jitter > legacy_jitter / 4) {
+            Logger::writeToLog("MidiThruScheduler: jitter not reduced");
+            return false;
+        }
+        // due as late as the host's events are
+        late.sort();
+        double next_late = stamped.getLast() - (t0 + num_blocks * block_ms) - late[late.size() / 2];
+        if (std::abs(next_late) > 0.5) {
+            Logger::writeToLog("MidiThruScheduler: message for the next block off by " + String(next_late, 2) + "ms");
+            return false;
+        }
+        stamped.clear();
+        arrived.clear();
+    }
+
+    // on the wall clock
+    thru.resync();
+    thru.clear_histogram();
+    ideal.clear();
+    t0 = Time::getMillisecondCounterHiRes() + 10;
+    for (int k = 0; k < num_blocks; k++) {
+        double callback = t0 + k * block_ms + rnd.nextDouble() * 3.0;
+        while (Time::getMillisecondCounterHiRes() < callback) {
+            Thread::yield();
+        }
+        int pos = (k * 37) % block;
+        MidiBuffer b;
+        b.addEvent(MidiMessage::noteOn(1, 60, (uint8) 100), pos);
+        thru.schedule_block(b, block, sr);
+        ideal.add(t0 + (k * block + pos) * 1000.0 / sr);
+    }
+    Thread::sleep((int) (latency + 50));
+
+    ScopedLock l(lock);
+    if (arrived.size() != num_blocks) {
+        Logger::writeToLog("MidiThruScheduler: " + String(arrived.size()) + " of " + String(num_blocks) + " events arrived");
+        return false;
+    }
+    Array<double> late;
+    for (int k = 50; k < num_blocks; k++) {
+        late.add(arrived[k] - ideal[k]);
+    }
+    Logger::writeToLog("MidiThruScheduler: jitter " + String(peak_to_peak(late), 2) + "ms peak to peak; " + thru.get_jitter_summary());
+    return true;
+}
@@ -0,0 +1,108 @@
+/*
+ This file is part of micronau.
+ Copyright (c) 2013 - David Smitley
+
+ Permission is granted to use this software under the terms of the GPL v2 (or any later version)
+
+ Details can be found at: www.gnu.org/licenses
+*/
+
+#ifndef __MIDITHRUSCHEDULER_H__
+#define __MIDITHRUSCHEDULER_H__
+
+#include "MicronauCore.h"
+#include <juce_audio_basics/juce_audio_basics.h>
+#include <functional>
+
+//==============================================================================
+/*
+    MidiThruScheduler:
+        Relays the host's midi to a hardware port with steady timing.
+
+        Audio callbacks do not arrive at regular wall clock times, so stamping a
+        block with "now" moves every note in it by however late the callback
+        was. Instead the start of each block is predicted from the previous one
+        (block length / sample rate) and only nudged towards the measured time
+        by a running average, which takes the callback jitter out. An event at
+        sample position p is then due at
+            block start + p / sample rate + latency
+        where the fixed latency gives the callback and dispatch room to be late.
+
+        The audio thread only writes events into a preallocated ring and wakes
+        the dispatch thread. That high priority thread waits on its event until
+        less than SPIN_USEC before the next event is due (waits are whole
+        milliseconds, so up to a millisecond more), spins for the rest and
+        sends it, recording how late it was in a histogram that can be read
+        out at any time. With nothing queued it just waits to be woken.
+*/
+class MidiThruScheduler : private Thread
+{
+public:
+    typedef std::function<void (const MidiMessage &)> OutputFunction;
+
+    enum {
+        QUEUE_BYTES = 32 * 1024,
+        MAX_MESSAGE = 1024,
+        BIN_USEC = 100,         // histogram resolution
+        SPIN_USEC = 200,        // left to spin after a timed wait
+        NUM_BINS = 101          // 0 - 10ms, the last bin collects anything later
+    };
+
+    MidiThruScheduler(OutputFunction f);
+    ~MidiThruScheduler();
+
+    void set_latency_ms(double ms) {latency_ms = ms;}
+    double get_latency_ms() const {return latency_ms;}
+
+    // audio thread: queue a block of host midi, called back at now (ms)
+    void schedule_block(const MidiBuffer &midi, int num_samples, double sample_rate)
+        {schedule_block(midi, num_samples, sample_rate, Time::getMillisecondCounterHiRes());}
+    void schedule_block(const MidiBuffer &midi, int num_samples, double sample_rate, double now);
+    // audio thread: queue one message of our own for the start of the next block
+    void schedule_next(const MidiMessage &msg);
+    // audio thread: forget the clock model (after a transport jump, sample rate change...)
+    void resync() {anchored = false;}
+
+    // lateness of dispatched events, NUM_BINS counts of BIN_USEC each
+    Array<int> get_histogram() const;
+    void clear_histogram();
+    // lateness in ms at a percentile (0-100) of the histogram
+    double get_percentile(double pct) const;
+    String get_jitter_summary() const;
+    int get_dropped() const {return dropped.get();}
+
+private:
+    struct header {
+        double due;
+        int size;
+    };
+
+    void run();
+    void write(const header &h, const uint8 *data);
+    bool fetch();
+
+    OutputFunction output;
+    AbstractFifo fifo;
+    HeapBlock<uint8> ring;
+    double latency_ms;
+
+    // audio thread only
+    bool anchored;
+    int blocks_seen;
+    double block_start;
+    double expected_start;
+
+    // dispatch thread only
+    header next;
+    HeapBlock<uint8> next_data;
+    bool have_next;
+
+    Atomic<int> histogram[NUM_BINS];
+    Atomic<int> dropped;
+
+    JUCE_DECLARE_NON_COPYABLE (MidiThruScheduler)
+};
+
+bool MidiThruSchedulerTests();
+
+#endif  // __MIDITHRUSCHEDULER_H__
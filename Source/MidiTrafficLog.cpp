@@ -0,0 +1,326 @@
+/*
+ This file is part of micronau.
+ Copyright (c) 2013 - David Smitley
+
+ Permission is granted to use this software under the terms of the GPL v2 (or any later version)
+
+ Details can be found at: www.gnu.org/licenses
+*/
+
+#include "MidiTrafficLog.h"
+
+static const char log_magic[4] = {'M', 'N', 'L', 'G'};
+
+static int put_varint(uint8 *d, uint64 v)
+{
+    int n = 0;
+    while (v >= 0x80) {
+        d[n++] = (uint8) (v | 0x80);
+        v >>= 7;
+    }
+    d[n++] = (uint8) v;
+    return n;
+}
+
+static bool get_varint(const uint8 *d, int size, int &pos, uint64 &v)
+{
+    v = 0;
+    for (int shift = 0; (shift < 64) && (pos < size); shift += 7) {
+        uint8 b = d[pos++];
+        v |= (uint64) (b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+//==============================================================================
+MidiTrafficRecorder::MidiTrafficRecorder() :
+    Thread("MidiTrafficRecorder"),
+    fifo(RING_BYTES),
+    last_us(0),
+    start_ticks(0)
+{
+    ring.malloc(RING_BYTES);
+}
+
+MidiTrafficRecorder::~MidiTrafficRecorder()
+{
+    stop();
+}
+
+bool MidiTrafficRecorder::start(const File &f)
+{
+    stop();
+
+    ScopedLock l(out_lock);
+    out.reset(new FileOutputStream(f));
+    if (out->failedToOpen()) {
+        out = nullptr;
+        return false;
+    }
+    out->setPosition(0);
+    out->truncate();
+    out->write(log_magic, sizeof(log_magic));
+    out->writeInt(VERSION);
+    out->writeInt64(Time::currentTimeMillis());
+
+    {
+        SpinLock::ScopedLockType r(ring_lock);
+        fifo.reset();
+        start_ticks = Time::getHighResolutionTicks();
+        last_us = 0;
+    }
+    recorded = 0;
+    dropped = 0;
+    recording = 1;
+    startThread();
+    return true;
+}
+
+void MidiTrafficRecorder::stop()
+{
+    if (!is_recording()) {
+        return;
+    }
+    recording = 0;
+    stopThread(1000);
+
+    ScopedLock l(out_lock);
+    drain();
+    out->flush();
+    out = nullptr;
+}
+
+void MidiTrafficRecorder::record(Direction d, const MidiMessage &m, double offset_ms)
+{
+    if (!is_recording()) {
+        return;
+    }
+    int size = m.getRawDataSize();
+    uint8 head[1 + 10 + 5];
+
+    SpinLock::ScopedLockType r(ring_lock);
+    int64 now_us = (int64) (Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - start_ticks) * 1.0e6 + offset_ms * 1000.0);
+    int64 delta = now_us - last_us;
+    int n = 0;
+    head[n++] = (uint8) d;
+    n += put_varint(head + n, (uint64) ((delta << 1) ^ (delta >> 63)));
+    n += put_varint(head + n, (uint64) size);
+
+    int start1, size1, start2, size2;
+    fifo.prepareToWrite(n + size, start1, size1, start2, size2);
+    if (size1 + size2 < n + size) {
+        dropped += 1;
+        return;
+    }
+    // the record may wrap around the end of the ring
+    const uint8 *parts[2] = {head, m.getRawData()};
+    int lens[2] = {n, size};
+    int pos = start1;
+    int left = size1;
+    for (int p = 0; p < 2; p++) {
+        const uint8 *src = parts[p];
+        int len = lens[p];
+        while (len > 0) {
+            if (left == 0) {
+                pos = start2;
+                left = size2;
+            }
+            int k = jmin(len, left);
+            memcpy(ring + pos, src, (size_t) k);
+            pos += k;
+            left -= k;
+            src += k;
+            len -= k;
+        }
+    }
+    fifo.finishedWrite(n + size);
+    last_us = now_us;
+    recorded += 1;
+}
+
+// single reader: the writer thread, or stop() once it has gone
+void MidiTrafficRecorder::drain()
+{
+    int start1, size1, start2, size2;
+    fifo.prepareToRead(fifo.getNumReady(), start1, size1, start2, size2);
+    if (size1 > 0) {
+        out->write(ring + start1, (size_t) size1);
+    }
+    if (size2 > 0) {
+        out->write(ring + start2, (size_t) size2);
+    }
+    fifo.finishedRead(size1 + size2);
+}
+
+void MidiTrafficRecorder::run()
+{
+    while (!threadShouldExit()) {
+        wait(50);
+        ScopedLock l(out_lock);
+        drain();
+    }
+}
+
+//==============================================================================
+MidiTrafficReplay::MidiTrafficReplay() :
+    start_time(0)
+{
+}
+
+bool MidiTrafficReplay::load(const File &f)
+{
+    events.clearQuick();
+    MemoryBlock data;
+    if (!f.loadFileAsData(data) || (data.getSize() < MidiTrafficRecorder::HEADER_SIZE) ||
+        (memcmp(data.getData(), log_magic, sizeof(log_magic)) != 0)) {
+        return false;
+    }
+    MemoryInputStream in(data, false);
+    in.skipNextBytes(sizeof(log_magic));
+    if (in.readInt() != MidiTrafficRecorder::VERSION) {
+        return false;
+    }
+    start_time = in.readInt64();
+
+    const uint8 *d = (const uint8 *) data.getData();
+    int size = (int) data.getSize();
+    int pos = MidiTrafficRecorder::HEADER_SIZE;
+    int64 time_us = 0;
+    while (pos < size) {
+        int direction = d[pos++];
+        uint64 zz, len;
+        if (!get_varint(d, size, pos, zz) || !get_varint(d, size, pos, len) || (len == 0) || (len > (uint64) (size - pos))) {
+            break;
+        }
+        time_us += (int64) (zz >> 1) ^ -(int64) (zz & 1);
+        Event e;
+        e.direction = direction;
+        e.time_ms = time_us / 1000.0;
+        e.msg = MidiMessage(d + pos, (int) len);
+        events.add(e);
+        pos += (int) len;
+    }
+    return true;
+}
+
+double MidiTrafficReplay::play(EventFunction f, bool realtime) const
+{
+    double t0 = Time::getMillisecondCounterHiRes();
+    double first = events.isEmpty() ? 0 : events.getReference(0).time_ms;
+    for (int i = 0; i < events.size(); i++) {
+        const Event &e = events.getReference(i);
+        if (realtime) {
+            double wait_ms = t0 + (e.time_ms - first) - Time::getMillisecondCounterHiRes();
+            if (wait_ms > 2) {
+                Thread::sleep((int) wait_ms - 1);
+            }
+            while (Time::getMillisecondCounterHiRes() < t0 + (e.time_ms - first)) {
+                // spin the last stretch, like the thru scheduler
+            }
+        }
+        f(e);
+    }
+    return Time::getMillisecondCounterHiRes() - t0;
+}
+
+//==============================================================================
+namespace {
+    class RecordingThread : public Thread {
+    public:
+        RecordingThread(MidiTrafficRecorder &r, int c) : Thread("record"), rec(r), chan(c) {}
+        void run() {
+            for (int i = 0; i < 2000; i++) {
+                rec.record(MidiTrafficRecorder::OUT, MidiMessage::controllerEvent(chan, 0x62, i & 0x7f));
+            }
+        }
+        MidiTrafficRecorder &rec;
+        int chan;
+    };
+}
+
+bool MidiTrafficLogTests()
+{
+    File f = File::createTempFile(".mnlg");
+    MidiTrafficRecorder rec;
+    if (!rec.start(f)) {
+        Logger::writeToLog("MidiTrafficLog: could not start");
+        return false;
+    }
+
+    // a few paced messages, a sysex, an event placed ahead in its block
+    for (int i = 0; i < 10; i++) {
+        rec.record(MidiTrafficRecorder::THRU, MidiMessage::noteOn(1, 60 + i, (uint8) 100));
+        Thread::sleep(10);
+    }
+    uint8 sysex[434];
+    memset(sysex, 0x11, sizeof(sysex));
+    sysex[0] = 0xf0;
+    sysex[433] = 0xf7;
+    rec.record(MidiTrafficRecorder::IN, MidiMessage(sysex, sizeof(sysex)));
+    rec.record(MidiTrafficRecorder::HOST, MidiMessage::noteOff(1, 60), 5.0);
+
+    // several threads at once
+    RecordingThread a(rec, 2), b(rec, 3);
+    a.startThread();
+    b.startThread();
+    a.waitForThreadToExit(5000);
+    b.waitForThreadToExit(5000);
+    rec.stop();
+
+    MidiTrafficReplay replay;
+    if (!replay.load(f) || (replay.get_events().size() != 12 + 4000 - rec.get_dropped())) {
+        Logger::writeToLog("MidiTrafficLog: " + String(replay.get_events().size()) + " events read back, " + String(rec.get_dropped()) + " dropped");
+        f.deleteFile();
+        return false;
+    }
+    const Array<MidiTrafficReplay::Event> &ev = replay.get_events();
+    if ((ev[10].direction != MidiTrafficRecorder::IN) || (ev[10].msg.getRawDataSize() != 434) ||
+        (memcmp(ev[10].msg.getRawData(), sysex, sizeof(sysex)) != 0) ||
+        (ev[11].direction != MidiTrafficRecorder::HOST) || (ev[11].time_ms < ev[10].time_ms + 4.0) ||
+        (ev[9].time_ms - ev[0].time_ms < 80.0)) {
+        Logger::writeToLog("MidiTrafficLog: events not read back as recorded");
+        f.deleteFile();
+        return false;
+    }
+    // each thread's messages stay in order
+    int next[2] = {0, 0};
+    for (int i = 12; i < ev.size(); i++) {
+        int t = ev[i].msg.getChannel() - 2;
+        if (ev[i].msg.getControllerValue() != (next[t]++ & 0x7f)) {
+            Logger::writeToLog("MidiTrafficLog: thread " + String(t) + " out of order at " + String(i));
+            f.deleteFile();
+            return false;
+        }
+    }
+
+    // a truncated log still gives everything up to the cut
+    {
+        MemoryBlock m;
+        f.loadFileAsData(m);
+        File cut = File::createTempFile(".mnlg");
+        cut.replaceWithData(m.getData(), m.getSize() - 1);
+        MidiTrafficReplay r;
+        bool ok = r.load(cut) && (r.get_events().size() == ev.size() - 1);
+        cut.deleteFile();
+        if (!ok) {
+            Logger::writeToLog("MidiTrafficLog: truncated log not read");
+            f.deleteFile();
+            return false;
+        }
+    }
+    f.deleteFile();
+
+    // realtime replay keeps the recorded pace (the first 10 alone took ~90ms), fast does not
+    int played = 0;
+    double real = replay.play([&] (const MidiTrafficReplay::Event &) { played++; }, true);
+    double fast = replay.play([&] (const MidiTrafficReplay::Event &) { played++; }, false);
+    Logger::writeToLog("MidiTrafficLog: " + String(ev.size()) + " events replayed in " + String(real, 1) + "ms realtime, " + String(fast, 3) + "ms fast");
+    if ((played != 2 * ev.size()) || (real < ev.getLast().time_ms - ev[0].time_ms - 1.0) || (fast > 20.0)) {
+        Logger::writeToLog("MidiTrafficLog: replay timing wrong");
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,123 @@
+/*
+ This file is part of micronau.
+ Copyright (c) 2013 - David Smitley
+
+ Permission is granted to use this software under the terms of the GPL v2 (or any later version)
+
+ Details can be found at: www.gnu.org/licenses
+*/
+
+#ifndef __MIDITRAFFICLOG_H__
+#define __MIDITRAFFICLOG_H__
+
+#include "MicronauCore.h"
+#include <juce_audio_basics/juce_audio_basics.h>
+#include <functional>
+
+//==============================================================================
+/*
+    MidiTrafficRecorder:
+        Captures an instance's midi traffic into a binary log, for tracking
+        down timing problems and for replaying real sessions (see
+        MidiTrafficReplay).
+
+        File layout, integers little-endian:
+            "MNLG"      magic
+            int32       version
+            int64       wall clock time of the first record, ms since 1970
+        then one record per message:
+            uint8       direction (see Direction)
+            varint      time since the previous record in us, zigzag signed
+            varint      message size
+            bytes       the message
+
+        record() can be called from any thread including the audio thread: it
+        only copies into a preallocated ring under a spin lock. A background
+        thread writes the ring out; if it falls behind, records are dropped
+        and counted rather than blocking the caller.
+*/
+class MidiTrafficRecorder : private Thread
+{
+public:
+    enum Direction {
+        OUT = 0,        // sent to the synth (nrpns, sysex, program changes...)
+        THRU = 1,       // host midi relayed to the synth
+        HOST = 2,       // host midi as it arrived in processBlock
+        IN = 3          // received from the synth
+    };
+
+    enum {
+        VERSION = 1,
+        HEADER_SIZE = 16,
+        RING_BYTES = 256 * 1024
+    };
+
+    MidiTrafficRecorder();
+    ~MidiTrafficRecorder();
+
+    bool start(const File &f);
+    void stop();
+    bool is_recording() const {return recording.get() != 0;}
+
+    // offset_ms moves the time stamp, e.g. to an event's position in the block
+    void record(Direction d, const MidiMessage &m, double offset_ms = 0);
+
+    int get_recorded() const {return recorded.get();}
+    int get_dropped() const {return dropped.get();}
+
+private:
+    void run();
+    void drain();
+
+    std::unique_ptr<FileOutputStream> out;
+    CriticalSection out_lock;
+    Atomic<int> recording;
+
+    SpinLock ring_lock;
+    AbstractFifo fifo;
+    HeapBlock<uint8> ring;
+    int64 last_us;
+    int64 start_ticks;
+
+    Atomic<int> recorded;
+    Atomic<int> dropped;
+
+    JUCE_DECLARE_NON_COPYABLE (MidiTrafficRecorder)
+};
+
+//==============================================================================
+/*
+    MidiTrafficReplay:
+        Reads a log written by MidiTrafficRecorder and plays it back through a
+        callback, either at the recorded pace or as fast as possible.
+*/
+class MidiTrafficReplay
+{
+public:
+    struct Event {
+        int direction;
+        double time_ms;         // since the first record
+        MidiMessage msg;
+    };
+    typedef std::function<void (const Event &)> EventFunction;
+
+    MidiTrafficReplay();
+
+    // false unless the file is a log; a truncated last record is left out
+    bool load(const File &f);
+    const Array<Event> &get_events() const {return events;}
+    int64 get_start_time() const {return start_time;}
+
+    // returns how long it took in ms
+    double play(EventFunction f, bool realtime) const;
+
+private:
+    Array<Event> events;
+    int64 start_time;
+
+    JUCE_DECLARE_NON_COPYABLE (MidiTrafficReplay)
+};
+
+bool MidiTrafficLogTests();
+
+#endif  // __MIDITRAFFICLOG_H__
@@ -0,0 +1,283 @@
+/*
+ This file is part of micronau.
+ Copyright (c) 2013 - David Smitley
+
+ Permission is granted to use this software under the terms of the GPL v2 (or any later version)
+
+ Details can be found at: www.gnu.org/licenses
+*/
+
+#include "PluginState.h"
+
+static const char state_magic[4] = {'M', 'N', 'A', 'U'};
+
+PluginState::PluginState() :
+    midi_out_chan(0),
+    hw_insert(false),
+    hw_latency_us(-1),
+    legacy(false),
+    legacy_bank(0),
+    legacy_patch(0)
+{
+}
+
+void PluginState::write(MemoryBlock &dest) const
+{
+    MemoryOutputStream body;
+    body.writeInt(midi_out_chan);
+    body.writeString(midi_in_port);
+    body.writeString(midi_out_port);
+    body.writeString(prog_name);
+    body.writeInt(values.size());
+    for (int i = 0; i < values.size(); i++) {
+        body.writeShort(values.getUnchecked(i));
+    }
+    body.writeInt(hw_insert ? 1 : 0);
+    body.writeInt(hw_latency_us);
+    body.writeInt((int) program.getSize());
+    body.write(program.getData(), program.getSize());
+
+    MemoryOutputStream out(dest, false);
+    out.write(state_magic, sizeof(state_magic));
+    out.writeInt(VERSION);
+    out.writeInt((int) body.getDataSize());
+    out.write(body.getData(), body.getDataSize());
+}
+
+// a 0 terminated string that has to end inside the stream
+static bool read_string(MemoryInputStream &in, String &s)
+{
+    const char *start = (const char *) in.getData() + in.getPosition();
+    size_t left = in.getNumBytesRemaining();
+    const char *end = (const char *) memchr(start, 0, left);
+    // we only ever write utf8, anything else is a damaged state
+    if ((end == nullptr) || !CharPointer_UTF8::isValidString(start, (int) (end - start))) {
+        return false;
+    }
+    s = String(CharPointer_UTF8(start), CharPointer_UTF8(end));
+    in.setPosition(in.getPosition() + (end - start) + 1);
+    return true;
+}
+
+bool PluginState::read(const void *data, int size)
+{
+    legacy = false;
+    values.clearQuick();
+    program.reset();
+    if ((data == nullptr) || (size < HEADER_SIZE) || (memcmp(data, state_magic, sizeof(state_magic)) != 0)) {
+        return read_legacy(data, size);
+    }
+
+    MemoryInputStream in(data, (size_t) size, false);
+    in.skipNextBytes(sizeof(state_magic));
+    int version = in.readInt();
+    int length = in.readInt();
+    if ((version < 1) || (version > VERSION) || (length < 0) || (length > size - HEADER_SIZE)) {
+        return false;
+    }
+    MemoryInputStream body((const char *) data + HEADER_SIZE, (size_t) length, false);
+    if (body.getNumBytesRemaining() < 4) {
+        return false;
+    }
+    midi_out_chan = body.readInt();
+    if (!read_string(body, midi_in_port) || !read_string(body, midi_out_port) || !read_string(body, prog_name)) {
+        return false;
+    }
+    if (body.getNumBytesRemaining() < 4) {
+        return false;
+    }
+    int count = body.readInt();
+    if ((count < 0) || (body.getNumBytesRemaining() < (int64) count * 2)) {
+        return false;
+    }
+    values.ensureStorageAllocated(count);
+    for (int i = 0; i < count; i++) {
+        values.add(body.readShort());
+    }
+    if (version >= 2) {
+        if (body.getNumBytesRemaining() < 8) {
+            return false;
+        }
+        hw_insert = (body.readInt() != 0);
+        hw_latency_us = body.readInt();
+    }
+    if (version >= 3) {
+        if (body.getNumBytesRemaining() < 4) {
+            return false;
+        }
+        int program_size = body.readInt();
+        if ((program_size < 0) || (body.getNumBytesRemaining() < program_size)) {
+            return false;
+        }
+        program.setSize((size_t) program_size);
+        body.read(program.getData(), program_size);
+    }
+    return true;
+}
+
+// the old struct held whatever bytes the port name had, take them as latin-1
+// unless they are valid utf8, so that the name can be written out again
+static String legacy_string(const char *s)
+{
+    int len = (int) strlen(s);
+    if (CharPointer_UTF8::isValidString(s, len)) {
+        return String(CharPointer_UTF8(s));
+    }
+    String name;
+    for (int i = 0; i < len; i++) {
+        name += (juce_wchar) (uint8) s[i];
+    }
+    return name;
+}
+
+bool PluginState::read_legacy(const void *data, int size)
+{
+    if ((data == nullptr) || (size != LEGACY_SIZE)) {
+        return false;
+    }
+    // the old struct, read field by field rather than cast
+    MemoryInputStream in(data, (size_t) size, false);
+    legacy_sysex.malloc(LEGACY_SYSEX_LEN);
+    in.read(legacy_sysex, LEGACY_SYSEX_LEN);
+    midi_out_chan = in.readInt();
+
+    char port[LEGACY_PORT_NAME + 1];
+    in.read(port, LEGACY_PORT_NAME);
+    port[LEGACY_PORT_NAME] = 0;
+    midi_in_port = legacy_string(port);
+    in.read(port, LEGACY_PORT_NAME);
+    port[LEGACY_PORT_NAME] = 0;
+    midi_out_port = legacy_string(port);
+
+    legacy_bank = in.readInt();
+    legacy_patch = in.readInt();
+    legacy = true;
+    return true;
+}
+
+//==============================================================================
+bool PluginStateTests()
+{
+    PluginState s;
+    s.midi_out_chan = 3;
+    s.midi_in_port = "In \xc3\xa9";
+    s.midi_out_port = "Virtual Micron";
+    s.prog_name = "Pad";
+    for (int i = 0; i < 300; i++) {
+        s.values.add((int16) (i * 37 - 2000));
+    }
+    s.hw_insert = true;
+    s.hw_latency_us = 12345;
+    const uint8 dump[] = {0x00, 0x00, 0x0e, 0x22, 0x41, 0x7f};
+    s.program.append(dump, sizeof(dump));
+    MemoryBlock m;
+    s.write(m);
+
+    // fixed little-endian layout
+    const uint8 *b = (const uint8 *) m.getData();
+    if ((memcmp(b, "MNAU", 4) != 0) || (b[4] != PluginState::VERSION) || (b[5] != 0) ||
+        ((int) (b[8] | (b[9] << 8)) != (int) m.getSize() - PluginState::HEADER_SIZE) || (b[12] != 3)) {
+        Logger::writeToLog("PluginState: header layout wrong");
+        return false;
+    }
+
+    PluginState r;
+    if (!r.read(m.getData(), (int) m.getSize()) || r.legacy ||
+        (r.midi_out_chan != 3) || (r.midi_in_port != s.midi_in_port) || (r.midi_out_port != s.midi_out_port) ||
+        (r.prog_name != "Pad") || (r.values != s.values) || !r.hw_insert || (r.hw_latency_us != 12345) ||
+        (r.program != s.program)) {
+        Logger::writeToLog("PluginState: round trip failed");
+        return false;
+    }
+
+    // every truncation is refused
+    for (int n = 0; n < (int) m.getSize(); n++) {
+        PluginState t;
+        if (t.read(m.getData(), n)) {
+            Logger::writeToLog("PluginState: truncated state of " + String(n) + " bytes accepted");
+            return false;
+        }
+    }
+    // a newer version is refused
+    {
+        MemoryBlock newer(m);
+        ((uint8 *) newer.getData())[4] = PluginState::VERSION + 1;
+        PluginState t;
+        if (t.read(newer.getData(), (int) newer.getSize())) {
+            Logger::writeToLog("PluginState: newer version accepted");
+            return false;
+        }
+    }
+
+    // version 2 had no program dump
+    const int program_bytes = 4 + (int) sizeof(dump);
+    {
+        MemoryBlock v2(m);
+        v2.setSize(m.getSize() - program_bytes);
+        uint8 *d = (uint8 *) v2.getData();
+        d[4] = 2;
+        int length = (int) v2.getSize() - PluginState::HEADER_SIZE;
+        d[8] = (uint8) length;
+        d[9] = (uint8) (length >> 8);
+        PluginState t;
+        if (!t.read(v2.getData(), (int) v2.getSize()) || (t.values != s.values) || (t.hw_latency_us != 12345) ||
+            (t.program.getSize() != 0)) {
+            Logger::writeToLog("PluginState: version 2 state not read");
+            return false;
+        }
+    }
+
+    // version 1 had no hardware return
+    {
+        MemoryBlock v1(m);
+        v1.setSize(m.getSize() - program_bytes - 8);
+        uint8 *d = (uint8 *) v1.getData();
+        d[4] = 1;
+        int length = (int) v1.getSize() - PluginState::HEADER_SIZE;
+        d[8] = (uint8) length;
+        d[9] = (uint8) (length >> 8);
+        PluginState t;
+        if (!t.read(v1.getData(), (int) v1.getSize()) || (t.values != s.values) || t.hw_insert || (t.hw_latency_us != -1)) {
+            Logger::writeToLog("PluginState: version 1 state not read");
+            return false;
+        }
+    }
+
+    // the old raw struct
+    {
+        uint8 old[PluginState::LEGACY_SIZE];
+        memset(old, 0, sizeof(old));
+        old[0] = 0x00;
+        old[3] = 0x22;
+        old[PluginState::LEGACY_SYSEX_LEN] = 5;
+        strcpy((char *) old + PluginState::LEGACY_SYSEX_LEN + 4, "Old In");
+        strcpy((char *) old + PluginState::LEGACY_SYSEX_LEN + 4 + PluginState::LEGACY_PORT_NAME, "Old Out");
+        old[PluginState::LEGACY_SYSEX_LEN + 4 + 2 * PluginState::LEGACY_PORT_NAME] = 2;
+        old[PluginState::LEGACY_SYSEX_LEN + 8 + 2 * PluginState::LEGACY_PORT_NAME] = 7;
+        PluginState t;
+        if (!t.read(old, sizeof(old)) || !t.legacy || (t.midi_out_chan != 5) || (t.midi_in_port != "Old In") ||
+            (t.midi_out_port != "Old Out") || (t.legacy_bank != 2) || (t.legacy_patch != 7) || (t.legacy_sysex[3] != 0x22)) {
+            Logger::writeToLog("PluginState: legacy state not read");
+            return false;
+        }
+        if (t.read(old, sizeof(old) - 1)) {
+            Logger::writeToLog("PluginState: short legacy state accepted");
+            return false;
+        }
+
+        // a name that is not utf8 has to survive being saved in the new format
+        strcpy((char *) old + PluginState::LEGACY_SYSEX_LEN + 4, "Port \xe9\x80");
+        MemoryBlock saved;
+        PluginState again;
+        if (!t.read(old, sizeof(old)) || (t.midi_in_port.length() != 7)) {
+            Logger::writeToLog("PluginState: latin-1 legacy name not read");
+            return false;
+        }
+        t.write(saved);
+        if (!again.read(saved.getData(), (int) saved.getSize()) || (again.midi_in_port != t.midi_in_port)) {
+            Logger::writeToLog("PluginState: latin-1 legacy name not saved");
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,86 @@
+/*
+ This file is part of micronau.
+ Copyright (c) 2013 - David Smitley
+
+ Permission is granted to use this software under the terms of the GPL v2 (or any later version)
+
+ Details can be found at: www.gnu.org/licenses
+*/
+
+#ifndef __PLUGINSTATE_H__
+#define __PLUGINSTATE_H__
+
+#include "MicronauCore.h"
+
+//==============================================================================
+/*
+    PluginState:
+        What getStateInformation saves, and reading it back.
+
+        Current format, all integers little-endian:
+            "MNAU"                      magic
+            int32   version
+            int32   length of what follows
+            int32   midi out channel
+            string  midi in port        (utf8, 0 terminated)
+            string  midi out port
+            string  program name
+            int32   number of values
+            int16   value, one per parameter in IonSysexParams order
+            int32   hardware insert on              (version 2 on)
+            int32   hardware return latency in us, -1 if not measured
+            int32   size of the program             (version 3 on)
+            bytes   the program as a sysex dump, without f0/f7
+
+        The values are the decoded parameter values, so a restore copies them
+        straight into the value store instead of unpacking a sysex dump. They
+        only fit the parameter list they were saved with; when that changes
+        the program is decoded from the dump instead.
+        Anything shorter than its length fields say, with an unknown magic or
+        a newer version is rejected; an older one leaves the fields it did not
+        have at their defaults.
+
+        Sessions saved before this format hold a raw struct (432 sysex bytes,
+        channel, two 80 byte port names, bank, patch); those are recognised by
+        their size and handed back as legacy_sysex for the old decode path.
+*/
+class PluginState
+{
+public:
+    enum {
+        VERSION = 3,
+        HEADER_SIZE = 12,
+        LEGACY_SYSEX_LEN = 432,
+        LEGACY_PORT_NAME = 80,
+        LEGACY_SIZE = LEGACY_SYSEX_LEN + 4 + 2 * LEGACY_PORT_NAME + 4 + 4
+    };
+
+    PluginState();
+
+    int midi_out_chan;
+    String midi_in_port;
+    String midi_out_port;
+    String prog_name;
+    Array<int16> values;
+    bool hw_insert;
+    int hw_latency_us;
+    MemoryBlock program;
+
+    // set by read() for a legacy state, values is empty then
+    bool legacy;
+    HeapBlock<unsigned char> legacy_sysex;
+    int legacy_bank;
+    int legacy_patch;
+
+    void write(MemoryBlock &dest) const;
+    bool read(const void *data, int size);
+
+private:
+    bool read_legacy(const void *data, int size);
+
+    JUCE_DECLARE_NON_COPYABLE (PluginState)
+};
+
+bool PluginStateTests();
+
+#endif  // __PLUGINSTATE_H__
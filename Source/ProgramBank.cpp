@@ -0,0 +1,121 @@
+/*
+ This file is part of micronau.
+ Copyright (c) 2013 - David Smitley
+
+ Permission is granted to use this software under the terms of the GPL v2 (or any later version)
+
+ Details can be found at: www.gnu.org/licenses
+*/
+
+#include "ProgramBank.h"
+
+ProgramBank::ProgramBank()
+{
+    programs.calloc(NUM_SLOTS * PROGRAM_LEN);
+    clear();
+}
+
+void ProgramBank::clear()
+{
+    ScopedLock l(lock);
+    for (int i = 0; i < NUM_SLOTS; i++) {
+        valid[i] = false;
+    }
+}
+
+bool ProgramBank::set_program(int slot, const unsigned char *sysex, int len)
+{
+    if ((slot < 0) || (slot >= NUM_SLOTS) || (len != PROGRAM_LEN)) {
+        return false;
+    }
+    // only accept program dumps
+    if ((sysex[0] != 0x00) || (sysex[1] != 0x00) || (sysex[2] != 0x0e) || (sysex[3] != 0x22)) {
+        return false;
+    }
+
+    ScopedLock l(lock);
+    memcpy(programs + slot * PROGRAM_LEN, sysex, PROGRAM_LEN);
+    valid[slot] = true;
+    return true;
+}
+
+bool ProgramBank::get_program(int slot, unsigned char *sysex) const
+{
+    if ((slot < 0) || (slot >= NUM_SLOTS)) {
+        return false;
+    }
+
+    ScopedLock l(lock);
+    if (!valid[slot]) {
+        return false;
+    }
+    memcpy(sysex, programs + slot * PROGRAM_LEN, PROGRAM_LEN);
+    return true;
+}
+
+bool ProgramBank::has_program(int slot) const
+{
+    if ((slot < 0) || (slot >= NUM_SLOTS)) {
+        return false;
+    }
+    ScopedLock l(lock);
+    return valid[slot];
+}
+
+int ProgramBank::num_programs() const
+{
+    ScopedLock l(lock);
+    int n = 0;
+    for (int i = 0; i < NUM_SLOTS; i++) {
+        if (valid[i]) {
+            n++;
+        }
+    }
+    return n;
+}
+
+bool ProgramBank::save(const File &f) const
+{
+    MemoryBlock mb;
+    {
+        ScopedLock l(lock);
+        unsigned char empty[PROGRAM_LEN];
+        zeromem(empty, sizeof(empty));
+        empty[0] = 0x7d;
+        for (int i = 0; i < NUM_SLOTS; i++) {
+            const unsigned char f0 = 0xf0, f7 = 0xf7;
+            mb.append(&f0, 1);
+            mb.append(valid[i] ? programs + i * PROGRAM_LEN : empty, PROGRAM_LEN);
+            mb.append(&f7, 1);
+        }
+    }
+    f.getParentDirectory().createDirectory();
+    return f.replaceWithData(mb.getData(), mb.getSize());
+}
+
+bool ProgramBank::load(const File &f)
+{
+    MemoryBlock mb;
+    if (!f.loadFileAsData(mb)) {
+        return false;
+    }
+
+    clear();
+    const unsigned char *p = (const unsigned char *) mb.getData();
+    int n = jmin((int) (mb.getSize() / SYSEX_PROGRAM_SIZE), (int) NUM_SLOTS);
+    bool any = false;
+    // one message per slot, empty slots are anything but a program dump
+    for (int slot = 0; slot < n; slot++, p += SYSEX_PROGRAM_SIZE) {
+        if ((p[0] == 0xf0) && (p[SYSEX_PROGRAM_SIZE - 1] == 0xf7) && set_program(slot, p + 1, PROGRAM_LEN)) {
+            any = true;
+        }
+    }
+    return any;
+}
+
+File ProgramBank::get_default_file()
+{
+    return File::getSpecialLocation(File::userApplicationDataDirectory)
+        .getChildFile("micronau")
+        .getChildFile("micron_backup.syx");
+}
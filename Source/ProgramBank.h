@@ -0,0 +1,66 @@
+/*
+ This file is part of micronau.
+ Copyright (c) 2013 - David Smitley
+
+ Permission is granted to use this software under the terms of the GPL v2 (or any later version)
+
+ Details can be found at: www.gnu.org/licenses
+*/
+
+#ifndef __PROGRAMBANK_H__
+#define __PROGRAMBANK_H__
+
+#include "MicronauCore.h"
+#include "IonSysex.h"
+
+//==============================================================================
+/*
+    ProgramBank:
+        In-memory copy of the Micron's program memory (8 banks of 128 programs).
+        Each slot holds one program dump exactly as it arrives from the synth,
+        i.e. the sysex data without the leading f0 and trailing f7.
+
+        Saved banks are plain .syx files with one complete f0 ... f7 message of
+        SYSEX_PROGRAM_SIZE bytes per slot, in slot order, so a program keeps
+        its slot through a save and load. An empty slot is written as a
+        message for the non-commercial id 0x7d, which the synth ignores.
+*/
+class ProgramBank
+{
+public:
+    enum {
+        NUM_BANKS = 8,
+        PROGS_PER_BANK = 128,
+        NUM_SLOTS = NUM_BANKS * PROGS_PER_BANK,
+        PROGRAM_LEN = SYSEX_PROGRAM_SIZE - 2
+    };
+
+    ProgramBank();
+
+    void clear();
+
+    // sysex is the message data without f0/f7, len must be PROGRAM_LEN
+    bool set_program(int slot, const unsigned char *sysex, int len);
+    bool get_program(int slot, unsigned char *sysex) const;
+    bool has_program(int slot) const;
+    int num_programs() const;
+
+    bool save(const File &f) const;
+    bool load(const File &f);
+
+    static int slot_of(int bank, int prog) {return bank * PROGS_PER_BANK + prog;}
+    static int bank_of(int slot) {return slot / PROGS_PER_BANK;}
+    static int prog_of(int slot) {return slot % PROGS_PER_BANK;}
+
+    // where a full backup of the synth ends up
+    static File get_default_file();
+
+private:
+    CriticalSection lock;
+    HeapBlock<unsigned char> programs;
+    bool valid[NUM_SLOTS];
+
+    JUCE_DECLARE_NON_COPYABLE (ProgramBank)
+};
+
+#endif  // __PROGRAMBANK_H__
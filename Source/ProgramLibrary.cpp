@@ -0,0 +1,226 @@
+/*
+ This file is part of micronau.
+ Copyright (c) 2013 - David Smitley
+
+ Permission is granted to use this software under the terms of the GPL v2 (or any later version)
+
+ Details can be found at: www.gnu.org/licenses
+*/
+
+#include "ProgramLibrary.h"
+#include "ProgramBank.h"
+
+ProgramLibrary::ProgramLibrary() :
+    count(0)
+{
+}
+
+static bool is_program_at(const uint8 *d, size_t size, size_t pos)
+{
+    return (pos + SYSEX_PROGRAM_SIZE <= size) && (d[pos] == 0xf0) && (d[pos + 1] == 0x00) && (d[pos + 2] == 0x00) &&
+           (d[pos + 3] == 0x0e) && (d[pos + 4] == 0x22) && (d[pos + SYSEX_PROGRAM_SIZE - 1] == 0xf7);
+}
+
+// a program, or an empty slot of a saved bank
+static bool is_slot_at(const uint8 *d, size_t size, size_t pos)
+{
+    return (pos + SYSEX_PROGRAM_SIZE <= size) && (d[pos] == 0xf0) && (d[pos + SYSEX_PROGRAM_SIZE - 1] == 0xf7);
+}
+
+bool ProgramLibrary::open(const File &f)
+{
+    ScopedLock l(lock);
+    map.reset();
+    offsets.clear();
+    count = 0;
+    file = File();
+
+    std::unique_ptr<MemoryMappedFile> m(new MemoryMappedFile(f, MemoryMappedFile::readOnly));
+    if ((m->getData() == nullptr) || (m->getSize() == 0)) {
+        return false;
+    }
+    const uint8 *d = (const uint8 *) m->getData();
+    size_t size = m->getSize();
+
+    if ((size % SYSEX_PROGRAM_SIZE == 0) && is_slot_at(d, size, 0) && is_slot_at(d, size, size - SYSEX_PROGRAM_SIZE)) {
+        count = (int) (size / SYSEX_PROGRAM_SIZE);
+    } else {
+        // step over whatever else is in there, one message at a time
+        size_t pos = 0;
+        while (pos < size) {
+            if (is_program_at(d, size, pos)) {
+                offsets.add((int) pos);
+                pos += SYSEX_PROGRAM_SIZE;
+                continue;
+            }
+            const uint8 *end = (const uint8 *) memchr(d + pos + 1, 0xf0, size - pos - 1);
+            pos = (end != nullptr) ? end - d : size;
+        }
+        count = offsets.size();
+    }
+    if (count == 0) {
+        return false;
+    }
+    map = std::move(m);
+    file = f;
+    return true;
+}
+
+void ProgramLibrary::close()
+{
+    ScopedLock l(lock);
+    map.reset();
+    offsets.clear();
+    count = 0;
+    file = File();
+}
+
+bool ProgramLibrary::is_open() const
+{
+    ScopedLock l(lock);
+    return map != nullptr;
+}
+
+File ProgramLibrary::get_file() const
+{
+    ScopedLock l(lock);
+    return file;
+}
+
+int ProgramLibrary::size() const
+{
+    return count;
+}
+
+// data after the f0, or nullptr; call with the lock held
+const uint8 *ProgramLibrary::program_data(int index) const
+{
+    if ((map == nullptr) || (index < 0) || (index >= count)) {
+        return nullptr;
+    }
+    size_t pos = offsets.isEmpty() ? (size_t) index * SYSEX_PROGRAM_SIZE : (size_t) offsets.getUnchecked(index);
+    const uint8 *d = (const uint8 *) map->getData();
+    if (!is_program_at(d, map->getSize(), pos)) {
+        return nullptr;
+    }
+    return d + pos + 1;
+}
+
+String ProgramLibrary::get_name(int index) const
+{
+    ScopedLock l(lock);
+    const uint8 *p = program_data(index);
+    if (p == nullptr) {
+        return String();
+    }
+    return programNameFromSysex(p, PROGRAM_LEN);
+}
+
+bool ProgramLibrary::get_program(int index, unsigned char *sysex) const
+{
+    ScopedLock l(lock);
+    const uint8 *p = program_data(index);
+    if ((p == nullptr) || (validateProgramSysex(p, PROGRAM_LEN) != SYSEX_OK)) {
+        return false;
+    }
+    memcpy(sysex, p, PROGRAM_LEN);
+    return true;
+}
+
+//==============================================================================
+bool ProgramLibraryTests()
+{
+    // a bank with every program named after its slot
+    IonSysexParams params;
+    unsigned char msg[SYSEX_PROGRAM_SIZE];
+    const int num = 10000;
+    File f = File::createTempFile(".syx");
+    {
+        FileOutputStream out(f);
+        for (int i = 0; i < num; i++) {
+            params.set_prog_name("Prog " + String(i));
+            memset(msg, 0, sizeof(msg));
+            params.getAsSysexMessage(msg);
+            out.write(msg, sizeof(msg));
+        }
+    }
+
+    ProgramLibrary lib;
+    double t0 = Time::getMillisecondCounterHiRes();
+    if (!lib.open(f) || (lib.size() != num)) {
+        Logger::writeToLog("ProgramLibrary: bank of " + String(num) + " not opened");
+        f.deleteFile();
+        return false;
+    }
+    double t1 = Time::getMillisecondCounterHiRes();
+    for (int i = 0; i < num; i++) {
+        if (lib.get_name(i) != "Prog " + String(i)) {
+            Logger::writeToLog("ProgramLibrary: name of " + String(i) + " is " + lib.get_name(i));
+            lib.close();
+            f.deleteFile();
+            return false;
+        }
+    }
+    double t2 = Time::getMillisecondCounterHiRes();
+    Logger::writeToLog("ProgramLibrary: opened " + String(num) + " programs in " + String(t1 - t0, 3) + "ms, listed in " + String(t2 - t1, 2) + "ms");
+
+    // a selected program decodes to the same name
+    unsigned char sysex[ProgramLibrary::PROGRAM_LEN];
+    IonSysexParams check;
+    if (!lib.get_program(1234, sysex) || !check.parseParamsFromContent(sysex, ProgramLibrary::PROGRAM_LEN) ||
+        (check.get_prog_name() != "Prog 1234")) {
+        Logger::writeToLog("ProgramLibrary: program not read back");
+        lib.close();
+        f.deleteFile();
+        return false;
+    }
+    if (lib.get_program(num, sysex) || lib.get_name(-1).isNotEmpty()) {
+        Logger::writeToLog("ProgramLibrary: out of range program returned");
+        lib.close();
+        f.deleteFile();
+        return false;
+    }
+    lib.close();
+
+    // other sysex in between: found by scanning
+    {
+        FileOutputStream out(f);
+        out.setPosition(0);
+        out.truncate();
+        const uint8 other[] = {0xf0, 0x7e, 0x00, 0x06, 0x01, 0xf7};
+        for (int i = 0; i < 3; i++) {
+            params.set_prog_name("Mixed " + String(i));
+            params.getAsSysexMessage(msg);
+            out.write(other, sizeof(other));
+            out.write(msg, sizeof(msg));
+        }
+    }
+    bool ok = lib.open(f) && (lib.size() == 3) && (lib.get_name(2) == "Mixed 2") && lib.get_program(0, sysex);
+    lib.close();
+    if (!ok) {
+        f.deleteFile();
+        Logger::writeToLog("ProgramLibrary: mixed file not indexed");
+        return false;
+    }
+
+    // a saved bank with gaps: programs stay in their slots
+    ProgramBank bank, loaded;
+    const int slots[] = {1, 5, ProgramBank::NUM_SLOTS - 1};
+    for (int slot : slots) {
+        params.set_prog_name("Slot " + String(slot));
+        params.getAsSysexMessage(msg);
+        bank.set_program(slot, msg + 1, ProgramBank::PROGRAM_LEN);
+    }
+    ok = bank.save(f) && loaded.load(f) && (loaded.num_programs() == 3) && lib.open(f) &&
+         (lib.size() == ProgramBank::NUM_SLOTS) && lib.get_name(0).isEmpty() && !lib.get_program(0, sysex);
+    for (int slot : slots) {
+        ok = ok && loaded.has_program(slot) && (lib.get_name(slot) == "Slot " + String(slot));
+    }
+    lib.close();
+    f.deleteFile();
+    if (!ok) {
+        Logger::writeToLog("ProgramLibrary: saved bank lost its slots");
+        return false;
+    }
+    return true;
+}
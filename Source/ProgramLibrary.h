@@ -0,0 +1,67 @@
+/*
+ This file is part of micronau.
+ Copyright (c) 2013 - David Smitley
+
+ Permission is granted to use this software under the terms of the GPL v2 (or any later version)
+
+ Details can be found at: www.gnu.org/licenses
+*/
+
+#ifndef __PROGRAMLIBRARY_H__
+#define __PROGRAMLIBRARY_H__
+
+#include "MicronauCore.h"
+#include "IonSysex.h"
+
+//==============================================================================
+/*
+    ProgramLibrary:
+        Read-only view of a .syx bank file (as ProgramBank::save writes them)
+        for the host's program list.
+
+        The file is memory mapped rather than loaded. A file made of nothing
+        but program dumps and the empty slots ProgramBank writes has every
+        program at a multiple of 434 bytes, so opening it only checks the first
+        and last message and the count, names and data of any program are found
+        in constant time; an empty slot has no name and no program. Anything
+        else (other sysex mixed in) is scanned once on open to find where the
+        programs are.
+
+        Names are decoded from the two 8 byte groups that hold them; a program
+        is validated and copied out only when it is asked for.
+*/
+class ProgramLibrary
+{
+public:
+    enum {
+        PROGRAM_LEN = SYSEX_PROGRAM_SIZE - 2
+    };
+
+    ProgramLibrary();
+
+    bool open(const File &f);
+    void close();
+    bool is_open() const;
+    File get_file() const;
+
+    int size() const;
+    // empty if index is out of range or the slot is not a program
+    String get_name(int index) const;
+    // sysex data without f0/f7, PROGRAM_LEN bytes; false unless it passes validateProgramSysex
+    bool get_program(int index, unsigned char *sysex) const;
+
+private:
+    const uint8 *program_data(int index) const;
+
+    CriticalSection lock;
+    std::unique_ptr<MemoryMappedFile> map;
+    File file;
+    int count;
+    Array<int> offsets;     // empty when programs are at a fixed stride
+
+    JUCE_DECLARE_NON_COPYABLE (ProgramLibrary)
+};
+
+bool ProgramLibraryTests();
+
+#endif  // __PROGRAMLIBRARY_H__
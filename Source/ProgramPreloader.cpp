@@ -0,0 +1,270 @@
+/*
+ This file is part of micronau.
+ Copyright (c) 2013 - David Smitley
+
+ Permission is granted to use this software under the terms of the GPL v2 (or any later version)
+
+ Details can be found at: www.gnu.org/licenses
+*/
+
+#include "ProgramPreloader.h"
+
+ProgramPreloader::ProgramPreloader(SendFunction f) :
+    Thread("micronau preloader"),
+    send(f),
+    bandwidth(DIN_BYTES_PER_SEC),
+    settle_ms(SETTLE_MS),
+    seen_generation(0),
+    last_lead_us(0),
+    last_needed_us(0),
+    late_us(0)
+{
+    state = IDLE;
+    startThread();
+}
+
+ProgramPreloader::~ProgramPreloader()
+{
+    stopThread(1000);
+}
+
+double ProgramPreloader::transfer_ms(int bytes) const
+{
+    double wire = (bandwidth > 0) ? bytes * 1000.0 / bandwidth : 0.0;
+    return wire + settle_ms;
+}
+
+void ProgramPreloader::schedule(const Array<MidiMessage> &msgs)
+{
+    int bytes = 0;
+    for (int i = 0; i < msgs.size(); i++) {
+        bytes += msgs.getReference(i).getRawDataSize();
+    }
+    ScopedLock l(lock);
+    pending = msgs;
+    pending_bytes = bytes;
+    generation += 1;
+    state = WAITING;
+}
+
+void ProgramPreloader::send_now(const Array<MidiMessage> &msgs)
+{
+    schedule(msgs);
+    late_us = 0;
+    start_sending();
+}
+
+bool ProgramPreloader::is_playing() const
+{
+    // a host that stops calling processBlock has stopped playing too
+    return (playing.get() != 0) && (Time::getMillisecondCounter() - last_process.get() < 250);
+}
+
+String ProgramPreloader::get_last_warning() const
+{
+    ScopedLock l(lock);
+    return warning;
+}
+
+void ProgramPreloader::start_sending()
+{
+    if (state.compareAndSetBool(SENDING, WAITING)) {
+        started += 1;
+        notify();
+    }
+}
+
+static int64 to_us(double ms)
+{
+    return (int64) std::llround(ms * 1000.0);
+}
+
+void ProgramPreloader::process(AudioPlayHead *head, int num_samples, double sample_rate)
+{
+    AudioPlayHead::CurrentPositionInfo pos;
+    bool have_pos = (head != nullptr) && head->getCurrentPosition(pos);
+    bool rolling = have_pos && pos.isPlaying && (pos.bpm > 0) && (sample_rate > 0);
+    playing = rolling ? 1 : 0;
+    last_process = Time::getMillisecondCounter();
+
+    if (state.get() != WAITING) {
+        return;
+    }
+    int gen = generation.get();
+    bool first = (gen != seen_generation);
+    seen_generation = gen;
+
+    if (!rolling) {
+        // nothing to line up with
+        late_us = 0;
+        start_sending();
+        return;
+    }
+
+    double bar_len = 4.0;
+    if ((pos.timeSigNumerator > 0) && (pos.timeSigDenominator > 0)) {
+        bar_len = pos.timeSigNumerator * 4.0 / pos.timeSigDenominator;
+    }
+    double bar_start = pos.ppqPositionOfLastBarStart;
+    if ((bar_start > pos.ppqPosition) || (pos.ppqPosition - bar_start >= bar_len)) {
+        // host does not report bars, count them from the song start
+        bar_start = std::floor(pos.ppqPosition / bar_len) * bar_len;
+    }
+    // worked out again every block, so loops and relocates retarget by themselves
+    double downbeat = bar_start + bar_len;
+    double ms_per_beat = 60000.0 / pos.bpm;
+    double lead = (downbeat - pos.ppqPosition) * ms_per_beat;
+    double needed = transfer_ms(pending_bytes.get());
+    double block_ms = num_samples * 1000.0 / sample_rate;
+
+    if (first && (lead < needed)) {
+        // too close already, go now and own up to it
+        last_lead_us = to_us(lead);
+        last_needed_us = to_us(needed);
+        late_us = to_us(needed - lead);
+        start_sending();
+    } else if (lead - block_ms < needed) {
+        // waiting for the next block would miss the downbeat
+        last_lead_us = to_us(lead);
+        last_needed_us = to_us(needed);
+        late_us = 0;
+        start_sending();
+    }
+}
+
+void ProgramPreloader::run()
+{
+    while (!threadShouldExit()) {
+        wait(100);
+
+        Array<MidiMessage> out;
+        int64 was_late = 0;
+        {
+            ScopedLock l(lock);
+            if (state.get() != SENDING) {
+                continue;
+            }
+            out.swapWith(pending);
+            was_late = late_us.get();
+            if (was_late > 0) {
+                warning = String(roundToInt(was_late / 1000.0)) + "ms late, needs " +
+                          String(roundToInt(get_last_needed_ms())) + "ms lead";
+                late += 1;
+            }
+            state = IDLE;
+        }
+        if (was_late > 0) {
+            Logger::writeToLog("ProgramPreloader: program change " + get_last_warning());
+        }
+        send(out);
+        sent += 1;
+    }
+}
+
+//==============================================================================
+namespace {
+    struct TestPlayHead : public AudioPlayHead {
+        TestPlayHead() {
+            zerostruct(info);
+            info.bpm = 120;
+            info.timeSigNumerator = 4;
+            info.timeSigDenominator = 4;
+            info.isPlaying = true;
+        }
+        bool getCurrentPosition(CurrentPositionInfo &result) {
+            result = info;
+            return true;
+        }
+        void advance(int samples, double sr) {
+            info.ppqPosition += samples / sr * info.bpm / 60.0;
+            info.ppqPositionOfLastBarStart = std::floor(info.ppqPosition / 4.0) * 4.0;
+        }
+        CurrentPositionInfo info;
+    };
+}
+
+bool ProgramPreloaderTests()
+{
+    const double sr = 48000;
+    const int block = 512;
+    const double block_ms = block * 1000.0 / sr;
+
+    Atomic<int> received;
+    ProgramPreloader pre([&] (const Array<MidiMessage> &msgs) { received += msgs.size(); });
+    uint8 sysex[434];
+    memset(sysex, 0, sizeof(sysex));
+    sysex[0] = 0xf0;
+    sysex[433] = 0xf7;
+    Array<MidiMessage> program;
+    program.add(MidiMessage::programChange(1, 5));
+    program.add(MidiMessage(sysex, sizeof(sysex)));
+    double needed = pre.transfer_ms(436);
+
+    // half way through bar 2 at 120bpm, 1s to the downbeat at ppq 8
+    TestPlayHead head;
+    head.info.ppqPosition = 6.0;
+    pre.schedule(program);
+    for (int b = 0; (b < 200) && (pre.get_started() < 1); b++) {
+        pre.process(&head, block, sr);
+        head.advance(block, sr);
+    }
+    double lead = pre.get_last_lead_ms();
+    if ((pre.get_late() != 0) || (lead < needed) || (lead - block_ms >= needed)) {
+        Logger::writeToLog("ProgramPreloader: started " + String(lead, 1) + "ms before the downbeat, needs " + String(needed, 1));
+        return false;
+    }
+    for (int i = 0; (i < 100) && (pre.get_sent() < 1); i++) {
+        Thread::sleep(5);
+    }
+    if ((pre.get_sent() != 1) || (received.get() != 2)) {
+        Logger::writeToLog("ProgramPreloader: program not sent");
+        return false;
+    }
+
+    // a relocate while waiting moves the target to the new next bar
+    head.info.ppqPosition = 6.0;
+    pre.schedule(program);
+    pre.process(&head, block, sr);
+    head.info.ppqPosition = 0.5;
+    for (int b = 0; (b < 400) && (pre.get_started() < 2); b++) {
+        pre.process(&head, block, sr);
+        head.advance(block, sr);
+        if (head.info.ppqPosition > 4.0) {
+            Logger::writeToLog("ProgramPreloader: missed the downbeat after a relocate");
+            return false;
+        }
+    }
+    lead = pre.get_last_lead_ms();
+    if ((lead < needed) || (lead - block_ms >= needed)) {
+        Logger::writeToLog("ProgramPreloader: relocated transfer started " + String(lead, 1) + "ms before the downbeat");
+        return false;
+    }
+
+    // 50ms before the downbeat is too short: sent at once, with a warning
+    for (int i = 0; (i < 100) && (pre.get_sent() < 2); i++) {
+        Thread::sleep(5);
+    }
+    head.info.ppqPosition = 7.9;
+    pre.schedule(program);
+    pre.process(&head, block, sr);
+    for (int i = 0; (i < 100) && (pre.get_sent() < 3); i++) {
+        Thread::sleep(5);
+    }
+    if ((pre.get_late() != 1) || (pre.get_sent() != 3) || pre.get_last_warning().isEmpty()) {
+        Logger::writeToLog("ProgramPreloader: short look-ahead not reported");
+        return false;
+    }
+
+    // stopped transport: nothing to wait for
+    head.info.isPlaying = false;
+    pre.schedule(program);
+    pre.process(&head, block, sr);
+    for (int i = 0; (i < 100) && (pre.get_sent() < 4); i++) {
+        Thread::sleep(5);
+    }
+    if ((pre.get_sent() != 4) || (pre.get_late() != 1) || pre.is_playing()) {
+        Logger::writeToLog("ProgramPreloader: stopped transport not sent straight away");
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,111 @@
+/*
+ This file is part of micronau.
+ Copyright (c) 2013 - David Smitley
+
+ Permission is granted to use this software under the terms of the GPL v2 (or any later version)
+
+ Details can be found at: www.gnu.org/licenses
+*/
+
+#ifndef __PROGRAMPRELOADER_H__
+#define __PROGRAMPRELOADER_H__
+
+#include "MicronauCore.h"
+#include <juce_audio_basics/juce_audio_basics.h>
+#include <functional>
+
+//==============================================================================
+/*
+    ProgramPreloader:
+        Sends a program change to the synth so that it has landed by the next
+        downbeat, instead of whenever the host happened to ask for it.
+
+        A program dump takes a while on the wire (434 bytes at 3125 bytes/s is
+        about 140ms) and the synth needs a moment to switch. When the transport
+        is running, the next bar start is looked up from the play head and the
+        transfer is started at
+            downbeat - (bytes / bandwidth + settle time)
+        If that moment has already passed when the change is asked for, it is
+        sent straight away and a warning says how late it will be.
+
+        schedule() may be called from any thread, process() is called from the
+        audio thread every block and never blocks; the sending itself happens
+        on a worker thread.
+*/
+class ProgramPreloader : private Thread
+{
+public:
+    typedef std::function<void (const Array<MidiMessage> &)> SendFunction;
+
+    enum {
+        DIN_BYTES_PER_SEC = 3125,
+        SETTLE_MS = 20          // synth time to take in a program once it has arrived
+    };
+
+    ProgramPreloader(SendFunction f);
+    ~ProgramPreloader();
+
+    // 0 for no bandwidth limit
+    void set_bandwidth(int bytes_per_sec) {bandwidth = bytes_per_sec;}
+    void set_settle_ms(double ms) {settle_ms = ms;}
+    // how long sending this many bytes takes, settle time included
+    double transfer_ms(int bytes) const;
+
+    // queue messages to go out together, replacing anything not yet sent
+    void schedule(const Array<MidiMessage> &msgs);
+    // queue messages to go out on the worker thread straight away
+    void send_now(const Array<MidiMessage> &msgs);
+    bool is_pending() const {return state.get() != IDLE;}
+
+    // audio thread, once per block
+    void process(AudioPlayHead *head, int num_samples, double sample_rate);
+
+    // true while process() is being called with the transport running
+    bool is_playing() const;
+
+    int get_started() const {return started.get();}
+    int get_sent() const {return sent.get();}
+    int get_late() const {return late.get();}
+    String get_last_warning() const;
+
+    // lead (ms before the downbeat) and needed time of the last timed transfer
+    double get_last_lead_ms() const {return last_lead_us.get() / 1000.0;}
+    double get_last_needed_ms() const {return last_needed_us.get() / 1000.0;}
+
+private:
+    enum { IDLE, WAITING, SENDING };
+
+    void run();
+    void start_sending();
+
+    SendFunction send;
+    int bandwidth;
+    double settle_ms;
+
+    CriticalSection lock;
+    Array<MidiMessage> pending;
+    String warning;
+    Atomic<int> state;
+    Atomic<int> generation;
+    Atomic<int> pending_bytes;
+
+    // audio thread only
+    int seen_generation;
+
+    Atomic<int> playing;
+    Atomic<uint32> last_process;
+    // written by the audio thread, read by the sending thread and the editor
+    Atomic<int64> last_lead_us;
+    Atomic<int64> last_needed_us;
+    Atomic<int64> late_us;
+
+    Atomic<int> started;
+    Atomic<int> sent;
+    Atomic<int> late;
+
+    JUCE_DECLARE_NON_COPYABLE (ProgramPreloader)
+};
+
+bool ProgramPreloaderTests();
+
+#endif  // __PROGRAMPRELOADER_H__
@@ -0,0 +1,592 @@
+/*
+ This file is part of micronau.
+ Copyright (c) 2013 - David Smitley
+
+ Permission is granted to use this software under the terms of the GPL v2 (or any later version)
+
+ Details can be found at: www.gnu.org/licenses
+*/
+
+#include "SoundMatch.h"
+#include "HardwareReturn.h"
+
+static const char capture_magic[4] = {'M', 'N', 'C', 'P'};
+static const char fingerprint_magic[4] = {'M', 'N', 'F', 'P'};
+static const int FILE_VERSION = 1;
+
+// below this many butterflies per group a stage is cheaper as a plain loop
+static const int VECTOR_MIN = 8;
+
+//==============================================================================
+SpectrumAnalyser::SpectrumAnalyser()
+{
+    window.malloc(SIZE);
+    for (int i = 0; i < SIZE; i++) {
+        window[i] = 0.5f - 0.5f * std::cos(2.0f * MathConstants<float>::pi * i / SIZE);
+    }
+    tw_re.malloc(SIZE);
+    tw_im.malloc(SIZE);
+    for (int m = 1; m < SIZE; m *= 2) {
+        for (int k = 0; k < m; k++) {
+            double a = -MathConstants<double>::pi * k / m;
+            tw_re[m - 1 + k] = (float) std::cos(a);
+            tw_im[m - 1 + k] = (float) std::sin(a);
+        }
+    }
+    reversed.malloc(SIZE);
+    for (int i = 0; i < SIZE; i++) {
+        int r = 0;
+        for (int b = 0; b < ORDER; b++) {
+            r |= ((i >> b) & 1) << (ORDER - 1 - b);
+        }
+        reversed[i] = r;
+    }
+    re.malloc(SIZE);
+    im.malloc(SIZE);
+    t_re.malloc(SIZE);
+    t_im.malloc(SIZE);
+}
+
+void SpectrumAnalyser::transform(float *r, float *i)
+{
+    for (int k = 0; k < SIZE; k++) {
+        int j = reversed[k];
+        if (j > k) {
+            std::swap(r[k], r[j]);
+            std::swap(i[k], i[j]);
+        }
+    }
+    for (int m = 1; m < SIZE; m *= 2) {
+        const float *wr = tw_re + m - 1;
+        const float *wi = tw_im + m - 1;
+        for (int g = 0; g < SIZE; g += 2 * m) {
+            float *ar = r + g, *ai = i + g;
+            float *br = ar + m, *bi = ai + m;
+            if (m < VECTOR_MIN) {
+                for (int k = 0; k < m; k++) {
+                    float xr = wr[k] * br[k] - wi[k] * bi[k];
+                    float xi = wr[k] * bi[k] + wi[k] * br[k];
+                    br[k] = ar[k] - xr;
+                    bi[k] = ai[k] - xi;
+                    ar[k] += xr;
+                    ai[k] += xi;
+                }
+                continue;
+            }
+            FloatVectorOperations::multiply(t_re, wr, br, m);
+            FloatVectorOperations::subtractWithMultiply(t_re, wi, bi, m);
+            FloatVectorOperations::multiply(t_im, wr, bi, m);
+            FloatVectorOperations::addWithMultiply(t_im, wi, br, m);
+            FloatVectorOperations::subtract(br, ar, t_re, m);
+            FloatVectorOperations::subtract(bi, ai, t_im, m);
+            FloatVectorOperations::add(ar, t_re, m);
+            FloatVectorOperations::add(ai, t_im, m);
+        }
+    }
+}
+
+void SpectrumAnalyser::power(const float *in, float *out)
+{
+    FloatVectorOperations::multiply(re, in, window, SIZE);
+    FloatVectorOperations::clear(im, SIZE);
+    transform(re, im);
+    FloatVectorOperations::multiply(out, re, re, BINS);
+    FloatVectorOperations::addWithMultiply(out, im, im, BINS);
+}
+
+//==============================================================================
+bool SoundFingerprint::compute(const float *x, int n, double sample_rate, SpectrumAnalyser &fft)
+{
+    const int bins = SpectrumAnalyser::BINS;
+    if ((n < SpectrumAnalyser::SIZE) || (sample_rate <= 0)) {
+        return false;
+    }
+
+    float sum[bins], frame[bins];
+    FloatVectorOperations::clear(sum, bins);
+    int frames = 0;
+    for (int pos = 0; pos + SpectrumAnalyser::SIZE <= n; pos += SpectrumAnalyser::SIZE / 2) {
+        fft.power(x + pos, frame);
+        FloatVectorOperations::add(sum, frame, bins);
+        frames++;
+    }
+
+    // spectrum shape, log spaced bands of at least one bin
+    const double lo_hz = 100.0;
+    const double hi_hz = jmin(16000.0, sample_rate * 0.45);
+    const double bin_hz = sample_rate / SpectrumAnalyser::SIZE;
+    double total = 0;
+    float loudest_band = -1000.0f;
+    for (int b = 0; b < NUM_BANDS; b++) {
+        double f0 = lo_hz * std::pow(hi_hz / lo_hz, (double) b / NUM_BANDS);
+        double f1 = lo_hz * std::pow(hi_hz / lo_hz, (double) (b + 1) / NUM_BANDS);
+        int from = jlimit(1, bins - 1, (int) (f0 / bin_hz));
+        int to = jlimit(from + 1, bins, (int) (f1 / bin_hz));
+        double p = 0;
+        for (int k = from; k < to; k++) {
+            p += sum[k];
+        }
+        total += p;
+        values[b] = 10.0f * (float) std::log10(p / ((to - from) * frames) + 1.0e-12);
+        loudest_band = jmax(loudest_band, values[b]);
+    }
+    if (total < 1.0e-9) {
+        return false;
+    }
+    // bands far below the loudest are the noise floor, which depends on the level
+    for (int b = 0; b < NUM_BANDS; b++) {
+        values[b] = jmax(values[b] - loudest_band, -50.0f) / 20.0f;
+    }
+
+    // envelope, relative to its loudest part
+    float *env = values + NUM_BANDS;
+    const int seg = n / NUM_SEGMENTS;
+    float loudest = -1000.0f;
+    for (int s = 0; s < NUM_SEGMENTS; s++) {
+        const float *p = x + s * seg;
+        double sq = 0;
+        for (int i = 0; i < seg; i++) {
+            sq += p[i] * p[i];
+        }
+        env[s] = 10.0f * (float) std::log10(sq / seg + 1.0e-12);
+        loudest = jmax(loudest, env[s]);
+    }
+    for (int s = 0; s < NUM_SEGMENTS; s++) {
+        env[s] = jmax(env[s] - loudest, -40.0f) / 20.0f;
+    }
+    return true;
+}
+
+bool SoundFingerprint::compute_from_recording(const float *x, int n, double sample_rate, int length_ms, SpectrumAnalyser &fft)
+{
+    if (n <= 0) {
+        return false;
+    }
+    // the first sound is the first sample within 20dB of the loudest
+    float peak = OnsetDetector::peak(&x, 1, n);
+    int start = OnsetDetector::find(&x, 1, n, peak * 0.1f);
+    if ((peak <= 0) || (start < 0)) {
+        return false;
+    }
+    int len = jmin(n - start, (int) (length_ms * sample_rate / 1000.0));
+    return compute(x + start, len, sample_rate, fft);
+}
+
+float SoundFingerprint::distance(const SoundFingerprint &other) const
+{
+    float d = 0;
+    for (int i = 0; i < SIZE; i++) {
+        float v = values[i] - other.values[i];
+        d += v * v;
+    }
+    return d;
+}
+
+//==============================================================================
+void FingerprintIndex::table::allocate(int n)
+{
+    count = n;
+    columns.calloc((size_t) n * SoundFingerprint::SIZE);
+    valid.calloc((size_t) n);
+}
+
+FingerprintIndex::FingerprintIndex()
+{
+}
+
+void FingerprintIndex::clear(int num_programs)
+{
+    ScopedLock l(lock);
+    current.allocate(jmax(0, num_programs));
+}
+
+int FingerprintIndex::size() const
+{
+    ScopedLock l(lock);
+    return current.count;
+}
+
+int FingerprintIndex::num_fingerprints() const
+{
+    ScopedLock l(lock);
+    int n = 0;
+    for (int i = 0; i < current.count; i++) {
+        n += current.valid[i];
+    }
+    return n;
+}
+
+void FingerprintIndex::set(int index, const SoundFingerprint &fp)
+{
+    ScopedLock l(lock);
+    if (!isPositiveAndBelow(index, current.count)) {
+        return;
+    }
+    for (int d = 0; d < SoundFingerprint::SIZE; d++) {
+        current.columns[d * current.count + index] = fp.values[d];
+    }
+    current.valid[index] = 1;
+}
+
+bool FingerprintIndex::get(int index, SoundFingerprint &fp) const
+{
+    ScopedLock l(lock);
+    if (!isPositiveAndBelow(index, current.count) || !current.valid[index]) {
+        return false;
+    }
+    for (int d = 0; d < SoundFingerprint::SIZE; d++) {
+        fp.values[d] = current.columns[d * current.count + index];
+    }
+    return true;
+}
+
+Array<FingerprintIndex::Match> FingerprintIndex::match(const SoundFingerprint &target, int max_results) const
+{
+    ScopedLock l(lock);
+    Array<Match> result;
+    const int n = current.count;
+    if (n == 0) {
+        return result;
+    }
+
+    // a row at a time: dist += (row - target)^2 for every program at once
+    HeapBlock<float> dist(n, true), diff(n);
+    for (int d = 0; d < SoundFingerprint::SIZE; d++) {
+        FloatVectorOperations::add(diff, current.columns + d * n, -target.values[d], n);
+        FloatVectorOperations::multiply(diff, diff, n);
+        FloatVectorOperations::add(dist, diff, n);
+    }
+
+    result.ensureStorageAllocated(n);
+    for (int i = 0; i < n; i++) {
+        if (current.valid[i]) {
+            Match m = {i, dist[i]};
+            result.add(m);
+        }
+    }
+    int k = jlimit(0, result.size(), max_results);
+    std::partial_sort(result.begin(), result.begin() + k, result.end(), [] (const Match &a, const Match &b) {
+        return (a.distance < b.distance) || ((a.distance == b.distance) && (a.index < b.index));
+    });
+    result.removeRange(k, result.size() - k);
+    return result;
+}
+
+bool FingerprintIndex::save(const File &f) const
+{
+    MemoryOutputStream out;
+    {
+        ScopedLock l(lock);
+        out.write(fingerprint_magic, sizeof(fingerprint_magic));
+        out.writeInt(FILE_VERSION);
+        out.writeInt(current.count);
+        out.writeInt(SoundFingerprint::SIZE);
+        out.write(current.valid, (size_t) current.count);
+        for (int i = 0; i < current.count * SoundFingerprint::SIZE; i++) {
+            out.writeFloat(current.columns[i]);
+        }
+    }
+    return f.replaceWithData(out.getData(), out.getDataSize());
+}
+
+bool FingerprintIndex::load(const File &f)
+{
+    MemoryBlock m;
+    if (!f.loadFileAsData(m) || (m.getSize() < 16) || (memcmp(m.getData(), fingerprint_magic, 4) != 0)) {
+        return false;
+    }
+    MemoryInputStream in(m, false);
+    in.skipNextBytes(4);
+    int version = in.readInt();
+    int count = in.readInt();
+    int size = in.readInt();
+    if ((version != FILE_VERSION) || (size != SoundFingerprint::SIZE) || (count < 0) ||
+        (in.getNumBytesRemaining() != (int64) count * (1 + 4 * size))) {
+        return false;
+    }
+    table t;
+    t.allocate(count);
+    in.read(t.valid, count);
+    for (int i = 0; i < count * size; i++) {
+        t.columns[i] = in.readFloat();
+    }
+
+    ScopedLock l(lock);
+    current.count = t.count;
+    current.columns.swapWith(t.columns);
+    current.valid.swapWith(t.valid);
+    return true;
+}
+
+int FingerprintIndex::build(const File &dir, int num_programs, int num_threads)
+{
+    table t;
+    t.allocate(jmax(0, num_programs));
+    num_threads = jmax(1, num_threads);
+
+    // each worker takes the next program until there are none left; they
+    // write to different columns of t, so nothing is shared but the counter
+    Atomic<int> next(0);
+    Atomic<int> found(0);
+    Atomic<int> running(num_threads);
+    WaitableEvent finished;
+    {
+        ThreadPool pool(num_threads);
+        for (int j = 0; j < num_threads; j++) {
+            pool.addJob([&] {
+                SpectrumAnalyser fft;
+                Array<float> samples;
+                double rate;
+                for (int i = (next += 1) - 1; i < t.count; i = (next += 1) - 1) {
+                    SoundFingerprint fp;
+                    if (load_capture(capture_file(dir, i), samples, rate) &&
+                        fp.compute(samples.getRawDataPointer(), samples.size(), rate, fft)) {
+                        for (int d = 0; d < SoundFingerprint::SIZE; d++) {
+                            t.columns[d * t.count + i] = fp.values[d];
+                        }
+                        t.valid[i] = 1;
+                        found += 1;
+                    }
+                }
+                if ((running -= 1) == 0) {
+                    finished.signal();
+                }
+            });
+        }
+        finished.wait();
+    }
+
+    ScopedLock l(lock);
+    current.count = t.count;
+    current.columns.swapWith(t.columns);
+    current.valid.swapWith(t.valid);
+    return found.get();
+}
+
+File FingerprintIndex::captures_dir(const File &bank)
+{
+    return bank.getSiblingFile(bank.getFileNameWithoutExtension() + ".captures");
+}
+
+File FingerprintIndex::fingerprints_file(const File &bank)
+{
+    return bank.withFileExtension(".fingerprints");
+}
+
+File FingerprintIndex::capture_file(const File &dir, int index)
+{
+    return dir.getChildFile(String(index).paddedLeft('0', 4) + ".cap");
+}
+
+//==============================================================================
+bool save_capture(const File &f, const float *samples, int n, double sample_rate)
+{
+    MemoryOutputStream out;
+    out.write(capture_magic, sizeof(capture_magic));
+    out.writeInt(FILE_VERSION);
+    out.writeInt(roundToInt(sample_rate));
+    out.writeInt(n);
+    for (int i = 0; i < n; i++) {
+        out.writeFloat(samples[i]);
+    }
+    return f.replaceWithData(out.getData(), out.getDataSize());
+}
+
+bool load_capture(const File &f, Array<float> &samples, double &sample_rate)
+{
+    MemoryBlock m;
+    if (!f.loadFileAsData(m) || (m.getSize() < 16) || (memcmp(m.getData(), capture_magic, 4) != 0)) {
+        return false;
+    }
+    MemoryInputStream in(m, false);
+    in.skipNextBytes(4);
+    int version = in.readInt();
+    int rate = in.readInt();
+    int n = in.readInt();
+    if ((version != FILE_VERSION) || (rate <= 0) || (n < 0) || (in.getNumBytesRemaining() != (int64) n * 4)) {
+        return false;
+    }
+    sample_rate = rate;
+    samples.resize(n);
+    for (int i = 0; i < n; i++) {
+        samples.setUnchecked(i, in.readFloat());
+    }
+    return true;
+}
+
+//==============================================================================
+namespace {
+
+// a note of the test pitch: harmonics falling off by brightness per octave,
+// an attack and an exponential decay, after lead samples of silence
+void make_note(Array<float> &out, double sr, int lead, float brightness, float attack_ms, float decay_ms, float gain, float noise, int seed)
+{
+    const int n = lead + (int) (HardwareReturn::CAPTURE_MS * sr / 1000.0);
+    const double f0 = 261.63;
+    Random rnd(seed);
+    out.resize(n);
+    for (int i = 0; i < n; i++) {
+        double t = (i - lead) / sr;
+        float v = 0;
+        if (i >= lead) {
+            double env = jmin(1.0, t * 1000.0 / attack_ms) * std::exp(-t * 1000.0 / decay_ms);
+            for (int h = 1; h <= 12; h++) {
+                v += (float) (std::pow(brightness, std::log2((double) h)) * std::sin(2.0 * MathConstants<double>::pi * f0 * h * t));
+            }
+            v *= (float) env * gain;
+        }
+        out.setUnchecked(i, v + noise * (rnd.nextFloat() * 2.0f - 1.0f));
+    }
+}
+
+struct program_sound {
+    float brightness, attack_ms, decay_ms;
+};
+
+program_sound sound_of(int p)
+{
+    program_sound s = {0.15f + 0.04f * (p % 20), 1.0f + 40.0f * ((p / 4) % 5), 80.0f + 300.0f * ((p * 7) % 11)};
+    return s;
+}
+
+}
+
+bool SoundMatchTests()
+{
+    SpectrumAnalyser fft;
+    const int size = SpectrumAnalyser::SIZE;
+
+    // against a plain dft
+    {
+        HeapBlock<float> re(size), im(size);
+        Random rnd(5);
+        Array<float> x;
+        for (int i = 0; i < size; i++) {
+            x.add(rnd.nextFloat() - 0.5f);
+            re[i] = x[i];
+            im[i] = 0;
+        }
+        fft.transform(re, im);
+        const int check[] = {0, 1, 7, 100, 511, 512, 900};
+        for (int k : check) {
+            double sr = 0, si = 0;
+            for (int i = 0; i < size; i++) {
+                double a = -2.0 * MathConstants<double>::pi * k * i / size;
+                sr += x[i] * std::cos(a);
+                si += x[i] * std::sin(a);
+            }
+            if ((std::abs(sr - re[k]) > 1.0e-3 * size) || (std::abs(si - im[k]) > 1.0e-3 * size)) {
+                Logger::writeToLog("SoundMatch: fft bin " + String(k) + " wrong");
+                return false;
+            }
+        }
+    }
+
+    // a sine lands in its bin
+    {
+        HeapBlock<float> x(size), p(SpectrumAnalyser::BINS);
+        for (int i = 0; i < size; i++) {
+            x[i] = std::sin(2.0f * MathConstants<float>::pi * 50 * i / size);
+        }
+        fft.power(x, p);
+        int best = 0;
+        for (int k = 1; k < SpectrumAnalyser::BINS; k++) {
+            best = (p[k] > p[best]) ? k : best;
+        }
+        if (best != 50) {
+            Logger::writeToLog("SoundMatch: sine found in bin " + String(best));
+            return false;
+        }
+    }
+
+    // level does not matter, timbre and envelope do
+    const double sr = 44100;
+    Array<float> a, b;
+    SoundFingerprint fa, fb;
+    make_note(a, sr, 0, 0.5f, 5, 400, 0.8f, 0.0005f, 1);
+    make_note(b, sr, 0, 0.5f, 5, 400, 0.1f, 0.0005f, 2);
+    if (!fa.compute(a.getRawDataPointer(), a.size(), sr, fft) || !fb.compute(b.getRawDataPointer(), b.size(), sr, fft) ||
+        (fa.distance(fb) > 0.05f)) {
+        Logger::writeToLog("SoundMatch: level changes the fingerprint, " + String(fa.distance(fb)));
+        return false;
+    }
+    const float same = fa.distance(fb);
+    make_note(b, sr, 0, 0.9f, 5, 400, 0.8f, 0.0005f, 3);
+    fb.compute(b.getRawDataPointer(), b.size(), sr, fft);
+    const float brighter = fa.distance(fb);
+    make_note(b, sr, 0, 0.5f, 5, 80, 0.8f, 0.0005f, 4);
+    fb.compute(b.getRawDataPointer(), b.size(), sr, fft);
+    const float shorter = fa.distance(fb);
+    if ((brighter < 20 * same) || (shorter < 20 * same)) {
+        Logger::writeToLog("SoundMatch: timbre or envelope not told apart");
+        return false;
+    }
+    if (fa.compute(a.getRawDataPointer(), size - 1, sr, fft)) {
+        Logger::writeToLog("SoundMatch: fingerprint of less than an fft");
+        return false;
+    }
+
+    // a library of captures beside a bank file, fingerprinted on several threads
+    const int num = 60;
+    File bank = File::createTempFile(".syx");
+    File dir = FingerprintIndex::captures_dir(bank);
+    dir.createDirectory();
+    FingerprintIndex serial;
+    serial.clear(num);
+    for (int p = 0; p < num; p++) {
+        if (p % 7 == 3) {
+            continue;   // no capture
+        }
+        program_sound s = sound_of(p);
+        make_note(a, sr, 0, s.brightness, s.attack_ms, s.decay_ms, 0.5f, 0.0005f, p);
+        save_capture(FingerprintIndex::capture_file(dir, p), a.getRawDataPointer(), a.size(), sr);
+        fa.compute(a.getRawDataPointer(), a.size(), sr, fft);
+        serial.set(p, fa);
+    }
+    FingerprintIndex index;
+    int built = index.build(dir, num, 4);
+    bool ok = (built == serial.num_fingerprints()) && (index.size() == num);
+    for (int p = 0; ok && p < num; p++) {
+        SoundFingerprint x, y;
+        bool has = serial.get(p, x);
+        ok = (has == index.get(p, y)) && (!has || (memcmp(x.values, y.values, sizeof(x.values)) == 0));
+    }
+    if (!ok) {
+        Logger::writeToLog("SoundMatch: threaded build differs, " + String(built) + " built");
+        dir.deleteRecursively();
+        bank.deleteFile();
+        return false;
+    }
+
+    // saved and loaded
+    File fpf = FingerprintIndex::fingerprints_file(bank);
+    FingerprintIndex loaded;
+    ok = index.save(fpf) && loaded.load(fpf) && (loaded.num_fingerprints() == built);
+    ok = ok && !loaded.load(FingerprintIndex::capture_file(dir, 0)) && (loaded.num_fingerprints() == built);
+    dir.deleteRecursively();
+    fpf.deleteFile();
+    bank.deleteFile();
+    if (!ok) {
+        Logger::writeToLog("SoundMatch: fingerprints not saved and loaded");
+        return false;
+    }
+
+    // a recording of one of them, quieter, noisier and late, finds it
+    for (int p = 0; p < num; p += 5) {
+        if (p % 7 == 3) {
+            continue;
+        }
+        program_sound s = sound_of(p);
+        make_note(b, 48000, 9000, s.brightness, s.attack_ms, s.decay_ms, 0.2f, 0.0005f, 100 + p);
+        SoundFingerprint target;
+        Array<FingerprintIndex::Match> m;
+        if (target.compute_from_recording(b.getRawDataPointer(), b.size(), 48000, HardwareReturn::CAPTURE_MS, fft)) {
+            m = loaded.match(target, 5);
+        }
+        if ((m.size() != 5) || (m[0].index != p) || (m[1].distance < m[0].distance) || (m[4].distance < m[3].distance)) {
+            Logger::writeToLog("SoundMatch: program " + String(p) + " not matched" + (m.size() ? ", got " + String(m[0].index) : String()));
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,149 @@
+/*
+ This file is part of micronau.
+ Copyright (c) 2013 - David Smitley
+
+ Permission is granted to use this software under the terms of the GPL v2 (or any later version)
+
+ Details can be found at: www.gnu.org/licenses
+*/
+
+#ifndef __SOUNDMATCH_H__
+#define __SOUNDMATCH_H__
+
+#include "MicronauCore.h"
+#include <juce_audio_basics/juce_audio_basics.h>
+
+//==============================================================================
+/*
+    SpectrumAnalyser:
+        Radix-2 FFT of a fixed size. The data is kept as separate real and
+        imaginary arrays and the twiddles of each stage are stored next to each
+        other, so every stage past the first few is a handful of
+        FloatVectorOperations calls over whole runs of butterflies. All the
+        buffers are allocated by the constructor; one analyser per thread.
+*/
+class SpectrumAnalyser
+{
+public:
+    enum {
+        ORDER = 10,
+        SIZE = 1 << ORDER,
+        BINS = SIZE / 2
+    };
+
+    SpectrumAnalyser();
+
+    // power of the first BINS bins of SIZE Hann windowed samples
+    void power(const float *in, float *out);
+    // in place, SIZE points
+    void transform(float *re, float *im);
+
+private:
+    HeapBlock<float> window;
+    HeapBlock<float> tw_re, tw_im;  // stage with m butterflies per group starts at m - 1
+    HeapBlock<int> reversed;
+    HeapBlock<float> re, im, t_re, t_im;
+
+    JUCE_DECLARE_NON_COPYABLE (SpectrumAnalyser)
+};
+
+//==============================================================================
+/*
+    SoundFingerprint:
+        A short description of how a note sounds, made from a recording that
+        starts at its onset (HardwareReturn::capture makes them):
+          - spectrum: the power in NUM_BANDS log spaced bands from 100Hz, summed
+            over the whole recording so the loud part counts most, in dB below
+            the loudest band down to -50, so neither the level nor the noise
+            floor matter
+          - envelope: the rms of NUM_SEGMENTS equal parts of the recording in
+            dB below the loudest, down to -40
+        Both are scaled to about the same range, and the distance between two
+        fingerprints is the sum of the squared differences.
+*/
+struct SoundFingerprint
+{
+    enum {
+        NUM_BANDS = 24,
+        NUM_SEGMENTS = 16,
+        SIZE = NUM_BANDS + NUM_SEGMENTS
+    };
+
+    float values[SIZE];
+
+    // false if there is less than one fft of sound
+    bool compute(const float *samples, int n, double sample_rate, SpectrumAnalyser &fft);
+    // a recording from anywhere: starts at the first sound and takes length_ms of it
+    bool compute_from_recording(const float *samples, int n, double sample_rate, int length_ms, SpectrumAnalyser &fft);
+    float distance(const SoundFingerprint &other) const;
+};
+
+//==============================================================================
+/*
+    FingerprintIndex:
+        The fingerprints of a program library, by program index, and the search
+        for the programs that sound closest to a target.
+
+        The values are stored a dimension at a time over all programs (SIZE
+        rows of size() floats), so a search is SIZE vector passes down the rows
+        rather than a loop over programs.
+
+        Captures of the library are kept beside the bank file in a
+        "<bank>.captures" folder, one file per program, and their fingerprints
+        in "<bank>.fingerprints". build() makes the fingerprints from the
+        captures on a pool of threads; the index is swapped in when it is done,
+        so searches can go on meanwhile.
+*/
+class FingerprintIndex
+{
+public:
+    struct Match {
+        int index;
+        float distance;
+    };
+
+    FingerprintIndex();
+
+    // forget everything and make room for num_programs
+    void clear(int num_programs);
+    int size() const;
+    int num_fingerprints() const;
+    void set(int index, const SoundFingerprint &fp);
+    bool get(int index, SoundFingerprint &fp) const;
+
+    // the max_results closest programs, nearest first
+    Array<Match> match(const SoundFingerprint &target, int max_results) const;
+
+    bool save(const File &f) const;
+    bool load(const File &f);
+
+    // fingerprints the captures in dir of programs 0..num_programs-1 with
+    // num_threads threads, returns how many there were
+    int build(const File &dir, int num_programs, int num_threads);
+
+    static File captures_dir(const File &bank);
+    static File fingerprints_file(const File &bank);
+    static File capture_file(const File &dir, int index);
+
+private:
+    struct table {
+        table() : count(0) {}
+        void allocate(int n);
+        int count;
+        HeapBlock<float> columns;
+        HeapBlock<uint8> valid;
+    };
+
+    CriticalSection lock;
+    table current;
+
+    JUCE_DECLARE_NON_COPYABLE (FingerprintIndex)
+};
+
+// a capture as raw little-endian floats with a small header
+bool save_capture(const File &f, const float *samples, int n, double sample_rate);
+bool load_capture(const File &f, Array<float> &samples, double &sample_rate);
+
+bool SoundMatchTests();
+
+#endif  // __SOUNDMATCH_H__
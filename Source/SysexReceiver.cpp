@@ -0,0 +1,228 @@
+/*
+ This file is part of micronau.
+ Copyright (c) 2013 - David Smitley
+
+ Permission is granted to use this software under the terms of the GPL v2 (or any later version)
+
+ Details can be found at: www.gnu.org/licenses
+*/
+
+#include "SysexReceiver.h"
+#include "BinaryData.h"
+
+SysexReceiver::SysexReceiver(ProgramFunction f) :
+    Thread("micronau sysex"),
+    deliver(f),
+    assembly_len(0),
+    in_sysex(false),
+    overflow(false),
+    fifo(NUM_SLOTS)
+{
+    assembly.calloc(PROGRAM_LEN);
+    slots.calloc(NUM_SLOTS * PROGRAM_LEN);
+    startThread();
+}
+
+SysexReceiver::~SysexReceiver()
+{
+    signalThreadShouldExit();
+    notify();
+    stopThread(2000);
+}
+
+void SysexReceiver::add_message(const MidiMessage &msg)
+{
+    if (msg.isSysEx()) {
+        add_bytes(msg.getRawData(), msg.getRawDataSize());
+    }
+}
+
+void SysexReceiver::add_bytes(const uint8 *data, int size)
+{
+    for (int i = 0; i < size; i++) {
+        uint8 b = data[i];
+        if (b == 0xf0) {
+            if (in_sysex) {
+                // previous message never finished
+                end_message();
+            }
+            in_sysex = true;
+            overflow = false;
+            assembly_len = 0;
+        } else if (b == 0xf7) {
+            if (in_sysex) {
+                end_message();
+            }
+        } else if (b >= 0xf8) {
+            // realtime bytes may appear anywhere, even inside sysex
+        } else if (b & 0x80) {
+            // any other status byte ends the message early
+            if (in_sysex) {
+                end_message();
+            }
+        } else if (in_sysex) {
+            if (assembly_len < PROGRAM_LEN) {
+                assembly[assembly_len++] = b;
+            } else {
+                overflow = true;
+            }
+        }
+    }
+}
+
+void SysexReceiver::end_message()
+{
+    in_sysex = false;
+
+    // only program dumps are ours, anything else is ignored
+    if ((assembly_len < 4) ||
+        (assembly[0] != 0x00) || (assembly[1] != 0x00) || (assembly[2] != 0x0e) || (assembly[3] != 0x22)) {
+        return;
+    }
+    received += 1;
+
+    int result = overflow ? SYSEX_BAD_LENGTH : validateProgramSysex(assembly, assembly_len);
+    switch (result) {
+        case SYSEX_OK:
+            break;
+        case SYSEX_BAD_LENGTH:
+            bad_length += 1;
+            return;
+        case SYSEX_BAD_HEADER:
+            bad_header += 1;
+            return;
+        default:
+            bad_checksum += 1;
+            return;
+    }
+
+    int start1, size1, start2, size2;
+    fifo.prepareToWrite(1, start1, size1, start2, size2);
+    if (size1 == 0) {
+        dropped += 1;
+        return;
+    }
+    memcpy(slots + start1 * PROGRAM_LEN, assembly, PROGRAM_LEN);
+    fifo.finishedWrite(1);
+    queued += 1;
+    notify();
+}
+
+void SysexReceiver::run()
+{
+    while (!threadShouldExit()) {
+        int start1, size1, start2, size2;
+        fifo.prepareToRead(1, start1, size1, start2, size2);
+        if (size1 == 0) {
+            wait(100);
+            continue;
+        }
+        if (deliver) {
+            deliver(slots + start1 * PROGRAM_LEN, PROGRAM_LEN);
+        }
+        fifo.finishedRead(1);
+        delivered += 1;
+    }
+}
+
+bool SysexReceiver::wait_until_idle(int timeout_ms)
+{
+    uint32 start = Time::getMillisecondCounter();
+    while (delivered.get() != queued.get()) {
+        if (Time::getMillisecondCounter() - start > (uint32) timeout_ms) {
+            return false;
+        }
+        Thread::sleep(1);
+    }
+    return true;
+}
+
+bool SysexReceiverTests()
+{
+    int sz;
+    const char *x = BinaryData::getNamedResource("default_syx", sz);
+    const uint8 *def = (const uint8 *) x;
+    if ((sz != SYSEX_PROGRAM_SIZE) || (validateProgramSysex(def + 1, sz - 2) != SYSEX_OK)) {
+        Logger::writeToLog("SysexReceiver: default program does not validate");
+        return false;
+    }
+
+    Atomic<int> names_ok;
+    SysexReceiver r([&] (const uint8 *data, int size) {
+        IonSysexParams p;
+        if (p.parseParamsFromContent((unsigned char *) data, size) && (p.get_prog_name().isNotEmpty())) {
+            names_ok += 1;
+        }
+    });
+
+    // fragmented, with realtime clock bytes in the middle of the dump
+    Random rnd(1);
+    for (int n = 0; n < 8; n++) {
+        int pos = 0;
+        while (pos < sz) {
+            int len = jmin(sz - pos, 1 + rnd.nextInt(40));
+            r.add_bytes(def + pos, len);
+            const uint8 clock = 0xf8;
+            r.add_bytes(&clock, 1);
+            pos += len;
+        }
+    }
+    if (!r.wait_until_idle(2000) || (r.get_delivered() != 8) || (names_ok.get() != 8)) {
+        Logger::writeToLog("SysexReceiver: fragmented dumps not reassembled");
+        return false;
+    }
+
+    // corrupted content byte, truncated dump, bad tag, and a note-on cutting a dump short
+    HeapBlock<uint8> bad(sz);
+    memcpy(bad, def, sz);
+    bad[200] ^= 0x01;
+    r.add_bytes(bad, sz);
+    r.add_bytes(def, sz - 10);
+    r.add_bytes(def + sz - 1, 1);
+    memcpy(bad, def, sz);
+    bad[10] ^= 0x01;
+    r.add_bytes(bad, sz);
+    const uint8 note[] = {0x90, 0x40, 0x7f};
+    r.add_bytes(def, 100);
+    r.add_bytes(note, sizeof(note));
+    r.add_bytes(def + 100, sz - 100);
+    if ((r.get_bad_checksum() != 1) || (r.get_bad_length() != 2) || (r.get_bad_header() != 1)) {
+        Logger::writeToLog("SysexReceiver: bad dumps not rejected");
+        return false;
+    }
+
+    // foreign sysex is not counted
+    const uint8 other[] = {0xf0, 0x43, 0x10, 0x4c, 0x00, 0xf7};
+    r.add_bytes(other, sizeof(other));
+    if (r.get_received() != 12) {
+        Logger::writeToLog("SysexReceiver: foreign sysex counted");
+        return false;
+    }
+
+    // back to back with a slow consumer: nothing blocks, overflow is dropped, not corrupted
+    {
+        Atomic<int> good;
+        SysexReceiver slow([&] (const uint8 *data, int size) {
+            Thread::sleep(5);
+            if (validateProgramSysex(data, size) == SYSEX_OK) {
+                good += 1;
+            }
+        });
+        uint32 start = Time::getMillisecondCounter();
+        for (int n = 0; n < 200; n++) {
+            slow.add_bytes(def, sz);
+        }
+        if (Time::getMillisecondCounter() - start > 100) {
+            Logger::writeToLog("SysexReceiver: input stalled");
+            return false;
+        }
+        if (!slow.wait_until_idle(5000) ||
+            (slow.get_delivered() + slow.get_dropped() != 200) ||
+            (good.get() != slow.get_delivered()) ||
+            (slow.get_dropped() == 0)) {
+            Logger::writeToLog("SysexReceiver: back to back dumps mishandled");
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,92 @@
+/*
+ This file is part of micronau.
+ Copyright (c) 2013 - David Smitley
+
+ Permission is granted to use this software under the terms of the GPL v2 (or any later version)
+
+ Details can be found at: www.gnu.org/licenses
+*/
+
+#ifndef __SYSEXRECEIVER_H__
+#define __SYSEXRECEIVER_H__
+
+#include "MicronauCore.h"
+#include <juce_audio_basics/juce_audio_basics.h>
+#include "IonSysex.h"
+#include <functional>
+
+//==============================================================================
+/*
+    SysexReceiver:
+        Sits between the midi input callback and the program parser.
+
+        Incoming bytes are reassembled into sysex messages in a fixed buffer, so
+        a dump split over several callbacks (or interleaved with realtime bytes)
+        comes out whole. Complete program dumps are checked for length, header
+        and checksum, then copied into a pre-sized ring of program slots; none
+        of this allocates or blocks, so it is safe on the midi thread.
+
+        A worker thread empties the ring and hands each program to the
+        ProgramFunction, which is where the (slow) decode and listener updates
+        happen. If dumps arrive faster than the worker takes them the newest
+        ones are dropped and counted, earlier ones are never overwritten.
+*/
+class SysexReceiver : private Thread
+{
+public:
+    // program data without f0/f7, always SYSEX_PROGRAM_SIZE - 2 bytes
+    typedef std::function<void (const uint8 *data, int size)> ProgramFunction;
+
+    enum {
+        NUM_SLOTS = 32,
+        PROGRAM_LEN = SYSEX_PROGRAM_SIZE - 2
+    };
+
+    SysexReceiver(ProgramFunction f);
+    ~SysexReceiver();
+
+    // raw midi bytes, in any fragmentation
+    void add_bytes(const uint8 *data, int size);
+    // one complete message
+    void add_message(const MidiMessage &msg);
+
+    // wait until everything received so far has been handed on
+    bool wait_until_idle(int timeout_ms);
+
+    int get_received() const {return received.get();}
+    int get_delivered() const {return delivered.get();}
+    int get_bad_length() const {return bad_length.get();}
+    int get_bad_header() const {return bad_header.get();}
+    int get_bad_checksum() const {return bad_checksum.get();}
+    int get_dropped() const {return dropped.get();}
+
+private:
+    void run();
+    void end_message();
+
+    ProgramFunction deliver;
+
+    // reassembly, only touched by the thread feeding bytes in
+    HeapBlock<uint8> assembly;
+    int assembly_len;
+    bool in_sysex;
+    bool overflow;
+
+    // validated programs waiting for the worker
+    AbstractFifo fifo;
+    HeapBlock<uint8> slots;
+
+    Atomic<int> received;
+    Atomic<int> queued;
+    Atomic<int> delivered;
+    Atomic<int> bad_length;
+    Atomic<int> bad_header;
+    Atomic<int> bad_checksum;
+    Atomic<int> dropped;
+
+    JUCE_DECLARE_NON_COPYABLE (SysexReceiver)
+};
+
+bool SysexReceiverTests();
+
+#endif  // __SYSEXRECEIVER_H__
@@ -0,0 +1,400 @@
+/*
+ This file is part of micronau.
+ Copyright (c) 2013 - David Smitley
+
+ Permission is granted to use this software under the terms of the GPL v2 (or any later version)
+
+ Details can be found at: www.gnu.org/licenses
+*/
+
+#include "VirtualMicron.h"
+#include "BankDump.h"
+#include "BinaryData.h"
+
+const char *VirtualMicron::port_name = "Virtual Micron";
+
+VirtualMicron::VirtualMicron() :
+    Thread("virtual micron"),
+    in_wire_free(0),
+    out_wire_free(0),
+    midi_chan(0),
+    bandwidth(DIN_BYTES_PER_SEC),
+    latency_ms(1.0),
+    nrpn_msb(0),
+    nrpn_lsb(0),
+    data_msb(0),
+    cur_bank(0)
+{
+    int sz;
+    const char *x = BinaryData::getNamedResource("default_syx", sz);
+    edit.parseParamsFromContent((unsigned char *) &x[1], sz - 2);
+    scratch.parseParamsFromContent((unsigned char *) &x[1], sz - 2);
+
+    startThread();
+}
+
+VirtualMicron::~VirtualMicron()
+{
+    stopThread(2000);
+}
+
+void VirtualMicron::set_output(OutputFunction f)
+{
+    ScopedLock o(output_lock);
+    output = f;
+}
+
+double VirtualMicron::wire_time(int bytes) const
+{
+    if (bandwidth <= 0) {
+        return 0.0;
+    }
+    return bytes * 1000.0 / bandwidth;
+}
+
+void VirtualMicron::send(const MidiMessage &msg)
+{
+    ScopedLock l(lock);
+    double now = Time::getMillisecondCounterHiRes();
+    in_wire_free = jmax(in_wire_free, now) + wire_time(msg.getRawDataSize());
+
+    event e = {in_wire_free + latency_ms, msg};
+    incoming.push_back(e);
+    bytes_in += msg.getRawDataSize();
+    notify();
+}
+
+void VirtualMicron::reply(const MidiMessage &msg, double now)
+{
+    out_wire_free = jmax(out_wire_free, now) + wire_time(msg.getRawDataSize());
+
+    event e = {out_wire_free, msg};
+    outgoing.push_back(e);
+    bytes_out += msg.getRawDataSize();
+}
+
+void VirtualMicron::run()
+{
+    while (!threadShouldExit()) {
+        double now = Time::getMillisecondCounterHiRes();
+        double next = now + 100;
+        MidiMessage to_host;
+        bool have_out = false;
+        {
+            ScopedLock l(lock);
+            if (!incoming.empty() && (incoming.front().due <= now)) {
+                MidiMessage m = incoming.front().msg;
+                incoming.pop_front();
+                process(m, now);
+                continue;
+            }
+            if (!outgoing.empty() && (outgoing.front().due <= now)) {
+                to_host = outgoing.front().msg;
+                outgoing.pop_front();
+                have_out = true;
+            } else {
+                if (!incoming.empty()) {
+                    next = jmin(next, incoming.front().due);
+                }
+                if (!outgoing.empty()) {
+                    next = jmin(next, outgoing.front().due);
+                }
+            }
+        }
+
+        // deliver outside the lock, the receiver may well send straight back to us
+        if (have_out) {
+            ScopedLock o(output_lock);
+            if (output) {
+                output(to_host);
+            }
+            continue;
+        }
+
+        int ms = (int) (next - now);
+        if (ms > 0) {
+            wait(ms);
+        }
+    }
+}
+
+void VirtualMicron::process(const MidiMessage &msg, double now)
+{
+    if (msg.isSysEx()) {
+        handle_sysex(msg.getSysExData(), msg.getSysExDataSize(), now);
+        return;
+    }
+    if (msg.getChannel() != midi_chan + 1) {
+        return;
+    }
+    if (msg.isController()) {
+        handle_controller(msg.getControllerNumber(), msg.getControllerValue());
+    } else if (msg.isProgramChange()) {
+        load_program(ProgramBank::slot_of(cur_bank, msg.getProgramChangeNumber()));
+    }
+}
+
+void VirtualMicron::handle_controller(int cc, int value)
+{
+    switch (cc) {
+        case 0x63:
+            nrpn_msb = value;
+            break;
+        case 0x62:
+            nrpn_lsb = value;
+            break;
+        case 0x06:
+            data_msb = value;
+            break;
+        case 0x26:
+            apply_nrpn((nrpn_msb << 7) | nrpn_lsb, (data_msb << 7) | value);
+            break;
+        case 32:
+            cur_bank = jlimit(0, ProgramBank::NUM_BANKS - 1, value);
+            break;
+    }
+}
+
+void VirtualMicron::apply_nrpn(int nrpn, int value)
+{
+    nrpns_received += 1;
+    IonSysexParam *p = param_of_wire_nrpn(nrpn);
+    if (p == NULL) {
+        return;
+    }
+    // data is 14 bits, two's complement for signed parameters and negative list values
+    int signed_value = (value & 0x2000) ? value - 0x4000 : value;
+    if (p->getMin() < 0) {
+        value = signed_value;
+    }
+
+    vector<ListItemParameter> &list = p->getList();
+    for (unsigned int i = 0; i < list.size(); i++) {
+        if (list[i].hasSpecialNrpnValue() && (list[i].getNrpnValue() == signed_value)) {
+            value = i;
+            break;
+        }
+    }
+    p->setValue(value);
+}
+
+// the reverse of what the plugin does before sending a parameter: fx parameters
+// depend on the selected fx type and everything above 512 is sent 512 lower.
+IonSysexParam *VirtualMicron::param_of_wire_nrpn(int nrpn)
+{
+    IonSysexParam *match = NULL;
+    for (unsigned int i = 0; i < edit.numParams(); i++) {
+        IonSysexParam *p = edit.getParam(i);
+        if (!p->hasNrpn()) {
+            continue;
+        }
+        if (edit.shouldSkipFx1(p) || edit.shouldSkipFx2(p)) {
+            continue;
+        }
+        int n = edit.fx1fx2NrpnNum(p);
+        if ((n == NO_NRPN) || (n >= 2048)) {
+            continue;
+        }
+        if (n >= 512) {
+            n -= 512;
+        }
+        if (n != nrpn) {
+            continue;
+        }
+        // a few plugin-only controls share numbers with program parameters, the
+        // program parameter is the one the synth knows about
+        if (p->getOffset() >= 0) {
+            return p;
+        }
+        if (match == NULL) {
+            match = p;
+        }
+    }
+    return match;
+}
+
+void VirtualMicron::handle_sysex(const uint8 *data, int size, double now)
+{
+    if ((size < 4) || (data[0] != 0x00) || (data[1] != 0x00) || (data[2] != 0x0e)) {
+        return;
+    }
+
+    if ((data[3] == 0x22) && (size == ProgramBank::PROGRAM_LEN)) {
+        edit.parseParamsFromContent((unsigned char *) data, size);
+        dumps_received += 1;
+        return;
+    }
+
+    if ((data[3] == 0x26) && (size >= 8) && (data[4] == 0x41)) {
+        int bank = data[5];
+        int prog = (data[6] << 7) | data[7];
+        unsigned char sysex[ProgramBank::PROGRAM_LEN];
+        if (get_program(ProgramBank::slot_of(bank, prog), sysex)) {
+            reply(MidiMessage::createSysExMessage(sysex, sizeof(sysex)), now);
+            requests_served += 1;
+        }
+    }
+}
+
+bool VirtualMicron::get_program(int slot, unsigned char *sysex)
+{
+    if ((slot < 0) || (slot >= ProgramBank::NUM_SLOTS)) {
+        return false;
+    }
+    if (memory.get_program(slot, sysex)) {
+        return true;
+    }
+
+    unsigned char buf[SYSEX_PROGRAM_SIZE];
+    scratch.set_prog_name(String::formatted("Bank%d Prog%03d", ProgramBank::bank_of(slot) + 1, ProgramBank::prog_of(slot) + 1));
+    scratch.getAsSysexMessage(buf);
+    memcpy(sysex, buf + 1, ProgramBank::PROGRAM_LEN);
+    return true;
+}
+
+void VirtualMicron::load_program(int slot)
+{
+    unsigned char sysex[ProgramBank::PROGRAM_LEN];
+    if (get_program(slot, sysex)) {
+        edit.parseParamsFromContent(sysex, sizeof(sysex));
+    }
+}
+
+int VirtualMicron::get_param_value(int nrpn)
+{
+    ScopedLock l(lock);
+    for (unsigned int i = 0; i < edit.numParams(); i++) {
+        IonSysexParam *p = edit.getParam(i);
+        if (p->getNrpn() == nrpn) {
+            return p->getValue();
+        }
+    }
+    return 0;
+}
+
+String VirtualMicron::get_prog_name()
+{
+    ScopedLock l(lock);
+    return edit.get_prog_name();
+}
+
+//==============================================================================
+static void send_test_nrpn(VirtualMicron &vm, int nrpn, int value)
+{
+    vm.send(MidiMessage::controllerEvent(1, 0x63, (nrpn >> 7) & 0x7f));
+    vm.send(MidiMessage::controllerEvent(1, 0x62, nrpn & 0x7f));
+    vm.send(MidiMessage::controllerEvent(1, 0x06, (value >> 7) & 0x7f));
+    vm.send(MidiMessage::controllerEvent(1, 0x26, value & 0x7f));
+}
+
+static bool wait_for(std::function<bool ()> done, int timeout_ms)
+{
+    uint32 start = Time::getMillisecondCounter();
+    while (!done()) {
+        if (Time::getMillisecondCounter() - start > (uint32) timeout_ms) {
+            return false;
+        }
+        Thread::sleep(1);
+    }
+    return true;
+}
+
+bool VirtualMicronTests()
+{
+    VirtualMicron vm;
+    CriticalSection replies_lock;
+    Array<MidiMessage> replies;
+    vm.set_output([&] (const MidiMessage &m) {
+        ScopedLock l(replies_lock);
+        replies.add(m);
+    });
+
+    // nrpn edits: filter 1 cutoff (556 goes out as 44) and mod 1 level, which is negative
+    send_test_nrpn(vm, 44, 600);
+    send_test_nrpn(vm, 694 - 512, -250);
+    if (!wait_for([&] { return vm.get_nrpns_received() == 2; }, 1000)) {
+        Logger::writeToLog("VirtualMicron: nrpns not received");
+        return false;
+    }
+    if ((vm.get_param_value(556) != 600) || (vm.get_param_value(694) != -250)) {
+        Logger::writeToLog("VirtualMicron: nrpn values not applied");
+        return false;
+    }
+
+    // program dump into the edit buffer
+    {
+        IonSysexParams p;
+        unsigned char buf[SYSEX_PROGRAM_SIZE];
+        int sz;
+        const char *x = BinaryData::getNamedResource("default_syx", sz);
+        p.parseParamsFromContent((unsigned char *) &x[1], sz - 2);
+        p.set_prog_name("test dump");
+        p.getAsSysexMessage(buf);
+        vm.send(MidiMessage(buf, sizeof(buf)));
+        if (!wait_for([&] { return vm.get_dumps_received() == 1; }, 1000) || (vm.get_prog_name() != "test dump")) {
+            Logger::writeToLog("VirtualMicron: program dump not loaded");
+            return false;
+        }
+    }
+
+    // request -> reply, which has to take at least as long as the two wire transfers
+    {
+        double start = Time::getMillisecondCounterHiRes();
+        MidiMessage req = BankDump::make_request(2, 5);
+        vm.send(req);
+        if (!wait_for([&] { ScopedLock l(replies_lock); return replies.size() == 1; }, 2000)) {
+            Logger::writeToLog("VirtualMicron: no reply to program request");
+            return false;
+        }
+        double elapsed = Time::getMillisecondCounterHiRes() - start;
+        double expected = (req.getRawDataSize() + SYSEX_PROGRAM_SIZE) * 1000.0 / VirtualMicron::DIN_BYTES_PER_SEC;
+        if ((elapsed < expected) || (elapsed > expected + 100)) {
+            Logger::writeToLog("VirtualMicron: request took " + String(elapsed) + " ms, expected " + String(expected));
+            return false;
+        }
+
+        IonSysexParams p;
+        MidiMessage m = replies[0];
+        p.parseParamsFromContent((unsigned char *) m.getSysExData(), m.getSysExDataSize());
+        if (p.get_prog_name() != "Bank3 Prog006") {
+            Logger::writeToLog("VirtualMicron: wrong program returned: " + p.get_prog_name());
+            return false;
+        }
+    }
+
+    // pipelined bank dump against the stand-in, at wire speed when the machine keeps up
+    {
+        ProgramBank store;
+        Atomic<int> finished;
+        BankDump dump(store, [&] (const MidiMessage &m) { vm.send(m); }, [&] { finished += 1; });
+        vm.set_output([&] (const MidiMessage &m) {
+            if (m.isSysEx()) {
+                dump.handle_sysex(m.getSysExData(), m.getSysExDataSize());
+            }
+        });
+
+        const int first = ProgramBank::slot_of(1, 0);
+        const int count = 16;
+        dump.start(first, count);
+        if (!wait_for([&] { return finished.get() == 1; }, 10000) || dump.is_running() || (dump.get_done() != count)) {
+            Logger::writeToLog("VirtualMicron: bank dump incomplete");
+            return false;
+        }
+        for (int i = first; i < first + count; i++) {
+            unsigned char sysex[ProgramBank::PROGRAM_LEN];
+            IonSysexParams p;
+            store.get_program(i, sysex);
+            p.parseParamsFromContent(sysex, sizeof(sysex));
+            if (p.get_prog_name() != String::formatted("Bank2 Prog%03d", i - first + 1)) {
+                Logger::writeToLog("VirtualMicron: bank dump slot " + String(i) + " holds " + p.get_prog_name());
+                return false;
+            }
+        }
+        // wall clock, so only reported: a loaded machine is slower and that is not a failure
+        Logger::writeToLog("VirtualMicron: bank dump ran at " + String(dump.get_bytes_per_sec() * 100.0 / VirtualMicron::DIN_BYTES_PER_SEC, 1) +
+                           "% of wire speed");
+        vm.set_output(nullptr);
+    }
+
+    return true;
+}
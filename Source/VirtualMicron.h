@@ -0,0 +1,115 @@
+/*
+ This file is part of micronau.
+ Copyright (c) 2013 - David Smitley
+
+ Permission is granted to use this software under the terms of the GPL v2 (or any later version)
+
+ Details can be found at: www.gnu.org/licenses
+*/
+
+#ifndef __VIRTUALMICRON_H__
+#define __VIRTUALMICRON_H__
+
+#include "MicronauCore.h"
+#include <juce_audio_basics/juce_audio_basics.h>
+#include "IonSysex.h"
+#include "ProgramBank.h"
+#include <deque>
+#include <functional>
+
+//==============================================================================
+/*
+    VirtualMicron:
+        In-process stand-in for a Micron on the other end of a midi cable, so the
+        sync, request and dump paths can be exercised without hardware.
+
+        It understands
+          - NRPN edits, applied to its own edit buffer (an IonSysexParams)
+          - bank select + program change, loading a program from memory
+          - program dumps (0x22), loaded into the edit buffer
+          - program requests (0x26 0x41), answered with a dump of that program
+
+        Both directions are modelled as DIN links: a message occupies the wire for
+        its length in bytes / bandwidth, and every incoming message takes a fixed
+        processing time before the synth acts on it. Programs that were never
+        stored are generated from the default program, named "Bank b Prog ppp".
+*/
+class VirtualMicron : private Thread
+{
+public:
+    typedef std::function<void (const MidiMessage &)> OutputFunction;
+
+    static const char *port_name;
+    enum { DIN_BYTES_PER_SEC = 3125 };
+
+    VirtualMicron();
+    ~VirtualMicron();
+
+    // where the synth's midi out goes; waits for a call to the old function
+    // that is in progress, so its receiver can go away once this returns
+    void set_output(OutputFunction f);
+    void set_midi_chan(int chan) {midi_chan = chan;}
+    // bytes per second on each wire, 0 for no bandwidth limit
+    void set_bandwidth(int bytes_per_sec) {bandwidth = bytes_per_sec;}
+    void set_latency_ms(double ms) {latency_ms = ms;}
+
+    // message arriving at the synth's midi in
+    void send(const MidiMessage &msg);
+
+    int get_param_value(int nrpn);
+    String get_prog_name();
+    ProgramBank &get_memory() {return memory;}
+
+    int get_bytes_in() const {return bytes_in.get();}
+    int get_bytes_out() const {return bytes_out.get();}
+    int get_nrpns_received() const {return nrpns_received.get();}
+    int get_dumps_received() const {return dumps_received.get();}
+    int get_requests_served() const {return requests_served.get();}
+
+private:
+    struct event {
+        double due;
+        MidiMessage msg;
+    };
+
+    void run();
+    double wire_time(int bytes) const;
+    void process(const MidiMessage &msg, double now);
+    void handle_controller(int cc, int value);
+    void handle_sysex(const uint8 *data, int size, double now);
+    void apply_nrpn(int nrpn, int value);
+    IonSysexParam *param_of_wire_nrpn(int nrpn);
+    bool get_program(int slot, unsigned char *sysex);
+    void load_program(int slot);
+    void reply(const MidiMessage &msg, double now);
+
+    CriticalSection lock;
+    std::deque<event> incoming;
+    std::deque<event> outgoing;
+    double in_wire_free;
+    double out_wire_free;
+
+    CriticalSection output_lock;    // held while output is called
+    OutputFunction output;
+    int midi_chan;
+    int bandwidth;
+    double latency_ms;
+
+    IonSysexParams edit;
+    IonSysexParams scratch;
+    ProgramBank memory;
+    int nrpn_msb, nrpn_lsb, data_msb;
+    int cur_bank;
+
+    Atomic<int> bytes_in;
+    Atomic<int> bytes_out;
+    Atomic<int> nrpns_received;
+    Atomic<int> dumps_received;
+    Atomic<int> requests_served;
+
+    JUCE_DECLARE_NON_COPYABLE (VirtualMicron)
+};
+
+bool VirtualMicronTests();
+
+#endif  // __VIRTUALMICRON_H__
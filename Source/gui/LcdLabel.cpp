@@ -12,6 +12,7 @@
 #include "LcdLabel.h"
 
 //==============================================================================
-LcdLabel::LcdLabel(const String& componentName, const String& labelText) : Label(componentName, labelText)
+LcdLabel::LcdLabel(const String& componentName, const String& labelText) : Label(componentName, labelText),
+	reserved_width(0)
 {
 }
@@ -24,7 +24,13 @@ public:
 	explicit LcdLabel(const String& componentName = String(),
 						const String& labelText = String());
 
+	// width at the right kept clear of text, for a display drawn over the lcd
+	void set_reserved_width(int w) {reserved_width = w;}
+	int get_reserved_width() const {return reserved_width;}
+
 private:
+	int reserved_width;
+
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (LcdLabel)
 };
 
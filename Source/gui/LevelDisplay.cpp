@@ -0,0 +1,70 @@
+/*
+  ==============================================================================
+
+    LevelDisplay.cpp
+
+  ==============================================================================
+*/
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "LevelDisplay.h"
+
+//==============================================================================
+LevelDisplay::LevelDisplay(LevelMeter &m) :
+	meter(m),
+	peak_h(0),
+	rms_h(0),
+	last_frame(0)
+{
+	zeromem(band_h, sizeof(band_h));
+	setInterceptsMouseClicks(false, false);
+}
+
+int LevelDisplay::to_pixels(float db) const
+{
+	return jlimit(0, getHeight(), roundToInt(getHeight() * (db + RANGE_DB) / RANGE_DB));
+}
+
+void LevelDisplay::update()
+{
+	uint32 now = Time::getMillisecondCounter();
+	int peak = 0, rms = 0;
+	int bands[LevelMeter::NUM_BANDS];
+	zeromem(bands, sizeof(bands));
+
+	LevelMeter::Frame f;
+	if (meter.read(f)) {
+		last_frame = now;
+		peak = to_pixels(Decibels::gainToDecibels(f.peak, -100.0f));
+		rms = to_pixels(Decibels::gainToDecibels(f.rms, -100.0f));
+		for (int b = 0; b < LevelMeter::NUM_BANDS; b++) {
+			bands[b] = to_pixels(f.bands[b]);
+		}
+	} else if (now - last_frame < HOLD_MS) {
+		return;
+	}
+
+	if ((peak == peak_h) && (rms == rms_h) && (memcmp(bands, band_h, sizeof(bands)) == 0)) {
+		return;
+	}
+	peak_h = peak;
+	rms_h = rms;
+	memcpy(band_h, bands, sizeof(bands));
+	repaint();
+}
+
+void LevelDisplay::paint (Graphics& g)
+{
+	const int h = getHeight();
+	g.setColour(Colours::black.withAlpha(0.75f));
+
+	// rms as a bar with the peak as a tick above it, then the bands
+	g.fillRect(0, h - rms_h, 4, rms_h);
+	if (peak_h > 0) {
+		g.fillRect(0, h - peak_h, 4, 1);
+	}
+	const float w = (getWidth() - 6) / (float) LevelMeter::NUM_BANDS;
+	for (int b = 0; b < LevelMeter::NUM_BANDS; b++) {
+		g.fillRect(6 + b * w, (float) (h - band_h[b]), jmax(1.0f, w - 0.5f), (float) band_h[b]);
+	}
+}
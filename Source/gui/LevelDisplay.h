@@ -0,0 +1,50 @@
+/*
+  ==============================================================================
+
+    LevelDisplay.h
+
+  ==============================================================================
+*/
+
+#ifndef LEVELDISPLAY_H_INCLUDED
+#define LEVELDISPLAY_H_INCLUDED
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "../LevelMeter.h"
+
+//==============================================================================
+/*
+	LevelDisplay:
+		The level and spectrum of the synth's audio return (see LevelMeter),
+		drawn in lcd ink over the right of the lcd. Passes mouse clicks through
+		to the lcd below.
+*/
+class LevelDisplay    : public Component
+{
+public:
+	explicit LevelDisplay(LevelMeter &meter);
+
+	// call from the editor's timer, only repaints when the bars move
+	void update();
+
+	void paint (Graphics& g);
+
+private:
+	enum {
+		RANGE_DB = 60,
+		HOLD_MS = 300		// bars drop to nothing once the audio stops for this long
+	};
+
+	int to_pixels(float db) const;
+
+	LevelMeter &meter;
+	int peak_h;
+	int rms_h;
+	int band_h[LevelMeter::NUM_BANDS];
+	uint32 last_frame;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (LevelDisplay)
+};
+
+
+#endif  // LEVELDISPLAY_H_INCLUDED
@@ -469,7 +469,7 @@ void PluginLookAndFeel::drawLabel (Graphics& g, Label& label)
 		g.drawFittedText (label.getText(),
                           borderSize.getLeftAndRight(),
                           borderSize.getTopAndBottom(),
-                          label.getWidth() - 2 * borderSize.getLeftAndRight(),
+                          label.getWidth() - 2 * borderSize.getLeftAndRight() - lcdLabel->get_reserved_width(),
                           label.getHeight() - 2 * borderSize.getTopAndBottom(),
                           label.getJustificationType(),
                           jmax (1, (int) (label.getHeight() / font.getHeight())),
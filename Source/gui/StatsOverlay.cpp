@@ -0,0 +1,222 @@
+/*
+  ==============================================================================
+
+    StatsOverlay.cpp
+
+  ==============================================================================
+*/
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "StatsOverlay.h"
+
+//==============================================================================
+StatsOverlay::StatsOverlay(MicronauAudioProcessor *o) :
+	owner(o),
+	export_button("export csv"),
+	record_button("record midi"),
+	replay_button("replay..."),
+	insert_button("hardware insert"),
+	measure_button("measure latency"),
+	capture_button("capture library"),
+	match_button("match sound..."),
+	out_rate(0),
+	in_rate(0),
+	last_update(0)
+{
+	export_button.addListener(this);
+	addAndMakeVisible(&export_button);
+	record_button.setColour(ToggleButton::textColourId, Colours::white);
+	record_button.addListener(this);
+	addAndMakeVisible(&record_button);
+	replay_button.addListener(this);
+	addAndMakeVisible(&replay_button);
+	insert_button.setColour(ToggleButton::textColourId, Colours::white);
+	insert_button.addListener(this);
+	addAndMakeVisible(&insert_button);
+	measure_button.addListener(this);
+	addAndMakeVisible(&measure_button);
+	capture_button.addListener(this);
+	addAndMakeVisible(&capture_button);
+	match_button.addListener(this);
+	addAndMakeVisible(&match_button);
+	setInterceptsMouseClicks(true, true);
+}
+
+void StatsOverlay::update()
+{
+	uint32 now = Time::getMillisecondCounter();
+	if (now - last_update < 500) {
+		return;
+	}
+	last_update = now;
+	insert_button.setToggleState(owner->get_hardware_return()->get_insert(), dontSendNotification);
+	record_button.setToggleState(owner->get_recorder().is_recording(), dontSendNotification);
+	capture_button.setButtonText(owner->get_library_capture()->is_running() ? "stop capture" : "capture library");
+	owner->get_midi_stats().get_rates(out_rate, in_rate);
+	repaint();
+}
+
+void StatsOverlay::resized()
+{
+	export_button.setBounds(getWidth() - 90, getHeight() - 25, 80, 18);
+	record_button.setBounds(getWidth() - 90, getHeight() - 47, 80, 18);
+	replay_button.setBounds(getWidth() - 90, getHeight() - 69, 80, 18);
+	insert_button.setBounds(10, getHeight() - 25, 120, 18);
+	measure_button.setBounds(135, getHeight() - 25, 100, 18);
+	capture_button.setBounds(10, getHeight() - 47, 120, 18);
+	match_button.setBounds(135, getHeight() - 47, 100, 18);
+}
+
+void StatsOverlay::buttonClicked (Button* button)
+{
+	if (button == &export_button) {
+		File f = File::getSpecialLocation(File::userDocumentsDirectory).getNonexistentChildFile("micronau stats", ".csv");
+		exported = owner->export_stats_csv(f) ? "saved " + f.getFullPathName() : "could not save " + f.getFullPathName();
+		repaint();
+	} else if (button == &record_button) {
+		MidiTrafficRecorder &recorder = owner->get_recorder();
+		if (recorder.is_recording()) {
+			recorder.stop();
+			exported = "recorded " + String(recorder.get_recorded()) + " messages, " + String(recorder.get_dropped()) + " dropped";
+		} else {
+			File f = File::getSpecialLocation(File::userDocumentsDirectory).getNonexistentChildFile("micronau midi", ".mnlg");
+			exported = recorder.start(f) ? "recording to " + f.getFullPathName() : "could not record to " + f.getFullPathName();
+		}
+		last_update = 0;
+		repaint();
+	} else if (button == &replay_button) {
+		chooser.reset(new FileChooser("midi log to replay", File::getSpecialLocation(File::userDocumentsDirectory), "*.mnlg"));
+		chooser->launchAsync(FileBrowserComponent::openMode | FileBrowserComponent::canSelectFiles,
+			[this] (const FileChooser &fc) { replay(fc.getResult()); });
+	} else if (button == &insert_button) {
+		owner->set_hardware_insert(insert_button.getToggleState());
+	} else if (button == &measure_button) {
+		HardwareReturn *hw = owner->get_hardware_return();
+		if (hw->get_state() == HardwareReturn::MEASURING) {
+			hw->cancel();
+		} else {
+			hw->measure();
+		}
+		last_update = 0;
+	} else if (button == &capture_button) {
+		if (owner->get_library_capture()->is_running()) {
+			owner->stop_library_capture();
+		} else if (!owner->start_library_capture(true)) {
+			matched = "capture needs a midi output and a program library";
+		}
+		last_update = 0;
+	} else if (button == &match_button) {
+		chooser.reset(new FileChooser("recording to match", File(), "*.wav;*.aif;*.aiff"));
+		chooser->launchAsync(FileBrowserComponent::openMode | FileBrowserComponent::canSelectFiles,
+			[this] (const FileChooser &fc) { match_sound(fc.getResult()); });
+	}
+}
+
+void StatsOverlay::match_sound(const File &f)
+{
+	if (f == File()) {
+		return;
+	}
+	Array<FingerprintIndex::Match> m = owner->match_sound(f, 5);
+	if (m.isEmpty()) {
+		matched = "nothing matched " + f.getFileName();
+	} else {
+		matched = "closest:";
+		for (int i = 0; i < m.size(); i++) {
+			matched << "  " << (m[i].index + 1) << " " << owner->getProgramName(m[i].index) << " (" << String(m[i].distance, 2) << ")";
+		}
+	}
+	repaint();
+}
+
+// as fast as it goes, the host's processing waits meanwhile
+void StatsOverlay::replay(const File &f)
+{
+	if (f == File()) {
+		return;
+	}
+	MidiTrafficReplay log;
+	if (!log.load(f)) {
+		exported = f.getFileName() + " is not a midi log";
+	} else if (owner->get_recorder().is_recording()) {
+		exported = "stop recording before replaying";
+	} else {
+		double ms = owner->replay_traffic(log, false);
+		exported = "replayed " + String(log.get_events().size()) + " messages from " + f.getFileName() + " in " + String(ms, 1) + "ms";
+	}
+	repaint();
+}
+
+static String describe(const LatencyHistogram &h)
+{
+	if (h.get_count() == 0) {
+		return "-";
+	}
+	return String(h.get_count()) + "  p50 " + String(h.get_percentile(50), 1) + "ms  p99 " +
+		String(h.get_percentile(99), 1) + "ms  max " + String(h.get_max_ms(), 1) + "ms";
+}
+
+void StatsOverlay::paint_histogram(Graphics& g, const LatencyHistogram &h, const String &title, Rectangle<int> area)
+{
+	g.setColour(Colours::white);
+	g.drawText(title + ": " + describe(h), area.removeFromTop(16), Justification::centredLeft);
+
+	Array<int> bins = h.get_bins();
+	int most = 1;
+	for (int i = 0; i < bins.size(); i++) {
+		most = jmax(most, bins[i]);
+	}
+	float w = area.getWidth() / (float) bins.size();
+	g.setColour(Colours::orange);
+	for (int i = 0; i < bins.size(); i++) {
+		float bar = area.getHeight() * bins[i] / (float) most;
+		g.fillRect(area.getX() + i * w, area.getBottom() - bar, jmax(1.0f, w - 1.0f), bar);
+	}
+	g.setColour(Colours::grey);
+	g.setFont(10.0f);
+	for (int i = 0; i < bins.size(); i += 12) {
+		g.drawText(String(LatencyHistogram::bin_upper_ms(i), 2), (int) (area.getX() + i * w), area.getBottom(), 40, 12, Justification::centredLeft);
+	}
+	g.setFont(14.0f);
+}
+
+void StatsOverlay::paint (Graphics& g)
+{
+	g.fillAll(Colours::black.withAlpha(0.85f));
+	g.setFont(14.0f);
+
+	MidiStats &stats = owner->get_midi_stats();
+	Rectangle<int> area = getLocalBounds().reduced(10);
+	g.setColour(Colours::white);
+	g.drawText("out " + String(roundToInt(out_rate)) + " B/s, in " + String(roundToInt(in_rate)) + " B/s  (" +
+		String(stats.get_bytes_out()) + " / " + String(stats.get_bytes_in()) + " bytes)", area.removeFromTop(18), Justification::centredLeft);
+
+	StringPairArray counters = owner->get_send_counters();
+	String line;
+	for (int i = 0; i < counters.size(); i++) {
+		line << counters.getAllKeys()[i] << " " << counters.getAllValues()[i] << "   ";
+	}
+	g.drawFittedText(line, area.removeFromTop(36), Justification::topLeft, 2);
+
+	int h = (area.getHeight() - 75) / 2;
+	paint_histogram(g, stats.enqueue_to_wire, "enqueue to wire", area.removeFromTop(h - 10));
+	area.removeFromTop(16);
+	paint_histogram(g, stats.request_to_reply, "request to reply", area.removeFromTop(h - 10));
+
+	g.setColour(Colours::white);
+	g.drawText("return: " + owner->get_hardware_return()->get_status(), 245, getHeight() - 25, getWidth() - 345, 18, Justification::centredLeft);
+
+	LibraryCapture *capture = owner->get_library_capture();
+	String library = matched;
+	if (capture->is_running() || (capture->get_total() > 0)) {
+		library = capture->get_status() + (matched.isNotEmpty() ? "   " + matched : String());
+	} else if (library.isEmpty()) {
+		library = String(owner->get_sound_index().num_fingerprints()) + " programs fingerprinted";
+	}
+	g.drawText(library, 245, getHeight() - 47, getWidth() - 345, 18, Justification::centredLeft);
+
+	if (exported.isNotEmpty()) {
+		g.setColour(Colours::lightgrey);
+		g.drawText(exported, 10, getHeight() - 69, getWidth() - 110, 18, Justification::centredLeft);
+	}
+}
@@ -0,0 +1,63 @@
+/*
+  ==============================================================================
+
+    StatsOverlay.h
+
+  ==============================================================================
+*/
+
+#ifndef STATSOVERLAY_H_INCLUDED
+#define STATSOVERLAY_H_INCLUDED
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "../micronau.h"
+
+//==============================================================================
+/*
+	StatsOverlay:
+		Panel drawn over the editor with the midi timings and counters of the
+		plugin (see MidiStats), and a button to save them as csv. The midi
+		traffic can be recorded to a log and a log replayed through the plugin
+		(see MidiTrafficRecorder). Also has
+		the hardware insert switch and its latency measurement (see
+		HardwareReturn), the capture of the program library and the search
+		for the programs that sound like a recording (see LibraryCapture).
+		Shown and hidden by double clicking the lcd.
+*/
+class StatsOverlay    : public Component, public Button::Listener
+{
+public:
+	explicit StatsOverlay(MicronauAudioProcessor *owner);
+
+	// call from the editor's timer while visible, rates are taken every half second
+	void update();
+
+	void paint (Graphics& g);
+	void resized();
+	void buttonClicked (Button* button);
+
+private:
+	void paint_histogram(Graphics& g, const LatencyHistogram &h, const String &title, Rectangle<int> area);
+	void match_sound(const File &f);
+	void replay(const File &f);
+
+	MicronauAudioProcessor *owner;
+	TextButton export_button;
+	ToggleButton record_button;
+	TextButton replay_button;
+	ToggleButton insert_button;
+	TextButton measure_button;
+	TextButton capture_button;
+	TextButton match_button;
+	std::unique_ptr<FileChooser> chooser;
+	String matched;
+	String exported;        // what happened to the last file saved or replayed
+	double out_rate;
+	double in_rate;
+	uint32 last_update;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (StatsOverlay)
+};
+
+
+#endif  // STATSOVERLAY_H_INCLUDED
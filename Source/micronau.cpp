@@ -43,8 +43,18 @@ MicronauAudioProcessor::MicronauAudioProcessor()
         }
 
     }
+    for (int i = 0; i < nrpns.size(); i++) {
+        // Logic Pro 9 fails to validate the plugin unless the tracking gen parameters are meta-parameters, see set_param_value
+        bool meta = nrpns[i]->isTrackingGenValue() || (i == index_of_nrpn(631));
+        MicronauParameter *p = new MicronauParameter(nrpns[i], meta, [this, i] (int value) { set_param_value(i, value); });
+        host_params.add(p);
+        addParameter(p);
+    }
 
     midi_out = NULL;
+    virtual_out = false;
+    virtual_in = false;
+    host_midi_out = false;
     midi_out_port = "None";
     set_midi_port(MIDI_OUT_IDX, midi_out_port);
     set_midi_chan(0);
@@ -53,6 +63,27 @@ MicronauAudioProcessor::MicronauAudioProcessor()
     midi_in_port = "None";
     set_midi_port(MIDI_IN_IDX, midi_in_port);
 
+    // the library is reopened on the message thread once a dump has ended
+    bank_dump.reset(new BankDump(program_bank, [this] (const MidiMessage &m) { send_midi(m); }, [this] { triggerAsyncUpdate(); }));
+    // only a dump that passed the receiver's checks answers a request
+    sysex_receiver.reset(new SysexReceiver([this] (const uint8 *data, int size) {
+        midi_stats.reply_received();
+        init_from_sysex((unsigned char *) data);
+    }));
+    thru.reset(new MidiThruScheduler([this] (const MidiMessage &m) { send_thru(m); }));
+    preloader.reset(new ProgramPreloader([this] (const Array<MidiMessage> &msgs) { send_midi(msgs); }));
+    thinner.reset(new AutomationThinner([this] (int nrpn, int value) { send_nrpn(nrpn, value); }));
+    hw_return.reset(new HardwareReturn([this] (const MidiMessage &m) { send_test_note(m); }));
+    hw_return->set_channel(get_midi_chan() + 1);
+    // the captures leave the synth on the last program loaded, put the edit buffer back
+    library_capture.reset(new LibraryCapture(*hw_return, sound_index, [this] (int index) { return load_library_program(index); },
+                                             [this] { sync_via_sysex(); }));
+
+    current_program = 0;
+    library_closed = false;
+    program_library.open(ProgramBank::get_default_file());
+    load_sound_index();
+
     int sz;
     const char *x = BinaryData::getNamedResource("default_syx", sz);
     init_from_sysex((unsigned char *) &x[1]);
@@ -60,15 +91,26 @@ MicronauAudioProcessor::MicronauAudioProcessor()
 
 MicronauAudioProcessor::~MicronauAudioProcessor()
 {
+    // stop everything that can deliver input before tearing down what consumes it
     if (midi_in != NULL) {
         midi_in->stop();
 		midi_in = NULL;
     }
+    if (virtual_micron != nullptr) {
+        virtual_micron->set_output(nullptr);
+    }
+
+    // its last resync still sends through the rest
+    library_capture = nullptr;
+    thru = nullptr;
+    preloader = nullptr;
+    thinner = nullptr;
+    hw_return = nullptr;
+    bank_dump = nullptr;
+    virtual_micron = nullptr;
+    sysex_receiver = nullptr;
 	
-	if (midi_out != NULL) {
-		midi_out->stopBackgroundThread();
-		midi_out = NULL;
-	}
+	midi_out = NULL;
 }
 
 //==============================================================================
@@ -77,40 +119,29 @@ const String MicronauAudioProcessor::getName() const
     return JucePlugin_Name;
 }
 
-int MicronauAudioProcessor::getNumParameters()
+void MicronauAudioProcessor::set_param_notifying_host(int index, int value)
 {
-    return nrpns.size();
+    MicronauParameter *p = host_params[index];
+    p->setValueNotifyingHost(p->to_normalised(value));
 }
 
-float MicronauAudioProcessor::getParameter (int index)
-{
-    return nrpns[index]->getValue();
-}
-
-bool MicronauAudioProcessor::isMetaParameter (int parameterIndex) const
-{
-	// We need this here because Logic Pro 9 fails to validate the plugin if we don't specify that the tracking gen parameters are "meta-parameters".
-	// They are meta-parameters in the sense that changing them can change other parameters. What happens is if the user edits a tracking point from a preset tracking
-	// pattern, the pattern switches from the preset to "custom". Also, changing preset patterns changes all the tracking points. Hence they are all meta params.
-	return nrpns[parameterIndex]->isTrackingGenValue() || parameterIndex == index_of_nrpn(631);
-}
-
-void MicronauAudioProcessor::setParameter (int index, float newValue)
+// The tracking gen parameters are meta-parameters in the sense that changing them can change other parameters. What happens is if the user edits a tracking point from a preset tracking
+// pattern, the pattern switches from the preset to "custom". Also, changing preset patterns changes all the tracking points.
+void MicronauAudioProcessor::set_param_value(int index, int value)
 {
     IonSysexParam *param;
     param = nrpns[index];
     int nrpn_num;
-    int value = (int) newValue;
    
     // XXX - handle the tracking matrix
 	// if tracking gen preset is modified, switch to "custom" tracking gen
     if (param->isTrackingGenValue() && nrpns[index_of_nrpn(631)]->getValue() != 0)
-		setParameter(index_of_nrpn(631), 0);	
+		set_param_value(index_of_nrpn(631), 0);	
 	
     param->setValue(value);
 
     // handle custom list values
-    if (param->getList().size()) {
+    if ((value >= 0) && (value < (int) param->getList().size())) {
         ListItemParameter lip =  param->getList()[(int) value];
         if (lip.hasSpecialNrpnValue()) {
             value = lip.getNrpnValue();
@@ -118,7 +149,10 @@ void MicronauAudioProcessor::setParameter (int index, float newValue)
     }
 
     if (param->isFxSelector()) {
-		// NOTE: must use value instead of newValue, as value has been remapped correctly for fx1 selector
+        // the fx nrpns are shared between fx types: what is held back belongs
+        // to the old type and has to reach the synth before the switch
+        thinner->flush_all();
+		// NOTE: must use value, as it has been remapped correctly for fx1 selector
         send_nrpn(param->fxSelectorToNrpn()-512, value);
 
         // we changed the fx type so update all the corresponding nrpns
@@ -133,6 +167,8 @@ void MicronauAudioProcessor::setParameter (int index, float newValue)
                 send_nrpn(nrpn_num, fxvalue);
             }
         }
+        // and what was last sent on them is the new type's now
+        thinner->reset();
         
         return;
     }
@@ -153,41 +189,26 @@ void MicronauAudioProcessor::setParameter (int index, float newValue)
     if (nrpn_num >= 512) {
         nrpn_num -= 512;
     }
-    send_nrpn(nrpn_num, (int) value);
+    if (host_midi_out) {
+        // the host times routed output to the block, so a bounce has to get
+        // every value at its own position, not whatever a wall clock held back
+        send_nrpn(nrpn_num, (int) value);
+    } else {
+        thinner->add(nrpn_num, (int) value);
+    }
     
     // update gui
     // send nrpn
 }
 
-const String MicronauAudioProcessor::getParameterName (int index)
-{
-    return nrpns[index]->getName();
-}
-
-const String MicronauAudioProcessor::getParameterText (int index)
-{
-    return nrpns[index]->getTextValue();
-}
-
 float MicronauAudioProcessor::getParameterMinValue (int index)
 {
-    return nrpns[index]->getMin();
+    return host_params[index]->get_min();
 }
 
 float MicronauAudioProcessor::getParameterMaxValue (int index)
 {
-    return nrpns[index]->getMax();
-;
-}
-
-float MicronauAudioProcessor::getParameterDefaultValue (int index)
-{
-    return nrpns[index]->getDefaultValue();
-}
-
-int MicronauAudioProcessor::getParameterNumSteps (int index)
-{
-    return nrpns[index]->getMax() - nrpns[index]->getMin();
+    return host_params[index]->get_max();
 }
 
 const String MicronauAudioProcessor::getInputChannelName (int channelIndex) const
@@ -240,21 +261,42 @@ double MicronauAudioProcessor::getTailLengthSeconds() const
 
 int MicronauAudioProcessor::getNumPrograms()
 {
-    return 0;
+    // hosts expect at least one, even with no bank to show
+    return jmax(1, program_library.size());
 }
 
 int MicronauAudioProcessor::getCurrentProgram()
 {
-    return 0;
+    return jlimit(0, getNumPrograms() - 1, current_program);
 }
 
 void MicronauAudioProcessor::setCurrentProgram (int index)
 {
+    unsigned char sysex[ProgramLibrary::PROGRAM_LEN];
+
+    // only the selected program is decoded in full
+    if (!program_library.get_program(index, sysex)) {
+        return;
+    }
+    current_program = index;
+    init_from_sysex(sysex);
+
+    if (!has_midi_out()) {
+        return;
+    }
+    // one dump into the edit buffer; the slot it came from may have changed since the bank was read
+    Array<MidiMessage> msgs;
+    add_program_dump(msgs);
+    if (preloader->is_playing()) {
+        preloader->schedule(msgs);
+    } else {
+        preloader->send_now(msgs);
+    }
 }
 
 const String MicronauAudioProcessor::getProgramName (int index)
 {
-    return String();
+    return program_library.get_name(index);
 }
 
 void MicronauAudioProcessor::changeProgramName (int index, const String& newName)
@@ -267,6 +309,13 @@ void MicronauAudioProcessor::prepareToPlay (double sampleRate, int samplesPerBlo
     // Use this method as the place to do any pre-playback
     // initialisation that you need..
 	sample_rate = sampleRate;
+    host_out.reset();
+    // a block of headroom for late callbacks, plus a little for dispatch
+    thru->set_latency_ms(samplesPerBlock * 1000.0 / sampleRate + 2.0);
+    thru->resync();
+    hw_return->prepare(sampleRate);
+    setLatencySamples(hw_return->get_reported_latency());
+    level_meter.prepare(sampleRate);
 }
 
 void MicronauAudioProcessor::releaseResources()
@@ -280,16 +329,53 @@ void MicronauAudioProcessor::processBlock (AudioSampleBuffer& buffer, MidiBuffer
 	{
 		ScopedLock lock(midi_port_lock);
 
+		if (recorder.is_recording()) {
+			MidiBuffer::Iterator it(midiMessages);
+			MidiMessage m;
+			int pos;
+			while (it.getNextEvent(m, pos)) {
+				recorder.record(MidiTrafficRecorder::HOST, m, pos * 1000.0 / sample_rate);
+			}
+		}
+
 		// relay any incoming midi msgs from the host block out to our midi output
-		if (midi_out)
-			midi_out->sendBlockOfMessages(midiMessages, Time::getMillisecondCounter(), sample_rate);
+		if (midi_out || virtual_out)
+			thru->schedule_block(midiMessages, buffer.getNumSamples(), sample_rate);
+
+		// host routed output: incoming events pass through, ours are added at their sample offsets
+		if (host_midi_out)
+			host_out.render(midiMessages, buffer.getNumSamples(), sample_rate);
 	}
 
-    // silence all output channels
-    for (int i = 0; i < getNumOutputChannels(); ++i)
+    preloader->process(getPlayHead(), buffer.getNumSamples(), sample_rate);
+
+    // outputs without an input hold garbage
+    for (int i = getTotalNumInputChannels(); i < buffer.getNumChannels(); ++i)
     {
         buffer.clear (i, 0, buffer.getNumSamples());
     }
+
+    // the synth's audio return, metered as it arrives and silenced unless it is inserted
+    level_meter.process(buffer, getTotalNumInputChannels());
+    hw_return->process(buffer);
+    if (hw_return->take_latency_changed()) {
+        triggerAsyncUpdate();
+    }
+}
+
+void MicronauAudioProcessor::handleAsyncUpdate()
+{
+    setLatencySamples(hw_return->get_reported_latency());
+    if (library_closed && !bank_dump->is_running()) {
+        library_closed = false;
+        open_program_library(ProgramBank::get_default_file());
+    }
+}
+
+void MicronauAudioProcessor::set_hardware_insert(bool on)
+{
+    hw_return->set_insert(on);
+    setLatencySamples(hw_return->get_reported_latency());
 }
 
 //==============================================================================
@@ -317,11 +403,20 @@ IonSysexParam *MicronauAudioProcessor::param_of_nrpn(int nrpn)
 
 void MicronauAudioProcessor::sync_via_nrpn()
 {
-    if (midi_out == NULL) {
+    if (!has_midi_out()) {
         return;
     }
 
-    send_bank_patch();
+    Array<MidiMessage> msgs;
+    add_sync_nrpns(msgs);
+    send_midi(msgs);
+}
+
+void MicronauAudioProcessor::add_sync_nrpns(Array<MidiMessage> &msgs)
+{
+    // everything goes out below, anything held back is stale
+    thinner->reset();
+    add_bank_patch(msgs);
     
     int l = nrpns.size();
     for (unsigned int i = 0; i < l; i++) {
@@ -350,56 +445,74 @@ void MicronauAudioProcessor::sync_via_nrpn()
         if (nrpn_num >= 512) {
             nrpn_num -= 512;
         }
-        send_nrpn(nrpn_num, param->getNrpnValue(), false);
+        add_nrpn(msgs, nrpn_num, param->getNrpnValue());
     }
-    return;
 }
 
 void MicronauAudioProcessor::send_bank_patch()
 {
-    if (midi_out == NULL) {
+    if (!has_midi_out()) {
         return;
     }
-    
+
+    Array<MidiMessage> msgs;
+    add_bank_patch(msgs);
+    send_midi(msgs);
+}
+
+void MicronauAudioProcessor::add_bank_patch(Array<MidiMessage> &msgs)
+{
     unsigned char cmd = 0xb0 + get_midi_chan();
     int bank, prog;
     bank = param_of_nrpn(100)->getValue();
     prog = param_of_nrpn(101)->getValue();
     
-    MidiMessage *msg;
     if (bank > 0) {
         bank = bank - 1;
 
         // bank msb
-        msg = new MidiMessage(cmd, 0, 0);
-        midi_out->sendMessageNow(*msg);
-        delete msg;
+        msgs.add(MidiMessage(cmd, 0, 0));
         
         // bank lsb
-        msg = new MidiMessage(cmd, 32, bank);
-        midi_out->sendMessageNow(*msg);
-        delete msg;
+        msgs.add(MidiMessage(cmd, 32, bank));
     }
 
     if (prog > 0) {
         prog = prog - 1;
         cmd = 0xc0 + get_midi_chan();
-        msg = new MidiMessage(cmd, prog);
-        midi_out->sendMessageNow(*msg);
-        delete msg;
+        msgs.add(MidiMessage(cmd, prog));
     }
 }
 
+// mid-song the nrpn sync (a few kB at DIN speed) would arrive well after the
+// host meant it to; send the program as one dump, timed for the next downbeat
+void MicronauAudioProcessor::preload_program()
+{
+    if (!has_midi_out()) {
+        return;
+    }
+
+    Array<MidiMessage> msgs;
+    add_bank_patch(msgs);
+    add_program_dump(msgs);
+    preloader->schedule(msgs);
+}
+
+void MicronauAudioProcessor::add_program_dump(Array<MidiMessage> &msgs)
+{
+    unsigned char sysex_buf[SYSEX_LEN + 2];
+
+    // the whole program goes out below, anything held back is stale
+    thinner->reset();
+
+    memset(sysex_buf, 0, SYSEX_LEN + 2);
+	params->getAsSysexMessage(sysex_buf);
+    msgs.add(MidiMessage(sysex_buf, sizeof(sysex_buf)));
+}
+
 void MicronauAudioProcessor::send_nrpn(int nrpn, int value, bool send_bank)
 {
-    unsigned char midiChannel = 176 + get_midi_chan();
-    unsigned char nrpnMSB;
-    unsigned char nrpnLSB;
-    unsigned char dataMSB;
-    unsigned char dataLSB;
-    MidiMessage *msg;
-    
-    if (midi_out == NULL) {
+    if (!has_midi_out()) {
         return;
     }
     
@@ -407,89 +520,104 @@ void MicronauAudioProcessor::send_nrpn(int nrpn, int value, bool send_bank)
         send_bank_patch();
         return;
     }
-    
-    nrpnMSB = (nrpn >> 7) & (0x7f);
-    nrpnLSB = (nrpn & 0xff) & (0x7f);
-    dataMSB = (value >> 7) & (0x7f);
-    dataLSB = (value & 0xff) & (0x7f);
-    
-    msg = new MidiMessage(midiChannel, 0x63, nrpnMSB);
-    midi_out->sendMessageNow(*msg);
-    delete msg;
-    
-    msg = new MidiMessage(midiChannel, 0x62, nrpnLSB);
-    midi_out->sendMessageNow(*msg);
-    delete msg;
-    
-    msg = new MidiMessage(midiChannel, 0x6, dataMSB);
-    midi_out->sendMessageNow(*msg);
-    delete msg;
 
-    msg = new MidiMessage(midiChannel, 0x26, dataLSB);
-    midi_out->sendMessageNow(*msg);
-    delete msg;
+    Array<MidiMessage> msgs;
+    add_nrpn(msgs, nrpn, value);
+    send_midi(msgs);
+}
+
+void MicronauAudioProcessor::add_nrpn(Array<MidiMessage> &msgs, int nrpn, int value)
+{
+    unsigned char buf[12];
+    encodeNrpn(get_midi_chan(), nrpn, value, buf);
+    for (int i = 0; i < 12; i += 3) {
+        msgs.add(MidiMessage(buf[i], buf[i + 1], buf[i + 2]));
+    }
 }
 
 void MicronauAudioProcessor::setStateInformation (const void* data, int sizeInBytes)
 {
-    preset *p = (preset *) data;
-    String s;
+    PluginState state;
+    if (!state.read(data, sizeInBytes)) {
+        return;
+    }
 
-	if (!params->parseParamsFromContent(p->sysex, SYSEX_LEN)) {
-		return;
-	}
+    bool restored;
+    if (state.legacy) {
+        restored = params->parseParamsFromContent(state.legacy_sysex, SYSEX_LEN);
+        if (restored) {
+            param_of_nrpn(100)->setValue(state.legacy_bank);
+            param_of_nrpn(101)->setValue(state.legacy_patch);
+        }
+    } else {
+        // decoded values go straight into the store, unless the parameter list
+        // changed since they were saved: then the program is decoded from its dump
+        restored = params->restoreValues(state.values.getRawDataPointer(), state.values.size());
+        if (!restored && (state.program.getSize() == SYSEX_LEN)) {
+            restored = params->parseParamsFromContent((unsigned char *) state.program.getData(), SYSEX_LEN);
+        }
+        if (restored) {
+            params->set_prog_name(state.prog_name);
+        }
+    }
 
-    set_midi_chan(p->midi_out_chan);
-    param_of_nrpn(100)->setValue(p->bank);
-    param_of_nrpn(101)->setValue(p->patch);
-   
-    s = String(CharPointer_UTF8((const char *) p->midi_in_port));
-    set_midi_port(MIDI_IN_IDX, s);
-    s = String(CharPointer_UTF8((const char *) p->midi_out_port));
-    set_midi_port(MIDI_OUT_IDX, s);
-    
+    // the setup is restored even when the program is not
+    set_midi_chan(state.midi_out_chan);
+    set_midi_port(MIDI_IN_IDX, state.midi_in_port);
+    set_midi_port(MIDI_OUT_IDX, state.midi_out_port);
+    hw_return->set_latency_ms(state.hw_latency_us / 1000.0);
+    set_hardware_insert(state.hw_insert);
+    if (!restored) {
+        return;
+    }
+
+    // the restored program replaces whatever automation was held back
+    thinner->reset();
     set_progchange(true);
 
-    if ((p->bank != 0) && (p->patch != 0)) {
-        sync_via_nrpn();
+    if ((param_of_nrpn(100)->getValue() != 0) && (param_of_nrpn(101)->getValue() != 0)) {
+        if (preloader->is_playing()) {
+            preload_program();
+        } else if (has_midi_out()) {
+            // a session load should not wait for the cable, the preloader's thread sends it
+            Array<MidiMessage> msgs;
+            add_sync_nrpns(msgs);
+            preloader->send_now(msgs);
+        }
     }
 }
 
 void MicronauAudioProcessor::getStateInformation (MemoryBlock& destData)
 {
-    unsigned char sysex_buf[SYSEX_LEN + 2];
-    preset p;
-    String s;
-    
-    memset(sysex_buf, 0, SYSEX_LEN + 2);
-	params->getAsSysexMessage(sysex_buf);
-    memcpy(p.sysex, sysex_buf+1, SYSEX_LEN);
+    PluginState state;
+    state.midi_out_chan = get_midi_chan();
+    state.midi_in_port = get_midi_port(MIDI_IN_IDX);
+    state.midi_out_port = get_midi_port(MIDI_OUT_IDX);
+    state.prog_name = get_prog_name();
+    state.hw_insert = hw_return->get_insert();
+    state.hw_latency_us = roundToInt(hw_return->get_latency_ms() * 1000.0);
+
+    ParamValueStore &store = params->getValueStore();
+    state.values.resize(store.size());
+    store.snapshot(state.values.getRawDataPointer());
 
-    p.midi_out_chan = get_midi_chan();
-    p.bank = param_of_nrpn(100)->getValue();
-    p.patch = param_of_nrpn(101)->getValue();
-
-    s = get_midi_port(MIDI_IN_IDX);
-    s.copyToUTF8(((CharPointer_UTF8::CharType *) p.midi_in_port), MAX_MIDI_PORT_NAME);
-    s = get_midi_port(MIDI_OUT_IDX);
-    s.copyToUTF8(((CharPointer_UTF8::CharType *) p.midi_out_port), MAX_MIDI_PORT_NAME);
+    unsigned char sysex_buf[SYSEX_LEN + 2];
+    memset(sysex_buf, 0, sizeof(sysex_buf));
+    params->getAsSysexMessage(sysex_buf);
+    state.program.append(sysex_buf + 1, SYSEX_LEN);
 
-    destData.append(&p, sizeof(p));
+    state.write(destData);
 }
 
 void MicronauAudioProcessor::sync_via_sysex()
 {
-    unsigned char sysex_buf[SYSEX_LEN + 2];
-
-    if (midi_out == NULL) {
+    if (!has_midi_out()) {
         return;
     }
-    
-    memset(sysex_buf, 0, SYSEX_LEN + 2);
-	params->getAsSysexMessage(sysex_buf);
 
-    MidiMessage sysexe_msg(sysex_buf, sizeof(sysex_buf));
-    midi_out->sendMessageNow(sysexe_msg);
+    Array<MidiMessage> msgs;
+    add_program_dump(msgs);
+    send_midi(msgs);
 }
 
 void MicronauAudioProcessor::init_from_sysex(unsigned char *sysex)
@@ -498,11 +626,11 @@ void MicronauAudioProcessor::init_from_sysex(unsigned char *sysex)
 	if (!params->parseParamsFromContent(sysex, SYSEX_LEN)) {
 		return;
 	}
+    // a new program, automation held back for the old one is stale
+    thinner->reset();
 
-	for (i = 0; i < nrpns.size(); i++) {
-        IonSysexParam *param = nrpns[i];
-		param = params->getParam(i);
-        sendParamChangeMessageToListeners(i, param->getValue());
+	for (i = 0; i < host_params.size(); i++) {
+        host_params[i]->sendValueChangedMessageToListeners(host_params[i]->getValue());
 	}
     set_progchange(true);
 }
@@ -512,20 +640,30 @@ void MicronauAudioProcessor::handleIncomingMidiMessage (MidiInput* source, const
     if (source != midi_in.get()) {
         return;
     }
+    handle_midi_input(message);
+}
+
+void MicronauAudioProcessor::handle_midi_input(const MidiMessage& message)
+{
+    recorder.record(MidiTrafficRecorder::IN, message);
+    midi_stats.received(message.getRawDataSize());
     if (message.isSysEx()) {
         const uint8 *data = message.getSysExData();
-        init_from_sysex((unsigned char *) data);
+        if (bank_dump->handle_sysex(data, message.getSysExDataSize())) {
+            return;
+        }
+        // validated and parsed on the receiver's thread, see init_from_sysex
+        sysex_receiver->add_message(message);
     }
 }
 
 void MicronauAudioProcessor::send_request()
 {
-    unsigned char req[]= {0x00, 0x00, 0x0e, 0x26, 0x41, 0x0, 0x0, 0x0};
     int bank, prog;
     bank = param_of_nrpn(100)->getValue();
     prog = param_of_nrpn(101)->getValue();
 
-    if (midi_out == NULL) {
+    if (!has_midi_out()) {
         return;
     }
     
@@ -535,16 +673,258 @@ void MicronauAudioProcessor::send_request()
     bank--;
 
     prog--;
-	req[5] = bank;
-    req[6] = (prog >> 7) & 1;
-    req[7] = prog & 0x7f;
-    
-    MidiMessage sysexe_msg = MidiMessage::createSysExMessage(req, sizeof(req));
-    midi_out->sendMessageNow(sysexe_msg);
+    midi_stats.request_sent();
+    send_midi(BankDump::make_request(bank, prog));
+}
+
+void MicronauAudioProcessor::start_bank_dump()
+{
+    if (!has_midi_out() || !has_midi_in()) {
+        return;
+    }
+    // the dump rewrites the file the library has mapped
+    library_capture->stop();
+    program_library.close();
+    library_closed = true;
+    sound_index.clear(0);
+    updateHostDisplay();
+    program_bank.clear();
+    if (!bank_dump->start(0, ProgramBank::NUM_SLOTS, ProgramBank::get_default_file())) {
+        triggerAsyncUpdate();
+    }
+}
+
+void MicronauAudioProcessor::stop_bank_dump()
+{
+    bank_dump->stop();
+}
+
+bool MicronauAudioProcessor::open_program_library(const File &f)
+{
+    library_capture->stop();
+    bool ok = program_library.open(f);
+    current_program = 0;
+    load_sound_index();
+    updateHostDisplay();
+    return ok;
+}
+
+void MicronauAudioProcessor::load_sound_index()
+{
+    sound_index.clear(program_library.size());
+    if (program_library.is_open()) {
+        sound_index.load(FingerprintIndex::fingerprints_file(program_library.get_file()));
+    }
+}
+
+// into the synth's edit buffer only, params and the editor keep the current program; called from
+// the capture thread, which sends the current program again when it is done
+bool MicronauAudioProcessor::load_library_program(int index)
+{
+    unsigned char sysex[ProgramLibrary::PROGRAM_LEN];
+    IonSysexParams p;
+
+    if (!has_midi_out() || !program_library.get_program(index, sysex) || !p.parseParamsFromContent(sysex, ProgramLibrary::PROGRAM_LEN)) {
+        return false;
+    }
+    unsigned char sysex_buf[SYSEX_LEN + 2];
+    memset(sysex_buf, 0, SYSEX_LEN + 2);
+    p.getAsSysexMessage(sysex_buf);
+    send_midi(MidiMessage(sysex_buf, sizeof(sysex_buf)));
+    return true;
+}
+
+bool MicronauAudioProcessor::start_library_capture(bool resume)
+{
+    if (!has_midi_out() || !program_library.is_open()) {
+        return false;
+    }
+    File bank = program_library.get_file();
+    sound_index.clear(program_library.size());
+    return library_capture->start(program_library.size(), FingerprintIndex::captures_dir(bank),
+                                  FingerprintIndex::fingerprints_file(bank), resume);
+}
+
+void MicronauAudioProcessor::stop_library_capture()
+{
+    library_capture->stop();
+}
+
+Array<FingerprintIndex::Match> MicronauAudioProcessor::match_sound(const File &recording, int max_results)
+{
+    AudioFormatManager formats;
+    formats.registerBasicFormats();
+    std::unique_ptr<AudioFormatReader> reader(formats.createReaderFor(recording));
+    if ((reader == nullptr) || (reader->lengthInSamples <= 0) || (reader->numChannels == 0)) {
+        return Array<FingerprintIndex::Match>();
+    }
+
+    // the note is looked for in the first few seconds, mixed down to one channel
+    const int channels = (int) reader->numChannels;
+    const int n = (int) jmin(reader->lengthInSamples, (int64) (reader->sampleRate * 10));
+    AudioSampleBuffer buffer(channels, n);
+    reader->read(&buffer, 0, n, 0, true, true);
+    for (int c = 1; c < channels; c++) {
+        buffer.addFrom(0, 0, buffer, c, 0, n);
+    }
+
+    SpectrumAnalyser fft;
+    SoundFingerprint target;
+    if (!target.compute_from_recording(buffer.getReadPointer(0), n, reader->sampleRate, HardwareReturn::CAPTURE_MS, fft)) {
+        return Array<FingerprintIndex::Match>();
+    }
+    return sound_index.match(target, max_results);
+}
+
+void MicronauAudioProcessor::send_midi(const MidiMessage &msg)
+{
+    ScopedLock lock(midi_port_lock);
+    recorder.record(MidiTrafficRecorder::OUT, msg);
+    midi_stats.sent(msg.getRawDataSize());
+    if (midi_out != NULL) {
+        midi_out->send(msg);
+    } else if (virtual_out) {
+        virtual_micron->send(msg);
+    } else if (host_midi_out) {
+        host_out.push(msg);
+    }
+}
+
+// messages that belong together (an nrpn, bank + program) reach a shared port as one piece
+void MicronauAudioProcessor::send_midi(const Array<MidiMessage> &msgs)
+{
+    ScopedLock lock(midi_port_lock);
+    if (midi_out != NULL) {
+        for (int i = 0; i < msgs.size(); i++) {
+            recorder.record(MidiTrafficRecorder::OUT, msgs.getReference(i));
+            midi_stats.sent(msgs.getReference(i).getRawDataSize());
+        }
+        midi_out->send(msgs);
+        return;
+    }
+    for (int i = 0; i < msgs.size(); i++) {
+        send_midi(msgs.getReference(i));
+    }
+}
+
+// audio thread: the hardware return's notes go into the queues processBlock
+// already feeds, for the start of the next block, and never take the port lock
+void MicronauAudioProcessor::send_test_note(const MidiMessage &msg)
+{
+    if (host_midi_out) {
+        host_out.push(msg);
+    } else if ((midi_out != NULL) || virtual_out) {
+        thru->schedule_next(msg);
+    }
+}
+
+void MicronauAudioProcessor::send_thru(const MidiMessage &msg)
+{
+    // host routed output passes the host's events through in processBlock already.
+    // The port is called without midi_port_lock, which processBlock takes
+    std::shared_ptr<SharedMidiOut> out;
+    bool to_virtual;
+    {
+        ScopedLock lock(midi_port_lock);
+        out = midi_out;
+        to_virtual = virtual_out;
+    }
+    recorder.record(MidiTrafficRecorder::THRU, msg);
+    midi_stats.sent(msg.getRawDataSize());
+    if (out != nullptr) {
+        out->send_now(msg);
+    } else if (to_virtual) {
+        virtual_micron->send(msg);
+    }
+}
+
+bool MicronauAudioProcessor::get_midi_out_stats(SharedMidiOut::Stats &stats)
+{
+    ScopedLock lock(midi_port_lock);
+    if (midi_out == NULL) {
+        return false;
+    }
+    stats = midi_out->get_stats();
+    return true;
+}
+
+StringPairArray MicronauAudioProcessor::get_send_counters()
+{
+    StringPairArray c;
+    SharedMidiOut::Stats port;
+    if (get_midi_out_stats(port)) {
+        c.set("port queued bytes", String(port.queued_bytes));
+        c.set("port frames sent", String(port.frames_sent));
+    }
+    c.set("automation values", String(thinner->get_received()));
+    c.set("automation nrpns sent", String(thinner->get_sent()));
+    c.set("automation duplicates", String(thinner->get_duplicates()));
+    c.set("program changes late", String(preloader->get_late()));
+    c.set("thru dropped", String(thru->get_dropped()));
+    return c;
+}
+
+bool MicronauAudioProcessor::export_stats_csv(const File &f)
+{
+    return f.replaceWithText(midi_stats.to_csv(get_send_counters()));
+}
+
+double MicronauAudioProcessor::replay_traffic(const MidiTrafficReplay &log, bool realtime)
+{
+    const int block = 32;
+    AudioSampleBuffer buffer(jmax(1, getTotalNumOutputChannels()), block);
+    MidiBuffer midi;
+
+    // the log's blocks take the place of the host's, and its input the synth's:
+    // the live input would hand the sysex receiver and the bank dump a second stream
+    suspendProcessing(true);
+    if (midi_in != NULL) {
+        midi_in->stop();
+    }
+    if (virtual_in) {
+        virtual_micron->set_output(nullptr);
+    }
+    double ms = log.play([&] (const MidiTrafficReplay::Event &e) {
+        switch (e.direction) {
+            case MidiTrafficRecorder::HOST:
+                midi.clear();
+                midi.addEvent(e.msg, 0);
+                processBlock(buffer, midi);
+                break;
+            case MidiTrafficRecorder::IN:
+                handle_midi_input(e.msg);
+                break;
+            case MidiTrafficRecorder::OUT:
+                send_midi(e.msg);
+                break;
+        }
+    }, realtime);
+    if (virtual_in) {
+        virtual_micron->set_output([this] (const MidiMessage &m) { handle_midi_input(m); });
+    }
+    if (midi_in != NULL) {
+        midi_in->start();
+    }
+    suspendProcessing(false);
+    return ms;
+}
+
+VirtualMicron *MicronauAudioProcessor::get_virtual_micron()
+{
+    if (virtual_micron == nullptr) {
+        virtual_micron.reset(new VirtualMicron());
+        virtual_micron->set_midi_chan(get_midi_chan());
+    }
+    return virtual_micron.get();
 }
 
 void MicronauAudioProcessor::set_midi_port(int in_out, String p)
 {
+    // set_output waits for a delivery in progress, which can need the port lock
+    // (a bank dump sends its next request from under its own lock)
+    if ((in_out == MIDI_IN_IDX) && virtual_in && (p != midi_in_port)) {
+        virtual_micron->set_output(nullptr);
+    }
 	ScopedLock lock(midi_port_lock);
 
     int idx;
@@ -552,16 +932,25 @@ void MicronauAudioProcessor::set_midi_port(int in_out, String p)
         case MIDI_OUT_IDX:
             if (p != midi_out_port) {
                 if (midi_out != NULL) {
-                    midi_out->stopBackgroundThread();
                     midi_out = NULL; // NOTE: must set the pointer to null due to a race-condition when setting output port to None. ProcessBlock() may attempt to use dangling midi_out pointer.
                 }
+                virtual_out = false;
+                host_midi_out = false;
                 midi_out_port = p;
                 idx = midi_find_port_by_name(in_out, midi_out_port);
-                if (idx == -1) {
+                if (midi_out_port == VirtualMicron::port_name) {
+                    get_virtual_micron();
+                    virtual_out = true;
+                } else if (midi_out_port == HostMidiOut::port_name) {
+                    host_out.reset();
+                    host_midi_out = true;
+                } else if (idx == -1) {
                     midi_out = NULL;
                 } else {
-                    midi_out = MidiOutput::openDevice(idx);
-                    midi_out->startBackgroundThread();
+                    midi_out.reset(port_manager->open(midi_out_port));
+                    if (midi_out != NULL) {
+                        midi_out->set_wire_histogram(&midi_stats.enqueue_to_wire);
+                    }
                 }
             }
             break;
@@ -571,9 +960,13 @@ void MicronauAudioProcessor::set_midi_port(int in_out, String p)
                     midi_in->stop();
                     midi_in = NULL;
                 }
+                virtual_in = false;
                 midi_in_port = p;
                 idx = midi_find_port_by_name(in_out, midi_in_port);
-                if (idx == -1) {
+                if (midi_in_port == VirtualMicron::port_name) {
+                    get_virtual_micron()->set_output([this] (const MidiMessage &m) { handle_midi_input(m); });
+                    virtual_in = true;
+                } else if (idx == -1) {
                     midi_in = NULL;
                 } else {
                     midi_in = MidiInput::openDevice(idx, this);
@@ -588,6 +981,12 @@ void MicronauAudioProcessor::set_midi_port(int in_out, String p)
 void MicronauAudioProcessor::set_midi_chan(unsigned int chan)
 {
     midi_out_channel = chan;
+    if (hw_return != nullptr) {
+        hw_return->set_channel(chan + 1);
+    }
+    if (virtual_micron != nullptr) {
+        virtual_micron->set_midi_chan(chan);
+    }
 }
 
 unsigned int MicronauAudioProcessor::get_midi_chan()
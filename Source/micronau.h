@@ -12,6 +12,23 @@
 
 #include "../JuceLibraryCode/JuceHeader.h"
 #include "IonSysex.h"
+#include "ProgramBank.h"
+#include "BankDump.h"
+#include "VirtualMicron.h"
+#include "SysexReceiver.h"
+#include "HostMidiOut.h"
+#include "MidiThruScheduler.h"
+#include "ProgramPreloader.h"
+#include "AutomationThinner.h"
+#include "MicronauParameter.h"
+#include "PluginState.h"
+#include "ProgramLibrary.h"
+#include "MidiPortManager.h"
+#include "MidiTrafficLog.h"
+#include "MidiStats.h"
+#include "HardwareReturn.h"
+#include "LibraryCapture.h"
+#include "LevelMeter.h"
 
 #define MIDI_OUT_IDX 0
 #define MIDI_IN_IDX 1
@@ -29,7 +46,8 @@ public:
 /**
 */
 class MicronauAudioProcessor  : public AudioProcessor,
-                                public MidiInputCallback
+                                public MidiInputCallback,
+                                private AsyncUpdater
 {
 public:
     //==============================================================================
@@ -49,19 +67,9 @@ public:
     //==============================================================================
     const String getName() const;
 
-    int getNumParameters();
-
-    float getParameter (int index);
-    void setParameter (int index, float newValue);
-
-    const String getParameterName (int index);
-    const String getParameterText (int index);
-
+    // raw range of a host parameter, see MicronauParameter for the rest
     float getParameterMinValue (int parameterIndex);
     float getParameterMaxValue (int parameterIndex);
-    float getParameterDefaultValue (int parameterIndex);
-    int getParameterNumSteps (int parameterIndex);
-    bool isMetaParameter (int parameterIndex) const;
 
     const String getInputChannelName (int channelIndex) const;
     const String getOutputChannelName (int channelIndex) const;
@@ -92,6 +100,48 @@ public:
     void sync_via_nrpn();
     void sync_via_sysex();
     void send_request();
+
+    // fetch every program from the synth into the program bank
+    void start_bank_dump();
+    void stop_bank_dump();
+    BankDump *get_bank_dump() {return bank_dump.get();}
+    ProgramBank &get_program_bank() {return program_bank;}
+    bool open_program_library(const File &f);
+    VirtualMicron *get_virtual_micron();
+    ProgramPreloader *get_preloader() {return preloader.get();}
+    AutomationThinner *get_thinner() {return thinner.get();}
+    // false unless the output is a device port
+    bool get_midi_out_stats(SharedMidiOut::Stats &stats);
+
+    // everything sent and received, see MidiTrafficRecorder
+    MidiTrafficRecorder &get_recorder() {return recorder;}
+    // plays a recorded log back through this instance: host midi into processBlock, input
+    // from the synth into the input handling, output through the selected output port.
+    // Thru is not replayed, the host midi makes it again. The host's processing and the
+    // live midi input are suspended meanwhile. Returns the time taken in ms.
+    double replay_traffic(const MidiTrafficReplay &log, bool realtime);
+
+    // timings and byte counts of the send and receive paths
+    MidiStats &get_midi_stats() {return midi_stats;}
+    // queue depth, coalescing and other counters that go with them
+    StringPairArray get_send_counters();
+    bool export_stats_csv(const File &f);
+
+    // the synth's audio on the plugin input, passed to the output with its
+    // measured latency reported to the host, see HardwareReturn
+    HardwareReturn *get_hardware_return() {return hw_return.get();}
+    void set_hardware_insert(bool on);
+    // levels of the return as it comes in, whether inserted or not
+    LevelMeter &get_level_meter() {return level_meter;}
+
+    // records every program of the open library through the hardware return
+    // and fingerprints them (see LibraryCapture), so match_sound can find the
+    // programs that sound most like a recording, nearest first
+    bool start_library_capture(bool resume);
+    void stop_library_capture();
+    LibraryCapture *get_library_capture() {return library_capture.get();}
+    FingerprintIndex &get_sound_index() {return sound_index;}
+    Array<FingerprintIndex::Match> match_sound(const File &recording, int max_results);
  
     String get_midi_port(int in_out);
     void set_midi_port(int in_out, String p);
@@ -100,6 +150,10 @@ public:
     String get_prog_name();
     void set_prog_name(String s) {params->set_prog_name(s);}
 
+    // editor: set a parameter from its raw value and tell the host
+    void set_param_notifying_host(int index, int value);
+    MicronauParameter *get_host_param(int index) {return host_params[index];}
+
     int index_of_nrpn(int nrpn) const;
     IonSysexParam *param_of_nrpn(int nrpn);
     bool get_progchange() {return prog_changed;}
@@ -110,27 +164,39 @@ private:
     //==============================================================================
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MicronauAudioProcessor)
 
-    static const int MAX_MIDI_PORT_NAME = 80;
     static const int SYSEX_LEN = 432;
-    typedef struct {
-        unsigned char sysex[SYSEX_LEN];
-        unsigned int midi_out_chan;
-        unsigned char midi_in_port[MAX_MIDI_PORT_NAME];
-        unsigned char midi_out_port[MAX_MIDI_PORT_NAME];
-        unsigned int bank;
-        unsigned int patch;
-    } preset;
+    void set_param_value(int index, int value);
     void send_nrpn(int nrpn, int value, bool send_bank=true);
+    void add_nrpn(Array<MidiMessage> &msgs, int nrpn, int value);
+    void add_sync_nrpns(Array<MidiMessage> &msgs);
     void init_from_sysex(unsigned char *sysex);
     void send_bank_patch();
+    void add_bank_patch(Array<MidiMessage> &msgs);
+    void preload_program();
+    void add_program_dump(Array<MidiMessage> &msgs);
+    void send_midi(const MidiMessage &msg);
+    void send_midi(const Array<MidiMessage> &msgs);
+    void send_thru(const MidiMessage &msg);
+    void send_test_note(const MidiMessage &msg);
+    void handle_midi_input(const MidiMessage &msg);
+    bool has_midi_out() const {return (midi_out != NULL) || virtual_out || host_midi_out;}
+    bool has_midi_in() const {return (midi_in != NULL) || virtual_in;}
+    // setLatencySamples, after the audio thread measured a new latency, and
+    // reopens the library after a bank dump
+    void handleAsyncUpdate();
 
     IonSysexParams *params;
     Array<IonSysexParam*> nrpns;
+    Array<MicronauParameter*> host_params; // same order as nrpns, owned by AudioProcessor
     HashMap<int, ext_param *> param_by_nrpn;
 
 	double sample_rate; // used for midi thru timing
 
-    std::unique_ptr<MidiOutput> midi_out;
+    MidiStats midi_stats;
+
+    // device ports are shared with other instances, see MidiPortManager
+    SharedResourcePointer<MidiPortManager> port_manager;
+    std::shared_ptr<SharedMidiOut> midi_out;    // shared with send_thru while it sends
     unsigned int midi_out_channel;
     String midi_out_port;
     CriticalSection midi_port_lock; // use this to ensure midi port is not halfway changed when process block runs
@@ -138,5 +204,43 @@ private:
     std::unique_ptr<MidiInput> midi_in;
     String midi_in_port;
     bool prog_changed;
+
+    // software stand-in for the synth, selected with the port name "Virtual Micron"
+    std::unique_ptr<VirtualMicron> virtual_micron;
+    bool virtual_out;
+    bool virtual_in;
+
+    // output written into the host's midi buffer in processBlock, selected with HostMidiOut::port_name
+    HostMidiOut host_out;
+    bool host_midi_out;
+
+    ProgramBank program_bank;
+    std::unique_ptr<BankDump> bank_dump;
+    std::unique_ptr<SysexReceiver> sysex_receiver;
+
+    // the host's program list, read from the last bank dump
+    ProgramLibrary program_library;
+    int current_program;
+    bool library_closed;        // while a bank dump rewrites the file, message thread only
+
+    // relays the host's midi to the hardware/virtual port with steady timing
+    std::unique_ptr<MidiThruScheduler> thru;
+
+    // lines state changes made during playback up with the next downbeat
+    std::unique_ptr<ProgramPreloader> preloader;
+
+    // drops automation values the synth would not notice before they become nrpns
+    std::unique_ptr<AutomationThinner> thinner;
+
+    MidiTrafficRecorder recorder;
+
+    std::unique_ptr<HardwareReturn> hw_return;
+    LevelMeter level_meter;
+
+    // fingerprints of the library programs, kept beside the bank file
+    FingerprintIndex sound_index;
+    std::unique_ptr<LibraryCapture> library_capture;
+    void load_sound_index();
+    bool load_library_program(int index);
 };
 #endif  // __PLUGINPROCESSOR_H_CCAD67E2__
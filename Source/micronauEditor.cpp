@@ -16,6 +16,8 @@
 #include "gui/LcdTextEditor.h"
 #include "gui/StdComboBox.h"
 #include "gui/LookAndFeel.h"
+#include "gui/StatsOverlay.h"
+#include "gui/LevelDisplay.h"
 #include "tracking.h"
 
 //==============================================================================
@@ -84,7 +86,13 @@ MicronauAudioProcessorEditor::MicronauAudioProcessorEditor (MicronauAudioProcess
     param_display->setColour (TextEditor::backgroundColourId, Colour (0x00000000));
     param_display->setFont (Font (18.00f, Font::plain));
 	param_display->setBounds(875,LCD_Y,170,LCD_Y + LCD_H);
+	param_display->set_reserved_width(40);
 	addAndMakeVisible(param_display);
+	param_display->addMouseListener(this, false);
+
+	level_display = new LevelDisplay(owner->get_level_meter());
+	level_display->setBounds(875 + 170 - 38, LCD_Y + 8, 32, LCD_H - 10);
+	addAndMakeVisible(level_display);
 
     midi_in_menu = new StdComboBox ();
     midi_in_menu->setEditableText (false);
@@ -117,6 +125,15 @@ MicronauAudioProcessorEditor::MicronauAudioProcessorEditor (MicronauAudioProcess
     add_box(100, 910, PROG_NAME_Y+40, 30, "Bank", 1, NULL);
     add_box(101, 950, PROG_NAME_Y+40, 30, "Prgm", 1, NULL);
 
+	add_label("dump", 990, PROG_NAME_Y + 57, 35, 15);
+	dump_button = create_guibutton(990, PROG_NAME_Y + 40);
+	dumpInProgress = false;
+	preloadLateSeen = owner->get_preloader()->get_late();
+
+    stats_overlay = new StatsOverlay(owner);
+    stats_overlay->setBounds(MODMAT_X, MODMAT_Y, MODMAT_W, 330);
+    addChildComponent(stats_overlay);
+
     logo = Drawable::createFromImageData (BinaryData::logo_svg, BinaryData::logo_svgSize);
 
 	// whole gui size
@@ -773,6 +790,43 @@ void MicronauAudioProcessorEditor::timerCallback()
     
 	update_midi_menu(MIDI_IN_IDX, false);
 	update_midi_menu(MIDI_OUT_IDX, false);
+
+	update_dump_progress();
+	update_preload_warning();
+	level_display->update();
+	if (stats_overlay->isVisible()) {
+		stats_overlay->update();
+	}
+}
+
+void MicronauAudioProcessorEditor::update_dump_progress()
+{
+    BankDump *dump = owner->get_bank_dump();
+    if (!dump->is_running() && !dumpInProgress) {
+        return;
+    }
+
+    String s = "Dump " + String(dump->get_done()) + "/" + String(dump->get_total()) + "\n";
+    if (dump->is_running()) {
+        s += String(dump->get_programs_per_sec(), 1) + " prg/s ";
+        s += String(dump->get_bytes_per_sec() / 1000.0, 1) + " kB/s";
+    } else if (dump->get_failed()) {
+        s += "Done, " + String(dump->get_failed()) + " failed";
+    } else {
+        s += "Done";
+    }
+    param_display->setText(s, dontSendNotification);
+    dumpInProgress = dump->is_running();
+}
+
+void MicronauAudioProcessorEditor::update_preload_warning()
+{
+    ProgramPreloader *pre = owner->get_preloader();
+    if (pre->get_late() == preloadLateSeen) {
+        return;
+    }
+    preloadLateSeen = pre->get_late();
+    param_display->setText("Program change\n" + pre->get_last_warning(), dontSendNotification);
 }
 
 void MicronauAudioProcessorEditor::update_midi_menu(int in_out, bool init)
@@ -786,11 +840,16 @@ void MicronauAudioProcessorEditor::update_midi_menu(int in_out, bool init)
             break;
         case MIDI_OUT_IDX:
             x = MidiOutput::getDevices();
+            x.add(HostMidiOut::port_name);
             menu = midi_out_menu;
             break;
         default:
             return;
     }
+#if JUCE_DEBUG
+    // lets the sync and dump paths be exercised without a synth attached
+    x.add(VirtualMicron::port_name);
+#endif
 
     bool midi_changed = false;
     if (x.size() + 1 != menu->getNumItems()) {
@@ -883,6 +942,20 @@ void MicronauAudioProcessorEditor::buttonClicked (Button* button)
     else if (button == request) {
         owner->send_request();
 		lcdTextMessage = "Send prgm request\nDone";
+    }
+    else if (button == dump_button) {
+        if (owner->get_bank_dump()->is_running()) {
+            owner->stop_bank_dump();
+            lcdTextMessage = "Bank dump\nStopped";
+        } else {
+            owner->start_bank_dump();
+            if (owner->get_bank_dump()->is_running()) {
+                dumpInProgress = true;
+                lcdTextMessage = "Bank dump\nStarted";
+            } else {
+                lcdTextMessage = "Bank dump\nNeeds midi in/out";
+            }
+        }
     }
 	else if (button == randomizeButton)
 	{
@@ -1340,6 +1413,17 @@ void MicronauAudioProcessorEditor::mouseDown(const MouseEvent& event)
 	Component::unfocusAllComponents();
 }
 
+void MicronauAudioProcessorEditor::mouseDoubleClick(const MouseEvent& event)
+{
+	if (event.eventComponent == param_display) {
+		stats_overlay->setVisible(!stats_overlay->isVisible());
+		if (stats_overlay->isVisible()) {
+			stats_overlay->toFront(false);
+			stats_overlay->update();
+		}
+	}
+}
+
 #if 0
 void ext_slider::mouseDoubleClick(const MouseEvent& event)
 {
@@ -24,6 +24,8 @@ class LcdLabel;
 class StdComboBox;
 class SliderBank;
 class LcdTextEditor;
+class StatsOverlay;
+class LevelDisplay;
 
 class ext_slider : public MicronSlider
 {
@@ -34,7 +36,7 @@ public:
         setRange (param->getMin(), param->getMax(), 1);
         setDoubleClickReturnValue(true, param->getDefaultValue());
     }
-    void set_value(int v){plugin->setParameterNotifyingHost(idx, v);}
+    void set_value(int v){plugin->set_param_notifying_host(idx, v);}
     int get_value(){ return param->getValue();}
     const String get_name () { return param->getName();}
     const String get_txt_value (int v) { return param->getConvertedValue(v);}
@@ -73,7 +75,7 @@ public:
         }
         nrpn = nrpn_num;
     }
-    void set_value(int v){plugin->setParameterNotifyingHost(idx, v);}
+    void set_value(int v){plugin->set_param_notifying_host(idx, v);}
     int get_value(){ return param->getValue();}
     int get_min() { return param->getMin();}
     int get_max() { return param->getMax();}
@@ -100,7 +102,7 @@ public:
             setLookAndFeel(lf);
         }
     }
-    void set_value(int v){plugin->setParameterNotifyingHost(idx, v);}
+    void set_value(int v){plugin->set_param_notifying_host(idx, v);}
     int get_value(){ return param->getValue();}
     const String get_name () { return param->getName();}
     const String get_txt_value (int v) { return param->getConvertedValue(v);}
@@ -142,6 +144,7 @@ public:
 	void sliderDragStarted (Slider* slider);
 	void sliderDragEnded (Slider* slider);
 	void mouseDown(const MouseEvent& event);
+	void mouseDoubleClick(const MouseEvent& event);
     KeyboardFocusTraverser* createFocusTraverser();
     void buttonClicked (Button* button);
     void comboBoxChanged (ComboBox* comboBoxThatHasChanged);
@@ -288,6 +291,8 @@ private:
 	void updateGuiComponents();
     void update_tracking();
     void update_midi_menu(int in_out, bool init);
+    void update_dump_progress();
+    void update_preload_warning();
 
     void select_item_by_name(int in_out, String nm);
 
@@ -305,6 +310,7 @@ private:
     ScopedPointer<Button> sync_nrpn;
     ScopedPointer<Button> sync_sysex;
     ScopedPointer<Button> request;
+    ScopedPointer<Button> dump_button;
     ScopedPointer<Button> undo_button;
     ScopedPointer<Button> redo_button;
 
@@ -313,10 +319,14 @@ private:
     ScopedPointer<ComboBox> midi_out_chan;
 
     ScopedPointer<LcdLabel> param_display;
+    ScopedPointer<LevelDisplay> level_display; // the audio return's levels, at the right of the lcd
     ScopedPointer<LcdTextEditor> prog_name;
+    ScopedPointer<StatsOverlay> stats_overlay; // midi timings, toggled by double clicking the lcd
 
     MicronauAudioProcessor *owner;
 	bool paramHasChanged; // using this flag to avoid repeatedly updating program name which interferes with editing of the name
+	bool dumpInProgress; // bank dump progress is shown in the parameter display until the dump finishes
+	int preloadLateSeen; // late program changes already shown
 
 	ScopedPointer<MicronTabBar> mod_tabs;
 	ScopedPointer<MicronTabBar> fx_and_tracking_tabs;
@@ -31,6 +31,148 @@ distribution.
 
 #include "tinystr.h"
 
+#include <new>
+
+#if defined( _MSC_VER )
+	#define TIXML_THREAD_LOCAL __declspec( thread )
+#else
+	#define TIXML_THREAD_LOCAL __thread
+#endif
+
+// Arena the allocations of this thread go to, 0 for the heap.
+static TIXML_THREAD_LOCAL TiXmlArena* currentArena = 0;
+
+// In front of every allocation: which arena it came from, 0 for the heap. Its
+// size keeps what follows aligned for anything TinyXML stores.
+union TiXmlAllocHeader
+{
+	TiXmlArena* arena;
+	double alignDouble;
+	long long alignLong;
+	void* alignPointer;
+	char pad[16];
+};
+
+// Blocks start with their Block, rounded up so that the data stays aligned.
+static const size_t blockHeader = ( sizeof(TiXmlAllocHeader) * 2 );
+
+
+TiXmlArena::TiXmlArena (size_t blockSize)
+	: blocks_(0), current_(0), large_(0), blockSize_(blockSize), used_(0), reserved_(0)
+{
+}
+
+
+TiXmlArena::~TiXmlArena ()
+{
+	reset();
+	while (blocks_)
+	{
+		Block* next = blocks_->next;
+		::operator delete(blocks_);
+		blocks_ = next;
+	}
+}
+
+
+void TiXmlArena::reset ()
+{
+	while (large_)
+	{
+		Block* next = large_->next;
+		reserved_ -= large_->size;
+		::operator delete(large_);
+		large_ = next;
+	}
+	for (Block* b = blocks_; b; b = b->next)
+		b->used = 0;
+	current_ = blocks_;
+	used_ = 0;
+}
+
+
+TiXmlArena::Block* TiXmlArena::newBlock (size_t size)
+{
+	assert(sizeof(Block) <= blockHeader);
+	Block* b = static_cast<Block*>( ::operator new(blockHeader + size) );
+	b->next = 0;
+	b->size = size;
+	b->used = 0;
+	reserved_ += size;
+	return b;
+}
+
+
+void* TiXmlArena::allocateHere (size_t size)
+{
+	const size_t align = sizeof(TiXmlAllocHeader);
+	size = (size + align - 1) & ~(align - 1);
+	used_ += size;
+
+	// big ones get a block of their own
+	if (size > blockSize_ / 4)
+	{
+		Block* b = newBlock(size);
+		b->next = large_;
+		large_ = b;
+		return reinterpret_cast<char*>(b) + blockHeader;
+	}
+
+	// the next kept block, or a new one after the current
+	while (!current_ || current_->used + size > current_->size)
+	{
+		if (current_ && current_->next)
+		{
+			current_ = current_->next;
+			continue;
+		}
+		Block* b = newBlock(blockSize_);
+		if (current_)
+			current_->next = b;
+		else
+			blocks_ = b;
+		current_ = b;
+	}
+	void* p = reinterpret_cast<char*>(current_) + blockHeader + current_->used;
+	current_->used += size;
+	return p;
+}
+
+
+void* TiXmlArena::allocate (size_t size)
+{
+	TiXmlAllocHeader* h;
+	if (currentArena)
+		h = static_cast<TiXmlAllocHeader*>( currentArena->allocateHere(sizeof(TiXmlAllocHeader) + size) );
+	else
+		h = static_cast<TiXmlAllocHeader*>( ::operator new(sizeof(TiXmlAllocHeader) + size) );
+	h->arena = currentArena;
+	return h + 1;
+}
+
+
+void TiXmlArena::free (void* p)
+{
+	if (!p)
+		return;
+	TiXmlAllocHeader* h = static_cast<TiXmlAllocHeader*>(p) - 1;
+	if (!h->arena)
+		::operator delete(h);
+}
+
+
+TiXmlArena::Scope::Scope (TiXmlArena* arena) : previous(currentArena)
+{
+	currentArena = arena;
+}
+
+
+TiXmlArena::Scope::~Scope ()
+{
+	currentArena = previous;
+}
+
+
 // Error value for find primitive
 const TiXmlString::size_type TiXmlString::npos = static_cast< size_type >(-1);
 
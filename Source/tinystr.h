@@ -40,8 +40,66 @@ distribution.
 #define TIXML_STRING_INCLUDED
 
 #include <assert.h>
+#include <stddef.h>
 #include <string.h>
 
+/*
+   TiXmlArena is a bump allocator for documents that are parsed once and then thrown
+   away whole (see TiXmlDocument::UseArena). While an arena is current on a thread,
+   the nodes, attributes and string buffers TinyXML creates on that thread come out
+   of its blocks; deleting them costs nothing and the memory is given back in one go
+   by Reset() or the destructor. Every allocation carries a small header saying where
+   it came from, so arena and heap objects can be mixed in one tree.
+*/
+class TiXmlArena
+{
+  public :
+	TiXmlArena (size_t blockSize = 32 * 1024);
+	~TiXmlArena ();
+
+	// Forget everything allocated so far, keeping the blocks for the next document.
+	void reset ();
+
+	// Bytes handed out since the last reset, and bytes held in blocks.
+	size_t used () const { return used_; }
+	size_t reserved () const { return reserved_; }
+
+	// Memory for a TinyXML object or string buffer, from the arena current on this
+	// thread or else from the heap. free() gives back heap memory only.
+	static void* allocate (size_t size);
+	static void free (void* p);
+
+	// Makes an arena (or, with 0, the heap) current on this thread for its lifetime.
+	class Scope
+	{
+	  public :
+		Scope (TiXmlArena* arena);
+		~Scope ();
+	  private :
+		TiXmlArena* previous;
+	};
+
+  private :
+	struct Block
+	{
+		Block* next;
+		size_t size, used;
+	};
+
+	void* allocateHere (size_t size);
+	Block* newBlock (size_t size);
+
+	Block* blocks_;		// blocks kept across resets
+	Block* current_;	// the one being filled
+	Block* large_;		// allocations too big for a block, freed by reset
+	size_t blockSize_;
+	size_t used_, reserved_;
+
+	TiXmlArena (const TiXmlArena&);
+	void operator = (const TiXmlArena&);
+} ;
+
+
 /*
    TiXmlString is an emulation of a subset of the std::string template.
    Its purpose is to allow compiling TinyXML on compilers with no or poor STL support.
@@ -217,14 +275,9 @@ class TiXmlString
 	{
 		if (cap)
 		{
-			// Lee: the original form:
-			//	rep_ = static_cast<Rep*>(operator new(sizeof(Rep) + cap));
-			// doesn't work in some cases of new being overloaded. Switching
-			// to the normal allocation, although use an 'int' for systems
-			// that are overly picky about structure alignment.
-			const size_type bytesNeeded = sizeof(Rep) + cap;
-			const size_type intsNeeded = ( bytesNeeded + sizeof(int) - 1 ) / sizeof( int ); 
-			rep_ = reinterpret_cast<Rep*>( new int[ intsNeeded ] );
+			// The buffer comes from TiXmlArena, which returns suitably aligned
+			// memory from the heap or, while parsing into an arena, the arena.
+			rep_ = reinterpret_cast<Rep*>( TiXmlArena::allocate( sizeof(Rep) + cap ) );
 
 			rep_->str[ rep_->size = sz ] = '\0';
 			rep_->capacity = cap;
@@ -239,9 +292,7 @@ class TiXmlString
 	{
 		if (rep_ != &nullrep_)
 		{
-			// The rep_ is really an array of ints. (see the allocator, above).
-			// Cast it back before delete, so the compiler won't incorrectly call destructors.
-			delete [] ( reinterpret_cast<int*>( rep_ ) );
+			TiXmlArena::free( rep_ );
 		}
 	}
 
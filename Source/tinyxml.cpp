@@ -894,6 +894,9 @@ const char* TiXmlElement::GetText() const
 
 TiXmlDocument::TiXmlDocument() : TiXmlNode( TiXmlNode::DOCUMENT )
 {
+	#ifndef TIXML_USE_STL
+	arena = 0;
+	#endif
 	tabsize = 4;
 	useMicrosoftBOM = false;
 	ClearError();
@@ -901,6 +904,9 @@ TiXmlDocument::TiXmlDocument() : TiXmlNode( TiXmlNode::DOCUMENT )
 
 TiXmlDocument::TiXmlDocument( const char * documentName ) : TiXmlNode( TiXmlNode::DOCUMENT )
 {
+	#ifndef TIXML_USE_STL
+	arena = 0;
+	#endif
 	tabsize = 4;
 	useMicrosoftBOM = false;
 	value = documentName;
@@ -921,10 +927,40 @@ TiXmlDocument::TiXmlDocument( const std::string& documentName ) : TiXmlNode( TiX
 
 TiXmlDocument::TiXmlDocument( const TiXmlDocument& copy ) : TiXmlNode( TiXmlNode::DOCUMENT )
 {
+	#ifndef TIXML_USE_STL
+	arena = 0;
+	#endif
 	copy.CopyTo( this );
 }
 
 
+TiXmlDocument::~TiXmlDocument()
+{
+	#ifndef TIXML_USE_STL
+	// the nodes have to go while their arena is still there
+	Clear();
+	delete arena;
+	#endif
+}
+
+
+#ifndef TIXML_USE_STL
+void TiXmlDocument::UseArena( bool useArena )
+{
+	if ( useArena && !arena )
+	{
+		arena = new TiXmlArena();
+	}
+	else if ( !useArena && arena )
+	{
+		Clear();
+		delete arena;
+		arena = 0;
+	}
+}
+#endif
+
+
 void TiXmlDocument::operator=( const TiXmlDocument& copy )
 {
 	Clear();
@@ -1730,3 +1766,95 @@ TiXmlHandle TiXmlHandle::ChildElement( const char* value, int count ) const
 	}
 	return TiXmlHandle( 0 );
 }
+
+
+#ifndef TIXML_USE_STL
+static TiXmlString PrintedDocument( const TiXmlDocument& doc )
+{
+	TiXmlOutStream out;
+	out << doc;
+	return out;
+}
+
+
+bool TinyXmlArenaTests()
+{
+	// a bit of everything, and values long enough to get blocks of their own
+	TiXmlString xml( "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<!-- library -->\n<library>\n" );
+	for ( int i = 0; i < 2000; ++i )
+	{
+		char line[200];
+		TIXML_SNPRINTF( line, sizeof( line ),
+						"<patch name=\"Patch &amp; %d\" bank=\"%d\"><param id=\"%d\" value=\"%d\"/>text %d</patch>\n",
+						i, i % 4, i * 3, i * 7 - 500, i );
+		xml += line;
+	}
+	xml += "<long value=\"";
+	for ( int i = 0; i < 20000; ++i )
+		xml += "x";
+	xml += "\"/>\n</library>\n";
+
+	TiXmlDocument heap;
+	heap.Parse( xml.c_str() );
+	TiXmlString expected = PrintedDocument( heap );
+
+	TiXmlDocument doc;
+	doc.UseArena( true );
+	size_t reserved = 0;
+	for ( int pass = 0; pass < 20; ++pass )
+	{
+		doc.Clear();
+		doc.Parse( xml.c_str() );
+		if ( doc.Error() || PrintedDocument( doc ) != expected )
+		{
+			TIXML_LOG( "TinyXmlArena: arena document differs\n" );
+			return false;
+		}
+		// reused without growing
+		if ( pass == 1 )
+			reserved = doc.ArenaSize();
+		if ( pass > 1 && doc.ArenaSize() != reserved )
+		{
+			TIXML_LOG( "TinyXmlArena: arena grows on reuse\n" );
+			return false;
+		}
+
+		// edits after parsing come from the heap and are freed with the rest
+		TiXmlElement* root = doc.RootElement();
+		root->FirstChildElement( "patch" )->SetAttribute( "name", "a name too long for the old buffer" );
+		root->LinkEndChild( new TiXmlElement( "added" ) );
+		root->RemoveChild( root->LastChild()->PreviousSibling() );
+	}
+
+	// the error description is not kept in the arena, which goes first
+	TiXmlString error;
+	{
+		TiXmlDocument d;
+		d.UseArena( true );
+		d.Parse( "<a><b></a>" );
+		error = d.ErrorDesc();
+	}
+	if ( error.empty() )
+	{
+		TIXML_LOG( "TinyXmlArena: error description lost\n" );
+		return false;
+	}
+
+	// a copy lives on its own
+	TiXmlDocument* copy = 0;
+	{
+		TiXmlDocument d;
+		d.UseArena( true );
+		d.Parse( xml.c_str() );
+		copy = new TiXmlDocument( d );
+	}
+	bool same = ( PrintedDocument( *copy ) == expected );
+	delete copy;
+	if ( !same )
+	{
+		TIXML_LOG( "TinyXmlArena: copy of an arena document differs\n" );
+		return false;
+	}
+	return true;
+}
+#endif
@@ -159,6 +159,12 @@ public:
 	TiXmlBase()	:	userData(0) {}
 	virtual ~TiXmlBase()					{}
 
+	#ifndef TIXML_USE_STL
+	// Nodes and attributes come out of the parsing document's arena, if it has one.
+	static void* operator new( size_t size )	{ return TiXmlArena::allocate( size ); }
+	static void operator delete( void* p )		{ TiXmlArena::free( p ); }
+	#endif
+
 	/**	All TinyXml classes can print themselves to a filestream.
 		This is a formatted print, and will insert tabs and newlines.
 		
@@ -1234,7 +1240,7 @@ public:
 	TiXmlDocument( const TiXmlDocument& copy );
 	void operator=( const TiXmlDocument& copy );
 
-	virtual ~TiXmlDocument() {}
+	virtual ~TiXmlDocument();
 
 	/** Load a file using the current document value.
 		Returns true if successful. Will delete any existing
@@ -1267,6 +1273,21 @@ public:
 	*/
 	virtual const char* Parse( const char* p, TiXmlParsingData* data = 0, TiXmlEncoding encoding = TIXML_DEFAULT_ENCODING );
 
+	#ifndef TIXML_USE_STL
+	/** Parse into memory owned by the document instead of allocating every node,
+		attribute and string on the heap. For documents that are read and thrown away,
+		such as bulk imports: everything parsed is given back at once when the document
+		is cleared and parsed again, or destroyed, so a document reused with Clear()
+		and Parse() stops allocating once its arena is big enough. Nodes added later
+		by hand still come from the heap. Nodes parsed into an arena must not be moved
+		to another document. Set before parsing; turning it off clears the document.
+	*/
+	void UseArena( bool useArena );
+	bool UsesArena() const					{ return arena != 0; }
+	/// Bytes the arena holds, 0 without one.
+	size_t ArenaSize() const				{ return arena ? arena->reserved() : 0; }
+	#endif
+
 	/** Get the root element -- the only top level element -- of the document.
 		In well formed XML, there should only be one. TinyXml is tolerant of
 		multiple elements at the document level.
@@ -1362,6 +1383,9 @@ private:
 	int tabsize;
 	TiXmlCursor errorLocation;
 	bool useMicrosoftBOM;		// the UTF-8 BOM were found when read. Note this, and try to write.
+	#ifndef TIXML_USE_STL
+	TiXmlArena* arena;
+	#endif
 };
 
 
@@ -1503,6 +1527,11 @@ private:
 	TiXmlNode* node;
 };
 
+#ifndef TIXML_USE_STL
+// Arena documents against heap documents: same trees, reuse, mixing in heap nodes.
+bool TinyXmlArenaTests();
+#endif
+
 #ifdef _MSC_VER
 #pragma warning( pop )
 #endif
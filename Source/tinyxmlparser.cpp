@@ -682,6 +682,14 @@ const char* TiXmlDocument::Parse( const char* p, TiXmlParsingData* prevData, TiX
 {
 	ClearError();
 
+	#ifndef TIXML_USE_STL
+	// Everything created from here on goes into the arena. Whatever it held
+	// before can go when nothing from it is left in the document.
+	if ( arena && !firstChild )
+		arena->reset();
+	TiXmlArena::Scope scope( arena );
+	#endif
+
 	// Parse away, at the document level. Since a document
 	// contains nothing but other tags, most of what happens
 	// here is skipping white space.
@@ -781,7 +789,13 @@ void TiXmlDocument::SetError( int err, const char* pError, TiXmlParsingData* dat
 	assert( err > 0 && err < TIXML_ERROR_STRING_COUNT );
 	error   = true;
 	errorId = err;
-	errorDesc = errorString[ errorId ];
+	{
+		#ifndef TIXML_USE_STL
+		// the document outlives what its arena holds
+		TiXmlArena::Scope heap( 0 );
+		#endif
+		errorDesc = errorString[ errorId ];
+	}
 
 	errorLocation.Clear();
 	if ( pError && data )
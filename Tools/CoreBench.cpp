@@ -0,0 +1,492 @@
+/*
+ This file is part of micronau.
+ Copyright (c) 2013 - David Smitley
+
+ Permission is granted to use this software under the terms of the GPL v2 (or any later version)
+
+ Details can be found at: www.gnu.org/licenses
+*/
+
+// Microbenchmarks of the core's hot paths: the 7/8 bit sysex codec, program
+// parse and build, display text of every conversion, nrpn encoding, the core
+// side of setParameter, loading the parameter schema, parsing xml (the schema
+// and a synthetic patch library) with and without a TinyXML arena, and the
+// audio thread's side of the hardware return.
+//
+//   micronau_core_bench [--quick] [--csv out.csv] [--compare base.csv [--tolerance pct]]
+//
+// Results are csv, one line per benchmark: name,iterations,median ns/op,min ns/op.
+// With --compare, a benchmark whose median is more than tolerance percent
+// (default 25) slower than in the baseline fails the run.
+
+#include "IonSysex.h"
+#include "BinaryData.h"
+#include "tinyxml.h"
+#include "HardwareReturn.h"
+#include "SoundMatch.h"
+#include "LevelMeter.h"
+
+static volatile int64 sink;
+
+struct bench_result {
+    String name;
+    int64 iterations;
+    double median_ns;
+    double min_ns;
+};
+
+class bench_runner
+{
+public:
+    bench_runner(bool quick) : target_ms(quick ? 1.0 : 20.0), samples(quick ? 3 : 11) {}
+
+    // fn runs the operation n times and returns how many operations that was
+    void run(const String &name, const std::function<int64 (int64 n)> &fn)
+    {
+        // grow the batch until one takes target_ms
+        int64 n = 1;
+        double ms = time_ms(fn, n, nullptr);
+        while (ms < target_ms && n < ((int64) 1 << 40)) {
+            n = (ms > 0.01) ? jmax(n + 1, (int64) (n * target_ms / ms)) : n * 10;
+            ms = time_ms(fn, n, nullptr);
+        }
+        Array<double> ns;
+        int64 ops = 0;
+        for (int i = 0; i < samples; i++) {
+            ms = time_ms(fn, n, &ops);
+            ns.add(ms * 1.0e6 / (double) ops);
+        }
+        ns.sort();
+        bench_result r = {name, ops, ns[ns.size() / 2], ns[0]};
+        results.add(r);
+        printf("%s,%lld,%.1f,%.1f\n", r.name.toRawUTF8(), (long long) r.iterations, r.median_ns, r.min_ns);
+        fflush(stdout);
+    }
+
+    String to_csv() const
+    {
+        String s("name,iterations,median_ns,min_ns\n");
+        for (const bench_result &r : results) {
+            s << r.name << "," << String(r.iterations) << ","
+              << String(r.median_ns, 1) << "," << String(r.min_ns, 1) << "\n";
+        }
+        return s;
+    }
+
+    // number of benchmarks that got slower than the baseline allows
+    int compare(const File &baseline, double tolerance_pct) const
+    {
+        StringArray lines;
+        lines.addLines(baseline.loadFileAsString());
+        int slower = 0;
+        for (const bench_result &r : results) {
+            for (const String &line : lines) {
+                StringArray f = StringArray::fromTokens(line, ",", "");
+                if (f.size() < 3 || f[0] != r.name) {
+                    continue;
+                }
+                double base = f[2].getDoubleValue();
+                if (base > 0 && r.median_ns > base * (1.0 + tolerance_pct / 100.0)) {
+                    fprintf(stderr, "%s: %.1f ns/op, baseline %.1f (+%.0f%%)\n",
+                            r.name.toRawUTF8(), r.median_ns, base, (r.median_ns / base - 1.0) * 100.0);
+                    slower++;
+                }
+            }
+        }
+        return slower;
+    }
+
+private:
+    double time_ms(const std::function<int64 (int64 n)> &fn, int64 n, int64 *ops)
+    {
+        int64 start = Time::getHighResolutionTicks();
+        int64 done = fn(n);
+        int64 end = Time::getHighResolutionTicks();
+        if (ops != nullptr) {
+            *ops = done;
+        }
+        return Time::highResolutionTicksToSeconds(end - start) * 1000.0;
+    }
+
+    double target_ms;
+    int samples;
+    Array<bench_result> results;
+};
+
+static const char *conversion_names[] = {
+    "NONE", "LIST", "PERCENT", "TENTHS_OF_PERCENT", "INT32", "INT16", "INT8",
+    "ENV_TIME", "FX1_FX2_BALANCE", "FILTER_FREQ", "PITCH_FINE", "PORTA_TIME",
+    "LFO_FREQ", "RELEASE_TIME", "FILTER_OFFSET_FREQ", "FILTER_OFFSET_OCT",
+    "BALANCE", "TENTHS", "NAME", "TEXT_LABEL", "WET_DRY", "PRE_BAL", "POST_BAL",
+    "EXT_IN", "FX_LFO_FREQ", "MS", "OCTAVE", "SEMITONE", "BANK"
+};
+
+static void bench_codec(bench_runner &b)
+{
+    vector<unsigned char> raw, encoded, decoded;
+    for (int i = 0; i < 315; i++) {
+        raw.push_back((unsigned char) (i * 37));
+    }
+    encodeToMidi(raw, encoded);
+
+    b.run("codec/encodeToMidi", [&] (int64 n) {
+        for (int64 i = 0; i < n; i++) {
+            encodeToMidi(raw, encoded);
+        }
+        sink += encoded.size();
+        return n;
+    });
+    b.run("codec/decodeFromMidi", [&] (int64 n) {
+        for (int64 i = 0; i < n; i++) {
+            decodeFromMidi(encoded, decoded);
+        }
+        sink += decoded.size();
+        return n;
+    });
+}
+
+static void bench_program(bench_runner &b)
+{
+    int sz;
+    const char *x = BinaryData::getNamedResource("default_syx", sz);
+    HeapBlock<unsigned char> content(sz);
+    memcpy(content, x, sz);
+    IonSysexParams params;
+    unsigned char msg[SYSEX_PROGRAM_SIZE];
+
+    b.run("program/parseParamsFromContent", [&] (int64 n) {
+        for (int64 i = 0; i < n; i++) {
+            sink += params.parseParamsFromContent(&content[1], sz - 2);
+        }
+        return n;
+    });
+    b.run("program/getAsSysexMessage", [&] (int64 n) {
+        for (int64 i = 0; i < n; i++) {
+            params.getAsSysexMessage(msg);
+        }
+        sink += msg[100];
+        return n;
+    });
+    b.run("program/validateProgramSysex", [&] (int64 n) {
+        for (int64 i = 0; i < n; i++) {
+            sink += validateProgramSysex(&content[1], sz - 2);
+        }
+        return n;
+    });
+    b.run("schema/IonSysexParams", [&] (int64 n) {
+        for (int64 i = 0; i < n; i++) {
+            IonSysexParams p;
+            sink += p.numParams();
+        }
+        return n;
+    });
+    b.run("schema/IonSysexParams_dom", [&] (int64 n) {
+        for (int64 i = 0; i < n; i++) {
+            IonSysexParams p(IonSysexParams::DOM_SCHEMA);
+            sink += p.numParams();
+        }
+        return n;
+    });
+}
+
+struct param_value {
+    IonSysexParam *param;
+    int value;
+};
+
+// every value of every parameter, leaving out list items the list does not
+// have (some lists are shorter than their parameter's range)
+static Array<param_value> all_values(IonSysexParams &params, int type)
+{
+    Array<param_value> values;
+    for (UInt32 i = 0; i < params.numParams(); i++) {
+        IonSysexParam *p = params.getParam(i);
+        if ((type >= 0 && (int) p->getConversionType() != type) ||
+            (p->getConversionType() == IonSysexParam::NAME))
+        {
+            continue;
+        }
+        for (int v = p->getMin(); v <= p->getMax(); v++) {
+            if ((p->getList().size() != 0) && (v + p->getCntrlOffset() >= (int) p->getList().size())) {
+                continue;
+            }
+            param_value pv = {p, v};
+            values.add(pv);
+        }
+    }
+    return values;
+}
+
+// one op is the text of one value
+static void bench_conversions(bench_runner &b)
+{
+    IonSysexParams params;
+    const int num_types = numElementsInArray(conversion_names);
+    for (int type = 0; type < num_types; type++) {
+        Array<param_value> values = all_values(params, type);
+        if (values.isEmpty()) {
+            continue;
+        }
+        b.run(String("convert/") + conversion_names[type], [&] (int64 n) {
+            for (int64 i = 0; i < n; i++) {
+                const param_value &pv = values.getReference((int) (i % values.size()));
+                sink += pv.param->getTextForValue(pv.value).length();
+            }
+            return n;
+        });
+        b.run(String("format/") + conversion_names[type], [&] (int64 n) {
+            for (int64 i = 0; i < n; i++) {
+                const param_value &pv = values.getReference((int) (i % values.size()));
+                sink += pv.param->formatValue(pv.value + pv.param->getCntrlOffset()).length();
+            }
+            return n;
+        });
+    }
+}
+
+static void bench_nrpn(bench_runner &b)
+{
+    IonSysexParams params;
+    Array<param_value> values;
+    for (const param_value &pv : all_values(params, -1)) {
+        if (pv.param->hasNrpn() && (pv.param->getList().size() == 0 || pv.value < (int) pv.param->getList().size())) {
+            values.add(pv);
+        }
+    }
+    unsigned char buf[12];
+
+    b.run("nrpn/encodeNrpn", [&] (int64 n) {
+        for (int64 i = 0; i < n; i++) {
+            sink += encodeNrpn(0, (int) (i & 0x3ff), (int) (i & 0x3fff), buf);
+        }
+        return n;
+    });
+
+    // what MicronauAudioProcessor::set_param_value does before the message
+    // leaves the core: store the value, map list items and fx slots to the
+    // nrpn the synth wants, encode
+    b.run("nrpn/setParameter", [&] (int64 n) {
+        for (int64 i = 0; i < n; i++) {
+            // a prime stride so consecutive calls hit different parameters
+            const param_value &pv = values.getReference((int) ((i * 7919) % values.size()));
+            IonSysexParam *p = pv.param;
+            int value = pv.value;
+            p->setValue(value);
+            if (p->getList().size()) {
+                ListItemParameter &lip = p->getList()[value];
+                if (lip.hasSpecialNrpnValue()) {
+                    value = lip.getNrpnValue();
+                }
+            }
+            int nrpn = p->isFxSelector() ? p->fxSelectorToNrpn() : params.fx1fx2NrpnNum(p);
+            if (nrpn >= 512) {
+                nrpn -= 512;
+            }
+            sink += encodeNrpn(0, nrpn, value, buf);
+        }
+        return n;
+    });
+}
+
+// one patch as an xml file: a <param> with name and value for every parameter
+static String patch_xml(IonSysexParams &params, int n)
+{
+    String s;
+    s << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+      << "<patch name=\"Bank " << (n / 128) << " Prog " << (n % 128) << "\">\n";
+    for (UInt32 i = 0; i < params.numParams(); i++) {
+        IonSysexParam *p = params.getParam(i);
+        s << "  <param name=\"" << p->getName() << "\" value=\""
+          << (p->getMin() + (n * 31 + (int) i) % (p->getMax() - p->getMin() + 1)) << "\"/>\n";
+    }
+    s << "</patch>\n";
+    return s;
+}
+
+// one op is one stereo block of 64 samples, the smallest a host is likely to
+// ask for; the scan is over silence (the usual case) and with an onset at the end
+static void bench_audio(bench_runner &b)
+{
+    const int block = 64;
+    AudioSampleBuffer buffer(2, block);
+    buffer.clear();
+    const float *const *in = buffer.getArrayOfReadPointers();
+    b.run("audio/onset_scan/silent", [&] (int64 n) {
+        for (int64 i = 0; i < n; i++) {
+            sink += OnsetDetector::find(in, 2, block, 0.01f);
+        }
+        return n;
+    });
+    buffer.setSample(1, block - 1, 0.5f);
+    b.run("audio/onset_scan/onset", [&] (int64 n) {
+        for (int64 i = 0; i < n; i++) {
+            sink += OnsetDetector::find(in, 2, block, 0.01f);
+        }
+        return n;
+    });
+    HardwareReturn hw([] (const MidiMessage &) {});
+    hw.prepare(44100);
+    hw.set_insert(true);
+    b.run("audio/hardware_return/insert", [&] (int64 n) {
+        for (int64 i = 0; i < n; i++) {
+            hw.process(buffer);
+        }
+        return n;
+    });
+    // kept in the quiet phase, which looks at every sample
+    buffer.clear();
+    b.run("audio/hardware_return/measure", [&] (int64 n) {
+        for (int64 i = 0; i < n; i++) {
+            hw.measure();
+            hw.process(buffer);
+        }
+        return n;
+    });
+
+    // a 64 sample stereo block of noise; every eighth one runs the transform
+    LevelMeter meter;
+    meter.prepare(44100);
+    LevelMeter::Frame frame;
+    Random noise(2);
+    for (int c = 0; c < 2; c++) {
+        for (int i = 0; i < block; i++) {
+            buffer.setSample(c, i, noise.nextFloat() - 0.5f);
+        }
+    }
+    b.run("audio/level_meter", [&] (int64 n) {
+        for (int64 i = 0; i < n; i++) {
+            meter.process(buffer, 2);
+            if ((i & 63) == 0) {
+                sink += meter.read(frame);
+            }
+        }
+        return n;
+    });
+
+    // one op is one capture fingerprinted, or one search of a 10000 program library
+    SpectrumAnalyser fft;
+    Array<float> note;
+    Random rnd(1);
+    for (int i = 0; i < HardwareReturn::CAPTURE_MS * 44100 / 1000; i++) {
+        note.add((rnd.nextFloat() - 0.5f) * std::exp(-i / 20000.0f));
+    }
+    SoundFingerprint fp;
+    b.run("audio/fingerprint", [&] (int64 n) {
+        for (int64 i = 0; i < n; i++) {
+            sink += fp.compute(note.getRawDataPointer(), note.size(), 44100, fft);
+        }
+        return n;
+    });
+    FingerprintIndex index;
+    index.clear(10000);
+    for (int p = 0; p < 10000; p++) {
+        for (int d = 0; d < SoundFingerprint::SIZE; d++) {
+            fp.values[d] = rnd.nextFloat() - 0.5f;
+        }
+        index.set(p, fp);
+    }
+    b.run("audio/match", [&] (int64 n) {
+        for (int64 i = 0; i < n; i++) {
+            sink += index.match(fp, 5).size();
+        }
+        return n;
+    });
+}
+
+// one op is one document; heap parses into a new document every time, arena
+// reuses one document the way a bulk import would
+static void bench_xml(bench_runner &b)
+{
+    int sz;
+    const char *schema = BinaryData::getNamedResource("parameters_xml", sz);
+    String schema_text(CharPointer_UTF8(schema), (size_t) sz);
+
+    IonSysexParams params;
+    StringArray patches;
+    String library("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<library>\n");
+    for (int n = 0; n < 64; n++) {
+        patches.add(patch_xml(params, n));
+        library << patches[n].fromFirstOccurrenceOf("?>", false, false);
+    }
+    library << "</library>\n";
+
+    struct source {
+        const char *name;
+        const String *text;
+        int count;
+    };
+    const String library_text(library);
+    const source sources[] = {
+        {"parameters", &schema_text, 1},
+        {"patch", nullptr, patches.size()},
+        {"library", &library_text, 1},
+    };
+    for (const source &src : sources) {
+        auto text = [&] (int64 i) {
+            return (src.text != nullptr) ? src.text->toRawUTF8() : patches[(int) (i % src.count)].toRawUTF8();
+        };
+        b.run(String("xml/") + src.name + "/heap", [&] (int64 n) {
+            for (int64 i = 0; i < n; i++) {
+                TiXmlDocument doc;
+                doc.Parse(text(i));
+                sink += (doc.RootElement() != nullptr);
+            }
+            return n;
+        });
+        TiXmlDocument doc;
+        doc.UseArena(true);
+        b.run(String("xml/") + src.name + "/arena", [&] (int64 n) {
+            for (int64 i = 0; i < n; i++) {
+                doc.Clear();
+                doc.Parse(text(i));
+                sink += (doc.RootElement() != nullptr);
+            }
+            return n;
+        });
+    }
+}
+
+int main(int argc, char **argv)
+{
+    bool quick = false;
+    File csv, baseline;
+    double tolerance = 25.0;
+    for (int i = 1; i < argc; i++) {
+        String arg(argv[i]);
+        bool has_value = (i + 1 < argc);
+        if (arg == "--quick") {
+            quick = true;
+        } else if (arg == "--csv" && has_value) {
+            csv = File::getCurrentWorkingDirectory().getChildFile(argv[++i]);
+        } else if (arg == "--compare" && has_value) {
+            baseline = File::getCurrentWorkingDirectory().getChildFile(argv[++i]);
+        } else if (arg == "--tolerance" && has_value) {
+            tolerance = String(argv[++i]).getDoubleValue();
+        } else {
+            fprintf(stderr, "usage: %s [--quick] [--csv out.csv] [--compare base.csv [--tolerance pct]]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    bench_runner b(quick);
+    printf("name,iterations,median_ns,min_ns\n");
+    bench_codec(b);
+    bench_program(b);
+    bench_conversions(b);
+    bench_nrpn(b);
+    bench_xml(b);
+    bench_audio(b);
+
+    if (csv != File() && !csv.replaceWithText(b.to_csv())) {
+        fprintf(stderr, "cannot write %s\n", csv.getFullPathName().toRawUTF8());
+        return 2;
+    }
+    if (baseline != File()) {
+        if (!baseline.existsAsFile()) {
+            fprintf(stderr, "no baseline %s\n", baseline.getFullPathName().toRawUTF8());
+            return 2;
+        }
+        return (b.compare(baseline, tolerance) == 0) ? 0 : 1;
+    }
+    return 0;
+}
@@ -0,0 +1,89 @@
+/*
+ This file is part of micronau.
+ Copyright (c) 2013 - David Smitley
+
+ Permission is granted to use this software under the terms of the GPL v2 (or any later version)
+
+ Details can be found at: www.gnu.org/licenses
+*/
+
+// Runs the core's in-source tests: all of them, or the ones named on the
+// command line (as ctest does, one per test).
+
+#include "IonSysex.h"
+#include "PluginState.h"
+#include "SysexReceiver.h"
+#include "VirtualMicron.h"
+#include "ProgramLibrary.h"
+#include "HostMidiOut.h"
+#include "MidiThruScheduler.h"
+#include "ProgramPreloader.h"
+#include "AutomationThinner.h"
+#include "MidiTrafficLog.h"
+#include "MidiStats.h"
+#include "MidiPortManager.h"
+#include "HardwareReturn.h"
+#include "SoundMatch.h"
+#include "LibraryCapture.h"
+#include "LevelMeter.h"
+#include "tinyxml.h"
+#if MICRONAU_PROCESSORS
+ #include "MicronauParameter.h"
+#endif
+
+struct core_test {
+    const char *name;
+    bool (*run)();
+};
+
+static const core_test tests[] = {
+    {"IonSysex", IonSysexTests},
+    {"ProgramLayout", ProgramLayoutTests},
+    {"ConversionTable", ConversionTableTests},
+    {"ParamValueStore", ParamValueStoreTests},
+    {"ParamSweep", ParamSweepTests},
+    {"ParamSchema", ParamSchemaTests},
+    {"TinyXmlArena", TinyXmlArenaTests},
+    {"PluginState", PluginStateTests},
+    {"SysexReceiver", SysexReceiverTests},
+    {"VirtualMicron", VirtualMicronTests},
+    {"ProgramLibrary", ProgramLibraryTests},
+    {"HostMidiOut", HostMidiOutTests},
+    {"MidiThruScheduler", MidiThruSchedulerTests},
+    {"ProgramPreloader", ProgramPreloaderTests},
+    {"AutomationThinner", AutomationThinnerTests},
+    {"MidiTrafficLog", MidiTrafficLogTests},
+    {"MidiStats", MidiStatsTests},
+    {"MidiPortManager", MidiPortManagerTests},
+    {"HardwareReturn", HardwareReturnTests},
+    {"SoundMatch", SoundMatchTests},
+    {"LibraryCapture", LibraryCaptureTests},
+    {"LevelMeter", LevelMeterTests},
+#if MICRONAU_PROCESSORS
+    {"MicronauParameter", MicronauParameterTests},
+#endif
+};
+
+int main(int argc, char **argv)
+{
+    int failed = 0;
+    int ran = 0;
+    for (const core_test &t : tests) {
+        bool wanted = (argc < 2);
+        for (int i = 1; i < argc; i++) {
+            wanted = wanted || (strcmp(argv[i], t.name) == 0);
+        }
+        if (!wanted) {
+            continue;
+        }
+        bool ok = t.run();
+        printf("%-20s %s\n", t.name, ok ? "ok" : "FAILED");
+        failed += ok ? 0 : 1;
+        ran++;
+    }
+    if (ran == 0) {
+        fprintf(stderr, "no test of that name\n");
+        return 2;
+    }
+    return (failed == 0) ? 0 : 1;
+}
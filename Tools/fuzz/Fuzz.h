@@ -0,0 +1,44 @@
+/*
+ This file is part of micronau.
+ Copyright (c) 2013 - David Smitley
+
+ Permission is granted to use this software under the terms of the GPL v2 (or any later version)
+
+ Details can be found at: www.gnu.org/licenses
+*/
+
+#ifndef __FUZZ_H__
+#define __FUZZ_H__
+
+// Fuzz targets use the libFuzzer entry point, so they build either against
+// libFuzzer (clang, MICRONAU_FUZZ=ON) or against FuzzMain.cpp, which replays
+// a corpus and mutates it without coverage feedback.
+
+#include "IonSysex.h"
+#include <stdint.h>
+#include <stddef.h>
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+// what the plugin does with a program once it is in: show every value, work
+// out the nrpns and build the dump the editor would send back
+static inline void fuzz_use_program(IonSysexParams &params)
+{
+    static volatile int sink;
+    for (UInt32 i = 0; i < params.numParams(); i++) {
+        IonSysexParam *p = params.getParam(i);
+        sink = sink + p->getConvertedValue(p->getValue()).length();
+        if (p->hasNrpn()) {
+            sink = sink + params.fx1fx2NrpnNum(p);
+        }
+    }
+    sink = sink + params.get_prog_name().length();
+    unsigned char msg[SYSEX_PROGRAM_SIZE];
+    params.getAsSysexMessage(msg);
+    if (validateProgramSysex(&msg[1], SYSEX_PROGRAM_SIZE - 2) != SYSEX_OK) {
+        // whatever went in, what we build must be a valid dump
+        abort();
+    }
+}
+
+#endif  // __FUZZ_H__
@@ -0,0 +1,198 @@
+/*
+ This file is part of micronau.
+ Copyright (c) 2013 - David Smitley
+
+ Permission is granted to use this software under the terms of the GPL v2 (or any later version)
+
+ Details can be found at: www.gnu.org/licenses
+*/
+
+// Stand-in for libFuzzer's main where it is not available (gcc, msvc). Takes
+// the same arguments for the parts it has:
+//
+//   micronau_fuzz_xxx [-runs=N] [-seed=S] [-max_len=L] [-max_total_time=secs] corpus_dir_or_file...
+//
+// Every corpus file is run once, then N inputs made by randomly mutating
+// corpus entries (no coverage feedback, so this finds less than libFuzzer
+// does, but it keeps the targets honest in ctest). If an input crashes the
+// target it is written to crash-input in the current directory.
+
+#include "Fuzz.h"
+
+#if ! JUCE_WINDOWS
+ #include <signal.h>
+ #include <fcntl.h>
+ #include <unistd.h>
+#endif
+
+static const uint8_t *current_data;
+static size_t current_size;
+
+#if ! JUCE_WINDOWS
+static void write_crash_input()
+{
+    int fd = open("crash-input", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        ssize_t unused = write(fd, current_data, current_size);
+        (void) unused;
+        close(fd);
+    }
+    const char msg[] = "fuzz: crashed, input written to crash-input\n";
+    ssize_t unused = write(2, msg, sizeof(msg) - 1);
+    (void) unused;
+}
+
+static void crash_handler(int sig)
+{
+    write_crash_input();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+// sanitizers report and exit without a signal, they call this first
+extern "C" void __sanitizer_set_death_callback(void (*callback)(void)) __attribute__((weak));
+#endif
+
+static void run_one(const MemoryBlock &input)
+{
+    current_data = (const uint8_t *) input.getData();
+    current_size = input.getSize();
+    LLVMFuzzerTestOneInput(current_data, current_size);
+}
+
+static void mutate(MemoryBlock &m, const Array<MemoryBlock> &corpus, Random &rnd, int max_len)
+{
+    static const uint8 interesting[] = {0x00, 0x01, 0x7f, 0x80, 0xf0, 0xf7, 0xf8, 0xff};
+    int count = 1 + rnd.nextInt(4);
+    for (int n = 0; n < count; n++) {
+        int size = (int) m.getSize();
+        uint8 *d = (uint8 *) m.getData();
+        switch (rnd.nextInt(7)) {
+            case 0:     // flip a bit
+                if (size > 0) {
+                    d[rnd.nextInt(size)] ^= (uint8) (1 << rnd.nextInt(8));
+                }
+                break;
+            case 1:     // random byte
+                if (size > 0) {
+                    d[rnd.nextInt(size)] = (uint8) rnd.nextInt(256);
+                }
+                break;
+            case 2:     // byte that means something to a midi or sysex parser
+                if (size > 0) {
+                    d[rnd.nextInt(size)] = interesting[rnd.nextInt(numElementsInArray(interesting))];
+                }
+                break;
+            case 3: {   // insert bytes
+                uint8 b[8];
+                int len = 1 + rnd.nextInt(8);
+                for (int i = 0; i < len; i++) {
+                    b[i] = (uint8) rnd.nextInt(256);
+                }
+                m.insert(b, (size_t) len, (size_t) rnd.nextInt(size + 1));
+                break;
+            }
+            case 4:     // remove bytes
+                if (size > 0) {
+                    int at = rnd.nextInt(size);
+                    m.removeSection((size_t) at, (size_t) (1 + rnd.nextInt(jmin(size - at, 64))));
+                }
+                break;
+            case 5:     // truncate
+                if (size > 0) {
+                    m.setSize((size_t) rnd.nextInt(size));
+                }
+                break;
+            default: {  // splice in part of another entry
+                const MemoryBlock &other = corpus.getReference(rnd.nextInt(corpus.size()));
+                if (other.getSize() > 0) {
+                    int from = rnd.nextInt((int) other.getSize());
+                    int len = 1 + rnd.nextInt((int) other.getSize() - from);
+                    m.insert((const uint8 *) other.getData() + from, (size_t) len, (size_t) rnd.nextInt(size + 1));
+                }
+                break;
+            }
+        }
+    }
+    if ((int) m.getSize() > max_len) {
+        m.setSize((size_t) max_len);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int64 runs = 0;
+    int64 seed = Time::currentTimeMillis();
+    int max_len = 4096;
+    double max_time = 0;
+    Array<File> inputs;
+
+    for (int i = 1; i < argc; i++) {
+        String arg(argv[i]);
+        if (arg.startsWith("-runs=")) {
+            runs = arg.fromFirstOccurrenceOf("=", false, false).getLargeIntValue();
+        } else if (arg.startsWith("-seed=")) {
+            seed = arg.fromFirstOccurrenceOf("=", false, false).getLargeIntValue();
+        } else if (arg.startsWith("-max_len=")) {
+            max_len = jmax(1, arg.fromFirstOccurrenceOf("=", false, false).getIntValue());
+        } else if (arg.startsWith("-max_total_time=")) {
+            max_time = arg.fromFirstOccurrenceOf("=", false, false).getDoubleValue();
+        } else if (arg.startsWith("-")) {
+            fprintf(stderr, "fuzz: ignoring %s\n", argv[i]);
+        } else {
+            File f = File::getCurrentWorkingDirectory().getChildFile(arg);
+            if (f.isDirectory()) {
+                Array<File> files = f.findChildFiles(File::findFiles, false);
+                files.sort();
+                inputs.addArray(files);
+            } else {
+                inputs.add(f);
+            }
+        }
+    }
+
+#if ! JUCE_WINDOWS
+    signal(SIGSEGV, crash_handler);
+    signal(SIGBUS, crash_handler);
+    signal(SIGABRT, crash_handler);
+    signal(SIGFPE, crash_handler);
+    if (__sanitizer_set_death_callback != nullptr) {
+        __sanitizer_set_death_callback(write_crash_input);
+    }
+#endif
+
+    Array<MemoryBlock> corpus;
+    for (const File &f : inputs) {
+        MemoryBlock m;
+        if (!f.loadFileAsData(m)) {
+            fprintf(stderr, "fuzz: cannot read %s\n", f.getFullPathName().toRawUTF8());
+            return 1;
+        }
+        run_one(m);
+        corpus.add(m);
+    }
+    printf("fuzz: %d corpus inputs ok\n", corpus.size());
+    if (corpus.isEmpty()) {
+        corpus.add(MemoryBlock());
+    }
+
+    Random rnd(seed);
+    double start = Time::getMillisecondCounterHiRes();
+    int64 done = 0;
+    while (done < runs || ((runs == 0) && (max_time > 0))) {
+        MemoryBlock m(corpus.getReference(rnd.nextInt(corpus.size())));
+        mutate(m, corpus, rnd, max_len);
+        run_one(m);
+        done++;
+        if ((max_time > 0) && ((done & 255) == 0) &&
+            (Time::getMillisecondCounterHiRes() - start > max_time * 1000.0)) {
+            break;
+        }
+    }
+    double secs = (Time::getMillisecondCounterHiRes() - start) / 1000.0;
+    if (done > 0) {
+        printf("fuzz: %lld mutated inputs ok in %.1fs (%.0f/s), seed %lld\n",
+               (long long) done, secs, done / jmax(secs, 0.001), (long long) seed);
+    }
+    return 0;
+}
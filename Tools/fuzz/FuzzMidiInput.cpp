@@ -0,0 +1,43 @@
+/*
+ This file is part of micronau.
+ Copyright (c) 2013 - David Smitley
+
+ Permission is granted to use this software under the terms of the GPL v2 (or any later version)
+
+ Details can be found at: www.gnu.org/licenses
+*/
+
+// Incoming midi: the input is a raw byte stream as a midi input callback
+// sees it. The first byte picks how it is fragmented (1..256 bytes per
+// call), the rest goes through SysexReceiver and every program it accepts
+// is decoded as init_from_sysex does.
+
+#include "Fuzz.h"
+#include "SysexReceiver.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    static IonSysexParams params;
+
+    if (size < 1) {
+        return 0;
+    }
+    int chunk = data[0] + 1;
+    data++;
+    size--;
+
+    // a new receiver each time, so no half message carries over to the next input
+    SysexReceiver receiver([] (const uint8 *program, int len) {
+        if (params.parseParamsFromContent((unsigned char *) program, len)) {
+            fuzz_use_program(params);
+        }
+    });
+    for (size_t i = 0; i < size; i += chunk) {
+        receiver.add_bytes(data + i, (int) jmin((size_t) chunk, size - i));
+    }
+    if (!receiver.wait_until_idle(5000)) {
+        // the worker stopped taking programs
+        abort();
+    }
+    return 0;
+}
@@ -0,0 +1,28 @@
+/*
+ This file is part of micronau.
+ Copyright (c) 2013 - David Smitley
+
+ Permission is granted to use this software under the terms of the GPL v2 (or any later version)
+
+ Details can be found at: www.gnu.org/licenses
+*/
+
+// Program decode: the input is the data of a program dump without f0/f7, as
+// init_from_sysex, the legacy state restore and VirtualMicron get it. Nothing
+// is validated first, parseParamsFromContent has to cope on its own.
+
+#include "Fuzz.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    // the schema takes milliseconds to load, parse into the same one every time
+    static IonSysexParams params;
+
+    // the parser takes a non-const pointer, and must not read past size
+    HeapBlock<unsigned char> copy(jmax((size_t) 1, size));
+    memcpy(copy, data, size);
+    if (params.parseParamsFromContent(copy, (int) size)) {
+        fuzz_use_program(params);
+    }
+    return 0;
+}
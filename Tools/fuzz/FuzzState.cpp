@@ -0,0 +1,51 @@
+/*
+ This file is part of micronau.
+ Copyright (c) 2013 - David Smitley
+
+ Permission is granted to use this software under the terms of the GPL v2 (or any later version)
+
+ Details can be found at: www.gnu.org/licenses
+*/
+
+// State restore: the input is what a host hands setStateInformation, current
+// format or legacy struct, and it goes through the same steps.
+
+#include "Fuzz.h"
+#include "PluginState.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    static IonSysexParams params;
+
+    PluginState state;
+    if (!state.read(data, (int) size)) {
+        return 0;
+    }
+    if (state.legacy) {
+        if (!params.parseParamsFromContent(state.legacy_sysex, PluginState::LEGACY_SYSEX_LEN)) {
+            return 0;
+        }
+    } else {
+        if (!params.restoreValues(state.values.getRawDataPointer(), state.values.size())) {
+            return 0;
+        }
+        params.set_prog_name(state.prog_name);
+    }
+    fuzz_use_program(params);
+
+    // and saving it again must give something that reads back
+    MemoryBlock saved;
+    PluginState again;
+    again.prog_name = state.prog_name;
+    again.midi_in_port = state.midi_in_port;
+    again.midi_out_port = state.midi_out_port;
+    again.midi_out_chan = state.midi_out_chan;
+    again.values.resize(params.getValueStore().size());
+    params.getValueStore().snapshot(again.values.getRawDataPointer());
+    again.write(saved);
+    PluginState check;
+    if (!check.read(saved.getData(), (int) saved.getSize()) || (check.values != again.values)) {
+        abort();
+    }
+    return 0;
+}
@@ -0,0 +1,42 @@
+# Embeds files the way the Projucer's BinaryData does (a BinaryData namespace
+# with one char array per file, named after the file with '.' as '_', and
+# getNamedResource), for builds that do not go through the Projucer.
+#
+#   micronau_binary_data(<output dir> <file>...)
+#
+# writes <output dir>/BinaryData.h and BinaryData.cpp at configure time; cmake
+# is rerun when one of the files changes.
+
+function(micronau_binary_data out_dir)
+    set(header "#pragma once\n\nnamespace BinaryData\n{\n")
+    set(source "#include \"BinaryData.h\"\n#include <string.h>\n\nnamespace BinaryData\n{\n")
+    set(lookup "")
+
+    foreach(file ${ARGN})
+        get_filename_component(path ${file} ABSOLUTE)
+        get_filename_component(name ${file} NAME)
+        string(MAKE_C_IDENTIFIER ${name} id)
+        set_property(DIRECTORY APPEND PROPERTY CMAKE_CONFIGURE_DEPENDS ${path})
+
+        file(READ ${path} hex HEX)
+        string(LENGTH "${hex}" hex_length)
+        math(EXPR size "${hex_length} / 2")
+        string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," bytes "${hex}")
+        # a line break every 32 bytes (cmake's regex has no {n})
+        string(REPEAT "0x[0-9a-f][0-9a-f]," 32 row)
+        string(REGEX REPLACE "(${row})" "\\1\n" bytes "${bytes}")
+
+        string(APPEND header "    extern const char*   ${id};\n    const int            ${id}Size = ${size};\n\n")
+        string(APPEND source "static const unsigned char ${id}_data[] = {\n${bytes}0 };\nconst char* ${id} = (const char*) ${id}_data;\n\n")
+        string(APPEND lookup "    if (strcmp (resourceNameUTF8, \"${id}\") == 0) { dataSizeInBytes = ${id}Size; return ${id}; }\n")
+    endforeach()
+
+    string(APPEND header "    const char* getNamedResource (const char* resourceNameUTF8, int& dataSizeInBytes);\n}\n")
+    string(APPEND source "const char* getNamedResource (const char* resourceNameUTF8, int& dataSizeInBytes)\n{\n${lookup}    dataSizeInBytes = 0;\n    return nullptr;\n}\n\n}\n")
+
+    # only touch the outputs when they change, so a rerun does not force a rebuild
+    file(WRITE ${out_dir}/BinaryData.h.tmp "${header}")
+    file(WRITE ${out_dir}/BinaryData.cpp.tmp "${source}")
+    configure_file(${out_dir}/BinaryData.h.tmp ${out_dir}/BinaryData.h COPYONLY)
+    configure_file(${out_dir}/BinaryData.cpp.tmp ${out_dir}/BinaryData.cpp COPYONLY)
+endfunction()